@@ -0,0 +1,153 @@
+/********************************************************************************
+ * Binary Command Protocol
+ * Ben Weiss, University of Washington 2014
+ * Purpose: A compact alternative to the text get/set commands for host tuning
+ *   scripts. Values go both ways in their in-memory binary form, so the device does
+ *   no float parsing or printing, and a whole vector (kdr, kcn, ...) fits in one packet.
+ *
+ * Framing:
+ *   Requests are single 64-byte usb packets, told apart from text by their first byte:
+ *     [0] RX_HEAD_BINARY  [1] opcode  [2] parameter id  [3] sequence #  [4] payload length  [5...] payload
+ *   Each request gets exactly one reply packet on the BIN_PACK_TYPE stream:
+ *     [0] opcode  [1] parameter id  [2] sequence # (copied from the request)  [3] status (bin_status)
+ *     [4] type (param_type)  [5] element count  [6...] payload
+ *   Parameter ids and types are listed in params.h; all values are little-endian.
+ *   A dump request (BIN_OP_DUMP) is answered with a run of replies holding every parameter in
+ *   the registry, each as id, type, count and value (see param_dump); the last one has status
+ *   BIN_OK, the others BIN_MORE.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include <string.h>
+
+#include "bincmd.h"
+#include "params.h"
+#include "ctrl.h"
+
+// Type Definitions ==================================================================
+typedef struct
+{
+  uint8_t head;         // RX_HEAD_BINARY
+  uint8_t opcode;
+  uint8_t param_id;
+  uint8_t seq;
+  uint8_t len;
+  uint8_t payload[HID_PACKLEN - 5];
+} __attribute__ ((packed)) bin_request_t;
+
+typedef struct
+{
+  uint8_t opcode;
+  uint8_t param_id;
+  uint8_t seq;
+  uint8_t status;
+  uint8_t type;
+  uint8_t count;
+  uint8_t payload[HID_PACKLEN - 1 - 6];   // the packet header byte takes the first byte of the packet
+} __attribute__ ((packed)) bin_reply_t;
+
+// Constants =========================================================================
+#define BIN_PACK_TYPE     TX_PACK_TYPE_DATA2
+#define BIN_REPLY_TIMEOUT 10     // ms to wait for room to send a reply
+
+
+// sends every registry parameter, packed into as few replies as possible. All but the last reply have status
+// BIN_MORE; param_id counts the replies up from 0. The payload length tells the host where the last parameter ends.
+static void bin_dump_params(bin_reply_t *reply)
+{
+  uint32_t next_id = 0, len;
+
+  reply->param_id = 0;
+  while(next_id < PARAM_COUNT)
+  {
+    len = param_dump(reply->payload, sizeof(reply->payload), &next_id);
+    reply->status = (next_id < PARAM_COUNT) ? BIN_MORE : BIN_OK;
+    if(!hid_write_frame(BIN_PACK_TYPE, (uint8_t *)reply, sizeof(bin_reply_t) - sizeof(reply->payload) + len, BIN_REPLY_TIMEOUT))
+      return;   // host isn't listening; it'll have to ask again.
+    reply->param_id++;
+  }
+}
+
+// handles one binary request packet (see bin_is_request) and sends the reply.
+void bin_handle_request(const uint8_t *pkt)
+{
+  const bin_request_t *req = (const bin_request_t *)pkt;
+  const param_desc_t *p = NULL;
+  bin_reply_t reply;
+  uint32_t len = 0;
+
+  reply.opcode = req->opcode;
+  reply.param_id = req->param_id;
+  reply.seq = req->seq;
+  reply.status = BIN_OK;
+  reply.type = 0;
+  reply.count = 0;
+
+  switch(req->opcode)
+  {
+  case BIN_OP_GET:
+  case BIN_OP_SET:
+    p = param_by_id(req->param_id);
+    if(!p)
+    {
+      reply.status = BIN_ERR_PARAM;
+      break;
+    }
+    if(BIN_OP_SET == req->opcode)
+    {
+      if(req->len > sizeof(req->payload) || !param_write(p, req->payload, req->len))
+      {
+        reply.status = BIN_ERR_LENGTH;
+        break;
+      }
+    }
+    reply.type = p->type;
+    reply.count = p->count;
+    len = param_read(p, reply.payload, sizeof(reply.payload));
+    break;
+  case BIN_OP_TELEMETRY:
+    ctrl_get_telemetry((ctrl_telemetry_t *)reply.payload);
+    len = sizeof(ctrl_telemetry_t);
+    break;
+  case BIN_OP_DUMP:
+    bin_dump_params(&reply);
+    return;
+  case BIN_OP_TIMING:
+    if(req->param_id >= CTRL_MODE_COUNT)
+    {
+      reply.status = BIN_ERR_PARAM;
+      break;
+    }
+    ctrl_get_timing((ctrl_mode)req->param_id, (ctrl_timing_t *)reply.payload, req->len > 0 && req->payload[0]);
+    len = sizeof(ctrl_timing_t);
+    break;
+  default:
+    reply.status = BIN_ERR_OPCODE;
+  }
+
+  hid_write_frame(BIN_PACK_TYPE, (uint8_t *)&reply, sizeof(reply) - sizeof(reply.payload) + len, BIN_REPLY_TIMEOUT);
+}
@@ -0,0 +1,58 @@
+/* Binary command protocol 
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2014 Ben Weiss
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __bincmd_h
+#define __bincmd_h
+
+#include "common.h"
+
+// Opcodes of the binary protocol
+typedef enum {
+  BIN_OP_GET = 0x01,        // read a parameter. Reply payload: the value
+  BIN_OP_SET = 0x02,        // write a parameter from the request payload. Reply payload: the new value
+  BIN_OP_TELEMETRY = 0x03,  // read a ctrl_telemetry_t snapshot (param id ignored)
+  BIN_OP_DUMP = 0x04,       // read every parameter in the registry (param id ignored)
+  BIN_OP_TIMING = 0x05      // read the ctrl_timing_t of the control mode given as the param id. A nonzero first
+                            // payload byte resets those statistics in the same step.
+} __attribute__ ((packed)) bin_opcode;
+
+// Reply status codes
+typedef enum {
+  BIN_OK = 0,
+  BIN_ERR_OPCODE,           // unknown opcode
+  BIN_ERR_PARAM,            // unknown parameter id
+  BIN_ERR_LENGTH,           // payload length doesn't match the parameter
+  BIN_MORE                  // dump reply; more replies follow
+} __attribute__ ((packed)) bin_status;
+
+// returns true if the (64-byte) usb packet pkt is a binary request rather than text.
+static inline bool bin_is_request(const uint8_t *pkt)
+{
+  return RX_HEAD_BINARY == pkt[0];
+}
+
+void bin_handle_request(const uint8_t *pkt);
+
+#endif
@@ -0,0 +1,297 @@
+/********************************************************************************
+ * Control input capture
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Records the inputs of the control update and path module for replay on a host. See capture.h.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include <usb_serial.h>
+
+#include "capture.h"
+#include "imc/stepper.h"
+#include "imc/queue.h"
+#include "imc/utils.h"
+
+// Constants ==========================================================================
+#define CAP_RING_SIZE       4096U   // bytes of records waiting to be sent. Needs to be a power of 2.
+#define CAP_PACK_DATA       (HID_PACKLEN - 1 - CAP_PACK_HEAD)   // record bytes per packet
+
+typedef enum {
+  CAP_OFF,
+  CAP_ARMED,        // waiting for the controller to be enabled
+  CAP_ON,
+  CAP_OVERFLOWED    // the ring filled; waiting for room for the END record
+} cap_state_t;
+
+// Global Variables ====================================================================
+bool capture_enabled = false;
+
+// Local Variables ===================================================================
+// Record ring. cap_put (any context, with interrupts off) is the only writer of cap_head, cap_idle the only
+// writer of cap_tail. Indices run freely and are masked on use.
+static volatile uint8_t cap_ring[CAP_RING_SIZE];
+static volatile uint32_t cap_head = 0;
+static volatile uint32_t cap_tail = 0;
+static volatile cap_state_t cap_state = CAP_OFF;
+static uint8_t cap_seq = 0;
+static volatile bool slow_busy = false;         // software_isr is running
+static volatile uint8_t slow_state;             // st.state as it started
+// IMC queue moves recorded (QUEUE records) and taken off the queue (from_queue moves) since the capture
+// started. Both only ever see the head of the queue, so the recorded moves are always the oldest ones, and the
+// head has been recorded if queue_logged > queue_taken.
+static volatile uint32_t queue_logged = 0, queue_taken = 0;
+static volatile const msg_queue_move_t *queue_last_taken = NULL;
+
+// Function Predeclares ==============================================================
+static void cap_start(void);
+static void cap_end(uint8_t reason);
+
+
+// Appends a record of type with the payload a (alen bytes) followed by b (blen bytes) to the ring, if a
+// capture is running. Call with interrupts disabled. Returns false if the record wasn't written; if it didn't
+// fit, that ends the capture.
+static bool cap_put(uint8_t type, const void *a, uint32_t alen, const void *b, uint32_t blen)
+{
+  uint32_t head = cap_head;
+
+  if(CAP_ON != cap_state)
+    return false;
+  if(CAP_RING_SIZE - (head - cap_tail) < CAP_REC_HEAD + alen + blen)
+  {
+    cap_state = CAP_OVERFLOWED;
+    return false;
+  }
+  if(slow_busy && CAP_REC_QUEUE != type)
+    type |= CAP_REC_NESTED;
+  cap_ring[head++ & (CAP_RING_SIZE - 1)] = type;
+  cap_ring[head++ & (CAP_RING_SIZE - 1)] = (uint8_t)(alen + blen);
+  for(uint32_t i = 0; i < alen; i++)
+    cap_ring[head++ & (CAP_RING_SIZE - 1)] = ((const uint8_t *)a)[i];
+  for(uint32_t i = 0; i < blen; i++)
+    cap_ring[head++ & (CAP_RING_SIZE - 1)] = ((const uint8_t *)b)[i];
+  cap_head = head;
+  return true;
+}
+
+// cap_put, from any context with interrupts enabled. Records from different contexts never interleave.
+static void cap_write(uint8_t type, const void *a, uint32_t alen, const void *b, uint32_t blen)
+{
+  __disable_irq();
+  cap_put(type, a, alen, b, blen);
+  __enable_irq();
+}
+
+// on_change for parameter x: arms or ends a capture.
+void cap_changed(void)
+{
+  if(capture_enabled && CAP_OFF == cap_state)
+    cap_state = CAP_ARMED;
+  else if(!capture_enabled && CAP_ARMED == cap_state)
+    cap_state = CAP_OFF;
+  else if(!capture_enabled && CAP_ON == cap_state)
+    cap_end(CAP_END_STOPPED);
+}
+
+// Capture idle function - call from the main loop.
+// Sends the ring out, as much as the usb transmit queue will take without waiting. Returns true if anything was sent.
+bool cap_idle(void)
+{
+  uint8_t pack[CAP_PACK_HEAD + CAP_PACK_DATA];
+  uint32_t n;
+  bool sent = false;
+
+  if(CAP_OVERFLOWED == cap_state && CAP_RING_SIZE - (cap_head - cap_tail) >= CAP_REC_HEAD + 1)
+  {
+    cap_state = CAP_ON;
+    cap_end(CAP_END_OVERFLOW);
+    capture_enabled = false;
+    sent = true;
+  }
+
+  while(cap_head != cap_tail)
+  {
+#ifdef USB_RAWHID
+    if(hid_tx_ready() <= 0)
+      return sent;
+#endif
+    n = min(cap_head - cap_tail, CAP_PACK_DATA);
+    pack[0] = cap_seq++;
+    pack[1] = CAP_PACK_FLAG;
+    for(uint32_t i = 0; i < n; i++)
+      pack[CAP_PACK_HEAD + i] = cap_ring[(cap_tail + i) & (CAP_RING_SIZE - 1)];
+    cap_tail += n;
+#ifdef USB_RAWHID
+    hid_write_frame(CAP_PACK_TYPE, pack, CAP_PACK_HEAD + n, 0);
+#else
+    usb_serial_write("#", 1);
+    usb_serial_write(pack, CAP_PACK_HEAD + n);
+#endif
+    sent = true;
+  }
+  return sent;
+}
+
+// Writes the start records: everything a replay needs to set up before the first update.
+static void cap_start(void)
+{
+  uint8_t start[5] = {CAP_VERSION};
+  uint32_t us = ctrl_get_period(), t = time_tenus();
+  custom_path_dp_t elem;
+  cap_path_t hdr;
+  path_snap_t snap;
+  const param_desc_t *p;
+
+  queue_logged = queue_taken = 0;
+  queue_last_taken = NULL;
+  cap_state = CAP_ON;
+  memcpy(start + 1, &t, sizeof(t));
+  cap_write(CAP_REC_START, start, sizeof(start), NULL, 0);
+  for(uint32_t id = 0; id < PARAM_COUNT; id++)
+    if((p = param_by_id(id)))
+      cap_param(p);
+  cap_write(CAP_REC_PERIOD, &us, sizeof(us), NULL, 0);
+  hdr.time = t;
+  hdr.op = CAP_PATH_CUSTOM_CLEAR;
+  cap_write(CAP_REC_PATH, &hdr, sizeof(hdr), NULL, 0);
+  hdr.op = CAP_PATH_CUSTOM_ADD;
+  for(uint32_t i = 0; path_custom_get_elem(i, &elem); i++)
+    cap_write(CAP_REC_PATH, &hdr, sizeof(hdr), &elem, sizeof(elem));
+  path_get_snap(&snap);
+  hdr.op = CAP_PATH_SNAP;
+  cap_write(CAP_REC_PATH, &hdr, sizeof(hdr), &snap, sizeof(snap));
+}
+
+// writes the END record and stops capturing
+static void cap_end(uint8_t reason)
+{
+  cap_write(CAP_REC_END, &reason, 1, NULL, 0);
+  cap_state = CAP_OFF;
+}
+
+// ctrl_enable hook: starts an armed capture when the controller comes on, and records the enable.
+void cap_mode(ctrl_mode mode, int32_t encpos)
+{
+  cap_mode_t rec;
+
+  if(CAP_ARMED == cap_state && CTRL_DISABLED != mode)
+    cap_start();
+  rec.mode = (uint8_t)mode;
+  rec.encpos = encpos;
+  rec.time = time_tenus();
+  cap_write(CAP_REC_MODE, &rec, sizeof(rec), NULL, 0);
+}
+
+// ctrl_set_period hook
+void cap_period(uint32_t us)
+{
+  cap_write(CAP_REC_PERIOD, &us, sizeof(us), NULL, 0);
+}
+
+// parameter registry hook: records p's (new) value.
+void cap_param(const param_desc_t *p)
+{
+  uint8_t value[FILTER_MAX_SIZE * sizeof(real)];    // (the biggest parameters are the filter vectors)
+  uint8_t id = p->id;
+  uint32_t len;
+
+  if(PARAM_CAPTURE == p->id || !(len = param_read(p, value, sizeof(value))))
+    return;
+  cap_write(CAP_REC_PARAM, &id, 1, value, len);
+}
+
+// path command hook: op is the command (CAP_PATH_*), time the time it started at, and arg its argument.
+void cap_path(uint8_t op, uint32_t time, const void *arg, uint32_t len)
+{
+  cap_path_t hdr;
+  hdr.op = op;
+  hdr.time = time;
+  cap_write(CAP_REC_PATH, &hdr, sizeof(hdr), arg, len);
+}
+
+// path_ramps_move hook. A move from the IMC queue is its head, just dequeued; record it first if the path
+// module hadn't looked at it yet.
+void cap_path_move(volatile const msg_queue_move_t *move, uint32_t time)
+{
+  cap_move_t rec;
+  cap_path_t hdr;
+
+  if(CAP_ON != cap_state)
+    return;
+  rec.from_queue = queue_owns(move);
+  vmemcpy(&rec.move, (volatile msg_queue_move_t *)move, sizeof(msg_queue_move_t));
+  hdr.op = CAP_PATH_MOVE;
+  hdr.time = time;
+  __disable_irq();
+  if(rec.from_queue)
+  {
+    if(queue_logged == queue_taken && cap_put(CAP_REC_QUEUE, &rec.move, sizeof(msg_queue_move_t), NULL, 0))
+      queue_logged++;
+    queue_taken++;
+    queue_last_taken = move;
+  }
+  cap_put(CAP_REC_PATH, &hdr, sizeof(hdr), &rec, sizeof(rec));
+  __enable_irq();
+}
+
+// the path module looked at block, the head of the IMC queue. Records it if it's new (and, in case the sync
+// handshake got in since the path module looked, still queued).
+void cap_queue_peek(const msg_queue_move_t *block)
+{
+  if(CAP_ON != cap_state)
+    return;
+  __disable_irq();
+  if(queue_logged == queue_taken && block != queue_last_taken &&
+     cap_put(CAP_REC_QUEUE, block, sizeof(msg_queue_move_t), NULL, 0))
+    queue_logged++;
+  __enable_irq();
+}
+
+// control update hook (fast path)
+FASTRUN void cap_tick(const ctrl_inputs_t *in, real target_pos, real ctrl_out)
+{
+  cap_tick_t rec;
+
+  if(CAP_ON != cap_state)
+    return;
+  rec.in = *in;
+  rec.target_pos = target_pos;
+  rec.ctrl_out = ctrl_out;
+  cap_write(CAP_REC_TICK, &rec, sizeof(rec), NULL, 0);
+}
+
+// software_isr hooks, around its work on an update
+void cap_slow_begin(void)
+{
+  slow_state = st.state;
+  slow_busy = true;
+}
+void cap_slow_end(void)
+{
+  uint8_t state = slow_state;
+  slow_busy = false;
+  cap_write(CAP_REC_SLOW, &state, 1, NULL, 0);
+}
@@ -0,0 +1,143 @@
+/* Control input capture
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __capture_h
+#define __capture_h
+
+#include "common.h"
+#include "ctrl.h"
+#include "path.h"
+#include "params.h"
+#include "imc/protocol/message_structs.h"
+
+/********************************************************************************
+ * Control input capture
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Records everything the control update and the path take in from outside - the encoder reading,
+ *   motor position, update time and flags of every update, and every command, parameter change, move and
+ *   sync handshake that reaches them - so a run from the field can be played back through the same ctrl.c and
+ *   path.c on a host (sim/replay.c, "imcsim -R") and checked against the outputs the board computed, bit for
+ *   bit.
+ *
+ *   "sx 1" arms a capture. It starts at the next controller enable (a c* command, or n with the controller
+ *   off), which resets the controller, so nothing from before needs recording but the parameters and the path
+ *   state; "sx 0" ends it.
+ *   Records go into a RAM ring, and the main loop streams them out on the DATA0 stream (shared with "s"
+ *   history streaming), behind a 2-byte header: sequence number (uint8), then flags (uint8) = CAP_PACK_FLAG.
+ *   History stream packets never have that bit set. The records run on from packet to packet. If the ring
+ *   fills, the capture ends there with a CAP_END_OVERFLOW record, since a replay can't skip anything.
+ *
+ *   Each record is a type byte (CAP_REC_*), a length byte, and that many bytes of payload, little-endian:
+ *     START   uint8 version (CAP_VERSION), uint32 time (tenus)
+ *     PARAM   uint8 id (params.h), then the value as param_read gives it. The parameters at the start of a
+ *             capture, then every change.
+ *     PERIOD  uint32 control period (us). At the start, then at every change.
+ *     PATH    cap_path_t, then the argument of the path command (see CAP_PATH_*). time is the time the path
+ *             module started the command at. A CAP_PATH_SNAP of the path state (path.h:path_snap_t) comes at
+ *             the start, after the custom path.
+ *     MODE    cap_mode_t. Last of the start records, then at every ctrl_enable.
+ *     QUEUE   msg_queue_move_t: the next move of the IMC queue, the first time the path module looks at it.
+ *     TICK    cap_tick_t: the inputs and outputs of one control update.
+ *     SLOW    uint8 st.state (imc/stepper.h) as software_isr began: software_isr ran for the last TICK. Written
+ *             as it finishes.
+ *     END     uint8 reason (CAP_END_*)
+ *   A record written while software_isr was running, by something that preempted it, has CAP_REC_NESTED
+ *   set in its type. A replay applies it before the slow path it landed in, which may not be where it took
+ *   effect on the board (QUEUE records are the slow path's own, and never have it).
+ ********************************************************************************/
+
+// Constants ==========================================================================
+#define CAP_VERSION         3
+#define CAP_PACK_TYPE       TX_PACK_TYPE_DATA0
+#define CAP_PACK_FLAG       0x2     // flags byte of a capture packet. ctrl.c's history stream packets use bit 0.
+#define CAP_PACK_HEAD       2       // header bytes ahead of the records in a packet
+
+#define CAP_REC_START       1
+#define CAP_REC_PARAM       2
+#define CAP_REC_PERIOD      3
+#define CAP_REC_PATH        4
+#define CAP_REC_MODE        5
+#define CAP_REC_QUEUE       6
+#define CAP_REC_TICK        7
+#define CAP_REC_SLOW        8
+#define CAP_REC_END         9
+#define CAP_REC_NESTED      0x80    // type flag: written in the middle of software_isr
+#define CAP_REC_HEAD        2       // type and length bytes ahead of each payload
+
+// path commands in a CAP_REC_PATH record, and the argument that follows
+#define CAP_PATH_STEP         1     // path_set_step_target: int32 target
+#define CAP_PATH_IMC          2     // path_imc: real wait_pos
+#define CAP_PATH_MOVE         3     // path_ramps_move: cap_move_t
+#define CAP_PATH_CUSTOM_CLEAR 4     // path_custom_clear
+#define CAP_PATH_CUSTOM_ADD   5     // path_custom_add_elem: custom_path_dp_t
+#define CAP_PATH_CUSTOM_START 6     // path_custom_start
+#define CAP_PATH_SINES        7     // path_sines_start
+#define CAP_PATH_RAND         8     // path_rand_start
+#define CAP_PATH_SNAP         9     // path_set_snap: path_snap_t
+#define CAP_PATH_FRA          10    // path_fra_start
+#define CAP_PATH_PRBS         11    // path_prbs_start
+
+#define CAP_END_STOPPED     0       // sx 0
+#define CAP_END_OVERFLOW    1       // the ring filled before the main loop could send it
+
+typedef struct {
+  ctrl_inputs_t in;
+  real target_pos;          // target the update worked to (tics)
+  real ctrl_out;            // controller output (tics/min), as ctrl_run returned it
+} __attribute__ ((packed)) cap_tick_t;
+
+typedef struct {
+  uint8_t mode;             // ctrl_mode
+  int32_t encpos;           // encoder reading the controller started from (tics)
+  uint32_t time;            // tenus
+} __attribute__ ((packed)) cap_mode_t;
+
+typedef struct {
+  uint8_t op;               // CAP_PATH_*
+  uint32_t time;            // tenus
+} __attribute__ ((packed)) cap_path_t;
+
+typedef struct {
+  uint8_t from_queue;       // the move was the head of the IMC queue (and was dequeued), not a pm command
+  msg_queue_move_t move;
+} __attribute__ ((packed)) cap_move_t;
+
+// Global Variables ====================================================================
+extern bool capture_enabled;    // parameter x
+
+void cap_changed(void);
+bool cap_idle(void);
+
+void cap_mode(ctrl_mode mode, int32_t encpos);
+void cap_period(uint32_t us);
+void cap_param(const param_desc_t *p);
+void cap_path(uint8_t op, uint32_t time, const void *arg, uint32_t len);
+void cap_path_move(volatile const msg_queue_move_t *move, uint32_t time);
+void cap_queue_peek(const msg_queue_move_t *block);
+void cap_tick(const ctrl_inputs_t *in, real target_pos, real ctrl_out);
+void cap_slow_begin(void);
+void cap_slow_end(void);
+
+#endif
@@ -64,50 +64,12 @@
 // datatype used for control functions (for future conversion to double?)
 typedef float real;
 
-// In main.c:main(), I am co-opting the Teensy's systick_millis_count functionality to increase
-// the amount of time between rollovers of the SYST counter. This function computes the current
-// time in 10us increments. NOTE: I think it would be a significant time-savings to switch the time base from
-// ms to some even power of two off of the systic counter and just do all our timing in those units.
-// Rollover is every ~12 hours.
-// To implement this in other projects, include:
-// SYST_RVR = (F_CPU / 1000) * SYSTICK_UPDATE_MS - 1; //in main
-// and add the systick_isr at the bottom of main. Note the builtin delay() stops working; use
-// delay_real() below. Because imc needs delay() and usb_rawhid.c uses systick_millis_count, 
-// I have reverted the system to use 1ms updates again.
-// If it is having issues with not correctly reporting just when the systick counter is incremented
-// (i.e. get_systic_tenus returns, successively, 97, 98, 99, 0, 100 because systick_millis_count has not been
-// incremented by the systic isr even though CVR has reset), consider using this code:
-  //__disable_irq();
-  //uint32_t cvr = SYST_CVR;
-  //uint32_t cnt = (SYST_RVR - SYST_CVR) * 1000L / (F_CPU / 100L) + // 10*us on the timer now
-  //                systick_millis_count * SYSTICK_UPDATE_TEN_US;   // accumulated 10*us      was systick_tenus_count
-  //__enable_irq();
-  //if(SYST_RVR - cvr < 4)    // counter rollover has occcurred but not been captured by systick_millis_count
-  //  return cnt + SYSTICK_UPDATE_TEN_US;
-  //else
-  //  return cnt;
-// I discovered the hard way that reversing the lines of the cnt = (so we read systick_millis_count before SYST_CVR)
-// results in occasional errors of this kind, but so far the code below seems to be working.
+// Time: the control, path and encoder code count time in 10us units (tenus) off the DWT cycle counter;
+// see timebase.h (time_tenus(), time_cycles(), delay_real()). systick_millis_count still counts ms for
+// the Teensy core, imc and the slow timeouts in ctrl.c.
 #define SYSTICK_UPDATE_TEN_US      100     // Frequency of update for systic timer (default Teensy is 1ms=100)
-extern volatile uint32_t systick_tenus_count;     // millisecond counter which updates every SYSTICK_UPDATE_MS ms.
 extern volatile uint32_t systick_millis_count;
-__attribute__ ((always_inline)) inline uint32_t get_systick_tenus(void)
-{
-  return (SYST_RVR - SYST_CVR) * 1000L / (F_CPU / 100L) + // 10*us on the timer now
-                  systick_millis_count * SYSTICK_UPDATE_TEN_US;   // accumulated 10*us      was systick_tenus_count
-}
-// The above hack causes delay() as implemented in util.c to fail. Instead, we'll use one that depends on
-// our enhanced counter. Note that it's accuracy is somewhat reduced due to computations required for 
-//the ms counter, probably still accurate to within 1us or so.
-__attribute__ ((always_inline)) inline void delay_real(uint32_t ms)
-{
-  uint32_t endtick = get_systick_tenus() + ms * 100L;
-  // counter rollover?
-  while(get_systick_tenus() > endtick)
-    ;
-  while(get_systick_tenus() < endtick)
-    ;
-} 
+#include "timebase.h"
 
 // Sometimes for bitbanging a bus I need finer delay control than delay_microseconds. Below is a function
 // wich delays only 1/8 (0.125) us per tic
@@ -122,12 +84,16 @@ static inline void delay_0125us(uint32_t tics)
 	uint32_t n = tics;
 #endif
 	if (tics == 0) return;
+#ifdef SIM_HOST
+	sim_delay_cycles(n * 3);	// the loop is 3 cycles a pass
+#else
 	asm volatile(
 		"L_%=_delay_microseconds:"		"\n\t"
 		"subs   %0, #1"				"\n\t"
 		"bne    L_%=_delay_microseconds"		"\n"
 		: "+r" (n) :
 	);
+#endif
 }
 
 // a few time-related constants
@@ -140,15 +106,23 @@ static inline void delay_0125us(uint32_t tics)
 
 // Random number generator: (lfsr113)
 uint32_t rand_uint32 (void);
+void rand_get_state(uint32_t *state);
+void rand_set_state(const uint32_t *state);
 
 
 // The Teensy development tools don't give good access to allow masking of interrupt priorities
 // (effectively elevating the current level of execution to a more urgent (=lower #) level)
 // The following follows ARM DDI 0403D B5-805, with hints from mk20dx128.c:nvic_execution_priority.
 // The parameter pri should be of the same form used by mk20dx128.h:NVIC_SET_PRIORITY()
+#ifndef SIM_HOST
 #define SET_BASEPRI(pri)    asm volatile("msr basepri, %0\n" :: "r" ((pri)) : );
 #define CLEAR_BASEPRI()     asm volatile("movs r0, #0\n\
                                           msr basepri, r0" ::: "r0");
+#else
+// host build (make sim): the simulated NVIC keeps BASEPRI (sim/sim.c)
+#define SET_BASEPRI(pri)    sim_set_basepri(pri);
+#define CLEAR_BASEPRI()     sim_set_basepri(0);
+#endif
 
 // Min and Max functions:
 //FORCE_INLINE uint8_t max8(uint8_t a, uint8_t b) {return a > b ? a : b;}
@@ -38,10 +38,14 @@
 #include <math.h>
 
 #include "ctrl.h"
+#include "ctrl_fixed.h"
 #include "qdenc.h"
 #include "spienc.h"
 #include "path.h"
 #include "stepper_hooks.h"
+#include "isrprof.h"
+#include "capture.h"
+#include "fra.h"
 #include <pin_config.h>
 #include "imc/utils.h"
 #include "imc/stepper.h"
@@ -61,16 +65,70 @@ typedef struct
   uint8_t flags;
 } __attribute__ ((packed)) hist_data_t;
 
+// Snapshot of one control update, handed from the fast path (pit3_isr) to the slow path (software_isr)
+typedef struct
+{
+  uint32_t time;        // time of the update (tenus)
+  int32_t encpos;
+  int32_t motorpos;
+  real target_pos;
+  real target_vel;
+  real ctrl_out;        // commanded velocity (encoder tics/min) after clamping
+  uint8_t flags;        // HIST_FLAG_* bits sampled at the time of the update
+} ctrl_sample_t;
+
+// Streaming packet: sent on the HIST_PACK_TYPE stream by ctrl_idle. The payload length in the packet header
+// tells the host how many records follow (1 or 2).
+typedef struct
+{
+  uint8_t seq;          // increments once per packet
+  uint8_t flags;        // STREAM_FLAG_*
+  uint16_t dropped;     // running count of records dropped because the stream ring was full (wraps)
+  hist_data_t recs[2];
+} __attribute__ ((packed)) stream_pack_t;
+
+// History dump packet: sent on the DUMP_PACK_TYPE stream by output_history/resend_history. Packet seq carries
+// records 2*seq and 2*seq+1 of the dump, counting from the oldest record.
+typedef struct
+{
+  uint16_t seq;
+  hist_data_t recs[2];
+} __attribute__ ((packed)) dump_pack_t;
+
+// Timing statistics of the control update for one control mode (see ctrl_get_timing)
+typedef struct
+{
+  uint32_t count;
+  uint32_t min_cycles, max_cycles;
+  uint64_t sum_cycles;
+  uint32_t min_latency, max_latency;
+  uint64_t sum_latency;
+  uint32_t overruns;
+  uint16_t hist[CTRL_TIMING_BUCKETS];
+} ctrl_timing_acc_t;
+
 // Constants =========================================================================
 #define HIST_SIZE   1000U     // have the history use ~40k of memory.
 #define FF_TARGETS 16        // Feed forward target buffer size. another ring buffer...needs to be a power of 2.
 #define HIST_PACK_TYPE  TX_PACK_TYPE_DATA0     // needs to match the DS_STREAM_HIST constant in scripts.py
 
+#define DUMP_PACK_TYPE  TX_PACK_TYPE_DATA1
+#define DUMP_RECS_PER_PACK  2
+#define DUMP_PACK_COUNT ((HIST_SIZE + DUMP_RECS_PER_PACK - 1) / DUMP_RECS_PER_PACK)
+#define DUMP_STALL_MS     100   // give up on a dump if usb can't take a packet for this long
+#define DUMP_HOLD_MS      5000  // un-freeze the history this long after the last dump/resend request
+
+#define STREAM_RING_SIZE    64U   // records waiting to be streamed. Needs to be a power of 2.
+#define STREAM_RECS_PER_PACK  2     // (2 * 29 + 4 = 62 bytes; one HID packet)
+#define STREAM_FLAG_OVERFLOW  0x1   // records were dropped between the last packet and this one. capture.h:CAP_PACK_FLAG is 0x2.
+
 #define HIST_FLAG_SYNC      0x1
 #define HIST_FLAG_LOSTTRACK 0x2
 #define HIST_FLAG_PIN14     0x4   // just records the value of pin14 for whatever you want to use it for.
 #define HIST_FLAG_PIN17     0x8   // just records the value of pin17 for whatever you want to use it for.
 
+#define TIMING_BUCKET0_LOG2 8     // timing histogram bucket 0 is everything under 2^(TIMING_BUCKET0_LOG2 + 1) cycles
+
 // Global Variables ==================================================================
 extern float enc_tics_per_step;
 extern float steps_per_enc_tic;
@@ -85,6 +143,7 @@ real osac_As[10] = {0., 0.};      // A is assumed monic, so all we store is A1..
 real osac_Bs[10] = {1.};          // B is not monic, so we store B0..B9
 uint32_t osac_Acount = 2, osac_Bcount = 1;
 bool stream_ctrl_hist = false;    // turn on streaming of control history over usb in real time.
+bool ctrl_fixed_point = true;     // run PID/DARMA/COMP with the fixed-point kernels in ctrl_fixed.c. false = float reference versions below.
 
 real darma_R[FILTER_MAX_SIZE] = {1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
 real darma_S[FILTER_MAX_SIZE] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
@@ -101,9 +160,13 @@ static ctrl_mode mode = CTRL_DISABLED;
 static uint32_t ctrl_period_cycles;		// set update time, in cpu cycles
 static float ctrl_period_sec;         // set update time, in seconds
 static volatile uint32_t update_time = 0;		// set to the time the last update took, in cpu cycles
+static volatile ctrl_timing_acc_t timing[CTRL_MODE_COUNT];   // update timing statistics, per control mode
 static volatile hist_data_t hist_data[HIST_SIZE];
 static volatile uint32_t hist_head = 0;
 static uint32_t hist_time_offset = 0;
+static volatile bool hist_frozen = false;       // history isn't recorded while a dump is in progress
+static uint32_t dump_first = 0;                 // index of the oldest record in the frozen history
+static uint32_t dump_time = 0;                  // systick_millis_count at the last dump or resend request
 //static char message[100] = "Hello, World";
 static volatile float last_vel = 0;   // velocity chosen last update
 static volatile int32_t last_encpos = 0.f;
@@ -113,6 +176,18 @@ static volatile real last_ctrl_out = 0.f;
 static volatile real ff_target_pos_buf[FF_TARGETS];
 static volatile real ff_target_vel_buf[FF_TARGETS];
 static volatile uint32_t ff_target_head = 0;
+static volatile ctrl_sample_t slow_sample;        // latest update, waiting for the slow path
+static volatile bool slow_pending = false;        // set by pit3_isr, cleared by software_isr
+static volatile uint32_t slow_overruns = 0;       // # of updates the slow path didn't get to before the next one
+// Streaming ring buffer. software_isr is the only writer of stream_head and stream_dropped, ctrl_idle the only
+// writer of stream_tail, so no locking is needed. Indices run freely and are masked on use.
+static volatile hist_data_t stream_ring[STREAM_RING_SIZE];
+static volatile uint32_t stream_head = 0;
+static volatile uint32_t stream_tail = 0;
+static volatile uint32_t stream_dropped = 0;
+static uint32_t stream_dropped_sent = 0;          // value of stream_dropped in the last packet sent
+static uint8_t stream_seq = 0;
+static volatile hist_data_t last_rec;             // latest history record, for ctrl_get_telemetry
 
 // PID variables
 static volatile float pid_i_sum = 0.f;
@@ -135,6 +210,7 @@ void bang_ctrl(real dt, real target_pos, real target_vel, real encpos);
 real darma_ctrl();
 real comp_ctrl();
 bool fault_check(real encpos, real cmdpos, real *pos_error_deriv);
+bool send_dump_packet(uint32_t seq);
 
 // Initializes the PIT timer used for control
 void init_ctrl(void)
@@ -142,9 +218,17 @@ void init_ctrl(void)
 	// Clock up all of the PITs
   SIM_SCGC6 |= SIM_SCGC6_PIT;
   PIT_MCR = 0x00;
+#ifdef ENC_USE_DMA
+  // PIT3 only triggers the encoder read; the control update runs from the SPI interrupt when the reading is in
+  // (see enc_sample_hook).
+  PIT_TCTRL3 = 0;
+#else
   PIT_TCTRL3 = PIT_TCTRL_TIE_MASK;
 	
   NVIC_ENABLE_IRQ(IRQ_PIT_CH3);
+#endif
+  // the software interrupt runs the deferred part of the control update (see software_isr). Priority is set in configure_nvic.
+  NVIC_ENABLE_IRQ(IRQ_SOFTWARE);
 	ctrl_set_period(1000);		// start with 1ms update frequency
   ctrl_enable(CTRL_DISABLED); // disable the timer which ctrl_set_period just enabled
 	
@@ -158,6 +242,8 @@ void init_ctrl(void)
   GPIOB_PDDR &= ~(1<<1);
   PORTB_PCR1 = MUX_GPIO;
 
+  ctrl_reset_timing();
+
   // clear the history ringbuffer
   vmemset((void *)hist_data, 0, sizeof(hist_data_t) * HIST_SIZE);
   vmemset((void *)ff_target_pos_buf, 0, sizeof(real) * FF_TARGETS);
@@ -166,6 +252,7 @@ void init_ctrl(void)
   vmemset((void *)filter_u_hist, 0, sizeof(real) * FILTER_MAX_SIZE);
   vmemset((void *)filter_y_hist, 0, sizeof(real) * FILTER_MAX_SIZE);
   vmemset((void *)filter_uc_hist, 0, sizeof(real) * FILTER_MAX_SIZE);
+  fix_ctrl_reset();
 }
 
 // Sets the frequency of the controller update
@@ -175,12 +262,21 @@ void ctrl_set_period(uint32_t us)
 	ctrl_period_cycles = (F_BUS / 1000000L) * us;
   ctrl_period_sec = (float)us / 1000000.f;
 	set_update_cycles(ctrl_period_cycles);
+  fix_ctrl_set_coefs(ctrl_period_sec);    // PID gains are scaled by the period
+  cap_period(us);
 }
 uint32_t ctrl_get_period(void)
 {
   return (ctrl_period_cycles) / (F_BUS / 1000000L);
 }
 
+// Call after changing any of the controller coefficients (pid_k*, darma_*, comp_*) so the fixed-point
+// versions get re-scaled.
+void ctrl_coefs_changed(void)
+{
+  fix_ctrl_set_coefs(ctrl_period_sec);
+}
+
 // sets the timer value for the PIT in bus clock cycles (same as cpu cycles for 48 MHz chip)
 void set_update_cycles(uint32_t cycles)
 {
@@ -192,6 +288,15 @@ void set_update_cycles(uint32_t cycles)
 // Enables/disables the controller. mode = CTRL_DISABLE turns off the controller.
 // otherwise specifies which control algorithm to use.
 void ctrl_enable(ctrl_mode newmode)
+{
+  int32_t encpos = 0;
+  if(newmode != CTRL_DISABLED)
+    get_enc_value(&encpos);
+  ctrl_enable_at(newmode, encpos);
+}
+
+// ctrl_enable, with the encoder reading the controller starts from (tics) given instead of read.
+void ctrl_enable_at(ctrl_mode newmode, int32_t encpos)
 {
   if(newmode != CTRL_DISABLED)
   {
@@ -199,19 +304,22 @@ void ctrl_enable(ctrl_mode newmode)
     old_stepper_mode = false;
     // need to clear PID variables to avoid major issues
     pid_i_sum = 0;
-    get_enc_value(&last_encpos);
+    last_encpos = encpos;
     last_vel = 0;
     //ctrl_integrator = 0;
     ff_target_head = 0;
+    slow_pending = false;
     vmemset((void *)ff_target_pos_buf, 0, sizeof(real) * FF_TARGETS);
     vmemset((void *)ff_target_vel_buf, 0, sizeof(real) * FF_TARGETS);
     //||\\!! TODO: Re-fill the target pos buf with a first value?
+    // record what happens from here, even if a dump still holds the history
+    hist_frozen = false;
     // if the mode has changed, reset the history buffer
     if(newmode != mode)
     {
       vmemset((void *)hist_data, 0, sizeof(hist_data_t) * HIST_SIZE);
       hist_head = 0;
-      hist_time_offset = get_systick_tenus();   // so we don't have some 0's and then stuff way off in time at the same time
+      hist_time_offset = time_tenus();   // so we don't have some 0's and then stuff way off in time at the same time
     }
 
     // reset filter history variables (used by darma and comp controllers)
@@ -220,6 +328,8 @@ void ctrl_enable(ctrl_mode newmode)
     vmemset((void *)filter_uc_hist, 0, sizeof(real) * FILTER_MAX_SIZE);
     filter_head = 0;
     filter_warmup = 0;
+    fix_ctrl_reset();
+    fix_ctrl_set_coefs(ctrl_period_sec);
 
     // darma history variables check
     if(CTRL_DARMA == newmode)
@@ -239,6 +349,9 @@ void ctrl_enable(ctrl_mode newmode)
       vmemset((void *)comp_f_hats, 0, sizeof(real) * FILTER_MAX_SIZE);
     }
 
+#ifdef ENC_USE_DMA
+    enc_dma_enable(true);
+#endif
     set_update_cycles(ctrl_period_cycles);
 
     //if(CTRL_BANG == newmode)
@@ -248,8 +361,14 @@ void ctrl_enable(ctrl_mode newmode)
     //}
   }
   else    // disable control
+  {
     PIT_TCTRL3 &= ~PIT_TCTRL_TEN_MASK;
+#ifdef ENC_USE_DMA
+    enc_dma_enable(false);
+#endif
+  }
   mode = newmode;
+  cap_mode(newmode, encpos);
 }
 
 ctrl_mode ctrl_get_mode(void)
@@ -262,69 +381,236 @@ ctrl_mode ctrl_get_mode(void)
 // returns ms.
 float ctrl_get_update_time(void)
 {
-	return (float)update_time * 1000.f / (float)F_BUS;
+	return (float)update_time * 1000.f / (float)F_CPU;
+}
+
+// gets the number of control updates where the deferred stage (history, feedforward targets, streaming)
+// was still pending when the next update fired. Should stay at 0; if not, the control period is too short.
+uint32_t ctrl_get_slow_overruns(void)
+{
+  return slow_overruns;
+}
+
+// fills t with the state of the controller as of the latest update. Call from the main loop only.
+void ctrl_get_telemetry(ctrl_telemetry_t *t)
+{
+  hist_data_t rec;
+
+  // software_isr writes last_rec; hold it off while we copy.
+  SET_BASEPRI(4 << 4);
+  vmemcpy(&rec, (void *)&last_rec, sizeof(hist_data_t));
+  CLEAR_BASEPRI();
+
+  t->time = rec.time;
+  t->position = rec.position;
+  t->motor_position = rec.motor_position;
+  t->target_pos = rec.target_pos;
+  t->target_vel = rec.target_vel;
+  t->cmd_velocity = rec.cmd_velocity;
+  t->flags = rec.flags;
+  t->mode = (uint8_t)mode;
+  t->stream_dropped = (uint16_t)stream_dropped;
+  t->update_cycles = update_time;
+  t->slow_overruns = slow_overruns;
+}
+
+// fills t with the control update timing statistics for control mode m, optionally resetting them in the same
+// step so no update is lost between a read and a reset. Call from the main loop only.
+void ctrl_get_timing(ctrl_mode m, ctrl_timing_t *t, bool reset)
+{
+  ctrl_timing_acc_t acc;
+
+  // the control update writes the statistics; hold it off while we copy.
+  SET_BASEPRI(2 << 4);
+  vmemcpy(&acc, (void *)&timing[m], sizeof(ctrl_timing_acc_t));
+  if(reset)
+  {
+    vmemset((void *)&timing[m], 0, sizeof(ctrl_timing_acc_t));
+    timing[m].min_cycles = timing[m].min_latency = UINT32_MAX;
+  }
+  CLEAR_BASEPRI();
+
+  t->count = acc.count;
+  t->min_cycles = acc.count ? acc.min_cycles : 0;
+  t->mean_cycles = acc.count ? (uint32_t)(acc.sum_cycles / acc.count) : 0;
+  t->max_cycles = acc.max_cycles;
+  t->min_latency = acc.count ? acc.min_latency : 0;
+  t->mean_latency = acc.count ? (uint32_t)(acc.sum_latency / acc.count) : 0;
+  t->max_latency = acc.max_latency;
+  t->overruns = acc.overruns;
+  memcpy(t->hist, acc.hist, sizeof(t->hist));
+}
+
+// clears the control update timing statistics of every mode.
+void ctrl_reset_timing(void)
+{
+  ctrl_timing_t t;
+  for(uint32_t m = 0; m < CTRL_MODE_COUNT; m++)
+    ctrl_get_timing((ctrl_mode)m, &t, true);
 }
 
 // spits the history ringbuffer out over USB.
+// The history is frozen (no new records are saved) from here until release_history() is called - by "gr", the next
+// path command or controller enable - or DUMP_HOLD_MS passes without a dump or resend request, so the host can ask
+// for any packets it missed with resend_history() before it moves on.
+// Packets are sent as fast as the usb transmit queue will take them.
 void output_history(void)
 {
-  uint32_t old_head_loc;
-  // start at the tail and write to the end of the buffer, then catch back up to the head
-  // (which may move...)
-  old_head_loc = hist_head;
-  hid_printf("%u\n", HIST_SIZE);   // # of entries we're going to print
-  // the serial port can't take all this data at once, so we'll give it to them in bites...
-  // We don't want to wait too long, however, so we'll put a timeout of 30ms on the transmits.
-  for(uint32_t chunk = old_head_loc + 1; chunk < HIST_SIZE - 1; chunk += 100)
+  // freeze the history without software_isr getting caught half way through a record.
+  SET_BASEPRI(4 << 4);
+  hist_frozen = true;
+  dump_first = hist_head + 1;
+  if(dump_first >= HIST_SIZE) dump_first = 0;
+  CLEAR_BASEPRI();
+  dump_time = systick_millis_count;
+
+  hid_printf("%u\n", HIST_SIZE);   // # of entries we're going to send
+  hid_flush(DUMP_STALL_MS);         // make sure the count goes out before the data
+  for(uint32_t seq = 0; seq < DUMP_PACK_COUNT; seq++)
   {
-    for(uint32_t i = 0; i < 3; i++)   // retry the packet up to 3 times.
+    if(!send_dump_packet(seq))
     {
-      delay_real(30);
-      if(hid_print((void*)(hist_data + chunk), sizeof(hist_data_t) * min(HIST_SIZE - chunk, 100), 30))
-        break;
+      hid_printf("'History dump stalled at packet %lu\n", (unsigned long)seq);
+      return;
     }
   }
-  for(uint32_t chunk = 0; chunk < old_head_loc + 1; chunk += 100)
+}
+
+// re-sends one packet of the last history dump.
+void resend_history(uint32_t seq)
+{
+  if(!hist_frozen)
   {
-    for(uint32_t i = 0; i < 3; i++)   // retry the packet up to 3 times.
-    {
-      delay_real(30);
-      if(hid_print((void*)(hist_data + chunk), sizeof(hist_data_t) * min(old_head_loc + 1 - chunk, 100), 30))
-        break;
-    }
+    hid_printf("'History was released; request a new dump.\n");
+    return;
   }
+  dump_time = systick_millis_count;
+  if(seq < DUMP_PACK_COUNT && !send_dump_packet(seq))
+    hid_printf("'History resend stalled at packet %lu\n", (unsigned long)seq);
+}
+
+// lets the history record new data again after a dump.
+void release_history(void)
+{
+  hist_frozen = false;
 }
 
+// sends packet seq of the frozen history, waiting up to DUMP_STALL_MS for room on the usb transmit queue.
+bool send_dump_packet(uint32_t seq)
+{
+  dump_pack_t pack;
+  uint32_t begin = systick_millis_count, n, k;
+
+  while(hid_tx_ready() <= 0)
+    if(systick_millis_count - begin > DUMP_STALL_MS)
+      return false;
+
+  pack.seq = (uint16_t)seq;
+  n = min(HIST_SIZE - seq * DUMP_RECS_PER_PACK, DUMP_RECS_PER_PACK);
+  for(uint32_t i = 0; i < n; i++)
+  {
+    k = dump_first + seq * DUMP_RECS_PER_PACK + i;
+    if(k >= HIST_SIZE) k -= HIST_SIZE;
+    vmemcpy(pack.recs + i, hist_data + k, sizeof(hist_data_t));
+  }
+  return hid_write_frame(DUMP_PACK_TYPE, (uint8_t *)&pack, sizeof(pack) - (DUMP_RECS_PER_PACK - n) * sizeof(hist_data_t), DUMP_STALL_MS);
+}
+
+
+// adds one control update (cycles = execution time, latency = bus cycles from the PIT3 tick to the start of the
+// update) to the timing statistics of the current mode.
+static inline void record_timing(uint32_t cycles, uint32_t latency)
+{
+  volatile ctrl_timing_acc_t *acc = &timing[mode];
+  uint32_t bucket = 31 - __builtin_clz(cycles | 1);   // log2
+
+  bucket = bucket > TIMING_BUCKET0_LOG2 ? min(bucket - TIMING_BUCKET0_LOG2, CTRL_TIMING_BUCKETS - 1) : 0;
+  if(acc->hist[bucket] < UINT16_MAX)
+    acc->hist[bucket]++;
+  acc->count++;
+  acc->min_cycles = min(acc->min_cycles, cycles);
+  acc->max_cycles = max(acc->max_cycles, cycles);
+  acc->sum_cycles += cycles;
+  acc->min_latency = min(acc->min_latency, latency);
+  acc->max_latency = max(acc->max_latency, latency);
+  acc->sum_latency += latency;
+  // if PIT3 has reloaded since we started, the next tick came in while we were still running.
+  if(PIT_LDVAL3 - PIT_CVAL3 < latency)
+    acc->overruns++;
+}
 
 // Controller ISR - fires every ctrl_period_cycles cycles = ctrl_period_sec seconds
-// The timing on this routine will break down if the control algorithm takes more than SYSTICK_UPDATE_MS ms to
-// to it's job.
-void pit3_isr(void) 
+FASTRUN void pit3_isr(void)
 {
-	uint32_t old_systic, new_systic, time_of_update;
-	int32_t encpos, motorpos;
-  real target_pos, target_vel, ctrl_out;
-  real pos_error_deriv = 0.f;
+  PROF_ISR(PROF_PIT3);
+  ctrl_update();
+}
+
+#ifdef ENC_USE_DMA
+// With DMA encoder reads, PIT3 starts the read and the SPI interrupt calls this when the reading is in.
+FASTRUN void enc_sample_hook(void)
+{
+  ctrl_update();
+}
+#endif
+
+// Control update - runs once per control period, from pit3_isr or enc_sample_hook.
+// This is the hard real-time part of the update: read the encoder, run the control law, and set the new
+// step rate. Everything that can wait (history, next feedforward target, streaming) is handed to software_isr,
+// which runs at a lower priority as soon as nothing more important is pending.
+FASTRUN void ctrl_update(void)
+{
+	uint32_t start_cycles, latency;
+  int32_t encpos;
+  ctrl_inputs_t in;
+  real target_pos, ctrl_out;
 	
 	// Update the controller heartbeat
 	//GPIOD_PTOR = (1<<3);
 
-	// get the current system tick timer so we can add the time it takes to do the loop update into the update frequency
-	// remember, the timer counts down.
-	old_systic = SYST_CVR;
-  time_of_update = get_systick_tenus();   // do this just once so we don't change our control if an unknown time elapses between querying position and doing control things
-  //if((int32_t)time_of_update - (int32_t)last_update < 90)
-  //{
-  //  // we have an error!
-  //  hid_printf("Time error! Old: %u, New: %u, syst_cvr: %u\n", last_update, time_of_update, old_systic);
-  //}
+	// get the current cycle count so we can add the time it takes to do the loop update into the update frequency,
+	// and how long ago PIT3 ticked (it counts down from PIT_LDVAL3 again right after it does)
+	start_cycles = ARM_DWT_CYCCNT;
+  latency = PIT_LDVAL3 - PIT_CVAL3;
+  in.time = time_tenus();   // do this just once so we don't change our control if an unknown time elapses between querying position and doing control things
 	
 	// Read the encoder position
 	//||\\!! TODO: figure out what happens if the encoder has lost track...
   get_enc_value(&encpos);
-  motorpos = get_motor_position();
-  last_vel = (encpos - last_encpos) / ctrl_period_sec * 60;   // tics/min
+  in.encpos = encpos;
+#ifdef ENC_USE_DMA
+  in.time = enc_sample_time();     // the reading was taken when PIT3 expired, a little before we got here
+#endif
+  in.motorpos = get_motor_position();
+  // sample the flags now so they line up with the encoder reading
+  in.flags = (CONTROL_PORT(DIR) & SYNC_BIT) ? HIST_FLAG_SYNC : 0;
+  in.flags |= enc_lost_track() ? HIST_FLAG_LOSTTRACK : 0;
+  in.flags |= (GPIOD_PDIR & 0x2) ? HIST_FLAG_PIN14 : 0;
+  in.flags |= (GPIOB_PDIR & 0x2) ? HIST_FLAG_PIN17 : 0;
+
+  if(!ctrl_run(&in, &target_pos, &ctrl_out))
+    return;
+  cap_tick(&in, target_pos, ctrl_out);
+	
+	update_time = ARM_DWT_CYCCNT - start_cycles;
+  record_timing(update_time, latency);
   
+  // clear the interrupt flag
+  PIT_TFLG3 = 1;
+}
+
+// The control law: everything in a control update after its inputs are sampled. Sets the new step rate, hands
+// the update to software_isr, and returns the target the update worked to and the controller output
+// (commanded velocity, encoder tics/min, after clamping); or returns false if the controller is disabled.
+// Nothing in here reads the hardware, so the same inputs and controller state always give the same outputs
+// (which is what lets sim/replay.c check a capture against the code bit for bit).
+FASTRUN bool ctrl_run(const ctrl_inputs_t *in, real *target_pos_out, real *ctrl_out_out)
+{
+  int32_t encpos = in->encpos, motorpos = in->motorpos;
+  real target_pos, target_vel, ctrl_out;
+  real pos_error_deriv = 0.f;
+
+  last_vel = (encpos - last_encpos) / ctrl_period_sec * 60;   // tics/min
 
   target_pos = ff_target_pos_buf[(ff_target_head - ctrl_feedforward_advance) & (FF_TARGETS - 1)];
   target_vel = ff_target_vel_buf[(ff_target_head - ctrl_feedforward_advance) & (FF_TARGETS - 1)];
@@ -334,6 +620,7 @@ void pit3_isr(void)
   filter_u_hist[filter_head] = 0.f;
   filter_y_hist[filter_head] = encpos;
   filter_uc_hist[filter_head] = target_pos;
+  fix_ctrl_push_inputs(encpos, target_pos);
 	
 	// perform the control law
   switch(mode)
@@ -366,7 +653,7 @@ void pit3_isr(void)
     PIT_TCTRL3 &= ~PIT_TCTRL_TEN_MASK;
     // clear the interrupt flag
     PIT_TFLG3 = 1;
-    return;
+    return false;
   }
 
   if(pos_ctrl_mode)
@@ -375,9 +662,6 @@ void pit3_isr(void)
     // and actual velocity is computed from the error between the position target and the current MOTOR position.
     // (calculation is still done in tics so we maintain compatibility with the normal mode)
     // see notes on 5/8/14
-    // integrate ctrl_out:
-    //ctrl_integrator += ctrl_out * ctrl_period_sec;
-    //ctrl_out = ctrl_integrator;
     // check for faults - compare this target motor position with the actual motor position.
     if(fault_check(encpos, ctrl_out, &pos_error_deriv))
     {
@@ -393,86 +677,152 @@ void pit3_isr(void)
   if(fabsf(ctrl_out) < min_ctrl_vel) ctrl_out = 0;
   if(fabsf(ctrl_out) > max_ctrl_vel) ctrl_out = copysignf(max_ctrl_vel, ctrl_out);
 
+  // set the new velocity (the output is encoder tics per minute; we want motor steps/minute)
+  if(mode != CTRL_BANG)
+  {
+    // don't do this when we're in bang mode...it does it internally.
+    set_step_rate_ctrl(ctrl_out * steps_per_enc_tic);
+  }
+
   // re-compute the control output after clamping for use by DARMA next time
   last_ctrl_out = ctrl_out * ctrl_period_sec / 60.f + (real)motorpos * enc_tics_per_step;
   filter_u_hist[filter_head] = last_ctrl_out;   // save for future use on filter buffer
+  fix_ctrl_push_output(last_ctrl_out);
   
+  last_encpos = encpos;
+  last_update = in->time;
+
+  // hand the rest of the work off to the slow path. If it hasn't picked up the last sample yet, that
+  // sample is lost from the history and the feedforward target isn't advanced this period.
+  if(slow_pending)
+    slow_overruns++;
+  slow_sample.time = in->time;
+  slow_sample.encpos = encpos;
+  slow_sample.motorpos = motorpos;
+  slow_sample.target_pos = target_pos;
+  slow_sample.target_vel = target_vel;
+  slow_sample.ctrl_out = ctrl_out;
+  slow_sample.flags = in->flags;
+  slow_pending = true;
+  NVIC_SET_PENDING(IRQ_SOFTWARE);
+
+  *target_pos_out = target_pos;
+  *ctrl_out_out = ctrl_out;
+  return true;
+}
 
-  // save this update to the ring buffer
-  //hist_head = (hist_head + 1) & (HIST_SIZE - 1);   // list_size is a power of 2, so list_size - 1 is 0b0..01..1
-  if(++hist_head >= HIST_SIZE) hist_head = 0;
-  hist_data[hist_head].time = time_of_update - hist_time_offset;  // rollover may occur here, but this is just reporting.
-  hist_data[hist_head].motor_position = motorpos * enc_tics_per_step;
-  hist_data[hist_head].position = encpos;
-  hist_data[hist_head].target_pos = target_pos;
-  hist_data[hist_head].target_vel = target_vel;
-  //hist_data[hist_head].velocity = last_vel;
-  hist_data[hist_head].pos_error_deriv = target_pos; //||\\!! pos_error_deriv;
-  hist_data[hist_head].cmd_velocity = ctrl_out;
-  hist_data[hist_head].flags = (CONTROL_PORT(DIR) & SYNC_BIT) ? HIST_FLAG_SYNC : 0;
-  hist_data[hist_head].flags |= enc_lost_track() ? HIST_FLAG_LOSTTRACK : 0;
-  hist_data[hist_head].flags |= (GPIOD_PDIR & 0x2) ? HIST_FLAG_PIN14 : 0;
-  hist_data[hist_head].flags |= (GPIOB_PDIR & 0x2) ? HIST_FLAG_PIN17 : 0;
-  // fill the rest of the flags byte with the first few bits of the ramps move id
-  hist_data[hist_head].flags |= (uint8_t)(path_get_ramps_moveid() & 0xF) << 4;
 
-  // the output was encoder tics per minute; we want that back in motor steps/minute
-  ctrl_out = ctrl_out * steps_per_enc_tic;
-  // set the new velocity
-  if(mode != CTRL_BANG)
+// Deferred controller stage - pended by pit3_isr after each update and run below everything else (see configure_nvic), so it never
+// holds off step generation, the I2C link, or the next control update.
+// Records the update in the history ring buffer, computes the feedforward target for the next update, and
+// streams the record out over USB if requested.
+void software_isr(void)
+{
+  ctrl_sample_t s;
+  hist_data_t rec;
+  uint32_t next_head;
+  PROF_ISR(PROF_SOFTWARE);
+
+  // grab a consistent copy of the sample; pit3_isr can't fire in the middle of this.
+  SET_BASEPRI(2 << 4);
+  if(!slow_pending)
   {
-    // don't do this when we're in bang mode...it does it internally.
-    set_direction(ctrl_out > 0.f ? false : true);
-    set_step_events_per_minute_ctrl((uint32_t)abs((int32_t)floorf(ctrl_out)));
+    CLEAR_BASEPRI();
+    return;
   }
-  
+  vmemcpy(&s, (void *)&slow_sample, sizeof(ctrl_sample_t));
+  slow_pending = false;
+  CLEAR_BASEPRI();
+  cap_slow_begin();
+
   // get the path target location (encoder tics) and velocity (encoder tics/minute) for the NEXT update (even including feedforward).
   // We will get the target advanced in time ctrl_feedforward_advance steps + 1 and keep it until it's current.
-  ff_target_head = (ff_target_head + 1) & (FF_TARGETS - 1);   // advance the head
-  path_get_target(ff_target_pos_buf + ff_target_head, ff_target_vel_buf + ff_target_head, time_of_update + (ctrl_feedforward_advance + 1) * ctrl_period_sec * TENUS_PER_SEC_F);
+  // The new target is written before the head moves, so pit3_isr never sees a half-written entry.
+  next_head = (ff_target_head + 1) & (FF_TARGETS - 1);
+  path_get_target(ff_target_pos_buf + next_head, ff_target_vel_buf + next_head, s.time + (ctrl_feedforward_advance + 1) * ctrl_period_sec * TENUS_PER_SEC_F);
+  ff_target_head = next_head;
+  fra_sample(s.time, s.target_pos, s.encpos, s.ctrl_out);
+
+  // build the history record
+  rec.time = s.time - hist_time_offset;  // rollover may occur here, but this is just reporting.
+  rec.motor_position = s.motorpos * enc_tics_per_step;
+  rec.position = s.encpos;
+  rec.target_pos = s.target_pos;
+  rec.target_vel = s.target_vel;
+  rec.pos_error_deriv = s.target_pos; //||\\!! pos_error_deriv;
+  rec.cmd_velocity = s.ctrl_out;
+  // fill the rest of the flags byte with the first few bits of the ramps move id
+  rec.flags = s.flags | (uint8_t)(path_get_ramps_moveid() & 0xF) << 4;
 
-	
-  
-  last_encpos = encpos;
-  last_update = time_of_update;
-	
- // __disable_irq();    // keep us from being interrupted for a sec
-	new_systic = SYST_CVR;
+  vmemcpy((void *)&last_rec, &rec, sizeof(hist_data_t));
 
-	if(new_systic < old_systic)		// counter counts down!
-		update_time = old_systic - new_systic;
-	else	// counter rolled over
-		update_time = old_systic - new_systic + SYST_RVR;
-  
-  // write it out right now
+  // save this update to the ring buffer (unless it's being dumped)
+  if(!hist_frozen)
+  {
+    if(++hist_head >= HIST_SIZE) hist_head = 0;
+    vmemcpy((void *)(hist_data + hist_head), &rec, sizeof(hist_data_t));
+  }
+
+  // queue it for streaming. ctrl_idle does the actual sending, so a slow host can never hold us up; if
+  // the ring is full, the record is dropped and counted.
   if(stream_ctrl_hist)
+  {
+    uint32_t head = stream_head;
+    if(head - stream_tail < STREAM_RING_SIZE)
+    {
+      vmemcpy((void *)(stream_ring + (head & (STREAM_RING_SIZE - 1))), &rec, sizeof(hist_data_t));
+      stream_head = head + 1;     // publish only after the record is complete
+    }
+    else
+      stream_dropped++;
+  }
+  cap_slow_end();
+}
+
+// Controller idle function - call from the main loop.
+// Releases a frozen history after DUMP_HOLD_MS and drains the streaming ring into usb packets. Never waits on usb: packets are only built when the transmit
+// queue has room, so records batch up (two to a packet) whenever the host falls behind. Returns true if anything was sent.
+bool ctrl_idle(void)
+{
+  uint32_t n, dropped;
+  bool sent = false;
+
+  // let go of a dumped history if the host has lost interest
+  if(hist_frozen && systick_millis_count - dump_time > DUMP_HOLD_MS)
+    hist_frozen = false;
+
+  while(stream_head != stream_tail || stream_dropped != stream_dropped_sent)
   {
 #ifdef USB_RAWHID
-    hid_write(HIST_PACK_TYPE, (uint8_t *)(hist_data + hist_head), sizeof(hist_data_t), 1);
+    stream_pack_t pack;
+    if(hid_tx_ready() <= 0)
+      return sent;
+    n = min(stream_head - stream_tail, STREAM_RECS_PER_PACK);
+    dropped = stream_dropped;
+    pack.seq = stream_seq;
+    pack.flags = (dropped != stream_dropped_sent) ? STREAM_FLAG_OVERFLOW : 0;
+    pack.dropped = (uint16_t)dropped;
+    for(uint32_t i = 0; i < n; i++)
+      vmemcpy(pack.recs + i, stream_ring + ((stream_tail + i) & (STREAM_RING_SIZE - 1)), sizeof(hist_data_t));
+    // if usb couldn't take the packet after all (no buffer free), leave the records in the ring for next time
+    if(hid_write_frame(HIST_PACK_TYPE, (uint8_t *)&pack, sizeof(pack) - (STREAM_RECS_PER_PACK - n) * sizeof(hist_data_t), 0) <= 0)
+      return sent;
+    stream_seq++;
+    stream_tail += n;
+    stream_dropped_sent = dropped;
 #else
+    (void)n;
+    dropped = stream_dropped;
+    stream_dropped_sent = dropped;
+    if(stream_head == stream_tail)
+      continue;
     usb_serial_write("$", 1);
-    usb_serial_write(hist_data + hist_head, sizeof(hist_data_t));
+    usb_serial_write((void *)(stream_ring + (stream_tail & (STREAM_RING_SIZE - 1))), sizeof(hist_data_t));
+    stream_tail++;
 #endif
+    sent = true;
   }
-  
-	// reset the PIT timer's cycle time based on how long this took. That's not how PIT timers
-  // work; the following code is irrelevant (but taught me something!)
-	//if(update_time < ctrl_period_cycles)
- // {
-	//	set_update_cycles(ctrl_period_cycles - update_time);
- //   //hid_printf("Old: %lu; New: %lu; Diff: %li; Target: %lu, Set: %lu\n", old_systic, new_systic, (long int)old_systic - (long int)new_systic, ctrl_period_cycles, ctrl_period_cycles - update_time);
- // }
-	//else
- // {
-	//	set_update_cycles(100);		// wait some minimum time before firing again
- //   //hid_printf("Old: %lu; New: %lu; Diff: %li; Target: %lu, Set: %lu\n", old_systic, new_systic, (long int)old_systic - (long int)new_systic, ctrl_period_cycles, 100);
- // }
- // 
- // //
-	//
-  // clear the interrupt flag
-  PIT_TFLG3 = 1;
-//  __enable_irq();     // done with time critical section
+  return sent;
 }
 
 
@@ -486,9 +836,14 @@ void pit3_isr(void)
 //   lastvel - current velocity (that chosen by last update)
 // Returns the control input for the system (update speed in step events per minute)
 // uses module variables beginning in pid_ only.
-real pid_ctrl(real dt, real target_pos, real target_vel, real encpos, real lastvel)
+FASTRUN real pid_ctrl(real dt, real target_pos, real target_vel, real encpos, real lastvel)
 {
-  real err = target_pos - encpos, ctrl;
+  real err, ctrl;
+
+  if(ctrl_fixed_point)
+    return fix_pid_ctrl(target_vel);
+
+  err = target_pos - encpos;
   // update the integrator
   pid_i_sum += err * dt;
 
@@ -502,7 +857,7 @@ real pid_ctrl(real dt, real target_pos, real target_vel, real encpos, real lastv
 // Bang-Bang controller
 // Answers the question "should we take a step?" based solely on position error.
 // This works because our cost of switching directions is almost free.
-void bang_ctrl(real dt, real target_pos, real target_vel, real encpos)
+FASTRUN void bang_ctrl(real dt, real target_pos, real target_vel, real encpos)
 {
   if(fabsf(encpos - target_pos) > enc_tics_per_step)
   {
@@ -530,12 +885,14 @@ void bang_ctrl(real dt, real target_pos, real target_vel, real encpos)
 // u(k) is the output of the controller/input of the system at the current time; uc(k) is the control input
 // (reference input/target position) and y(k) is the current system output.
 // This is designed to be used with either model-based control or model following control.
-real darma_ctrl()
+FASTRUN real darma_ctrl()
 {
   real Ru = 0, Sy = 0, Tuc = 0, u_out;
 
 
-  if(filter_warmup > FILTER_MAX_SIZE)   // don't run the controller until all buffers are full
+  if(filter_warmup > FILTER_MAX_SIZE && ctrl_fixed_point)
+    u_out = fix_darma_ctrl();
+  else if(filter_warmup > FILTER_MAX_SIZE)   // don't run the controller until all buffers are full
   {
 
     // compile the terms. NOTE: Officially, the Ru term should only contain terms 1..end of R and u
@@ -591,18 +948,20 @@ real darma_ctrl()
 //
 // All the parameters needed for this function are already supplied in the filter tables.
 //
-real comp_ctrl(void)
+FASTRUN real comp_ctrl(void)
 {
   real ucFn, fhFd = 0., errCn, chCd = 0.;
   
-  if(filter_warmup > FILTER_MAX_SIZE)   // don't run the controller until all buffers are full
+  if(filter_warmup > FILTER_MAX_SIZE && ctrl_fixed_point)
+    return fix_comp_ctrl();
+  else if(filter_warmup > FILTER_MAX_SIZE)   // don't run the controller until all buffers are full
   {
 
     // compile the filters. First element of both numerators is filled in by hand; first element of both denominators is what we're solving for.
     ucFn = comp_F_num[0] * filter_uc_hist[filter_head];
     errCn = comp_C_num[0] * (filter_uc_hist[filter_head] - filter_y_hist[filter_head]);    // error is uc - y.
 
-    for(uint8_t i = 0, j = (filter_head - 1) & FILTER_MAX_SIZE; i < FILTER_MAX_SIZE - 1; i++, j = (j - 1) & FILTER_MAX_SIZE)
+    for(uint8_t i = 0, j = (filter_head - 1) & (FILTER_MAX_SIZE - 1); i < FILTER_MAX_SIZE - 1; i++, j = (j - 1) & (FILTER_MAX_SIZE - 1))
     {
       // i counts indexes in the filter polys; j counts indexes in the filter buffers.
       ucFn += comp_F_num[i + 1] * filter_uc_hist[j];
@@ -627,7 +986,7 @@ real comp_ctrl(void)
 // Looks for significant changes in the error between the motor command position (coming out of the controller)
 // and the actual encoder position. Returns true if a fault has been detected, and sets the pos_error_deriv parameter
 // to the calculated error change.
-bool fault_check(real encpos, real cmdpos, real *pos_error_deriv)
+FASTRUN bool fault_check(real encpos, real cmdpos, real *pos_error_deriv)
 {
   static real last_cmdpos = -12345.f;
   static real last_pos_delta = -1.f;
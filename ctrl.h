@@ -34,19 +34,79 @@ typedef enum
   CTRL_BANG,         // bang-bang control mode
   CTRL_DARMA,        // DARMA control mode
   CTRL_COMP,         // compensating filter controller
+  CTRL_MODE_COUNT
 } ctrl_mode;
 
 
+// Snapshot of the controller state, sent as-is by the binary protocol's telemetry request (bincmd.c)
+typedef struct
+{
+  uint32_t time;            // time of the latest update (tenus, same time base as the history)
+  int32_t position;         // encoder position (tics)
+  int32_t motor_position;   // motor position (encoder tics)
+  float target_pos;
+  float target_vel;
+  float cmd_velocity;       // controller output (encoder tics/min)
+  uint8_t flags;            // history flags byte
+  uint8_t mode;             // ctrl_mode
+  uint16_t stream_dropped;  // running count of streamed records dropped (wraps)
+  uint32_t update_cycles;   // cpu cycles the last update took
+  uint32_t slow_overruns;   // see ctrl_get_slow_overruns
+} __attribute__ ((packed)) ctrl_telemetry_t;
+
+// Inputs of one control update: everything ctrl_run takes from the hardware. ctrl_update samples them; the
+// replay harness (sim/replay.c) feeds in the ones a capture recorded (see capture.h).
+typedef struct
+{
+  uint32_t time;            // time the encoder was read (tenus)
+  int32_t encpos;           // encoder position (tics)
+  int32_t motorpos;         // motor position (steps)
+  uint8_t flags;            // history flags: sync line, encoder lost track, pins 14 and 17 (ctrl.c:HIST_FLAG_*)
+} __attribute__ ((packed)) ctrl_inputs_t;
+
+#define CTRL_TIMING_BUCKETS   12    // execution time histogram buckets in ctrl_timing_t
+
+// Timing statistics of the control update in one control mode since they were last reset, as read by
+// ctrl_get_timing and sent as-is by the binary protocol. Execution times are in cpu cycles. Latency is
+// the time from the PIT3 tick to the start of the update, in bus cycles; its spread is the jitter of
+// the update relative to the ideal period.
+typedef struct
+{
+  uint32_t count;           // updates timed
+  uint32_t min_cycles;      // execution time
+  uint32_t mean_cycles;
+  uint32_t max_cycles;
+  uint32_t min_latency;     // entry latency
+  uint32_t mean_latency;
+  uint32_t max_latency;
+  uint32_t overruns;        // updates that were still running when the next PIT3 tick came
+  uint16_t hist[CTRL_TIMING_BUCKETS];   // execution times, log2 buckets: hist[0] is < 512 cycles, hist[k] is
+                                        // 2^(k+8) to 2^(k+9) cycles, hist[11] is everything above. Counts stop at 65535.
+} __attribute__ ((packed)) ctrl_timing_t;
+
+
 #define FILTER_MAX_SIZE 8      // maximum number of terms in any controller that uses a filter (darma/comp). Ring buffer...needs to be a power of 2.
 
 void init_ctrl(void);
+bool ctrl_idle(void);
 
 void ctrl_enable(ctrl_mode mode);
+void ctrl_enable_at(ctrl_mode mode, int32_t encpos);
 ctrl_mode ctrl_get_mode(void);
 
 void ctrl_set_period(uint32_t us);
 uint32_t ctrl_get_period(void);
+void ctrl_coefs_changed(void);
 float ctrl_get_update_time(void);
+uint32_t ctrl_get_slow_overruns(void);
+void ctrl_get_telemetry(ctrl_telemetry_t *t);
+void ctrl_get_timing(ctrl_mode m, ctrl_timing_t *t, bool reset);
+void ctrl_reset_timing(void);
 void output_history(void);
+void resend_history(uint32_t seq);
+void release_history(void);
+
+void ctrl_update(void);
+bool ctrl_run(const ctrl_inputs_t *in, real *target_pos, real *ctrl_out);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,379 @@
+/********************************************************************************
+ * Fixed-point Controller Kernels
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Integer implementations of the PID, DARMA and compensating filter control
+ *   laws in ctrl.c. The MK20DX has no FPU, so every float multiply-accumulate in those
+ *   controllers is a soft-float library call; these kernels do the same math with the
+ *   Cortex-M4 dual 16-bit multiply-accumulate (SMLALD) instruction instead.
+ *   ctrl.c:ctrl_fixed_point selects between these and the float versions, which are
+ *   kept as the reference implementation.
+ *
+ * How it works:
+ *   Every filter term is a dot product of a coefficient vector c with the last n samples
+ *   of a signal x (positions, in encoder tics). Positions are large (int32) but change
+ *   little between updates, so each dot product is rewritten in terms of the newest
+ *   sample and the differences d(j) = x(k-j) - x(k-j-1):
+ *
+ *     sum(c(i) * x(k-i)) = S(0) * x(k) - sum(S(j+1) * d(j)),   S(j) = c(j) + c(j+1) + ... + c(n-1)
+ *
+ *   S(0) * x(k) is one 32x32 multiply; the differences fit in 16 bits and are run through
+ *   SMLALD two at a time against the 16-bit tail sums S(1..n-1). Each coefficient vector
+ *   gets its own scale (block exponent), picked automatically from its largest element
+ *   whenever the coefficients change (fix_ctrl_set_coefs), so small and large coefficient
+ *   sets both keep ~15 bits of precision.
+ *
+ *   Signal histories are kept twice over (mirrored) so the newest FILTER_MAX_SIZE samples
+ *   are always contiguous in memory, newest first.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include <string.h>
+#include <math.h>
+
+#include "ctrl.h"
+#include "ctrl_fixed.h"
+#include "imc/utils.h"
+
+// core_cm4_simd.h normally comes in through core_cm4.h, which defines these for it.
+#ifndef __ASM
+#define __ASM __asm
+#endif
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+#include <core_cm4_simd.h>
+
+// Type Definitions ==================================================================
+// One coefficient vector, pre-scaled for fix_dot
+typedef struct
+{
+  int16_t tail[FILTER_MAX_SIZE];  // tail sums S(1)..S(n-1), zero padded. Scaled by 2^tail_shift
+  int32_t tail_shift;
+  int32_t head;                   // S(0) = sum of all coefficients. Scaled by 2^head_shift
+  int32_t head_shift;
+  bool zero;                      // all coefficients are zero - nothing to compute
+} __attribute__ ((aligned (4))) fix_vec_t;
+
+// History of one signal
+typedef struct
+{
+  int32_t x[2 * FILTER_MAX_SIZE];   // samples (Q FIX_POS_FRAC), mirrored. Newest is x[head]
+  int16_t d[2 * FILTER_MAX_SIZE];   // d[j] = x[j] - x[j + 1], saturated to 16 bits, mirrored.
+  uint32_t head;
+  uint32_t sat_count;               // non-zero while a saturated difference is still inside the window
+} __attribute__ ((aligned (4))) fix_hist_t;
+
+// All coefficients, swapped in as a block so the ISR never sees half of an update
+typedef struct
+{
+  fix_vec_t darma_r, darma_s, darma_t;      // all divided by R(0) already; darma_r skips R(0)
+  fix_vec_t comp_cn, comp_cd, comp_fn, comp_fd;
+  int32_t kp, ki, kd, kdv;                  // PID: kp, ki * dt, kd, kd * 60 / dt
+  int32_t kp_shift, ki_shift, kd_shift, kdv_shift;
+} fix_coefs_t;
+
+// Constants =========================================================================
+#define FIX_TAIL_BITS   15      // tail sums are int16
+#define FIX_HEAD_BITS   30      // head sums and PID gains are int32 (leaving a bit for rounding)
+#define FIX_MIN_SHIFT   -16     // limits on the automatically chosen scales
+#define FIX_MAX_SHIFT   48
+#define FIX_ACC_LIMIT   ((int64_t)1 << 62)    // PID integrator saturation
+
+// Global Variables ==================================================================
+extern real pid_kp, pid_ki, pid_kd;
+extern real darma_R[FILTER_MAX_SIZE];
+extern real darma_S[FILTER_MAX_SIZE];
+extern real darma_T[FILTER_MAX_SIZE];
+extern real comp_C_num[FILTER_MAX_SIZE];
+extern real comp_C_den[FILTER_MAX_SIZE - 1];
+extern real comp_F_num[FILTER_MAX_SIZE];
+extern real comp_F_den[FILTER_MAX_SIZE - 1];
+
+// Local Variables ===================================================================
+static fix_coefs_t coefs;
+static fix_hist_t y_hist;     // encoder position
+static fix_hist_t uc_hist;    // target position
+static fix_hist_t u_hist;     // controller output
+static fix_hist_t e_hist;     // uc - y (comp C filter input)
+static fix_hist_t ch_hist;    // comp c_hat
+static fix_hist_t fh_hist;    // comp f_hat
+static int64_t pid_i_acc = 0;   // PID integrator, already multiplied by ki * dt
+
+// Function Predeclares ==============================================================
+static int32_t pick_shift(real maxval, int32_t bits);
+static void fix_vec_build(fix_vec_t *v, const real *c, uint32_t n, real k);
+static int32_t fix_gain(real k, int32_t *shift);
+static void fix_hist_push(fix_hist_t *h, int32_t x);
+static int64_t fix_dot(const fix_vec_t *v, const fix_hist_t *h);
+static int64_t fix_rshift(int64_t v, int32_t shift);
+static int32_t fix_from_real(real x);
+static int32_t fix_from_tics(int32_t x);
+static int32_t fix_sat(int64_t v);
+static real fix_to_real(int64_t x);
+
+
+// Clears all signal histories and the PID integrator. Call when the controller is (re)started.
+void fix_ctrl_reset(void)
+{
+  vmemset(&y_hist, 0, sizeof(fix_hist_t));
+  vmemset(&uc_hist, 0, sizeof(fix_hist_t));
+  vmemset(&u_hist, 0, sizeof(fix_hist_t));
+  vmemset(&e_hist, 0, sizeof(fix_hist_t));
+  vmemset(&ch_hist, 0, sizeof(fix_hist_t));
+  vmemset(&fh_hist, 0, sizeof(fix_hist_t));
+  pid_i_acc = 0;
+}
+
+// Re-scales all controller coefficients from their float versions (pid_k*, darma_*, comp_*).
+// Call whenever any of them change, or the control period (dt, in seconds) changes.
+// The PID integrator holds sum(ki * dt * err), so changing ki while running only affects future error.
+void fix_ctrl_set_coefs(real dt)
+{
+  fix_coefs_t c;
+  real k = 0.f;
+
+  // DARMA: u(k) = (T*uc - S*y - R'*u) / R(0), where R' is R without its first term.
+  if(fabsf(darma_R[0]) > 0.f)
+    k = 1.f / darma_R[0];
+  fix_vec_build(&c.darma_r, darma_R + 1, FILTER_MAX_SIZE - 1, k);
+  fix_vec_build(&c.darma_s, darma_S, FILTER_MAX_SIZE, k);
+  fix_vec_build(&c.darma_t, darma_T, FILTER_MAX_SIZE, k);
+
+  fix_vec_build(&c.comp_cn, comp_C_num, FILTER_MAX_SIZE, 1.f);
+  fix_vec_build(&c.comp_cd, comp_C_den, FILTER_MAX_SIZE - 1, 1.f);
+  fix_vec_build(&c.comp_fn, comp_F_num, FILTER_MAX_SIZE, 1.f);
+  fix_vec_build(&c.comp_fd, comp_F_den, FILTER_MAX_SIZE - 1, 1.f);
+
+  c.kp = fix_gain(pid_kp, &c.kp_shift);
+  c.ki = fix_gain(pid_ki * dt, &c.ki_shift);
+  c.kd = fix_gain(pid_kd, &c.kd_shift);
+  c.kdv = fix_gain(pid_kd * 60.f / dt, &c.kdv_shift);
+
+  // swap in the new set without the control isr seeing a partial update. The integrator
+  // is stored at the scale of ki, so it has to follow it.
+  SET_BASEPRI(2 << 4);
+  pid_i_acc = fix_rshift(pid_i_acc, coefs.ki_shift - c.ki_shift);
+  memcpy(&coefs, &c, sizeof(fix_coefs_t));
+  CLEAR_BASEPRI();
+}
+
+// Adds this update's encoder position and target position to the signal histories.
+// Call at the start of every control update, before any of the controllers.
+FASTRUN void fix_ctrl_push_inputs(int32_t encpos, real target_pos)
+{
+  int32_t uc = fix_from_real(target_pos);
+  int32_t y = fix_from_tics(encpos);
+
+  fix_hist_push(&y_hist, y);
+  fix_hist_push(&uc_hist, uc);
+  fix_hist_push(&e_hist, fix_sat((int64_t)uc - y));
+}
+
+// Adds this update's (clamped) controller output, in encoder tics, to the history.
+// Call at the end of every control update.
+FASTRUN void fix_ctrl_push_output(real u)
+{
+  fix_hist_push(&u_hist, fix_from_real(u));
+}
+
+// PID controller - same control law as ctrl.c:pid_ctrl:
+//   ctrl = kp * err + ki * sum(err * dt) + kd * (target_vel - lastvel)
+// with lastvel taken from the last two encoder readings. Returns encoder tics.
+FASTRUN real fix_pid_ctrl(real target_vel)
+{
+  int32_t err = uc_hist.x[uc_hist.head] - y_hist.x[y_hist.head];
+  int64_t dy = (int64_t)y_hist.x[y_hist.head] - y_hist.x[y_hist.head + 1];
+  int64_t out;
+
+  pid_i_acc += (int64_t)coefs.ki * err;
+  if(pid_i_acc > FIX_ACC_LIMIT) pid_i_acc = FIX_ACC_LIMIT;
+  if(pid_i_acc < -FIX_ACC_LIMIT) pid_i_acc = -FIX_ACC_LIMIT;
+
+  out = fix_rshift((int64_t)coefs.kp * err, coefs.kp_shift);
+  out += fix_rshift(pid_i_acc, coefs.ki_shift);
+  // target_vel is in tics/min (no fractional bits), lastvel * dt / 60 is dy.
+  out += fix_rshift((int64_t)coefs.kd * (int32_t)target_vel, coefs.kd_shift - FIX_POS_FRAC);
+  out -= fix_rshift(coefs.kdv * dy, coefs.kdv_shift);
+
+  return fix_to_real(out);
+}
+
+// DARMA controller - same control law as ctrl.c:darma_ctrl. Returns the new position target in encoder tics.
+FASTRUN real fix_darma_ctrl(void)
+{
+  int64_t u = fix_dot(&coefs.darma_t, &uc_hist) - fix_dot(&coefs.darma_s, &y_hist) - fix_dot(&coefs.darma_r, &u_hist);
+  return fix_to_real(u);
+}
+
+// Compensating filter controller - same control law as ctrl.c:comp_ctrl. Returns the new position target in encoder tics.
+FASTRUN real fix_comp_ctrl(void)
+{
+  int64_t fh = fix_dot(&coefs.comp_fn, &uc_hist) - fix_dot(&coefs.comp_fd, &fh_hist);
+  int64_t ch = fix_dot(&coefs.comp_cn, &e_hist) - fix_dot(&coefs.comp_cd, &ch_hist);
+
+  // the filter outputs are histories too, so keep them in range
+  fh = max(min(fh, INT32_MAX), INT32_MIN);
+  ch = max(min(ch, INT32_MAX), INT32_MIN);
+  fix_hist_push(&fh_hist, (int32_t)fh);
+  fix_hist_push(&ch_hist, (int32_t)ch);
+  return fix_to_real(fh + ch);
+}
+
+
+// Returns the shift that scales maxval to just under 2^bits.
+static int32_t pick_shift(real maxval, int32_t bits)
+{
+  int e;
+  if(maxval <= 0.f)
+    return 0;
+  frexpf(maxval, &e);   // maxval = f * 2^e with 0.5 <= f < 1, so maxval < 2^e
+  return max(min(bits - e, FIX_MAX_SHIFT), FIX_MIN_SHIFT);
+}
+
+// Builds v from the n coefficients in c, each multiplied by k.
+static void fix_vec_build(fix_vec_t *v, const real *c, uint32_t n, real k)
+{
+  real sums[FILTER_MAX_SIZE + 1];
+  real maxtail = 0.f;
+  int32_t q;
+
+  // sums[j] = c[j] + c[j+1] + ... + c[n-1]
+  sums[n] = 0.f;
+  for(uint32_t j = n; j > 0; j--)
+    sums[j - 1] = sums[j] + c[j - 1] * k;
+  for(uint32_t j = 1; j < n; j++)
+    maxtail = max(maxtail, fabsf(sums[j]));
+
+  vmemset(v, 0, sizeof(fix_vec_t));
+  v->zero = true;
+  for(uint32_t j = 0; j < n; j++)
+    if(0.f != c[j] * k)
+      v->zero = false;
+
+  v->head = fix_gain(sums[0], &v->head_shift);
+  v->tail_shift = pick_shift(maxtail, FIX_TAIL_BITS);
+  for(uint32_t j = 1; j < n; j++)
+  {
+    q = (int32_t)lroundf(ldexpf(sums[j], v->tail_shift));
+    v->tail[j - 1] = (int16_t)max(min(q, INT16_MAX), INT16_MIN);
+  }
+}
+
+// Scales a single gain into an int32, returning the scale through shift.
+static int32_t fix_gain(real k, int32_t *shift)
+{
+  int64_t q;
+  *shift = pick_shift(fabsf(k), FIX_HEAD_BITS);
+  q = llroundf(ldexpf(k, *shift));
+  return (int32_t)max(min(q, INT32_MAX), INT32_MIN);
+}
+
+// Adds a new sample to a signal history.
+static void fix_hist_push(fix_hist_t *h, int32_t x)
+{
+  int64_t d = (int64_t)x - h->x[h->head];
+
+  h->head = (h->head - 1) & (FILTER_MAX_SIZE - 1);
+  if(d > INT16_MAX || d < INT16_MIN)
+  {
+    d = max(min(d, INT16_MAX), INT16_MIN);
+    h->sat_count = FILTER_MAX_SIZE;
+  }
+  else if(h->sat_count)
+    h->sat_count--;
+  h->x[h->head] = h->x[h->head + FILTER_MAX_SIZE] = x;
+  h->d[h->head] = h->d[h->head + FILTER_MAX_SIZE] = (int16_t)d;
+}
+
+// Loads two adjacent 16-bit values as one word for the SIMD instructions (the history may not be word aligned).
+static inline uint32_t load_pair(const int16_t *p)
+{
+  uint32_t w;
+  memcpy(&w, p, sizeof(uint32_t));
+  return w;
+}
+
+// Dot product of a coefficient vector with the newest samples of a history. Returns Q FIX_POS_FRAC.
+static FASTRUN int64_t fix_dot(const fix_vec_t *v, const fix_hist_t *h)
+{
+  int64_t tacc = 0;
+
+  if(v->zero)
+    return 0;
+
+  if(!h->sat_count)
+  {
+    const int16_t *d = h->d + h->head;
+    for(uint32_t j = 0; j < FILTER_MAX_SIZE; j += 2)
+      tacc = (int64_t)__SMLALD(load_pair(d + j), load_pair(v->tail + j), tacc);
+  }
+  else
+  {
+    // a recent jump was too big for 16 bits; take the differences from the full samples instead.
+    const int32_t *x = h->x + h->head;
+    for(uint32_t j = 0; j < FILTER_MAX_SIZE - 1; j++)
+      tacc += (int64_t)v->tail[j] * ((int64_t)x[j] - x[j + 1]);
+  }
+
+  return fix_rshift((int64_t)v->head * h->x[h->head], v->head_shift) - fix_rshift(tacc, v->tail_shift);
+}
+
+// Rounding arithmetic shift; shifts left for negative shift values.
+static int64_t fix_rshift(int64_t v, int32_t shift)
+{
+  if(shift > 0)
+    return (v + ((int64_t)1 << (shift - 1))) >> shift;
+  return v << -shift;
+}
+
+// converts a position in tics to Q FIX_POS_FRAC, rounding and saturating.
+static int32_t fix_from_real(real x)
+{
+  x *= (real)(1 << FIX_POS_FRAC);
+  if(x >= 2147483520.f) return INT32_MAX;
+  if(x <= -2147483520.f) return INT32_MIN;
+  return (int32_t)(x + (x >= 0.f ? 0.5f : -0.5f));    // round, so the PID integrator doesn't pick up a bias
+}
+
+// saturates v to the Q FIX_POS_FRAC range
+static int32_t fix_sat(int64_t v)
+{
+  return (int32_t)max(min(v, INT32_MAX), INT32_MIN);
+}
+
+// converts an encoder position in tics to Q FIX_POS_FRAC, saturating like fix_from_real.
+static int32_t fix_from_tics(int32_t x)
+{
+  return fix_sat((int64_t)x * (1 << FIX_POS_FRAC));
+}
+
+// converts a Q FIX_POS_FRAC value back to tics.
+static real fix_to_real(int64_t x)
+{
+  x = max(min(x, INT32_MAX), INT32_MIN);
+  return (real)(int32_t)x * (1.f / (1 << FIX_POS_FRAC));
+}
@@ -0,0 +1,47 @@
+/* Fixed-point controller kernels 
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2014 Ben Weiss
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __ctrl_fixed_h
+#define __ctrl_fixed_h
+
+#include "common.h"
+#include "ctrl.h"
+
+// Positions (encoder tics) inside the fixed-point kernels carry this many fractional bits. With 6 bits, a
+// position difference of up to 512 tics per update fits the 16-bit SIMD lanes - 3e7 tics/min at 1 kHz,
+// well above max_ctrl_vel. Larger jumps (step targets) are still exact, just slower (see fix_dot).
+#define FIX_POS_FRAC    6
+
+void fix_ctrl_reset(void);
+void fix_ctrl_set_coefs(real dt);
+
+void fix_ctrl_push_inputs(int32_t encpos, real target_pos);
+void fix_ctrl_push_output(real u);
+
+real fix_pid_ctrl(real target_vel);
+real fix_darma_ctrl(void);
+real fix_comp_ctrl(void);
+
+#endif
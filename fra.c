@@ -0,0 +1,272 @@
+/********************************************************************************
+ * Frequency response analyzer
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Stepped-sine sweep of the control loop, measured on the board. See fra.h.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include <math.h>
+
+#include "fra.h"
+
+// Constants ==========================================================================
+#define FRA_LAG             16      // updates the path target can run ahead of the updates it is used in (ctrl.c:FF_TARGETS)
+#define FRA_MIN_SAMPLES     3       // fewest updates per cycle of a sine
+
+typedef enum {
+  FRA_OFF,
+  FRA_RUNNING,
+  FRA_DONE
+} fra_state_t;
+
+// Global Variables ====================================================================
+real fra_freq_low = 1.f;
+real fra_freq_high = 50.f;
+uint32_t fra_points = 20;
+real fra_amp = 50.f;
+uint32_t fra_cycles = 4;
+uint32_t fra_settle = 2;
+
+// Local Variables ===================================================================
+static volatile fra_state_t fra_state = FRA_OFF;
+static volatile bool fra_announce = false;    // the sweep just finished; fra_idle says so
+static fra_point_t results[FRA_MAX_POINTS];
+static volatile uint32_t results_done = 0;    // points measured. software_isr writes each one before counting it.
+static uint32_t sweep_points;                 // points in this sweep (yn, when it started)
+static uint32_t sweep_period_us;              // control period the sweep is timed with
+static real center;                           // the sine runs around this position (tics)
+
+// the point being run. Counted in updates from its start: n, then settle updates, then meas_len measured ones.
+static uint32_t point;
+static uint32_t n, settle, meas_len;
+static real point_w;                          // rad/update
+static uint32_t last_time;                    // time of the last update sampled (tenus)
+static bool first_sample;
+
+// single-bin DFT: the basis vector is at bin_n updates into the measurement
+static real bin_re, bin_im, bin_rot_re, bin_rot_im;
+static uint32_t bin_n;
+static real ref_re, ref_im, enc_re, enc_im, out_re, out_im;
+
+// the target's sine, as a rotating unit vector (see path.c's sine oscillators). It steps on by point_w every
+// control update, the same rotation as the DFT bin, so it stays on the bin's frequency however the update times
+// jitter.
+static real stim_sin, stim_cos, stim_rot_sin, stim_rot_cos;
+static real stim_vel;                         // fra_amp * point_w, in tics/min
+static uint32_t stim_time;
+static bool stim_called, stim_started;
+
+// Function Predeclares ==============================================================
+static void point_start(void);
+static void point_finish(void);
+static uint32_t updates_between(uint32_t from, uint32_t to);
+
+
+// Starts a sweep around center (tics) with the control period period_us. Returns false if the sweep parameters
+// don't make a sweep.
+bool fra_start(real center_pos, uint32_t period_us)
+{
+  if(fra_freq_low <= 0 || fra_freq_high <= 0 || period_us < 10)
+    return false;
+  fra_state = FRA_OFF;
+  center = center_pos;
+  sweep_period_us = period_us;
+  sweep_points = max(1U, min(fra_points, (uint32_t)FRA_MAX_POINTS));
+  results_done = 0;
+  point = 0;
+  point_start();
+  stim_sin = 0;
+  stim_cos = 1;
+  stim_called = stim_started = false;
+  fra_announce = false;
+  fra_state = FRA_RUNNING;
+  return true;
+}
+
+// sets up the measurement of the current point
+static void point_start(void)
+{
+  real f = fra_freq_low, samples;
+
+  if(sweep_points > 1)
+    f *= powf(fra_freq_high / fra_freq_low, (real)point / (sweep_points - 1));
+  // a whole number of updates for the yc cycles
+  samples = fra_cycles * 10.f * TENUS_PER_SEC_F / (f * sweep_period_us);
+  meas_len = max((uint32_t)(samples + 0.5f), (uint32_t)FRA_MIN_SAMPLES * fra_cycles);
+  point_w = 2 * PI * fra_cycles / meas_len;
+  settle = fra_settle * meas_len / fra_cycles + FRA_LAG;
+  n = 0;
+  first_sample = true;
+
+  bin_n = 0;
+  bin_re = 1;
+  bin_im = 0;
+  bin_rot_re = cosf(point_w);
+  bin_rot_im = -sinf(point_w);
+  ref_re = ref_im = enc_re = enc_im = out_re = out_im = 0;
+  // the stimulus picks up the new frequency (in phase) at its next step
+  stim_rot_sin = -bin_rot_im;
+  stim_rot_cos = bin_rot_re;
+  stim_vel = fra_amp * point_w * (10.f * TENUS_PER_MIN_F / sweep_period_us);
+}
+
+// PATH_FRA: the sweep's target at elapsed (tenus since the path started). Returns false once the sweep is over.
+bool fra_target(uint32_t elapsed, volatile real *target_pos, volatile real *target_vel)
+{
+  uint32_t steps;
+  real s, g;
+
+  if(FRA_RUNNING != fra_state)
+    return false;
+  // one step per control update since the last target (more if the slow path missed some)
+  steps = stim_started ? updates_between(stim_time, elapsed) : 0;
+  while(steps--)
+  {
+    s = stim_sin * stim_rot_cos + stim_cos * stim_rot_sin;
+    stim_cos = stim_cos * stim_rot_cos - stim_sin * stim_rot_sin;
+    stim_sin = s;
+  }
+  // keep it on the unit circle (first order is plenty this close)
+  g = 1.5f - 0.5f * (stim_sin * stim_sin + stim_cos * stim_cos);
+  stim_sin *= g;
+  stim_cos *= g;
+  stim_time = elapsed;
+  stim_called = stim_started = true;
+
+  *target_pos = center + fra_amp * stim_sin;
+  *target_vel = stim_vel * stim_cos;
+  return true;
+}
+
+// Slow path hook: one control update (time (tenus), the target it used, the encoder position, and the controller
+// output). Call after path_get_target.
+void fra_sample(uint32_t time, real target_pos, int32_t encpos, real ctrl_out)
+{
+  uint32_t steps = 1;
+  real x;
+
+  if(FRA_RUNNING != fra_state)
+    return;
+  // no target from us this update: the path has moved on to something else.
+  if(!stim_called)
+  {
+    if(stim_started)
+      fra_state = FRA_OFF;
+    return;
+  }
+  stim_called = false;
+
+  // count any updates the slow path missed, so the basis stays in step
+  if(!first_sample)
+    steps = updates_between(last_time, time);
+  first_sample = false;
+  last_time = time;
+  n += steps;
+  if(n <= settle)
+    return;
+
+  while(bin_n < n - settle - 1)
+  {
+    x = bin_re * bin_rot_re - bin_im * bin_rot_im;
+    bin_im = bin_re * bin_rot_im + bin_im * bin_rot_re;
+    bin_re = x;
+    bin_n++;
+  }
+  if(bin_n < meas_len)
+  {
+    x = target_pos - center;
+    ref_re += x * bin_re;
+    ref_im += x * bin_im;
+    x = encpos - center;
+    enc_re += x * bin_re;
+    enc_im += x * bin_im;
+    out_re += ctrl_out * bin_re;
+    out_im += ctrl_out * bin_im;
+  }
+  if(bin_n + 1 >= meas_len)
+    point_finish();
+}
+
+// records the point just measured and moves on to the next
+static void point_finish(void)
+{
+  fra_point_t *r = results + point;
+  real mag = ref_re * ref_re + ref_im * ref_im;
+
+  r->freq = fra_cycles * 10.f * TENUS_PER_SEC_F / ((real)meas_len * sweep_period_us);
+  r->ref_amp = 2.f * sqrtf(mag) / meas_len;
+  if(mag > 0)
+  {
+    // X / R = X * conj(R) / |R|^2
+    r->enc_re = (enc_re * ref_re + enc_im * ref_im) / mag;
+    r->enc_im = (enc_im * ref_re - enc_re * ref_im) / mag;
+    r->out_re = (out_re * ref_re + out_im * ref_im) / mag;
+    r->out_im = (out_im * ref_re - out_re * ref_im) / mag;
+  }
+  else
+    r->enc_re = r->enc_im = r->out_re = r->out_im = 0;
+  results_done = ++point;
+
+  if(point >= sweep_points)
+  {
+    fra_state = FRA_DONE;
+    fra_announce = true;
+  }
+  else
+    point_start();
+}
+
+// Main loop hook: says when a sweep has finished. Returns true if it did.
+bool fra_idle(void)
+{
+  if(!fra_announce)
+    return false;
+  fra_announce = false;
+  hid_printf("'Frequency response sweep done: %lu points (gy).\n", (unsigned long)results_done);
+  return true;
+}
+
+// control updates from one update time to another (tenus), to the nearest update and at least one
+static uint32_t updates_between(uint32_t from, uint32_t to)
+{
+  return max(1U, ((to - from) * 10 + sweep_period_us / 2) / sweep_period_us);
+}
+
+// "gy": prints the points measured and the points in the sweep, then one line per point: frequency (Hz),
+// target amplitude (tics), encoder response (re, im), controller output response (re, im).
+void fra_report(void)
+{
+  uint32_t count = results_done;
+  const fra_point_t *r;
+
+  hid_printf("%lu %lu\n", (unsigned long)count, (unsigned long)(FRA_OFF == fra_state && count < sweep_points ? count : sweep_points));
+  for(uint32_t k = 0; k < count; k++)
+  {
+    r = results + k;
+    hid_printf("%f %f %f %f %f %f\n", r->freq, r->ref_amp, r->enc_re, r->enc_im, r->out_re, r->out_im);
+  }
+}
@@ -0,0 +1,76 @@
+/* Frequency response analyzer
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __fra_h
+#define __fra_h
+
+#include "common.h"
+
+/********************************************************************************
+ * Frequency response analyzer
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Measures the controller's frequency response on the board, so tuning doesn't need the whole
+ *   history streamed to the PC. The "pb" path command runs a stepped-sine sweep: the path target becomes a
+ *   sine of amplitude ya around where it was, at yn frequencies spaced logarithmically from yl to yh Hz. Each
+ *   frequency runs ys cycles to settle and yc cycles to measure, and during the measurement the slow path
+ *   correlates the target, the encoder position and the controller output of every update against a single
+ *   DFT bin at that frequency. The number of updates measured is picked so the yc cycles fit exactly, which
+ *   moves each frequency a little off the log spacing; the frequency reported is the one measured.
+ *
+ *   Each point is reported ("gy") as the encoder and controller output responses relative to the target -
+ *   the closed-loop response, and the response from target to commanded velocity - as complex gains, along
+ *   with the target amplitude actually seen. The plant's response is their ratio. When the sweep is over
+ *   the path holds at its center.
+ *
+ *   The sweep is timed in control updates, using the control period it started with. Changing the path
+ *   mode stops it.
+ ********************************************************************************/
+
+// Constants ==========================================================================
+#define FRA_MAX_POINTS      64
+
+// one measured frequency
+typedef struct {
+  real freq;          // Hz
+  real ref_amp;       // amplitude of the target's sine (tics)
+  real enc_re;        // encoder position / target (tics/tic)
+  real enc_im;
+  real out_re;        // controller output / target ((tics/min)/tic)
+  real out_im;
+} fra_point_t;
+
+// Global Variables ====================================================================
+extern real fra_freq_low, fra_freq_high;    // parameters yl and yh (Hz)
+extern uint32_t fra_points;                 // yn
+extern real fra_amp;                        // ya (tics)
+extern uint32_t fra_cycles, fra_settle;     // yc and ys
+
+bool fra_start(real center, uint32_t period_us);
+bool fra_target(uint32_t elapsed, volatile real *target_pos, volatile real *target_vel);
+void fra_sample(uint32_t time, real target_pos, int32_t encpos, real ctrl_out);
+bool fra_idle(void);
+void fra_report(void);
+
+#endif
@@ -28,11 +28,13 @@
 #include "parameters.h"
 #include "control_isr.h"
 #include "parser.h"
+#include "../isrprof.h"
 #include <pin_config.h>
 //||\\!! TEMP
 //#include "../common.h"
 
 void portb_isr(void){
+  PROF_ISR(PROF_PORTB);
   if(SDA_CTRL & ISF){
     SDA_CTRL |= ISF;
     if (!(I2C0_S & I2C_S_BUSY)){
@@ -98,6 +100,7 @@ void portb_isr(void){
 }
 
 void pit2_isr(void){
+  PROF_ISR(PROF_PIT2);
   PIT_TFLG2 = 1;
   // Stop the timer...
   PIT_TCTRL2 &= ~TEN;
@@ -69,13 +69,14 @@ void configure_limit_gpio(uint32_t axis, imc_pullup_values value, uint32_t homin
 // This is dependent on the parameters structure being properly configured
 // before execution
 void reset_hardware(void){
-  STEPPER_DDR |= DISABLE_BIT | DIR_BIT | STEP_BIT;
+  STEPPER_DDR |= DISABLE_BIT | DIR_BIT;
+  STEP_DDR |= STEP_BIT;
   DISABLE_CTRL = STANDARD_OUTPUT;
   DIR_CTRL = STANDARD_OUTPUT;
   STEP_CTRL = STANDARD_OUTPUT;
   // Put stepper driver in a safe condition - todo: allow for inverting disable and step
   STEPPER_PORT(SOR) = DISABLE_BIT;
-  STEPPER_PORT(COR) = STEP_BIT;
+  STEP_PORT(COR) = STEP_BIT;
 
   // As much as I don't like leaving the pin floating, I have no idea what this should default to.
   configure_limit_gpio(0, IMC_PULLDOWN, parameters.homing);
@@ -104,14 +105,22 @@ void configure_nvic(void){
   }
   // control ISR
   NVIC_SET_PRIORITY(IRQ_PIT_CH3, 2<<4);       // this priority level is explicity used in spienc.c:read_spi()
+  NVIC_SET_PRIORITY(IRQ_SPI0, 2<<4);          // runs the control update when spienc.h:ENC_USE_DMA is defined
 
   // Limits/sync and pin toggle/reset isr get the highest priority
   NVIC_SET_PRIORITY(IRQ_PORTB, 0);
   NVIC_SET_PRIORITY(IRQ_PIT_CH1, 1<<4);
   // Followed by the main stepper isr
   NVIC_SET_PRIORITY(IRQ_PIT_CH0, 1<<4);
+#ifdef STEP_USE_FTM
+  NVIC_SET_PRIORITY(IRQ_DMA_CH4, 1<<4);       // carries the hardware step count (stepftm.c)
+#endif
   // Lastly, the sync reset/timeout isr and i2c communication
   NVIC_SET_PRIORITY(IRQ_I2C0, 2<<4);
   NVIC_SET_PRIORITY(IRQ_PIT_CH2, 2<<4);
+
+  // The deferred half of the control update (ctrl.c:software_isr) runs below everything else,
+  // including usb, so it can't hold off anything time-critical.
+  NVIC_SET_PRIORITY(IRQ_SOFTWARE, 4<<4);
 }
 
@@ -26,18 +26,32 @@
 #include <mk20dx128.h>
 #include "protocol/constants.h"
 #define hardware_h
-// All stepper control is placed on port c
+// uncomment the following define to generate step pulses in hardware with FTM0 instead of the pit0/pit1 interrupts
+// whenever the controller sets the step rate (see stepftm.c). The step output moves to pin 5 (PTD7, FTM0_CH7); the
+// PIT code, which still does the legacy IMC moves, counted moves and very slow rates, pulses the same pin.
+//#define STEP_USE_FTM
+
+// All stepper control is placed on port c (except the step pin with STEP_USE_FTM)
 #define STEPPER_PORT(reg) GPIOC_P##reg
 #define STEPPER_DDR GPIOC_PDDR
 // Pin 9  is stepper disable
 // Pin 22 is direction
-// Pin 15 is step
+// Pin 15 is step (pin 5 with STEP_USE_FTM)
 #define DISABLE_CTRL PORTC_PCR3
 #define DISABLE_BIT  (1<<3)
 #define DIR_CTRL PORTC_PCR1
 #define DIR_BIT  (1<<1)
+#ifdef STEP_USE_FTM
+#define STEP_PORT(reg) GPIOD_P##reg
+#define STEP_DDR  GPIOD_PDDR
+#define STEP_CTRL PORTD_PCR7
+#define STEP_BIT  (1<<7)
+#else
+#define STEP_PORT(reg) GPIOC_P##reg
+#define STEP_DDR  GPIOC_PDDR
 #define STEP_CTRL PORTC_PCR0
 #define STEP_BIT  1
+#endif
 
 // All input is placed on port b
 // Pin 16 is the global sync line
@@ -49,9 +49,9 @@ void set_homing_hooks(bool (*start_hook)(), void (*end_hook)())
 static int32_t untrigger_limit(uint32_t mask, uint32_t invert_mask, uint32_t speed){
   int32_t steps = 0;
   while((CONTROL_PORT(DIR) & mask) ^ invert_mask){
-    STEPPER_PORT(SOR) = STEP_BIT;
+    STEP_PORT(SOR) = STEP_BIT;
     delay_microseconds(PULSE_LENGTH);
-    STEPPER_PORT(COR) = STEP_BIT;
+    STEP_PORT(COR) = STEP_BIT;
     steps++;
     delay_microseconds(speed);
   }
@@ -61,9 +61,9 @@ static int32_t untrigger_limit(uint32_t mask, uint32_t invert_mask, uint32_t spe
 static int32_t trigger_limit(uint32_t mask, uint32_t invert_mask, uint32_t speed){
   int32_t steps = 0;
   while(!((CONTROL_PORT(DIR) & mask) ^ invert_mask)){
-    STEPPER_PORT(SOR) = STEP_BIT;
+    STEP_PORT(SOR) = STEP_BIT;
     delay_microseconds(PULSE_LENGTH);
-    STEPPER_PORT(COR) = STEP_BIT;
+    STEP_PORT(COR) = STEP_BIT;
     steps++;
     delay_microseconds(speed);
   }
@@ -71,9 +71,9 @@ static int32_t trigger_limit(uint32_t mask, uint32_t invert_mask, uint32_t speed
 }
 static void take_steps(uint32_t steps, uint32_t speed){
   while(steps-- > 0){
-    STEPPER_PORT(SOR) = STEP_BIT;
+    STEP_PORT(SOR) = STEP_BIT;
     delay_microseconds(PULSE_LENGTH);
-    STEPPER_PORT(COR) = STEP_BIT;
+    STEP_PORT(COR) = STEP_BIT;
     delay_microseconds(speed);
   }
 }
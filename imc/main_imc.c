@@ -33,6 +33,7 @@
 #include "config.h"
 #include "peripheral.h"
 #include "homing.h"
+#include "utils.h"
 #include <usb_serial.h>
 #include <mk20dx128.h>
 #include <pin_config.h>
@@ -52,43 +53,34 @@ void imc_init(void){
 }
 
 // used to be while(1) in main()
-void imc_idle(void)
+// Moves are queued (and answered) by the i2c isr as they arrive; everything else, and moves that arrived behind
+// it, waits in parser.ring for us. Returns true if there was anything to do.
+bool imc_idle(void)
 {
-  if(parser.status == PARSER_ERR){
-    send_response(IMC_RSP_UNKNOWN,0);
-    initialize_parser();
-    return;
-  }
-  if(parser.status == PARSER_NEW_EVENT){
-    switch(parser.packet_type){
+  volatile parser_msg_t* msg;
+  bool busy = false;
+
+  while(parser.ring_tail != parser.ring_head){
+    msg = &parser.ring[parser.ring_tail & PARSER_RING_MASK];
+    switch(msg->packet_type){
     case IMC_MSG_INITIALIZE:
       initialize_motion_queue();
-      initialize_parser();
       // Unlike out first initialization round, don't reset parameters
       initialize_stepper_state();
       float_sync_line();
       response.init.slave_hw_ver = 0;
       response.init.slave_fw_ver = 0;
       response.init.queue_depth = MOTION_QUEUE_LENGTH;
-      send_response(IMC_RSP_OK,sizeof(rsp_initialize_t));
+      send_response(IMC_RSP_OK,&response,sizeof(rsp_initialize_t));
       break;
     case IMC_MSG_GETPARAM:
-      handle_get_parameter(&parser.packet.get_param, &response.param);
-      send_response(IMC_RSP_OK,sizeof(rsp_get_param_t));
+      handle_get_parameter(&msg->packet.get_param, &response.param);
+      send_response(IMC_RSP_OK,&response,sizeof(rsp_get_param_t));
       break;
     case IMC_MSG_SETPARAM:
-      handle_set_parameter(&parser.packet.set_param);
-      send_response(IMC_RSP_OK,0);
+      handle_set_parameter(&msg->packet.set_param);
+      send_response(IMC_RSP_OK,NULL,0);
       break;	
-    case IMC_MSG_QUEUEMOVE:
-      {
-        int space = enqueue_block(&parser.packet.move);
-        send_response(space < 0 ? IMC_RSP_QUEUEFULL : IMC_RSP_OK,0);
-        // If we're adding moves in idle state, make sure that the sync interface is listening
-        if(st.state == STATE_IDLE)
-          enable_sync_interrupt();
-      }
-      break;
     case IMC_MSG_STATUS:
       response.status.queued_moves = queue_length();
       if(st.state == STATE_ERROR){
@@ -96,15 +88,44 @@ void imc_idle(void)
       }else{
         response.status.status = IMC_ERR_NONE;
       }
-      send_response(IMC_RSP_OK,sizeof(rsp_status_t));
+      send_response(IMC_RSP_OK,&response,sizeof(rsp_status_t));
       break;
     case IMC_MSG_HOME:
       enter_homing_routine();
       break;
+    case IMC_MSG_QUEUEMOVE:
+      // (the i2c isr leaves the queue alone until the ring is empty, so it can't reserve this slot too)
+      {
+        msg_queue_move_t* slot = reserve_block();
+        if(slot){
+          vmemcpy(slot, &msg->packet.move, sizeof(msg_queue_move_t));
+          commit_block();
+          parser.moves_queued = 1;
+          send_response(IMC_RSP_OK,NULL,0);
+        }else{
+          send_response(IMC_RSP_QUEUEFULL,NULL,0);
+        }
+      }
+      break;
+    case IMC_MSG_QUEUEMOVES:
+      queue_moves((const parser_moves_t*) &msg->packet.moves, &response);
+      break;
     case IMC_MSG_QUICKSTOP:
-      send_response(IMC_RSP_ERROR,0);
+      send_response(IMC_RSP_ERROR,NULL,0);
+      break;
+    default:
       break;
     }
-    initialize_parser();
+    parser.ring_tail++;
+    busy = true;
+  }
+
+  // If moves were added in idle state, make sure that the sync interface is listening
+  if(parser.moves_queued){
+    parser.moves_queued = 0;
+    if(st.state == STATE_IDLE)
+      enable_sync_interrupt();
+    busy = true;
   }
+  return busy;
 }
@@ -25,7 +25,9 @@
 #ifndef main_imc_h
 #define main_imc_h
 
+#include <stdbool.h>
+
 void imc_init(void);
-void imc_idle(void);
+bool imc_idle(void);
 
 #endif
\ No newline at end of file
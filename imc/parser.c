@@ -25,12 +25,15 @@
 #include "protocol/message_structs.h"
 #include "protocol/constants.h"
 #include "parser.h"
+#include "queue.h"
 #include "utils.h"
 #include "hardware.h"
+#include "../isrprof.h"
 
 #include <usb_serial.h>
 #include <pin_config.h>
 #include <mk20dx128.h>
+#include <string.h>
 
 uint8_t txBuffer[BUFFER_LENGTH];
 volatile uint32_t txBufferLength;
@@ -39,6 +42,7 @@ volatile uint32_t irqcount;
 
 volatile parser_state_t parser;
 generic_response response;
+static generic_response isr_response;   // replies built in the i2c isr, which may preempt imc_idle building one
 
 void initialize_i2c(uint8_t addr){
   SIM_SCGC4 |= SIM_SCGC4_I2C0;
@@ -61,27 +65,92 @@ void initialize_i2c(uint8_t addr){
 
 void initialize_parser(void){
   parser.status = PARSER_EMPTY;
+  parser.big_packet = 0;
   parser.packet_type = 0; // 0 is guaranteed to not be a packet type byte
-  parser.head = (uint8_t*) &parser.packet;
-  vmemset(&parser.packet, 0, sizeof(parser.packet));
+  parser.remaining = 0;
+  parser.slot = NULL;
+  parser.moves = NULL;
+  parser.deferred = 0;
+  parser.ring_head = parser.ring_tail = 0;
+  parser.moves_queued = 0;
 }
 
-void feed_data(uint8_t input){
-  if(parser.status == PARSER_NEW_EVENT || parser.status == PARSER_ERR){
-    // Haven't dealt with the event soon enough, and we have no queue,
-    // so this is an error. I2C shouldn't be prone to this, however
-    parser.status = PARSER_ERR; 
-    return;
+// Rejects the message being received. The rest of it is ignored.
+static void parser_error(void){
+  parser.status = PARSER_ERR;
+  parser.big_packet = 0;
+  send_response(IMC_RSP_UNKNOWN,NULL,0);
+}
+
+// Unpacks a Queue Moves message into motion queue slots, and replies with rsp, which needs to be the
+// caller's own. Moves after the first one that doesn't fit (or doesn't decode) are dropped; the response
+// tells the master how many made it.
+void queue_moves(const parser_moves_t* moves, generic_response* rsp){
+  const uint8_t* data = (const uint8_t*) moves->data;
+  const uint8_t* end = data + moves->head.length;
+  msg_queue_move_t prev, *slot;
+  uint32_t queued = 0;
+  imc_response_type status = IMC_RSP_OK;
+
+  memset(&prev, 0, sizeof(prev));
+  for(; queued < moves->head.count; queued++){
+    slot = reserve_block();
+    if(slot == NULL){
+      status = IMC_RSP_QUEUEFULL;
+      break;
+    }
+    if(imc_decode_move(&data, end, &prev, slot)){
+      status = IMC_RSP_ERROR;
+      break;
+    }
+    memcpy(&prev, slot, sizeof(prev));
+    commit_block();
   }
+  if(queued > 0)
+    parser.moves_queued = 1;
+  rsp->moves.queued = queued;
+  rsp->moves.queued_moves = queue_length();
+  send_response(status, rsp, sizeof(rsp_queue_moves_t));
+}
+
+// Called from the i2c isr with each byte received. Moves are parsed straight into a reserved motion
+// queue slot and committed (and answered) here once the checksum checks out; everything else is
+// checked here and handed to imc_idle through parser.ring. Nothing waits on imc_idle, so a late main
+// loop can't make us drop a message unless the ring fills up. Moves that arrive while earlier messages
+// are still in the ring go through the ring too, so an Initialize can't wipe out moves sent after it and
+// moves can't start before a Set Parameter or Home sent ahead of them.
+void feed_data(uint8_t input){
+  if(parser.status == PARSER_ERR)
+    return;   // ignore the rest of a bad message
   if(0 == parser.packet_type){
     imc_message_type type = (imc_message_type) input;
-    if(type < IMC_MSG_INITIALIZE || IMC_MSG_QUICKSTOP < type){ // First and last members of imc_message_type
-      parser.status = PARSER_ERR;
+    if(type < IMC_MSG_INITIALIZE || IMC_MSG_QUEUEMOVES < type){ // First and last members of imc_message_type
+      parser_error();
       return;
     }
     parser.packet_type = type;
+    parser.sum = type;
     parser.remaining = imc_message_length[type] + 1; // Include an extra for the checksum
-    parser.head = (uint8_t*) &parser.packet;
+    parser.slot = NULL;
+    parser.deferred = (type != IMC_MSG_QUEUEMOVE && type != IMC_MSG_QUEUEMOVES) || parser.ring_head != parser.ring_tail;
+    if(parser.deferred){
+      volatile parser_msg_t* msg = &parser.ring[parser.ring_head & PARSER_RING_MASK];
+      if(parser.ring_head - parser.ring_tail >= PARSER_RING_LENGTH){
+        // imc_idle hasn't kept up at all
+        parser_error();
+        return;
+      }
+      msg->packet_type = type;
+      parser.head = (uint8_t*) &msg->packet;
+      parser.moves = (parser_moves_t*) &msg->packet.moves;
+    }else if(type == IMC_MSG_QUEUEMOVE){
+      // If the queue is full, collect the move anyway so we can answer once it's all in.
+      parser.slot = reserve_block();
+      parser.head = parser.slot ? (uint8_t*) parser.slot : (uint8_t*) &parser.scratch.move;
+    }else{
+      parser.moves = (parser_moves_t*) &parser.scratch.moves;
+      parser.head = (uint8_t*) parser.moves;
+    }
 
     if(parser.remaining > PROTOCOL_MAX_TRANSMIT_SIZE){
       parser.big_packet = 1;
@@ -89,52 +158,78 @@ void feed_data(uint8_t input){
     
     return;
   }
-  if(parser.remaining-- > 0){
+  if(parser.remaining == 0)
+    return;   // extra bytes after a complete message
+  if(parser.remaining > 1){
     //   usb_serial_putchar(input + 'a');
     *parser.head++ = input;
-  }
-  // If we've finished an entire packet, signal that
-  if(parser.remaining == 0){
-    //   usb_serial_putchar('D');
-    uint8_t sum = parser.packet_type; 
-    uint32_t size = imc_message_length[sum];
-    uint32_t i;
-    for(i = 0; i < size; i++){
-      //   usb_serial_putchar(((uint8_t*) &parser.packet)[i] + 'a');
-      sum ^= ((uint8_t*) &parser.packet)[i];
+    parser.sum ^= input;
+    parser.remaining--;
+    // Queue Moves messages are variable-length; once we have the header, we know how much more is coming.
+    if(parser.packet_type == IMC_MSG_QUEUEMOVES && parser.head == parser.moves->data){
+      if(parser.moves->head.length > IMC_QUEUEMOVES_MAX_DATA){
+        parser_error();
+        return;
+      }
+      parser.remaining += parser.moves->head.length;
+      if(parser.remaining + sizeof(msg_queue_moves_t) > PROTOCOL_MAX_TRANSMIT_SIZE){
+        parser.big_packet = 1;
+      }
     }
+    return;
+  }
 
-    // usb_serial_putchar('0' + size);
-      
-    if(sum == (((uint8_t*) &parser.packet)[size])){
-      //   usb_serial_putchar('K');
-      parser.status = PARSER_NEW_EVENT;
+  // This is the checksum; the whole packet is in.
+  parser.remaining = 0;
+  parser.big_packet = 0;
+  if(input != parser.sum){
+    parser_error();
+    return;
+  }
+  if(parser.deferred){
+    parser.ring_head++;   // hand it to imc_idle
+    return;
+  }
+  switch(parser.packet_type){
+  case IMC_MSG_QUEUEMOVE:
+    if(parser.slot){
+      commit_block();
+      parser.moves_queued = 1;
+      send_response(IMC_RSP_OK,NULL,0);
     }else{
-      //     usb_serial_putchar('E');
-    
-      parser.status = PARSER_ERR;
+      send_response(IMC_RSP_QUEUEFULL,NULL,0);
     }
+    break;
+  case IMC_MSG_QUEUEMOVES:
+    queue_moves(parser.moves, &isr_response);
+    break;
+  default:
+    break;
   }
 }
 
-void send_response(imc_response_type status,uint32_t size){
+// Called from both imc_idle and the i2c isr, so the buffer is built with interrupts off.
+void send_response(imc_response_type status,const void* body,uint32_t size){
   uint8_t checksum = status;
-  uint32_t i;
+  uint32_t i, primask;
+  primask = irq_save();
   txBufferLength = size+2;
   txBuffer[0] = status;
 
   for(i = 0; i < size; i++){
-    uint8_t byte = ((uint8_t*) &response)[i];
+    uint8_t byte = ((const uint8_t*) body)[i];
     checksum ^= byte;
     txBuffer[i+1] = byte;
   }
   txBuffer[size+1] = checksum;
+  irq_restore(primask);
 }
 
 void i2c0_isr(void)
 {
   uint8_t status, c1, data;
   static uint8_t receiving=0;
+  PROF_ISR(PROF_I2C0);
 
   I2C0_S = I2C_S_IICIF;
   status = I2C0_S;
@@ -158,12 +253,13 @@ void i2c0_isr(void)
       // What is this byte? I should run a test.
       data = I2C0_D;
       if(parser.big_packet){
-	parser.big_packet = 0; // We're in the second transmision of a big packet, so we don't reinitialize the parser.
+	// We're in a later transmission of a big packet, so we don't reinitialize the parser. feed_data
+	// clears big_packet once the whole packet is in.
       }else{
-	// Reset the parser state, but don't really bother to memset the data buffer
+	// Reset the parser state for a new message. The ring is left alone; imc_idle may not have got to it yet.
 	parser.status = PARSER_EMPTY;
 	parser.packet_type = 0; // 0 is guaranteed to not be a packet type
-	parser.head = (uint8_t*) &parser.packet;
+	parser.remaining = 0;
       }
     }
     I2C0_S = I2C_S_IICIF;
@@ -31,29 +31,57 @@
 #define BUFFER_LENGTH 32
 void initialize_i2c(uint8_t);
 
-#define PARSER_NEW_EVENT 0
 #define PARSER_EMPTY 1
 #define PARSER_ERR 2
 
+#define PARSER_RING_LENGTH 8     // messages waiting for imc_idle. Needs to be a power of 2.
+#define PARSER_RING_MASK 0x7
+
+// body of a Queue Moves message
+typedef struct {
+  msg_queue_moves_t head;
+  uint8_t data[IMC_QUEUEMOVES_MAX_DATA];
+} __attribute__ ((packed)) parser_moves_t;
+
+// A message waiting for imc_idle. Moves only come through here when they arrive behind other messages
+// imc_idle hasn't handled yet, so they take effect in order; otherwise the i2c isr puts them straight into the
+// motion queue.
 typedef struct {
-  uint32_t status;
-  uint32_t big_packet;
   imc_message_type packet_type;
-  uint32_t remaining;
-  uint8_t* head;
   union {
     msg_initialize_t init;
-    msg_queue_move_t move;    
     msg_get_param_t get_param;
     msg_set_param_t set_param;
-    uint8_t pad[sizeof(msg_queue_move_t) + 1];
+    msg_queue_move_t move;
+    parser_moves_t moves;
   } packet;
+} parser_msg_t;
+
+typedef struct {
+  uint32_t status;            // PARSER_ERR after a bad message, until the next transmission starts
+  uint32_t big_packet;        // set while a message is split across transmissions
+  imc_message_type packet_type;
+  uint32_t remaining;         // body bytes still to come, plus the checksum
+  uint8_t sum;                // running checksum
+  uint8_t* head;              // where the next body byte goes
+  uint32_t deferred;          // the message goes through the ring to imc_idle
+  msg_queue_move_t* slot;     // motion queue slot a Queue Move is going into, or NULL if the queue is full
+  parser_moves_t* moves;      // where a Queue Moves body is going (scratch, or a ring entry)
+  union {                     // bodies the isr handles itself that don't go straight into the queue
+    msg_queue_move_t move;    // (a Queue Move that didn't fit)
+    parser_moves_t moves;
+  } scratch;
+  parser_msg_t ring[PARSER_RING_LENGTH];
+  uint32_t ring_head;         // written only by the i2c isr
+  uint32_t ring_tail;         // written only by imc_idle
+  uint32_t moves_queued;      // set by the isr when it queues moves, cleared by imc_idle
 } parser_state_t;
 
 typedef union {
   rsp_initialize_t init;
   rsp_status_t status;
   rsp_get_param_t param;
+  rsp_queue_moves_t moves;
 } generic_response;
 
 extern volatile parser_state_t parser;
@@ -61,9 +89,11 @@ extern volatile parser_state_t parser;
 void initialize_parser(void);
 void feed_data(uint8_t);
 
+// imc_idle's reply. The i2c isr builds its own replies separately.
 extern generic_response response;
-// Response type, and number of bytes of response to write
-void send_response(imc_response_type,uint32_t);
+// Response type, the response body, and its length
+void send_response(imc_response_type,const void*,uint32_t);
+void queue_moves(const parser_moves_t*,generic_response*);
 
 extern volatile uint8_t* txHead;
 extern volatile uint32_t txRemaining;
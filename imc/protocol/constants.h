@@ -14,7 +14,8 @@ typedef enum {
   IMC_MSG_QUEUEMOVE = 4,
   IMC_MSG_GETPARAM = 5,
   IMC_MSG_SETPARAM = 6,
-  IMC_MSG_QUICKSTOP = 7
+  IMC_MSG_QUICKSTOP = 7,
+  IMC_MSG_QUEUEMOVES = 8
   // FUTURE: IMC_MSG_BABYSTEP
 } __attribute__ ((packed)) imc_message_type;
 
@@ -1,9 +1,44 @@
 #include "message_structs.h"
+#include <string.h>
   
 const uint8_t imc_message_length[IMC_MESSAGE_TYPE_COUNT + 1] = {0, sizeof(msg_initialize_t), 
                               0/*sizeof(msg_status_t)*/, 0/*sizeof(msg_home_t)*/, sizeof(msg_queue_move_t), 
-                              sizeof(msg_get_param_t), sizeof(msg_set_param_t), 0};
+                              sizeof(msg_get_param_t), sizeof(msg_set_param_t), 0, sizeof(msg_queue_moves_t)};
 
 const uint8_t imc_resp_length[IMC_MESSAGE_TYPE_COUNT + 1] = {0, sizeof(rsp_initialize_t), 
 			      sizeof(rsp_status_t), 0, 0/*sizeof(rsp_queue_move_t)*/,
-                              sizeof(rsp_get_param_t), 0/*sizeof(rsp_set_param_t)*/, 0};
+                              sizeof(rsp_get_param_t), 0/*sizeof(rsp_set_param_t)*/, 0, sizeof(rsp_queue_moves_t)};
+
+// Queue Moves encoding: each move is its eight msg_queue_move_t fields in order, each sent as the difference
+// from the same field of the previous move in the message (the first move is relative to all zeros). The
+// difference (mod 2^32) is zigzag-mapped so small negative numbers stay small, then sent as a varint: 7 bits
+// per byte, least significant first, high bit set on every byte but the last.
+
+// reads one varint from *data (not past end) into *value. Returns 0 on success, -1 if the data ran out.
+static int decode_varint(const uint8_t **data, const uint8_t *end, uint32_t *value){
+  uint32_t shift = 0;
+  uint8_t byte;
+  *value = 0;
+  do{
+    if(*data >= end || shift > 28)
+      return -1;
+    byte = *(*data)++;
+    *value |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  }while(byte & 0x80);
+  return 0;
+}
+
+// decodes the next move at *data (not past end) into move, relative to prev. *data is advanced past the
+// move. Returns 0 on success, -1 if the data ran out.
+int imc_decode_move(const uint8_t **data, const uint8_t *end, const msg_queue_move_t *prev, msg_queue_move_t *move){
+  uint32_t zz, field, i;
+  for(i = 0; i < sizeof(msg_queue_move_t); i += sizeof(uint32_t)){
+    if(decode_varint(data, end, &zz))
+      return -1;
+    memcpy(&field, (const uint8_t *)prev + i, sizeof(uint32_t));   // the structs are packed; don't assume alignment
+    field += (zz >> 1) ^ -(zz & 1);   // undo the zigzag
+    memcpy((uint8_t *)move + i, &field, sizeof(uint32_t));
+  }
+  return 0;
+}
@@ -33,6 +33,14 @@ typedef struct { // Assume we don't have to pad this on 32-bit systems
   uint32_t start_decelerating;
 } __attribute__ ((packed)) msg_queue_move_t;
 
+// Queue Moves: header of a message carrying several moves. length bytes of encoded moves follow the
+// header (see imc_decode_move and description.md); the checksum comes after them.
+#define IMC_QUEUEMOVES_MAX_DATA 120
+typedef struct {
+  uint8_t length;       // bytes of encoded moves following this header
+  uint8_t count;        // number of moves encoded
+} __attribute__ ((packed)) msg_queue_moves_t;
+
 typedef struct {
   uint8_t param_id;
 } __attribute__ ((packed)) msg_get_param_t;
@@ -62,6 +70,11 @@ typedef struct {
 //typedef struct __attribute__ ((__packed__)){
 //} __attribute__ ((packed)) rsp_queue_move_t;
 
+typedef struct {
+  uint8_t queued;           // number of moves (from the start of the message) that made it into the queue
+  uint16_t queued_moves;    // moves in the queue afterward
+} __attribute__ ((packed)) rsp_queue_moves_t;
+
 typedef struct {
   uint32_t value;
 } __attribute__ ((packed)) rsp_get_param_t;
@@ -70,10 +83,12 @@ typedef struct {
 //} __attribute__ ((packed)) rsp_set_param_t;
 
 
-#define IMC_MESSAGE_TYPE_COUNT 7
+#define IMC_MESSAGE_TYPE_COUNT 8
 extern const uint8_t imc_message_length[IMC_MESSAGE_TYPE_COUNT + 1]; 
 extern const uint8_t imc_resp_length[IMC_MESSAGE_TYPE_COUNT + 1];
 
+int imc_decode_move(const uint8_t **data, const uint8_t *end, const msg_queue_move_t *prev, msg_queue_move_t *move);
+
 #endif
 
 
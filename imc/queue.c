@@ -26,6 +26,7 @@
 #include "queue.h"
 #include "utils.h"
 #include <string.h>
+#include <mk20dx128.h>
 
 static msg_queue_move_t motion_queue[MOTION_QUEUE_LENGTH];
 static volatile uint32_t queue_head;
@@ -37,12 +38,32 @@ void initialize_motion_queue(void){
 }
 
 int enqueue_block(volatile msg_queue_move_t* src){
-  if(queue_size == MOTION_QUEUE_LENGTH)
+  msg_queue_move_t* slot = reserve_block();
+  if(slot == NULL)
     return -1;
-  uint32_t offset = (queue_head + queue_size) & MOTION_QUEUE_MASK;
-  vmemcpy(&(motion_queue[offset]), src, sizeof(msg_queue_move_t));
+  vmemcpy(slot, src, sizeof(msg_queue_move_t));
+  return commit_block();
+}
+
+// Returns the slot the next block will be queued in, so it can be filled in place, or NULL if the
+// queue is full. The block isn't visible to dequeue_block until commit_block is called; calling
+// reserve_block again before then returns the same slot.
+msg_queue_move_t* reserve_block(void){
+  if(queue_size == MOTION_QUEUE_LENGTH)
+    return NULL;
+  return &(motion_queue[(queue_head + queue_size) & MOTION_QUEUE_MASK]);
+}
+
+// Queues the block filled in through reserve_block. Returns the space left in the queue.
+int commit_block(void){
+  // dequeue_block runs from the sync interrupt; don't let it change queue_size under us. (We're called
+  // from the i2c isr too, and from code that already has interrupts off.)
+  uint32_t primask = irq_save();
+  uint32_t room;
   queue_size++;
-  return MOTION_QUEUE_LENGTH - queue_size;
+  room = MOTION_QUEUE_LENGTH - queue_size;
+  irq_restore(primask);
+  return room;
 }
 
 msg_queue_move_t* dequeue_block(void){
@@ -55,6 +76,26 @@ msg_queue_move_t* dequeue_block(void){
   return ret;
 }
 
+// Returns the nth block waiting in the queue (0 = the next one dequeue_block will return) without
+// removing it, or NULL if fewer than n+1 blocks are queued. Blocks don't move once queued, so the
+// pointer stays good until that block has been dequeued and executed.
+const msg_queue_move_t* peek_block(uint32_t n){
+  uint32_t head, size;
+  // dequeue_block runs from the sync interrupt; get a matching head and size
+  uint32_t primask = irq_save();
+  head = queue_head;
+  size = queue_size;
+  irq_restore(primask);
+  if(n >= size)
+    return NULL;
+  return &(motion_queue[(head + n) & MOTION_QUEUE_MASK]);
+}
+
+// Returns true if block is one of the queue's slots (as opposed to a move held somewhere else).
+bool queue_owns(volatile const msg_queue_move_t *block){
+  return block >= motion_queue && block < motion_queue + MOTION_QUEUE_LENGTH;
+}
+
 uint32_t queue_length(void){
   return queue_size;
 }
@@ -25,17 +25,32 @@
 #ifndef queue_h
 #define queue_h
 #include <stdint.h>
+#include <stdbool.h>
 #include "protocol/message_structs.h"
 
-#define MOTION_QUEUE_LENGTH 16
-#define MOTION_QUEUE_MASK 0xF
+// Number of moves the queue holds (32 bytes each). Set from the Makefile; needs to be a power of 2.
+// The IMC protocol reports queue depth and queued moves as uint16, so keep it below 65536.
+#ifndef MOTION_QUEUE_LENGTH
+#define MOTION_QUEUE_LENGTH 256
+#endif
+#define MOTION_QUEUE_MASK (MOTION_QUEUE_LENGTH - 1)
+
+#if (MOTION_QUEUE_LENGTH & MOTION_QUEUE_MASK) || MOTION_QUEUE_LENGTH > 32768
+#error "MOTION_QUEUE_LENGTH must be a power of 2, no more than 32768"
+#endif
 
 void initialize_motion_queue(void);
 
 int enqueue_block(volatile msg_queue_move_t*);
 
+msg_queue_move_t* reserve_block(void);
+int commit_block(void);
+
 msg_queue_move_t*  dequeue_block(void);
 
+const msg_queue_move_t* peek_block(uint32_t n);
+bool queue_owns(volatile const msg_queue_move_t *block);
+
 uint32_t queue_length(void);
 
 #endif
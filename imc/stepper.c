@@ -34,6 +34,8 @@
 #include "config.h"
 #include "stepper.h"
 #include "utils.h"
+#include "../isrprof.h"
+#include "../stepftm.h"
 //||\\!! temp
 //#include "../common.h"
 
@@ -125,7 +127,7 @@ inline static uint32_t iterate_trapezoid_cycle_counter()
 }          
 
 // changed this routine to public for control access
-uint32_t config_step_timer(uint32_t cycles)
+FASTRUN uint32_t config_step_timer(uint32_t cycles)
 {
 
   PIT_TCTRL0 &= ~TEN; // Stop the timer 
@@ -144,11 +146,18 @@ static void set_step_events_per_minute(uint32_t steps_per_minute)
 }
 
 // new routine to allow module-level access to direction
-void set_direction(bool backwards)
+FASTRUN void set_direction(bool backwards)
 {
+#ifdef STEP_USE_FTM
+  // steps the FTM has already put out were taken the old way; count them before turning around.
+  uint32_t sc = ((uint32_t)backwards != out_dir) ? stepftm_hold() : 0;
+#endif
 	out_dir = (uint32_t)backwards;
   // set the direction NOW. Needed for bang-bang control.
   STEPPER_PORT(DOR) = (STEPPER_PORT(DOR) & ~DIR_BIT) | (out_dir ? DIR_BIT : 0);
+#ifdef STEP_USE_FTM
+  stepftm_resume(sc);
+#endif
 }
 bool get_direction(void)
 {
@@ -169,7 +178,9 @@ void enter_sync_state(void)
 }
 
 
-void pit0_isr(void) {
+FASTRUN void pit0_isr(void) {
+  PROF_ISR(PROF_PIT0);
+
   // Set the direction bits. Todo: only do this at the start of a block.
   STEPPER_PORT(DOR) = (STEPPER_PORT(DOR) & ~DIR_BIT) | (out_dir ? DIR_BIT : 0);
 
@@ -285,7 +296,7 @@ inline void trigger_pulse(void){
   pit1_state.step_interrupt_status = PULSE_SET;
   PIT_LDVAL1 = STEP_PULSE_DELAY;
 #else
-  STEPPER_PORT(TOR) = STEP_BIT;
+  STEP_PORT(TOR) = STEP_BIT;
   PIT_LDVAL1 = pit1_state.pulse_length;
 #endif
   PIT_TCTRL1 |= TEN;
@@ -293,10 +304,11 @@ inline void trigger_pulse(void){
     else { st.position++; }
 }
 
-void pit1_isr(void){
+FASTRUN void pit1_isr(void){
+  PROF_ISR(PROF_PIT1);
   PIT_TFLG1 = 1;
   PIT_TCTRL1 &= ~TEN;
-  STEPPER_PORT(COR) = STEP_BIT;   // was TOR; changed for reliability
+  STEP_PORT(COR) = STEP_BIT;   // was TOR; changed for reliability
 #ifdef STEP_PULSE_DELAY
   if(pit1_state.step_interrupt_status == PULSE_SET){
     pit1_state.step_interrupt_status = PULSE_RESET;
@@ -343,12 +355,21 @@ void execute_move(void){
 // Immediately kill all motion, probably killing position due to deceleration
 void stop_motion(void){
   PIT_TCTRL0 &= ~TEN;
+#ifdef STEP_USE_FTM
+  stepftm_stop();
+#endif
 }
 
 // name changed from get_position() to avoid confusion with encoder position
-int32_t get_motor_position(void){
+FASTRUN int32_t get_motor_position(void){
+#ifdef STEP_USE_FTM
+  stepftm_sync();
+#endif
   return st.position;
 }
 void set_motor_position(uint32_t p){
+#ifdef STEP_USE_FTM
+  stepftm_sync();   // so steps already counted aren't added on top of the new position
+#endif
   st.position = p;
 }
@@ -27,6 +27,44 @@
 #define utils_h
 
 #include <stdint.h>
+
+// Puts a function in RAM, where it runs without flash wait states: the .fastrun section goes at the start of .data
+// (see mk20dx256.ld), so the startup code copies it into SRAM_L with the initialized variables. Used on the step and
+// control interrupts and what they call on every update. make FASTRUN=0 leaves everything in flash.
+#ifndef NO_FASTRUN
+#define FASTRUN __attribute__ ((section(".fastrun"), noinline, noclone))
+#else
+#define FASTRUN
+#endif
+
+// Interrupt masking that nests: irq_save turns interrupts off and returns whether they already were, and
+// irq_restore puts them back the way irq_save found them. Use these where the caller may already have
+// interrupts off (an isr, or code run from one).
+#ifndef SIM_HOST
+static inline uint32_t irq_save(void){
+  uint32_t primask;
+  asm volatile("mrs %0, primask\n\
+                cpsid i" : "=r" (primask) :: "memory");
+  return primask;
+}
+static inline void irq_restore(uint32_t primask){
+  if(!primask)
+    asm volatile("cpsie i" ::: "memory");
+}
+#else
+// host build (make sim): the simulated NVIC keeps PRIMASK (sim/sim.c)
+#include <mk20dx128.h>
+static inline uint32_t irq_save(void){
+  uint32_t primask = sim_get_primask();
+  sim_set_primask(1);
+  return primask;
+}
+static inline void irq_restore(uint32_t primask){
+  if(!primask)
+    sim_set_primask(0);
+}
+#endif
+
 void vmemset(volatile void *,uint8_t,uint32_t
 );
 // memcopy from a volatile dest
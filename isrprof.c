@@ -0,0 +1,181 @@
+/********************************************************************************
+ * Interrupt load profiler
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Per-handler CPU accounting. See isrprof.h.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include "isrprof.h"
+#include "imc/utils.h"
+
+#ifdef ISR_PROFILE
+
+// Vector Table Offset Register (not in this version of mk20dx128.h)
+#ifndef SCB_VTOR
+#define SCB_VTOR                  (*(volatile uint32_t *)0xE000ED08)
+#endif
+
+// Constants ==========================================================================
+#define PROF_VECTOR_COUNT         (NVIC_NUM_INTERRUPTS + 16)
+
+static const char * const prof_names[PROF_COUNT] = {
+  [PROF_MAIN]     = "main",
+  [PROF_PIT0]     = "pit0",
+  [PROF_PIT1]     = "pit1",
+  [PROF_PIT2]     = "pit2",
+  [PROF_PIT3]     = "pit3",
+  [PROF_PORTB]    = "portb",
+  [PROF_I2C0]     = "i2c0",
+  [PROF_SPI0]     = "spi0",
+  [PROF_USB]      = "usb",
+  [PROF_SYSTICK]  = "systick",
+  [PROF_SOFTWARE] = "software",
+  [PROF_STEPDMA]  = "stepdma",
+};
+
+// Global Variables ====================================================================
+volatile uint64_t prof_cycles[PROF_COUNT];
+volatile uint32_t prof_count[PROF_COUNT];
+volatile uint32_t prof_mark = 0;
+volatile uint32_t prof_cur = PROF_MAIN;
+
+extern void (* const gVectors[])(void);     // flash vector table, mk20dx128.c
+
+// Local Variables ===================================================================
+// usb_isr lives in the Teensy core, so rather than edit it, it's reached through a copy of the vector
+// table in RAM with its entry pointing at prof_usb_isr. VTOR needs the table aligned to its size
+// rounded up to a power of two.
+static void (*prof_vectors[PROF_VECTOR_COUNT])(void) __attribute__ ((aligned(512)));
+static uint64_t prof_start;           // time_cycles() at the last reset
+static uint32_t loop_mark;            // CYCCNT at the start of the current main loop pass
+static uint32_t loop_count;           // main loop passes since the last reset
+static uint32_t loop_max;             // longest main loop pass (cycles, including interrupts)
+static uint64_t loop_main;            // prof_cycles[PROF_MAIN] at the start of the current pass
+static uint64_t idle_cycles;          // main loop cycles spent in passes that did no work
+static uint32_t idle_count;           // passes that did no work
+
+// Function Predeclares ======================================================
+void usb_isr(void);
+static void prof_usb_isr(void);
+
+
+// Moves the vector table to RAM (to reach usb_isr) and starts counting. Call after time_init(), and
+// before interrupts are enabled if every handler's first run should be counted.
+void prof_init(void)
+{
+  memcpy(prof_vectors, gVectors, sizeof(prof_vectors));
+  prof_vectors[IRQ_USBOTG + 16] = prof_usb_isr;
+  __disable_irq();
+  SCB_VTOR = (uint32_t)prof_vectors;
+  __enable_irq();
+  prof_reset();
+}
+
+// zeros every counter and starts a new measurement window.
+void prof_reset(void)
+{
+  __disable_irq();
+  for(uint32_t i = 0; i < PROF_COUNT; i++)
+  {
+    prof_cycles[i] = 0;
+    prof_count[i] = 0;
+  }
+  prof_mark = ARM_DWT_CYCCNT;
+  loop_mark = prof_mark;
+  loop_count = 0;
+  loop_max = 0;
+  loop_main = 0;
+  idle_cycles = 0;
+  idle_count = 0;
+  prof_start = time_cycles();
+  __enable_irq();
+}
+
+// Called once per main loop pass, with whether the pass that just ended did any work. Tracks the longest
+// pass, which is the worst-case wait for anything the main loop services (USB commands, streaming, the IMC
+// idle work), and charges the main loop time of passes that did nothing to idle.
+void prof_loop(bool busy)
+{
+  uint64_t main_cycles;
+  uint32_t now;
+
+  __disable_irq();
+  now = ARM_DWT_CYCCNT;
+  prof_cycles[prof_cur] += now - prof_mark;
+  prof_mark = now;
+  main_cycles = prof_cycles[PROF_MAIN];
+  __enable_irq();
+
+  if(!busy)
+  {
+    idle_cycles += main_cycles - loop_main;
+    idle_count++;
+  }
+  loop_main = main_cycles;
+  loop_max = max(loop_max, now - loop_mark);
+  loop_mark = now;
+  loop_count++;
+}
+
+// Prints one line per context: name, runs, thousands of cycles, and share of the CPU since the last
+// reset; then the idle main loop passes, the window length (ms) and the longest main loop pass.
+void prof_report(void)
+{
+  uint64_t cycles[PROF_COUNT];
+  uint32_t count[PROF_COUNT];
+  uint64_t total;
+  uint32_t now;
+
+  // snapshot, charging the main loop (which is running this) up to now
+  __disable_irq();
+  now = ARM_DWT_CYCCNT;
+  prof_cycles[prof_cur] += now - prof_mark;
+  prof_mark = now;
+  vmemcpy(cycles, prof_cycles, sizeof(cycles));
+  vmemcpy(count, prof_count, sizeof(count));
+  total = time_cycles() - prof_start;
+  __enable_irq();
+  count[PROF_MAIN] = loop_count;    // "runs" of the main loop are its passes
+
+  if(!total)
+    total = 1;
+  for(uint32_t i = 0; i < PROF_COUNT; i++)
+    hid_printf("'%-8s %10lu %10lu %6.2f%%\n", prof_names[i], (unsigned long)count[i], (unsigned long)(cycles[i] / 1000),
+               (double)(100.f * (float)cycles[i] / (float)total));
+  hid_printf("'%-8s %10lu %10lu %6.2f%%\n", "idle", (unsigned long)idle_count, (unsigned long)(idle_cycles / 1000),
+             (double)(100.f * (float)idle_cycles / (float)total));
+  hid_printf("'%lu ms; longest main loop pass %lu cycles\n", (unsigned long)(total / (F_CPU / 1000)), (unsigned long)loop_max);
+}
+
+// USB interrupt, counted.
+static void prof_usb_isr(void)
+{
+  PROF_ISR(PROF_USB);
+  usb_isr();
+}
+
+#endif
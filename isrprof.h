@@ -0,0 +1,121 @@
+/* Interrupt load profiler
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __isrprof_h
+#define __isrprof_h
+
+#include <mk20dx128.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timebase.h"
+
+/********************************************************************************
+ * Interrupt load profiler
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Counts how much of the CPU each interrupt handler uses, and how much is left over
+ *   for the main loop. Only built when ISR_PROFILE is defined (make ISR_PROFILE=1); otherwise
+ *   PROF_ISR() compiles to nothing.
+ *
+ *   Each handler starts with PROF_ISR(id). On entry, and again when the handler returns (by
+ *   any path), the cycles since the last entry or exit are charged to whichever context was
+ *   running - the main loop or the handler that was preempted - so nested interrupts are only
+ *   counted once, against the handler that actually ran them. Everything that isn't charged
+ *   to a handler is main loop time. prof_loop() also adds up the main loop passes that found
+ *   nothing to do (no usb command, nothing to stream, no IMC message); that idle time is the
+ *   CPU still free for more work.
+ *
+ *   Each entry/exit costs about 30 cycles. Exception stacking and unstacking (12 cycles each
+ *   way) lands on the interrupted context.
+ ********************************************************************************/
+
+// Constants ==========================================================================
+typedef enum {
+  PROF_MAIN,        // main loop (thread mode)
+  PROF_PIT0,        // step generation (imc/stepper.c)
+  PROF_PIT1,        // step pulse reset (imc/stepper.c)
+  PROF_PIT2,        // sync delay/timeout (imc/control_isr.c)
+  PROF_PIT3,        // control update (ctrl.c)
+  PROF_PORTB,       // sync line and limit switches (imc/control_isr.c)
+  PROF_I2C0,        // IMC bus (imc/parser.c)
+  PROF_SPI0,        // encoder DMA read complete (spienc.c)
+  PROF_USB,         // Teensy core usb_isr, through the RAM vector table
+  PROF_SYSTICK,     // ms tick (main.c)
+  PROF_SOFTWARE,    // deferred control work (ctrl.c)
+  PROF_STEPDMA,     // step count carry with imc/hardware.h:STEP_USE_FTM (stepftm.c)
+  PROF_COUNT
+} prof_id;
+
+#ifdef ISR_PROFILE
+
+// Global Variables ====================================================================
+extern volatile uint64_t prof_cycles[PROF_COUNT];   // cycles charged to each context since prof_reset()
+extern volatile uint32_t prof_count[PROF_COUNT];    // times each handler has run
+extern volatile uint32_t prof_mark;                 // CYCCNT when time was last charged
+extern volatile uint32_t prof_cur;                  // context running since prof_mark
+
+void prof_init(void);
+void prof_reset(void);
+void prof_loop(bool busy);
+void prof_report(void);
+
+// charges the time since the last mark to whatever was running, and switches to id. Returns the
+// context that was running, so the matching prof_leave can switch back.
+__attribute__ ((always_inline)) inline uint32_t prof_enter(uint32_t id)
+{
+  uint32_t now, prev;
+  __disable_irq();    // handlers always run with interrupts enabled, so this pairs with the __enable_irq below
+  now = ARM_DWT_CYCCNT;
+  prev = prof_cur;
+  prof_cycles[prev] += now - prof_mark;
+  prof_mark = now;
+  prof_cur = id;
+  prof_count[id]++;
+  __enable_irq();
+  return prev;
+}
+
+// cleanup handler for PROF_ISR: charges the handler's last stretch and switches back to *prev.
+__attribute__ ((always_inline)) inline void prof_leave(uint32_t *prev)
+{
+  uint32_t now;
+  __disable_irq();
+  now = ARM_DWT_CYCCNT;
+  prof_cycles[prof_cur] += now - prof_mark;
+  prof_mark = now;
+  prof_cur = *prev;
+  __enable_irq();
+}
+
+// put at the top of a handler; the cleanup attribute closes the measurement on every return path.
+#define PROF_ISR(id)    uint32_t prof_prev_ __attribute__ ((cleanup(prof_leave))) = prof_enter(id)
+
+#else
+
+#define PROF_ISR(id)
+
+#endif
+
+#endif // __isrprof_h
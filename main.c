@@ -29,7 +29,7 @@
  *    12 <--> PC7 - DIN
  *    13 <--> PC5 - SCK
  *  14 <--> PD1 - "PIN14" flag on ctrl history data capture. No specific function except to save a pin value at each update.
- *  15 <--> PC0 - Step
+ *  15 <--> PC0 - Step (moves to 5 <--> PD7 - FTM0_CH7 when imc/hardware.h:STEP_USE_FTM is defined; see stepftm.c)
  *  16 <--> PB0 - Global sync line
  *  17 <--> PB1 - "PIN17" flag on ctrl history data capture. No specific function except to save a pin value at each update.
  *  18 <--> PB3 - I2C SDA
@@ -75,8 +75,14 @@
  *          pcs - starts executing the custom path buffer. The controller target will be set by linearly interpolating
  *                between the entries pushed to the buffer with pcp, counting time from the moment this command was received.
  *          pcc - clears the custom path buffer.
- *       pq - sine mode. Generates position and velocity targets from five summed sine waves.
+ *       pq - sine mode. Generates position and velocity targets from up to five summed sine waves (see pc, pf, pa,
+ *            pfr, par, pph).
  *       pr - random path mode. Generates a random path, keeping successive datapoints less than max vel (param a)
+ *       pn - PRBS path mode. Steps the target by +/- pna around where it was, following a maximum length pseudo-random
+ *            binary sequence (pn* parameters) for system identification. The sequence is fixed by pnb, so the host can
+ *            regenerate it instead of recording it; see path.c:path_prbs_start.
+ *       pb - frequency response sweep. Runs a stepped sine of the y* parameters around the current target, measuring
+ *            the loop's response at each frequency on the board; "gy" reads the results. See fra.h.
  *       pm - ramps-move mode. Move according to a trajectory generated using RAMPS's planner. Trajectory is
  *          specified using the pm parameter vector and executes only once. This path mode is used when the system mode is IMC
  *          network mode.
@@ -84,11 +90,27 @@
  *  Parameter commands:
  *   gX - gets parameter X's value
  *   sX YYYY - sets parameter X's value to YYYY
+ *   Host scripts can also get and set parameters, read a telemetry snapshot, or dump every parameter at
+ *   once with binary packets starting with byte 0xB5, and get binary replies on the DATA2 stream. See bincmd.c
+ *   for the framing and params.h for the parameter ids. The same parameters (scalars only) can be read and
+ *   written with the IMC get/set parameter messages, using id PARAM_I2C_BASE (0x80) + the params.h id.
+ *   Values outside a parameter's limits (see params.c) are clamped when set.
  * 
  *  Parameters:
  *    a - mAximum velocity allowed for controller output. Any velocity output by the controller above this value clamps to this value.
- *    d - controller history dump (binary)
+ *    d - controller history dump (binary, read only). Replies with the number of records as text, then sends the records
+ *        oldest first on the DATA1 stream, two per packet, each packet starting with its sequence number (uint16). The
+ *        history stops recording until "gr" is sent, the next path command or controller enable, or 5 s pass without a
+ *        dump or resend request.
  *    f - current move frequency (in fixed mode, this is the last number entered) (int32)
+ *    r - (get only) history dump resend. "gr N M ..." re-sends dump packets N, M, ...; "gr" with no numbers means the
+ *        dump is complete and lets the history record again.
+ *    l - interrupt load (read only; needs a build with ISR_PROFILE - make ISR_PROFILE=1). "gl" prints one line per
+ *        handler (pit0, pit1, pit2, pit3, portb, i2c0, spi0, usb, systick, software, stepdma) and one for the main loop: runs,
+ *        thousands of cpu cycles, and percent of the cpu since the last "sl", then the length of that window (ms) and
+ *        the longest main loop pass (cycles). Nested interrupts are charged to the handler that ran them. "main" is
+ *        all of the main loop, including usb parsing and streaming; a last "idle" line counts the main loop passes
+ *        that found nothing to do and the time spent in them, which is the cpu still free. "sl" starts a new window.
  *    i - mInimum velocity allowed for controller output. Any velocity output by the controller below this value clamps to 0.
  *    k* - Controller parameters:
  *      kp* - PID control parameters
@@ -99,6 +121,8 @@
  *      kf - feedforward time advance (in update steps - uint32)
  *      kt - fault detection threshhold - change in tics/update of the error between commanded position and actual position.
  *      ku - controller update period (in ms)
+ *      kq - use the fixed-point control kernels (ctrl_fixed.c) for PID, DARMA and COMP (int32 but represents a boolean -
+ *           1 means fixed-point, 0 means the float reference implementation). Default 1.
  *      kd* - DARMA control parameters
  *        kdr - DARMA control R vector. See notes in ctrl.c:darma_ctrl() for details
  *        kds - DARMA control S vector
@@ -112,18 +136,59 @@
  *    m* - motor parameters.
  *      mp - step position (int32)
  *      mf - force step counter reset whenever the step events per minute function is called. (int32 but represents a boolean - 1 means on, 0 means off)
+ *      md - DDA stepping (int32 but represents a boolean - 1 means on, 0 means off). When on, PIT0 ticks at a fixed 40 kHz
+ *           and adds the step rate (as a fraction of a step per tick) to a 32-bit phase accumulator, stepping each time it
+ *           wraps. The controller's rate keeps its fraction of a step/min and rate changes never restart the timer,
+ *           so mf doesn't apply; the top step rate is 40000 steps/s, and the tick costs interrupt time even when
+ *           stopped. When off (the default), PIT0 is reloaded with a step period in whole steps/min.
  *    o - occasionally output encoder value. Value specifies the number of ms between reporting. 0 = off (uint)
  *    p* - path parameters
  *      pc - number of sines (1-5, int)
- *      pf - sine frequency base - rad/tenus
+ *      pf - sine frequency base - Hz
  *      pa - sine amplitude (tics)
+ *      pfr - frequency of each sine, as a multiple of pf (vector of 5 floats). Default {1, 0.865, 0.77777, 0.425, 0.33333}.
+ *      par - amplitude of each sine, as a multiple of pa (vector of 5 floats). Default all 1.
+ *      pph - phase of each sine at the start of the path (rad, vector of 5 floats). Default {0.5, 1.0, -0.2, 0.7, -1.3}.
  *      pr - random path move amplitude (0->1 scalar, normalized against ctrl max vel)
+ *      pn* - PRBS path (pn) parameters. They take effect at the next pn.
+ *        pnb - register length (2-24 bits, uint). The sequence repeats every 2^pnb - 1 bits. Default 9.
+ *        pna - amplitude (tics, float). Default 20.
+ *        pnt - bit period (control updates, uint). Default 10.
  *      pm - path parameters used when executing a ramps-style move. This is a vector, with elements 
  *             {length, total_length, initial_rate, nominal_rate, final_rate, acceleration}. All elements are int32_t type.
  *             For this vector, all distances are in motor steps and all times are in minutes.
+ *      pl - RAMPS lookahead (int32 but represents a boolean - 1 means on, 0 means off). When on, the next queued IMC
+ *           block starts as soon as the current one ends, so the target runs through the junction at the blocks'
+ *           final/initial rates; the sync line still signals each block boundary. When off, each block starts when
+ *           its sync handshake comes in, and the target holds at the block end until then. Default 1.
+ *      pj - RAMPS jerk limit (steps/min^3, float). When nonzero, RAMPS moves (pm and IMC network moves) follow a
+ *           7-segment jerk-limited (S-curve) velocity profile built from the same move parameters, with the move's
+ *           acceleration as the acceleration limit, instead of a trapezoid. Blocks too short for that keep the
+ *           trapezoid. 0 (the default) means trapezoids only.
  *    q - encoder tics per step (float)
- *    s - Stream control history in real time. Boolean (0 = false, 1 = true)
+ *    s - Stream control history in real time. Boolean (0 = false, 1 = true). Records go out on the DATA0 stream, up
+ *        to two per packet, behind a 4-byte header: sequence number (uint8), flags (uint8; bit 0 = records were dropped
+ *        since the last packet), and the running count of dropped records (uint16). Bit 1 of the flags marks a
+ *        capture packet (x) instead.
  *    u - last controller update time (in ms), read only
+ *    w - control update timing statistics. "gw" reads them for the current control mode, "gw N" for mode N (ctrl.h:ctrl_mode),
+ *        as one line: count, execution time min/mean/max (cpu cycles), entry latency from the PIT3 tick min/mean/max (bus
+ *        cycles; the spread is the jitter), overruns (updates still running at the next tick), then the 12 buckets of the
+ *        execution time histogram (see ctrl.h:ctrl_timing_t). "sw" resets them for every mode.
+ *    x - control input capture (int32 but represents a boolean). "sx 1" arms a capture, which starts at the next
+ *        controller enable and records the inputs of every control update and every path command and parameter
+ *        change on the DATA0 stream, for a bit-exact replay on the host simulation (imcsim -R). "sx 0" ends it, as
+ *        does the capture falling behind the usb link. See capture.h for the records.
+ *    y* - frequency response sweep (pb) parameters:
+ *      yl - lowest frequency (Hz, float). Default 1.
+ *      yh - highest frequency (Hz, float). Default 50.
+ *      yn - number of frequencies, spaced logarithmically (1-64, uint). Default 20.
+ *      ya - sine amplitude (tics, float). Default 50.
+ *      yc - cycles measured at each frequency (uint). Default 4.
+ *      ys - cycles run first at each frequency to let the loop settle (uint). Default 2.
+ *      "gy" (read only) prints the points measured so far and the points in the sweep, then a line per point:
+ *      frequency (Hz), amplitude of the target's sine (tics), the encoder's response to the target (real and
+ *      imaginary parts), and the controller output's response to the target ((tics/min)/tic, real and imaginary).
  *
  *  Note: Responses meant to be human-readible (i.e. Debug strings for ctrl_design_gui) start with an apostrophe (')
  *
@@ -159,8 +224,15 @@
 #include "stepper_hooks.h"
 #include "param_hooks.h"
 #include "qdenc.h"
+#include "spienc.h"
 #include "ctrl.h"
 #include "path.h"
+#include "params.h"
+#include "bincmd.h"
+#include "isrprof.h"
+#include "stepftm.h"
+#include "capture.h"
+#include "fra.h"
 
 #include "imc/hardware.h"
 #include "imc/main_imc.h"
@@ -181,23 +253,7 @@ typedef enum {
 
 // Global Variables ==========================================================
 //extern volatile uint32_t systick_millis_count;    // system millisecond timer
-extern float pid_kp, pid_ki, pid_kd;
-extern float max_ctrl_vel, min_ctrl_vel;
-extern bool pos_ctrl_mode;
-extern uint32_t ctrl_feedforward_advance;
-extern float sine_freq_base, sine_amp, rand_scale;
-extern uint32_t sine_count;
-extern bool force_steps_per_minute;
-extern float fault_thresh;
 extern bool old_stepper_mode;
-extern real darma_R[FILTER_MAX_SIZE];
-extern real darma_S[FILTER_MAX_SIZE];
-extern real darma_T[FILTER_MAX_SIZE];
-extern real comp_C_num[FILTER_MAX_SIZE];
-extern real comp_C_den[FILTER_MAX_SIZE - 1];
-extern real comp_F_num[FILTER_MAX_SIZE];
-extern real comp_F_den[FILTER_MAX_SIZE - 1];
-extern bool stream_ctrl_hist;
 
 char message[200];
 runlevel_e runlevel = RL_IDLE;
@@ -206,16 +262,15 @@ enum { M_FIXED_SPEED, M_MOVE_STEPS } manual_mode;
 float enc_tics_per_step = 21.7343;//1.4986;                       // encoder tics per motor (micro)step (roughly)
 float steps_per_enc_tic = 1/21.7343;//1/1.4986;                          // = 1 / enc_tics_per_step
 
-volatile uint32_t systick_tenus_count;     // millisecond counter which updates every SYSTICK_UPDATE_MS ms.
+uint32_t show_encoder_time = 0;
+int32_t ramps_move_params[6] = {0, 0, 0, 0, 0, 0};
+
 volatile uint32_t csr_last;
 
 
 
 // Local Variables ===========================================================
-static char msg_build[30];
-static uint32_t show_encoder_time = 0;
 static bool moving = false;
-static int32_t ramps_move_params[6] = {0, 0, 0, 0, 0, 0};
 static char usb_input_buffer[USB_INPUT_BUF_SIZE];
 static uint32_t input_buf_len = 0;
 
@@ -226,18 +281,25 @@ void parse_ctrl_msg(const char *buf, uint32_t *i, uint32_t count);
 void parse_path_msg(const char *buf, uint32_t *i, uint32_t count);
 void parse_get_param(const char *buf, uint32_t *i, uint32_t count);
 void parse_set_param(const char *buf, uint32_t *i, uint32_t count);
-void set_enc_tics_per_step(float etps);
+bool read_float(const char * buf, uint32_t *i, float *value);
+bool read_int(const char * buf, uint32_t *i, int32_t *value);
+bool read_uint(const char * buf, uint32_t *i, uint32_t *value);
 
 
 // This hook is called by main at the beginning of setup.
 int main()
 {
-  uint32_t next_encoder_time = 0;
+  uint64_t next_encoder_time = 0;
   int32_t value;
+  bool busy = true;     // did the last main loop pass do any work
 
   // change the cpu systic clock to only roll over every SYSTICK_UPDATE_MS milliseconds:
   SYST_RVR = (F_CPU / 1000) * (SYSTICK_UPDATE_TEN_US / 100L) - 1;
   systick_millis_count = 0;
+  time_init();
+#ifdef ISR_PROFILE
+  prof_init();
+#endif
 
   hid_init(read_i2c_address());
 
@@ -248,6 +310,9 @@ int main()
   //enable_stepper();
 
   imc_init();     // initialize the IMC controller
+#ifdef STEP_USE_FTM
+  stepftm_init(); // hardware step generation
+#endif
 
   // turn on the max endstop for testing
   {
@@ -272,6 +337,7 @@ int main()
   // set up the stepper hooks into the IMC module
   init_stepper_hooks();
   init_param_hooks();
+  params_init();
 
   delay_real(100);
 
@@ -282,24 +348,35 @@ int main()
 
   while(1)
   {
+#ifdef ISR_PROFILE
+    prof_loop(busy);    // closes the last pass; passes that did nothing count as idle
+#endif
+    busy = false;
     if(RL_IMC == runlevel)
-      imc_idle();   // IMC main loop
+      busy |= imc_idle();   // IMC main loop
 
     if(hid_available() > 0)
     {
       parse_usb();
+      busy = true;
     }
     //||\\!! Just for testing
     hid_flush(5);
 
+    // send out any streamed control history and capture records
+    busy |= ctrl_idle();
+    busy |= cap_idle();
+    busy |= fra_idle();
+
     
-    if(show_encoder_time > 0 && get_systick_tenus() > next_encoder_time)
+    if(show_encoder_time > 0 && time_tenus64() > next_encoder_time)
 	  {
-      next_encoder_time = get_systick_tenus() + show_encoder_time * 100;
+      next_encoder_time = time_tenus64() + show_encoder_time * 100;
       if(get_enc_value(&value))
-        hid_printf("'%li**\n", value);   // signal we lost track!
+        hid_printf("'%li**\n", (long)value);   // signal we lost track!
       else
-        hid_printf("'%li\n", value);
+        hid_printf("'%li\n", (long)value);
+      busy = true;
       //usb_serial_write(message,strlen(message));
     }
     
@@ -310,6 +387,7 @@ int main()
       hid_printf("'Move complete. New step position = %li; Encoder position = %li\n", (long)get_motor_position(), (long)value);
       //usb_serial_write(message,strlen(message));
       moving = false;
+      busy = true;
     }
 #ifndef USE_QD_ENC
     if(ctrl_get_mode() == CTRL_DISABLED)    // only idle when controller is not running.
@@ -337,6 +415,13 @@ int get_usb_line(char *dest, uint32_t dest_size)
     if(!count)    // no (complete) packet read; return 0 but keep the partial packet for next time.
       return 0;
 
+    // binary requests are always one packet long, and only start on a packet boundary (see bincmd.c)
+    if(0 == input_buf_len && bin_is_request((uint8_t*)usb_input_buffer))
+    {
+      bin_handle_request((uint8_t*)usb_input_buffer);
+      return 0;
+    }
+
     input_buf_len += HID_PACKLEN;
     //hid_printf("Got a packet %02X %02X %02X %02X!\n", usb_input_buffer[0], usb_input_buffer[1], usb_input_buffer[2], usb_input_buffer[3]);
 
@@ -499,7 +584,7 @@ void parse_usb(void)
             set_direction((foo) < 0);
             set_steps_to_go((uint32_t)abs(foo));
             get_enc_value(&foo2);
-            hid_printf("'Move Steps mode. Moving from %li by %li steps\n  Current encoder value = %li\n", get_motor_position(), foo, foo2);
+            hid_printf("'Move Steps mode. Moving from %li by %li steps\n  Current encoder value = %li\n", (long)get_motor_position(), (long)foo, (long)foo2);
             
             start_moving();
             moving = true;
@@ -515,7 +600,7 @@ void parse_usb(void)
           path_set_step_target(foo);
 
           get_enc_value(&foo2);
-          hid_printf("'Stepping from %li to %li\n", foo2, foo);
+          hid_printf("'Stepping from %li to %li\n", (long)foo2, (long)foo);
           
         }
         break;
@@ -546,7 +631,7 @@ void parse_ctrl_msg(const char * buf, uint32_t *i, uint32_t count)
       path_set_step_target(foo);
 
       get_enc_value(&foo2);
-      hid_printf("'PID control mode. Step path from %li to %li\n", foo, foo2);
+      hid_printf("'PID control mode. Step path from %li to %li\n", (long)foo, (long)foo2);
       
     }
     else
@@ -695,7 +780,7 @@ void parse_path_msg(const char * buf, uint32_t *i, uint32_t count)
       *i += read;
 
       get_enc_value(&foo2);
-      hid_printf("'Step path mode. Stepping from %li to %li\n", foo2, foo);
+      hid_printf("'Step path mode. Stepping from %li to %li\n", (long)foo2, (long)foo);
       
     }
     else
@@ -746,6 +831,13 @@ void parse_path_msg(const char * buf, uint32_t *i, uint32_t count)
   case 'r':   // pr - random mode
     path_rand_start();
     break;
+  case 'n':   // pn - PRBS mode
+    path_prbs_start();
+    break;
+  case 'b':   // pb - frequency response sweep
+    if(!path_fra_start())
+      hid_printf("'Bad frequency response sweep parameters.\n");
+    break;
   case 'm':   // pm - ramps-style move
     {
       // Set up the move
@@ -759,6 +851,8 @@ void parse_path_msg(const char * buf, uint32_t *i, uint32_t count)
       get_enc_value(&foo);
       path_imc(foo);
       path_ramps_move(&msg);
+      // the end of the last move left the stepper module waiting for a sync handshake no IMC master will send
+      start_moving();
     }
     break;
 
@@ -773,17 +867,18 @@ void parse_path_msg(const char * buf, uint32_t *i, uint32_t count)
 void parse_get_param(const char * buf, uint32_t *i, uint32_t count)
 {
   int32_t foo;
+  const param_desc_t *p;
+
+  // everything stored in a variable is in the parameter registry
+  if((p = param_by_name(buf, i)))
+  {
+    param_print(p);
+    return;
+  }
+
   // which parameter?
   switch(buf[(*i)++])
   {
-  case 'a':
-    // maximum control value
-    hid_printf("%f\n", max_ctrl_vel);
-    break;
-  case 'i':
-    // minimum control value
-    hid_printf("%f\n", min_ctrl_vel);
-    break;
   case 't':
     // encoder tic count
     if(!get_enc_value(&foo))
@@ -800,10 +895,6 @@ void parse_get_param(const char * buf, uint32_t *i, uint32_t count)
     // motor driver parameters
     switch(buf[(*i)++])
     {
-    case 'f':
-      // mf - force counter reset on update
-      hid_printf("%li\n", (long)force_steps_per_minute);
-      break;
     case 'p':
       // mp - motor step position
       hid_printf("%li\n", (long)get_motor_position());
@@ -815,139 +906,14 @@ void parse_get_param(const char * buf, uint32_t *i, uint32_t count)
     // current move frequency
     hid_printf("%li\n", (long)(get_direction() ? -1 : 1) * (long)get_step_events_per_minute());
     break;
-  case 'o':
-    // current show encoder frequency
-    hid_printf("%lu\n", (unsigned long)show_encoder_time);
-    break;
   case 'k':
     // Control parameters
     switch(buf[(*i)++])
     {
-    case 'p':
-      // PID control parameters
-      switch(buf[(*i)++])
-      {
-      case 'p':
-        // kpp - proportional constant
-        hid_printf("%f\n", pid_kp);
-        break;
-      case 'i':
-        // kpi - integral constant
-        hid_printf("%f\n", pid_ki);
-        break;
-      case 'd':
-        // kpd - derivative constant
-        hid_printf("%f\n", pid_kd);
-        break;
-      }
-      break;
-    case 'm':
-      // km - control to position mode
-      hid_printf("%i\n", pos_ctrl_mode ? 1 : 0);
-      break;
-    case 'f':
-      // kf - feedforward advance time (update steps)
-      hid_printf("%lu\n", ctrl_feedforward_advance);
-      break;
-    case 't':
-      // fault threshold
-      hid_printf("%f\n", fault_thresh);
-      break;
     case 'u' :
       // controller update period (in ms)
       hid_printf("%f\n", ctrl_get_period() / 1000.f);
       break;
-    case 'd':
-      {
-        hid_printf("'Get started.\n");
-        
-        // DARMA control parameters
-        real *target = NULL;
-        int32_t m = 0;
-        switch(buf[(*i)++])
-        {
-        case 'r':
-          // kdr - R vector
-          target = darma_R;
-          break;
-        case 's':
-          // kds - S vector
-          target = darma_S;
-          break;
-        case 't':
-          // kdt - T vector
-          target = darma_T;
-          break;
-        default :
-          // didn't understand
-          hid_printf("Unknown command.\n");
-          
-          break;
-        }
-        if(target)
-        {
-          for(m = FILTER_MAX_SIZE - 1; m > 0; m--)
-            if(0.f != target[m])
-              break;
-          hid_printf("'m= %i.\n", (int)m);
-          message[0] = 0;
-          for(uint32_t k = 0; k <= m; k++)
-          {
-            sprintf(msg_build, "%f ", target[k]);
-            strcat(message, msg_build);
-          }
-          strcat(message, "\n");
-          hid_print(message, strlen(message), 100);
-        }
-        hid_printf("'get complete\n");
-      }
-      break;
-      
-      case 'c':
-      {
-        // Compensating control parameters
-        real *target = NULL;
-        uint8_t m = FILTER_MAX_SIZE - 1;
-        switch(buf[(*i)++])
-        {
-        case 'n':
-          // kcn - C numerator vector
-          target = comp_C_num;
-          break;
-        case 'd':
-          // kcd - C denominator vector
-          target = comp_C_den;
-          m--;
-          break;
-        case 'o':
-          // kco - F numerator vector
-          target = comp_F_num;
-          break;
-        case 'f':
-          // kcf - F denominator vector
-          target = comp_F_den;
-          m--;
-          break;
-        }
-        if(target)
-        {
-          for(; m > 0; m--)
-            if(0.f != target[m])
-              break;
-          //hid_printf("'m= %i.\n", (int)m);
-          message[0] = 0;
-          for(uint32_t k = 0; k <= m; k++)
-          {
-            sprintf(msg_build, "%f ", target[k]);
-            strcat(message, msg_build);
-          }
-          strcat(message, "\n");
-          hid_print(message, strlen(message), 100);
-        }
-        //hid_printf("'get complete\n");
-      }
-      break;
-
     }
     break;
 
@@ -955,49 +921,56 @@ void parse_get_param(const char * buf, uint32_t *i, uint32_t count)
     // last controller update time
     hid_printf("%f\n", ctrl_get_update_time());
     break;
-  case 'q':
-    // encoder tics per step (float)
-    hid_printf("%f\n", enc_tics_per_step);
-    break;
-  case 's':
-    // stream ctrl history
-    hid_printf("%i\n", (int)stream_ctrl_hist);
+  case 'd':
+    // controller history dump (binary)
+    output_history();
     break;
-  case 'p':
-    // path mode variables:
-    switch(buf[(*i)++])
+  case 'w':
+    // control update timing statistics of one mode (default: the current one)
     {
-    case 'c':
-      // pc - sine count
-      hid_printf("%lu\n", sine_count);
-      break;
-    case 'f':
-      // pf - sine frequency base (hz)
-      hid_printf("%f\n", sine_freq_base);
-      break;
-    case 'a':
-      // pa - sine amplitude
-      hid_printf("%f\n", sine_amp);
-      break;
-    case 'r':
-      // pr - random move scale
-      hid_printf("%f\n", rand_scale);
-      break;
-    case 'm':
-      // pm - ramps-style move parameters
-      message[0] = 0;
-      for(uint32_t k = 0; k < 6; k++)
+      ctrl_timing_t t;
+      uint32_t m;
+      if(!read_uint(buf, i, &m))
+        m = ctrl_get_mode();
+      if(m >= CTRL_MODE_COUNT)
       {
-        sprintf(msg_build, "%li ", ramps_move_params[k]);
-        strcat(message, msg_build);
+        hid_printf("'No such control mode.\n");
+        break;
       }
-      strcat(message, "\n");
-      hid_print(message, strlen(message), 100);
+      ctrl_get_timing((ctrl_mode)m, &t, false);
+      hid_printf("%lu %lu %lu %lu %lu %lu %lu %lu", (unsigned long)t.count, (unsigned long)t.min_cycles,
+                 (unsigned long)t.mean_cycles, (unsigned long)t.max_cycles, (unsigned long)t.min_latency,
+                 (unsigned long)t.mean_latency, (unsigned long)t.max_latency, (unsigned long)t.overruns);
+      for(uint32_t k = 0; k < CTRL_TIMING_BUCKETS; k++)
+        hid_printf(" %u", t.hist[k]);
+      hid_printf("\n");
     }
     break;
-  case 'd':
-    // controller history dump (binary)
-    output_history();
+  case 'l':
+    // interrupt load
+#ifdef ISR_PROFILE
+    prof_report();
+#else
+    hid_printf("'Interrupt profiling is not built in (make ISR_PROFILE=1).\n");
+#endif
+    break;
+  case 'y':
+    // frequency response sweep results
+    fra_report();
+    break;
+  case 'r':
+    // resend history dump packets, or release the history if none are listed
+    {
+      uint32_t seq;
+      bool any = false;
+      while(read_uint(buf, i, &seq))
+      {
+        resend_history(seq);
+        any = true;
+      }
+      if(!any)
+        release_history();
+    }
     break;
   default :
     // didn't understand!
@@ -1021,7 +994,7 @@ bool read_float(const char * buf, uint32_t *i, float *value)
 bool read_int(const char * buf, uint32_t *i, int32_t *value)
 {
   uint32_t read;
-  int32_t foo;
+  long foo;     // (not int32_t: %li needs a long, which is wider than int32_t on a 64-bit host)
   if(sscanf(buf + *i, " %li%n", &foo, (int*)&read) == 1)
   {
     *i += read;
@@ -1034,7 +1007,7 @@ bool read_int(const char * buf, uint32_t *i, int32_t *value)
 bool read_uint(const char * buf, uint32_t *i, uint32_t *value)
 {
   uint32_t read;
-  uint32_t foo;
+  unsigned long foo;
   if(sscanf(buf + *i, " %lu%n", &foo, (int*)&read) == 1)
   {
     *i += read;
@@ -1044,65 +1017,25 @@ bool read_uint(const char * buf, uint32_t *i, uint32_t *value)
   return false;
 }
 
-bool read_vector_float(const char *buf, uint32_t *i, float *vector, uint32_t size)
-{
-  uint32_t read;
-  if(vector)
-  {
-    // clear the buffer
-    vmemset((void *)vector, 0, sizeof(real) * size);
-    // load the buffer
-    for(uint32_t k = 0; k < size; k++)
-    {
-      if(sscanf(buf + *i, " %f%n", &vector[k], (int*)&read) == 1)
-        *i += read;
-      else
-        break;    // we're done!
-    }
-    return true;
-  }
-  return false;
-}
-
-bool read_vector_int(const char *buf, uint32_t *i, int32_t *vector, uint32_t size)
-{
-  uint32_t read;
-  if(vector)
-  {
-    // clear the buffer
-    vmemset((void *)vector, 0, sizeof(int32_t) * size);
-    // load the buffer
-    for(uint32_t k = 0; k < size; k++)
-    {
-      if(sscanf(buf + *i, " %li%n", &vector[k], (int*)&read) == 1)
-        *i += read;
-      else
-        break;    // we're done!
-    }
-    return true;
-  }
-  return false;
-}
-
-
 // Parses a Set Parameter message
 void parse_set_param(const char * buf, uint32_t *i, uint32_t count)
 {
   int32_t foo;
   float ffoo;
   bool parseok = false;
+  const param_desc_t *p;
+
+  // everything stored in a variable is in the parameter registry
+  if((p = param_by_name(buf, i)))
+  {
+    if(!param_parse(p, buf, i))
+      hid_printf("'Failed to parse new value.\n");
+    return;
+  }
+
   // which parameter?
   switch(buf[(*i)++])
   {
-  case 'a':
-    // maximum ctrl velocity
-    parseok = read_float(buf, i, &max_ctrl_vel);
-    break;
-  case 'i':
-    // minimum ctrl velocity
-    parseok = read_float(buf, i, &min_ctrl_vel);
-    break;
-    
   case 't':
     // encoder tic count
     parseok = read_int(buf, i, &foo);
@@ -1113,11 +1046,6 @@ void parse_set_param(const char * buf, uint32_t *i, uint32_t count)
     // Motor driver (stepper.c) parameters
     switch(buf[(*i)++])
     {
-    case 'f':
-      // mf - force motor timer update
-      parseok = read_int(buf, i, &foo); 
-      force_steps_per_minute = (foo != 0);
-      break;
     case 'p':
       // mp - Motor position
       parseok = read_int(buf, i, &foo); 
@@ -1125,10 +1053,6 @@ void parse_set_param(const char * buf, uint32_t *i, uint32_t count)
     }
     break;
     
-  case 'o':
-    // encoder readout frequency
-    parseok = read_uint(buf, i, &show_encoder_time);
-    break;
   case 'f':
     // current move frequency
     if(RL_MANUAL == runlevel)
@@ -1149,124 +1073,24 @@ void parse_set_param(const char * buf, uint32_t *i, uint32_t count)
     // Control parameters
     switch(buf[(*i)++])
     {
-    case 'p':
-      // PID control parameters
-      switch(buf[(*i)++])
-      {
-      case 'p':
-        // kpp - proportional constant
-        parseok = read_float(buf, i, &pid_kp);
-        break;
-      case 'i':
-        // kpi - integral constant
-        parseok = read_float(buf, i, &pid_ki);
-        break;
-      case 'd':
-        // kpd - derivative constant
-        parseok = read_float(buf, i, &pid_kd);
-        break;
-      }
-      break;
-    case 'm':
-      // km - control to position mode
-      parseok = read_uint(buf, i, (uint32_t*)&foo);
-      pos_ctrl_mode = (foo != 0);
-      break;
-    case 'f':
-      // kf - feedforward advance steps
-      parseok = read_uint(buf, i, &ctrl_feedforward_advance);
-      break;
-    case 't':
-      // kt - fault threshold
-      parseok = read_float(buf, i, &ffoo);
-      fault_thresh = fabsf(ffoo);
-      break;
     case 'u':
       // ku - controller update period (ms)
       parseok = read_float(buf, i, &ffoo);
       ctrl_set_period((uint32_t)(ffoo * 1000.f));
       break;
-    case 'd':
-      // DARMA control parameters
-      switch(buf[(*i)++])
-      {
-      case 'r':
-        // kdr - R vector
-        parseok = read_vector_float(buf, i, darma_R, FILTER_MAX_SIZE);
-        break;
-      case 's':
-        // kpi - integral constant
-        parseok = read_vector_float(buf, i, darma_S, FILTER_MAX_SIZE);
-        break;
-      case 't':
-        // kpd - derivative constant
-        parseok = read_vector_float(buf, i, darma_T, FILTER_MAX_SIZE);
-        break;
-      }
-      break;
-
-    case 'c':
-      // Compensating control parameters
-      switch(buf[(*i)++])
-      {
-      case 'n':
-        // kcn - C numerator vector
-        parseok = read_vector_float(buf, i, comp_C_num, FILTER_MAX_SIZE);
-        break;
-      case 'd':
-        // kcd - C denominator vector
-        parseok = read_vector_float(buf, i, comp_C_den, FILTER_MAX_SIZE - 1);
-        break;
-      case 'o':
-        // kco - F numerator vector
-        parseok = read_vector_float(buf, i, comp_F_num, FILTER_MAX_SIZE);
-        break;
-      case 'f':
-        // kcf - F denominator vector
-        parseok = read_vector_float(buf, i, comp_F_den, FILTER_MAX_SIZE - 1);
-        break;
-      }
-      break;
-
     }
     break;
-  case 'q':
-    // encoder tics per step
-    parseok = read_float(buf, i, &ffoo);
-    set_enc_tics_per_step(ffoo);
-    break;
-  case 's':
-    // stream ctrl history
-    parseok = read_int(buf, i, &foo);
-    stream_ctrl_hist = (foo != 0);
-    hid_printf("Streaming Set: %i\n", (int)stream_ctrl_hist);
+  case 'w':
+    // reset the control update timing statistics
+    ctrl_reset_timing();
+    parseok = true;
     break;
-  case 'p':
-    // Path sine mode parameters
-    switch(buf[(*i)++])
-    {
-    case 'c':
-      // pc - sine count
-      parseok = read_uint(buf, i, &sine_count);
-      break;
-    case 'f':
-      // pf - sine freq
-      parseok = read_float(buf, i, &ffoo);
-      path_sines_setfreq(ffoo);
-      break;
-    case 'a':
-      // pa - sine amplitude
-      parseok = read_float(buf, i, &sine_amp);
-      break;
-    case 'r':
-      // pr - random scale
-      parseok = read_float(buf, i, &rand_scale);
-      break;
-    case 'm':
-      // pm - ramps-style move parameters
-      parseok = read_vector_int(buf, i, ramps_move_params, 6);
-      break;
-    }
+  case 'l':
+    // start a new interrupt load measurement
+#ifdef ISR_PROFILE
+    prof_reset();
+#endif
+    parseok = true;
     break;
   default :
     // didn't understand!
@@ -1281,9 +1105,9 @@ void parse_set_param(const char * buf, uint32_t *i, uint32_t count)
 }
 
 // Random number generator:
+static uint32_t z1 = 12345, z2 = 12345, z3 = 12345, z4 = 12345;
 uint32_t rand_uint32 (void)
 {
-   static uint32_t z1 = 12345, z2 = 12345, z3 = 12345, z4 = 12345;
    uint32_t b;
    b  = ((z1 << 6) ^ z1) >> 13;
    z1 = ((z1 & 4294967294U) << 18) ^ b;
@@ -1296,19 +1120,23 @@ uint32_t rand_uint32 (void)
    return (z1 ^ z2 ^ z3 ^ z4);
 }
 
-
-// sets the encoder tics per motor step parameter (and its inverse)
-void set_enc_tics_per_step(float etps)
+// saves/restores the generator's state (4 words), so a capture replay (capture.c) draws the same numbers.
+void rand_get_state(uint32_t *state)
 {
-  enc_tics_per_step = etps;
-  steps_per_enc_tic = 1.f / (float)etps;
+  state[0] = z1; state[1] = z2; state[2] = z3; state[3] = z4;
 }
+void rand_set_state(const uint32_t *state)
+{
+  z1 = state[0]; z2 = state[1]; z3 = state[2]; z4 = state[3];
+}
+
 
 // We are orverriding the systic ISR provided by Teensy because it now counts
 // in 10ms increments instead of 1ms. To keep compatibility with delay(), which
 // imc needs, I have reverted this to the stock version.
 void systick_isr(void)
 {
-  //systick_tenus_count += SYSTICK_UPDATE_TEN_US;
+  PROF_ISR(PROF_SYSTICK);
   systick_millis_count++;
+  time_tick();    // keeps the DWT time base (timebase.h) extended
 }
\ No newline at end of file
@@ -25,6 +25,7 @@
 #include "common.h"
 
 #include "param_hooks.h"
+#include "params.h"
 #include "qdenc.h"
 #include "spienc.h"
 #include "imc/parameters.h"
@@ -56,23 +57,40 @@ void param_reset_hook(void)
 void param_get_hook(volatile msg_get_param_t *msg ,rsp_get_param_t *rsp )
 {
   int32_t foo;
+  const param_desc_t *p;
   switch(msg->param_id)
   {
   case IMC_PARAM_LOCATION :// override requests for position with the encoder-driven position
     get_enc_value(&foo);
     rsp->value = (int32_t)((float)foo * steps_per_enc_tic);
     break;
+  default:
+    // registry parameters. The value is the parameter's binary form (floats as their IEEE bits); vectors don't
+    // fit in one message, so they're only reachable over usb.
+    if(msg->param_id >= PARAM_I2C_BASE && (p = param_by_id(msg->param_id - PARAM_I2C_BASE)) && 1 == p->count)
+    {
+      rsp->value = 0;
+      param_read(p, (uint8_t *)&rsp->value, sizeof(rsp->value));
+    }
   }
 }
 
 void param_set_hook(volatile msg_set_param_t *msg )
 {
-  int32_t foo;
+  const param_desc_t *p;
+  uint32_t value;
   switch(msg->param_id)
   {
   case IMC_PARAM_LOCATION :// also set the position of the encoder.
     set_enc_value((int32_t)((float)msg->param_value * enc_tics_per_step));
     path_imc(get_motor_position() * enc_tics_per_step);   // keep the controller from moving us back to where we were.
     break;
+  default:
+    // registry parameters (see param_get_hook)
+    if(msg->param_id >= PARAM_I2C_BASE && (p = param_by_id(msg->param_id - PARAM_I2C_BASE)) && 1 == p->count)
+    {
+      value = msg->param_value;
+      param_write(p, (uint8_t *)&value, param_elem_size(p));
+    }
   }
 }
\ No newline at end of file
@@ -0,0 +1,391 @@
+/********************************************************************************
+ * Parameter Registry
+ * Ben Weiss, University of Washington 2014
+ * Purpose: One constant table describing every tunable parameter (binary id, text name,
+ *   type, element count, storage, limits and change callback), so the text get/set
+ *   commands in main.c, the binary protocol in bincmd.c and the IMC get/set parameter
+ *   messages (param_hooks.c) all read and write them the same way.
+ *
+ *   The table is indexed by id, so id lookups are a bounds check. Text names are found
+ *   through a small hash table built by params_init(); since no name is longer than
+ *   PARAM_NAME_MAX characters, a lookup hashes at most PARAM_NAME_MAX prefixes of the
+ *   command.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include <string.h>
+
+#include "params.h"
+#include "ctrl.h"
+#include "path.h"
+#include "stepper_hooks.h"
+#include "capture.h"
+#include "fra.h"
+#include "imc/utils.h"
+
+// Constants =========================================================================
+#define PARAM_HASH_SIZE   128U    // name hash table slots. Needs to be a power of 2, and well above PARAM_COUNT.
+#define PARAM_DUMP_HEAD   3       // bytes ahead of each value in a dump: id, type, count
+
+// Global Variables ==================================================================
+extern float pid_kp, pid_ki, pid_kd;
+extern float max_ctrl_vel, min_ctrl_vel;
+extern bool pos_ctrl_mode;
+extern uint32_t ctrl_feedforward_advance;
+extern bool ctrl_fixed_point;
+extern float fault_thresh;
+extern real darma_R[FILTER_MAX_SIZE];
+extern real darma_S[FILTER_MAX_SIZE];
+extern real darma_T[FILTER_MAX_SIZE];
+extern real comp_C_num[FILTER_MAX_SIZE];
+extern real comp_C_den[FILTER_MAX_SIZE - 1];
+extern real comp_F_num[FILTER_MAX_SIZE];
+extern real comp_F_den[FILTER_MAX_SIZE - 1];
+extern bool force_steps_per_minute;
+extern uint32_t sine_count;
+extern float sine_freq_base, sine_amp, rand_scale;
+extern float sine_freq_ratios[], sine_amps[], sine_phases[];
+extern uint32_t prbs_bits, prbs_period;
+extern float prbs_amp;
+extern float enc_tics_per_step;
+extern float steps_per_enc_tic;
+extern bool stream_ctrl_hist;
+extern uint32_t show_encoder_time;
+extern int32_t ramps_move_params[6];
+extern bool ramps_lookahead;
+extern float ramps_jerk;
+extern bool step_dda_mode;
+
+// Function Predeclares ==============================================================
+static void enc_tics_per_step_changed(void);
+static void sine_freq_changed(void);
+
+// Local Variables ===================================================================
+static const param_desc_t param_table[PARAM_COUNT] = {
+  // kf is held below FF_TARGETS - 1 (ctrl.c) so the feedforward ring never wraps onto the current target.
+  [PARAM_MAX_CTRL_VEL]    = {PARAM_MAX_CTRL_VEL,    "a",   PARAM_FLOAT,  1,                   &max_ctrl_vel,             0.f,    1e9f,   NULL},
+  [PARAM_MIN_CTRL_VEL]    = {PARAM_MIN_CTRL_VEL,    "i",   PARAM_FLOAT,  1,                   &min_ctrl_vel,             0.f,    1e9f,   NULL},
+  [PARAM_PID_KP]          = {PARAM_PID_KP,          "kpp", PARAM_FLOAT,  1,                   &pid_kp,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_PID_KI]          = {PARAM_PID_KI,          "kpi", PARAM_FLOAT,  1,                   &pid_ki,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_PID_KD]          = {PARAM_PID_KD,          "kpd", PARAM_FLOAT,  1,                   &pid_kd,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_POS_CTRL_MODE]   = {PARAM_POS_CTRL_MODE,   "km",  PARAM_BOOL,   1,                   &pos_ctrl_mode,            0.f,    0.f,    NULL},
+  [PARAM_FF_ADVANCE]      = {PARAM_FF_ADVANCE,      "kf",  PARAM_UINT32, 1,                   &ctrl_feedforward_advance, 0.f,    14.f,   NULL},
+  [PARAM_FIXED_POINT]     = {PARAM_FIXED_POINT,     "kq",  PARAM_BOOL,   1,                   &ctrl_fixed_point,         0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_DARMA_R]         = {PARAM_DARMA_R,         "kdr", PARAM_FLOAT,  FILTER_MAX_SIZE,     darma_R,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_DARMA_S]         = {PARAM_DARMA_S,         "kds", PARAM_FLOAT,  FILTER_MAX_SIZE,     darma_S,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_DARMA_T]         = {PARAM_DARMA_T,         "kdt", PARAM_FLOAT,  FILTER_MAX_SIZE,     darma_T,                   0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_COMP_C_NUM]      = {PARAM_COMP_C_NUM,      "kcn", PARAM_FLOAT,  FILTER_MAX_SIZE,     comp_C_num,                0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_COMP_C_DEN]      = {PARAM_COMP_C_DEN,      "kcd", PARAM_FLOAT,  FILTER_MAX_SIZE - 1, comp_C_den,                0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_COMP_F_NUM]      = {PARAM_COMP_F_NUM,      "kco", PARAM_FLOAT,  FILTER_MAX_SIZE,     comp_F_num,                0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_COMP_F_DEN]      = {PARAM_COMP_F_DEN,      "kcf", PARAM_FLOAT,  FILTER_MAX_SIZE - 1, comp_F_den,                0.f,    0.f,    ctrl_coefs_changed},
+  [PARAM_FORCE_SPM]       = {PARAM_FORCE_SPM,       "mf",  PARAM_BOOL,   1,                   &force_steps_per_minute,   0.f,    0.f,    NULL},
+  [PARAM_SINE_COUNT]      = {PARAM_SINE_COUNT,      "pc",  PARAM_UINT32, 1,                   &sine_count,               1.f,    5.f,    sine_freq_changed},
+  [PARAM_SINE_AMP]        = {PARAM_SINE_AMP,        "pa",  PARAM_FLOAT,  1,                   &sine_amp,                 0.f,    0.f,    NULL},
+  [PARAM_RAND_SCALE]      = {PARAM_RAND_SCALE,      "pr",  PARAM_FLOAT,  1,                   &rand_scale,               0.f,    1.f,    NULL},
+  [PARAM_FAULT_THRESH]    = {PARAM_FAULT_THRESH,    "kt",  PARAM_FLOAT,  1,                   &fault_thresh,             0.f,    1e9f,   NULL},
+  [PARAM_ENC_TICS_PER_STEP] = {PARAM_ENC_TICS_PER_STEP, "q", PARAM_FLOAT, 1,                  &enc_tics_per_step,        1e-3f,  1e3f,   enc_tics_per_step_changed},
+  [PARAM_SINE_FREQ]       = {PARAM_SINE_FREQ,       "pf",  PARAM_FLOAT,  1,                   &sine_freq_base,           0.f,    0.f,    sine_freq_changed},
+  [PARAM_STREAM_HIST]     = {PARAM_STREAM_HIST,     "s",   PARAM_BOOL,   1,                   &stream_ctrl_hist,         0.f,    0.f,    NULL},
+  [PARAM_SHOW_ENCODER]    = {PARAM_SHOW_ENCODER,    "o",   PARAM_UINT32, 1,                   &show_encoder_time,        0.f,    0.f,    NULL},
+  [PARAM_RAMPS_MOVE]      = {PARAM_RAMPS_MOVE,      "pm",  PARAM_INT32,  6,                   ramps_move_params,         0.f,    0.f,    NULL},
+  [PARAM_RAMPS_LOOKAHEAD] = {PARAM_RAMPS_LOOKAHEAD, "pl",  PARAM_BOOL,   1,                   &ramps_lookahead,          0.f,    0.f,    NULL},
+  [PARAM_RAMPS_JERK]      = {PARAM_RAMPS_JERK,      "pj",  PARAM_FLOAT,  1,                   &ramps_jerk,               0.f,    1e18f,  NULL},
+  [PARAM_STEP_DDA]        = {PARAM_STEP_DDA,        "md",  PARAM_BOOL,   1,                   &step_dda_mode,            0.f,    0.f,    step_dda_changed},
+  [PARAM_CAPTURE]         = {PARAM_CAPTURE,         "x",   PARAM_BOOL,   1,                   &capture_enabled,          0.f,    0.f,    cap_changed},
+  [PARAM_SINE_RATIOS]     = {PARAM_SINE_RATIOS,     "pfr", PARAM_FLOAT,  SINE_COUNT,          sine_freq_ratios,          -1e3f,  1e3f,   sine_freq_changed},
+  [PARAM_SINE_AMPS]       = {PARAM_SINE_AMPS,       "par", PARAM_FLOAT,  SINE_COUNT,          sine_amps,                 0.f,    0.f,    sine_freq_changed},
+  [PARAM_SINE_PHASES]     = {PARAM_SINE_PHASES,     "pph", PARAM_FLOAT,  SINE_COUNT,          sine_phases,               0.f,    0.f,    sine_freq_changed},
+  [PARAM_FRA_FREQ_LOW]    = {PARAM_FRA_FREQ_LOW,    "yl",  PARAM_FLOAT,  1,                   &fra_freq_low,             1e-3f,  1e4f,   NULL},
+  [PARAM_FRA_FREQ_HIGH]   = {PARAM_FRA_FREQ_HIGH,   "yh",  PARAM_FLOAT,  1,                   &fra_freq_high,            1e-3f,  1e4f,   NULL},
+  [PARAM_FRA_POINTS]      = {PARAM_FRA_POINTS,      "yn",  PARAM_UINT32, 1,                   &fra_points,               1.f,    FRA_MAX_POINTS, NULL},
+  [PARAM_FRA_AMP]         = {PARAM_FRA_AMP,         "ya",  PARAM_FLOAT,  1,                   &fra_amp,                  0.f,    0.f,    NULL},
+  [PARAM_FRA_CYCLES]      = {PARAM_FRA_CYCLES,      "yc",  PARAM_UINT32, 1,                   &fra_cycles,               1.f,    1000.f, NULL},
+  [PARAM_FRA_SETTLE]      = {PARAM_FRA_SETTLE,      "ys",  PARAM_UINT32, 1,                   &fra_settle,               0.f,    1000.f, NULL},
+  [PARAM_PRBS_BITS]       = {PARAM_PRBS_BITS,       "pnb", PARAM_UINT32, 1,                   &prbs_bits,                2.f,    24.f,   NULL},
+  [PARAM_PRBS_AMP]        = {PARAM_PRBS_AMP,        "pna", PARAM_FLOAT,  1,                   &prbs_amp,                 0.f,    0.f,    NULL},
+  [PARAM_PRBS_PERIOD]     = {PARAM_PRBS_PERIOD,     "pnt", PARAM_UINT32, 1,                   &prbs_period,              1.f,    1e6f,   NULL},
+};
+
+static uint8_t param_hash[PARAM_HASH_SIZE];     // param ids by hash of their names; 0 = empty slot
+
+
+// hash of the first len characters of name
+static uint32_t param_name_hash(const char *name, uint32_t len)
+{
+  uint32_t h = 0;
+  for(uint32_t k = 0; k < len; k++)
+    h = h * 31 + (uint8_t)name[k];
+  return h & (PARAM_HASH_SIZE - 1);
+}
+
+// builds the name hash table. Call once at startup, before any of the other param_ functions.
+void params_init(void)
+{
+  uint32_t h;
+
+  memset(param_hash, 0, sizeof(param_hash));
+  for(uint32_t id = 1; id < PARAM_COUNT; id++)
+  {
+    if(!param_table[id].name)
+      continue;
+    h = param_name_hash(param_table[id].name, strlen(param_table[id].name));
+    while(param_hash[h])
+      h = (h + 1) & (PARAM_HASH_SIZE - 1);
+    param_hash[h] = id;
+  }
+}
+
+// finds a parameter by its id. Returns NULL if there is no such parameter.
+const param_desc_t *param_by_id(uint32_t id)
+{
+  if(id >= PARAM_COUNT || !param_table[id].name)
+    return NULL;
+  return param_table + id;
+}
+
+// finds the parameter whose name starts buf + *i (the longest match wins). If one is found, *i is advanced
+// past the name. Returns NULL (and leaves *i alone) otherwise.
+const param_desc_t *param_by_name(const char *buf, uint32_t *i)
+{
+  const char *name = buf + *i;
+  uint32_t avail, h;
+  const param_desc_t *p;
+
+  for(avail = 0; avail < PARAM_NAME_MAX && name[avail]; avail++)
+    ;
+  for(uint32_t len = avail; len > 0; len--)
+  {
+    for(h = param_name_hash(name, len); param_hash[h]; h = (h + 1) & (PARAM_HASH_SIZE - 1))
+    {
+      p = param_table + param_hash[h];
+      if(0 == strncmp(name, p->name, len) && 0 == p->name[len])
+      {
+        *i += len;
+        return p;
+      }
+    }
+  }
+  return NULL;
+}
+
+// size of one element of p, in bytes
+uint32_t param_elem_size(const param_desc_t *p)
+{
+  return (PARAM_BOOL == p->type) ? sizeof(bool) : 4;
+}
+
+// clamps p to its limits and lets its owner know it changed. Called after every set.
+static void param_changed(const param_desc_t *p)
+{
+  if(p->min < p->max)
+  {
+    for(uint32_t k = 0; k < p->count; k++)
+    {
+      switch(p->type)
+      {
+      case PARAM_FLOAT:
+        ((float *)p->ptr)[k] = max(p->min, min(p->max, ((float *)p->ptr)[k]));
+        break;
+      case PARAM_INT32:
+        ((int32_t *)p->ptr)[k] = max((int32_t)p->min, min((int32_t)p->max, ((int32_t *)p->ptr)[k]));
+        break;
+      case PARAM_UINT32:
+        ((uint32_t *)p->ptr)[k] = max((uint32_t)p->min, min((uint32_t)p->max, ((uint32_t *)p->ptr)[k]));
+        break;
+      case PARAM_BOOL:
+        break;
+      }
+    }
+  }
+  if(p->on_change)
+    p->on_change();
+  cap_param(p);
+}
+
+// writes element k of p to str (size characters available) as text. Returns the number of characters written.
+static uint32_t param_format(const param_desc_t *p, uint32_t k, char *str, uint32_t size)
+{
+  int len = 0;
+  switch(p->type)
+  {
+  case PARAM_FLOAT:
+    len = snprintf(str, size, "%f ", ((float *)p->ptr)[k]);
+    break;
+  case PARAM_INT32:
+    len = snprintf(str, size, "%li ", (long)((int32_t *)p->ptr)[k]);
+    break;
+  case PARAM_UINT32:
+    len = snprintf(str, size, "%lu ", (unsigned long)((uint32_t *)p->ptr)[k]);
+    break;
+  case PARAM_BOOL:
+    len = snprintf(str, size, "%i ", ((bool *)p->ptr)[k] ? 1 : 0);
+    break;
+  }
+  return min((uint32_t)max(len, 0), size - 1);
+}
+
+// prints the value of p over usb as text (the reply to gX). Vectors are printed up to their last non-zero element.
+void param_print(const param_desc_t *p)
+{
+  char line[200];
+  uint32_t len = 0, m = p->count - 1;
+  const uint8_t *elem;
+
+  // trim trailing zeros
+  for(; m > 0; m--)
+  {
+    elem = (const uint8_t *)p->ptr + m * param_elem_size(p);
+    if(PARAM_BOOL == p->type ? *(bool *)elem : *(uint32_t *)elem)   // 0.f is all zero bits too
+      break;
+  }
+  for(uint32_t k = 0; k <= m; k++)
+    len += param_format(p, k, line + len, sizeof(line) - len);
+  line[len - 1] = '\n';     // replaces the last separator
+  hid_print(line, len, 100);
+}
+
+// reads one element of p from text at buf + *i into element k. Returns true if successful.
+static bool param_parse_elem(const param_desc_t *p, uint32_t k, const char *buf, uint32_t *i)
+{
+  int read;
+  float ffoo;
+  long foo;
+  unsigned long ufoo;
+
+  switch(p->type)
+  {
+  case PARAM_FLOAT:
+    if(sscanf(buf + *i, " %f%n", &ffoo, &read) != 1)
+      return false;
+    ((float *)p->ptr)[k] = ffoo;
+    break;
+  case PARAM_INT32:
+  case PARAM_BOOL:
+    if(sscanf(buf + *i, " %li%n", &foo, &read) != 1)
+      return false;
+    if(PARAM_BOOL == p->type)
+      ((bool *)p->ptr)[k] = (foo != 0);
+    else
+      ((int32_t *)p->ptr)[k] = foo;
+    break;
+  case PARAM_UINT32:
+    if(sscanf(buf + *i, " %lu%n", &ufoo, &read) != 1)
+      return false;
+    ((uint32_t *)p->ptr)[k] = ufoo;
+    break;
+  }
+  *i += read;
+  return true;
+}
+
+// parses a new value for p from text at buf + *i (the argument of sX). Vectors are cleared first, then
+// filled with as many elements as are given. Returns true if successful.
+bool param_parse(const param_desc_t *p, const char *buf, uint32_t *i)
+{
+  if(1 == p->count)
+  {
+    if(!param_parse_elem(p, 0, buf, i))
+      return false;
+  }
+  else
+  {
+    vmemset(p->ptr, 0, param_elem_size(p) * p->count);
+    for(uint32_t k = 0; k < p->count; k++)
+      if(!param_parse_elem(p, k, buf, i))
+        break;    // we're done!
+  }
+  param_changed(p);
+  return true;
+}
+
+// copies the value of p to dest (binary, size bytes available). Returns the number of bytes written, or 0
+// if it doesn't fit.
+uint32_t param_read(const param_desc_t *p, uint8_t *dest, uint32_t size)
+{
+  uint32_t len = param_elem_size(p) * p->count;
+
+  if(len > size)
+    return 0;
+  vmemcpy(dest, p->ptr, len);
+  return len;
+}
+
+// sets p from the binary value at src (size bytes). Vectors may be sent short; missing elements are set to 0,
+// just like the text interface. Returns false if size isn't a whole number of elements or is too long.
+bool param_write(const param_desc_t *p, const uint8_t *src, uint32_t size)
+{
+  uint32_t elem = param_elem_size(p);
+
+  if(0 == size || size % elem || size > elem * p->count)
+    return false;
+  if(PARAM_BOOL == p->type)
+  {
+    for(uint32_t k = 0; k < p->count; k++)
+      ((bool *)p->ptr)[k] = (k < size && src[k] != 0);
+  }
+  else
+  {
+    vmemset(p->ptr, 0, elem * p->count);
+    vmemcpy(p->ptr, (volatile void *)src, size);
+  }
+  param_changed(p);
+  return true;
+}
+
+// packs as many parameters as fit in dest (size bytes), starting with id *next_id, each as id (uint8),
+// type (uint8), count (uint8) and then the value as param_read gives it. *next_id is advanced past the last
+// parameter packed, and is PARAM_COUNT once everything has been sent. Returns the number of bytes used.
+uint32_t param_dump(uint8_t *dest, uint32_t size, uint32_t *next_id)
+{
+  const param_desc_t *p;
+  uint32_t used = 0, len;
+
+  for(; *next_id < PARAM_COUNT; (*next_id)++)
+  {
+    if(!(p = param_by_id(*next_id)))
+      continue;
+    len = param_elem_size(p) * p->count;
+    if(used + PARAM_DUMP_HEAD + len > size)
+      break;
+    dest[used++] = p->id;
+    dest[used++] = p->type;
+    dest[used++] = p->count;
+    used += param_read(p, dest + used, len);
+  }
+  return used;
+}
+
+// the sine parameters are only used through the tables path_sines_setfreq builds; rebuild them.
+static void sine_freq_changed(void)
+{
+  path_sines_setfreq(sine_freq_base);
+}
+
+static void enc_tics_per_step_changed(void)
+{
+  steps_per_enc_tic = 1.f / enc_tics_per_step;
+}
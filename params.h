@@ -0,0 +1,117 @@
+/* Parameter table 
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2014 Ben Weiss
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __params_h
+#define __params_h
+
+#include "common.h"
+
+// Element types a parameter can have. Over the binary protocol, every type travels as its
+// little-endian in-memory representation (PARAM_BOOL is one byte).
+typedef enum {
+  PARAM_FLOAT,
+  PARAM_INT32,
+  PARAM_UINT32,
+  PARAM_BOOL
+} __attribute__ ((packed)) param_type;
+
+// Parameter ids, as used by the binary protocol (bincmd.c) and, offset by PARAM_I2C_BASE, the IMC
+// get/set parameter messages (param_hooks.c). These go out to host scripts, so only ever add to the end
+// of this list.
+typedef enum {
+  PARAM_NONE = 0,
+  PARAM_MAX_CTRL_VEL,     // a
+  PARAM_MIN_CTRL_VEL,     // i
+  PARAM_PID_KP,           // kpp
+  PARAM_PID_KI,           // kpi
+  PARAM_PID_KD,           // kpd
+  PARAM_POS_CTRL_MODE,    // km
+  PARAM_FF_ADVANCE,       // kf
+  PARAM_FIXED_POINT,      // kq
+  PARAM_DARMA_R,          // kdr
+  PARAM_DARMA_S,          // kds
+  PARAM_DARMA_T,          // kdt
+  PARAM_COMP_C_NUM,       // kcn
+  PARAM_COMP_C_DEN,       // kcd
+  PARAM_COMP_F_NUM,       // kco
+  PARAM_COMP_F_DEN,       // kcf
+  PARAM_FORCE_SPM,        // mf
+  PARAM_SINE_COUNT,       // pc
+  PARAM_SINE_AMP,         // pa
+  PARAM_RAND_SCALE,       // pr
+  PARAM_FAULT_THRESH,     // kt
+  PARAM_ENC_TICS_PER_STEP,  // q
+  PARAM_SINE_FREQ,        // pf
+  PARAM_STREAM_HIST,      // s
+  PARAM_SHOW_ENCODER,     // o
+  PARAM_RAMPS_MOVE,       // pm
+  PARAM_RAMPS_LOOKAHEAD,  // pl
+  PARAM_RAMPS_JERK,       // pj
+  PARAM_STEP_DDA,         // md
+  PARAM_CAPTURE,          // x
+  PARAM_SINE_RATIOS,      // pfr
+  PARAM_SINE_AMPS,        // par
+  PARAM_SINE_PHASES,      // pph
+  PARAM_FRA_FREQ_LOW,     // yl
+  PARAM_FRA_FREQ_HIGH,    // yh
+  PARAM_FRA_POINTS,       // yn
+  PARAM_FRA_AMP,          // ya
+  PARAM_FRA_CYCLES,       // yc
+  PARAM_FRA_SETTLE,       // ys
+  PARAM_PRBS_BITS,        // pnb
+  PARAM_PRBS_AMP,         // pna
+  PARAM_PRBS_PERIOD,      // pnt
+  PARAM_COUNT
+} param_id;
+
+#define PARAM_NAME_MAX    3       // longest parameter name
+#define PARAM_I2C_BASE    0x80    // IMC parameter ids from here up are registry parameters (id - PARAM_I2C_BASE)
+
+// One entry of the parameter registry. Everything that is stored in a variable is in the registry; only
+// computed values and commands (t, mp, f, ku, u, d, r, w, l, y) are left to main.c's
+// parse_get_param/parse_set_param.
+typedef struct {
+  param_id id;
+  const char *name;       // text interface name (the X in gX/sX)
+  param_type type;
+  uint8_t count;          // number of elements (> 1 for vectors)
+  void *ptr;
+  real min, max;          // every element is clamped to [min, max] when set. Not checked if min >= max.
+  void (*on_change)(void);  // called after every set, or NULL
+} param_desc_t;
+
+void params_init(void);
+
+const param_desc_t *param_by_id(uint32_t id);
+const param_desc_t *param_by_name(const char *buf, uint32_t *i);
+uint32_t param_elem_size(const param_desc_t *p);
+
+void param_print(const param_desc_t *p);
+bool param_parse(const param_desc_t *p, const char *buf, uint32_t *i);
+uint32_t param_read(const param_desc_t *p, uint8_t *dest, uint32_t size);
+bool param_write(const param_desc_t *p, const uint8_t *src, uint32_t size);
+uint32_t param_dump(uint8_t *dest, uint32_t size, uint32_t *next_id);
+
+#endif
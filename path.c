@@ -14,6 +14,10 @@
  *        interpolates between the datapoints to generate the pos and vel targets.
  *   - Sines - generates position (tics) and velocity (tics/min) data using summed sinusoids
  *        for system identification purposes.
+ *   - PRBS - steps the position target between center - pna and center + pna by a maximum
+ *        length pseudo-random binary sequence, for system identification. The sequence is
+ *        fixed by its register length, so a host can regenerate it from the parameters alone
+ *        (see path_prbs_start).
  * After a RAMPS or Custom move is finished, the path module automatically switches to Step
  * to maintain the final value of the previous move.
  *
@@ -52,26 +56,46 @@
 #include <stdio.h>
 
 #include "imc/stepper.h"
+#include "imc/queue.h"
 #include "imc/utils.h"
 #include "qdenc.h"
 #include "spienc.h"
 #include "path.h"
+#include "ctrl.h"
+#include "fra.h"
+#include "capture.h"
 
 // Constants ==========================================================================
 #define MAX_CUSTOM_PATH_LENGTH    100     // maximum number of control nodes for a custom path.
-#define SINE_COUNT                5       // number of sines for sinusoidal path
-const float def_sine_freqs[SINE_COUNT] = {1., 0.865, 0.77777, 0.425, 0.33333};    // rad/tenus
-const float sine_shifts[SINE_COUNT] = {0.5, 1.0, -0.2, 0.7, -1.3};            // sine shifts
+#define SINE_RESYNC_STEPS         256     // sine path updates between exact recomputations of the oscillators
+#define PRBS_MAX_BITS             24      // longest PRBS register (pnb)
+#define RAMPS_MAX_SEGS            7       // segments in a RAMPS move. A jerk-limited move uses all 7; a trapezoid, 3.
+#define SCURVE_BISECT_STEPS       16      // iterations used to find the peak velocity of a short jerk-limited move
+#define RAMPS_MAX_STEP            0x10000U  // longest time (tenus) ramps_advance covers in one go, to keep its products in range
+// Fixed-point scales of the RAMPS move state. Each one is 8 bits finer than the one before it, so
+// every term in ramps_advance lines up with one 8-bit shift.
+#define RAMPS_Q_X                 4294967296.f          // 2^32. position, tics
+#define RAMPS_Q_V                 1099511627776.f       // 2^40. velocity, tics/tenus
+#define RAMPS_Q_A                 281474976710656.f     // 2^48. acceleration, tics/tenus^2
+#define RAMPS_Q_J                 72057594037927936.f   // 2^56. jerk, tics/tenus^3
 
 
 // Global Variables ====================================================================
 //extern uint32_t systick_millis_count;
 extern float max_ctrl_vel;
 extern float enc_tics_per_step;
-float sine_freq_base = 1;   // rad/sec
+float sine_freq_base = 1;   // Hz
 float sine_amp = 20;
+float sine_freq_ratios[SINE_COUNT] = {1., 0.865, 0.77777, 0.425, 0.33333};   // each sine's frequency, in sine_freq_base's
+float sine_amps[SINE_COUNT] = {1., 1., 1., 1., 1.};                         // each sine's amplitude, in sine_amp's
+float sine_phases[SINE_COUNT] = {0.5, 1.0, -0.2, 0.7, -1.3};                // each sine's phase at the start (rad)
 float rand_scale = 1.f;
+uint32_t prbs_bits = 9;       // PRBS register length (pnb); the sequence repeats every 2^pnb - 1 bits
+float prbs_amp = 20;          // PRBS amplitude (pna, tics)
+uint32_t prbs_period = 10;    // control updates per PRBS bit (pnt)
 uint32_t sine_count = 5;
+float ramps_jerk = 0;        // jerk limit for RAMPS moves (steps/min^3). 0 => trapezoidal profiles
+bool ramps_lookahead = true;  // start the next queued RAMPS block as soon as the current one ends, instead of after the sync handshake
 
 // Local Variables =====================================================================
 static pathmode_t pathmode;        // Type of path we are running.
@@ -80,10 +104,27 @@ static custom_path_dp_t custom_path[MAX_CUSTOM_PATH_LENGTH];
 static uint32_t custom_path_curloc = 0;   // upcoming location in the custom_path object
 static uint32_t custom_path_length = 0;   // length of current custom_path series.
 static uint32_t start_time = 0;    // time we started the current move.
+static uint32_t last_time = 0;     // elapsed time (since start_time) of the last path_get_target call
 static real last_target_pos = 0;
 static uint32_t ramps_moveid = 0;   // internal counter of the number of processed ramps moves.
 
-static struct {
+// state of a RAMPS move at some point in it, in the fixed-point units above.
+typedef struct {
+  uint32_t t;     // time since the start of the move (tenus)
+  int64_t x;      // position from the start of the move
+  int64_t v;      // velocity
+  int64_t a;      // acceleration
+} ramps_state_t;
+
+// one constant-jerk segment of a RAMPS move.
+typedef struct {
+  ramps_state_t start;  // state at the start of the segment. The evaluator re-anchors here.
+  int64_t j;            // jerk
+  int64_t j6;           // j / 6, so the control update doesn't need a 64-bit divide
+} ramps_seg_t;
+
+typedef struct {
+  // planning inputs. These are full-scale (the whole move, not just this axis) until the end of plan_ramps_move.
   real accel;
   real v_final;
   real v_init;
@@ -92,39 +133,92 @@ static struct {
 
   real start_pos;   // position when we started the move. This is defined as "x = 0"
   real dir;         // 1 => forward; -1 => backwards
-  bool short_move;  // true if we never reach v_nom during the move.
 
-  real t1;     // time (tenus) when we reach the nominal rate, if we get there, or the time we switch from accel to decel if we don't.
-  real t2;     // time (tenus) when we start decelerating
-  real t3;     // time (tenus) when move is complete
-
-  real x1;     // position at time t1.
-  real x2;     // position at time t2.
-
-  real vp;      // peak velocity in the event a move doesn't reach v_nom.
-} rmove;
+  uint32_t t3;      // time (tenus) when move is complete
+
+  uint8_t seg_count;
+  uint8_t cur_seg;  // segment we're in. Only moves forward as the move runs.
+  ramps_seg_t seg[RAMPS_MAX_SEGS];
+  ramps_state_t mark; // state at the last whole RAMPS_MAX_STEP into the current segment (see ramps_seek)
+  ramps_state_t now;  // state as of the last control update
+} ramps_move_t;
+static ramps_move_t rmove;    // move being executed
+static ramps_move_t rnext;    // next queued move, planned ahead while rmove runs (see ramps_lookahead)
+static const msg_queue_move_t *rnext_block = NULL;    // queue entry rnext was planned from, or NULL if rnext isn't valid
+static const msg_queue_move_t * volatile blended_block = NULL;  // block we blended into whose sync handshake hasn't arrived yet
+static volatile bool ramps_sync_owed = false;   // we finished blended_block before its handshake, and still need to signal sync
 static volatile real ramps_endpos = 0;
 
 static float sine_freqs[SINE_COUNT];    // rad/tenus
+static float sine_vel_amps[SINE_COUNT]; // sine_amps * sine_freqs
+static uint64_t sine_incs[SINE_COUNT];  // sine_freqs in 2^-64 turns/tenus, for the exact phases
+// Sine oscillators. Each sine is a unit vector (sine_sin, sine_cos) at its phase at sine_time, and moves on by
+// rotating through the phase it covers in one nominal control period (sine_period, us), whatever the jitter in
+// the measured update times. Every SINE_RESYNC_STEPS updates (or when the control period changes, or an update
+// was skipped) the vectors are re-anchored to the exact phases at the measured time, so neither the jitter nor
+// the rounding in the rotations ever adds up to a drift in amplitude or phase.
+static float sine_sin[SINE_COUNT], sine_cos[SINE_COUNT];
+static float sine_rot_sin[SINE_COUNT], sine_rot_cos[SINE_COUNT];
+static uint32_t sine_time, sine_period, sine_resync;
+static uint32_t sine_skip_tenus;        // a gap between updates longer than this means one was skipped
+
+// Feedback masks of maximum length Galois LFSRs, by register length: x^n + ... + 1 has bit k-1 set for each
+// x^k term but the 1. Every one of them runs through all 2^n - 1 nonzero states.
+static const uint32_t prbs_taps[PRBS_MAX_BITS + 1] = {
+  0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500, 0xE08, 0x1C80, 0x3802, 0x6000,
+  0xD008, 0x12000, 0x20400, 0x72000, 0x90000, 0x140000, 0x300000, 0x420000, 0xE10000
+};
+// PRBS path state. The parameters are latched when the path starts.
+static uint32_t prbs_state;         // the register, prbs_index steps from all ones
+static uint32_t prbs_mask;          // prbs_taps entry in use
+static uint32_t prbs_index;         // bit of the sequence the register is at
+static uint32_t prbs_count;         // control updates since the first one of the path
+static uint32_t prbs_bit_updates;   // length of a bit, in control updates
+static uint32_t prbs_update_us;     // control period
+static real prbs_center, prbs_level;  // the target is prbs_center +/- prbs_level
+static bool prbs_started;           // the first update has been computed
 
 // Local functions ========================================================
 void get_targets_ramps(volatile real *target_pos, volatile real *target_vel, uint32_t t);
+static void plan_ramps_move(ramps_move_t *m, volatile const msg_queue_move_t *move, real start_pos);
+static uint32_t plan_scurve(const ramps_move_t *m, real jerk, real *dur, real *acc, real *jrk);
+static void ramps_build_segs(ramps_move_t *m, uint32_t count, const real *dur, const real *acc, const real *jrk, real ratio);
+static void ramps_advance(ramps_state_t *s, const ramps_seg_t *g, uint32_t dt);
+static void ramps_seek(ramps_move_t *m, uint32_t t);
+static bool ramps_blend(uint32_t *t);
+static void ramps_lookahead_reset(void);
+static void set_step_target(int32_t target);
+static void sines_set_step(uint32_t period_us);
+static void sines_sync(uint32_t t);
 
 // tells Path to step instantly to target. This is primarily for debugging, as all real moves
 // are ramped moves set with path_set_move.
+// Like every path command, this releases a dumped history (ctrl.c:output_history), so the new move is recorded.
 void path_set_step_target(int32_t target)
+{
+  set_step_target(target);
+  release_history();
+  cap_path(CAP_PATH_STEP, start_time, &target, sizeof(target));
+}
+
+// path_set_step_target, without recording a capture - the path module's own steps replay on their own.
+static void set_step_target(int32_t target)
 {
   step_target = target;
   ramps_endpos = target;    // in case we do a ramps move next...
-  start_time = get_systick_tenus();
+  start_time = time_tenus();
   pathmode = PATH_STEP;
+  ramps_lookahead_reset();
 }
 
 void path_imc(real wait_pos)
 {
   ramps_endpos = wait_pos;
-  start_time = get_systick_tenus();
+  start_time = time_tenus();
   pathmode = PATH_RAMPS_WAITING;
+  ramps_lookahead_reset();
+  release_history();
+  cap_path(CAP_PATH_IMC, start_time, &wait_pos, sizeof(wait_pos));
 }
 
 // Implements a trapezoidal velocity profile move, as specified in the same way as packets from 
@@ -132,7 +226,16 @@ void path_imc(real wait_pos)
 // dated 5/31/2014
 void path_ramps_move(volatile msg_queue_move_t *move)
 {
-  real ratio;
+  // did get_targets_ramps already start this block when the last one ended? Then this call is just the
+  // sync handshake catching up with us, and the block keeps its timing.
+  if(move == blended_block)
+  {
+    blended_block = NULL;
+    if(PATH_RAMPS_MOVING != pathmode)
+      ramps_sync_owed = true;   // it's already finished too; signal that on the next control update
+    cap_path_move(move, start_time);
+    return;
+  }
 
   // put us in waiting mode, just in case the stepper interrupt runs while we're processing this section.
   if(PATH_RAMPS_MOVING == pathmode)
@@ -140,60 +243,248 @@ void path_ramps_move(volatile msg_queue_move_t *move)
     ramps_endpos = rmove.start_pos + rmove.x_total * rmove.dir;
     pathmode = PATH_RAMPS_WAITING;
   }
+  ramps_lookahead_reset();
 
-  start_time = get_systick_tenus();   //||\\ Change this later?
+  start_time = time_tenus();   //||\\ Change this later?
 
-  // set up the rmove structure. We will convert everything here into tics and seconds, and compute
+  plan_ramps_move(&rmove, move, (real)ramps_endpos);
+
+//  hid_printf("accel = %g, v_init = %g, v_final = %g\n\
+//v_nom = %g, x_total = %g, dir = %g\n\
+//start_pos = %g t3 = %lu, segments = %u\n",
+//                rmove.accel, rmove.v_init, rmove.v_final,
+//                rmove.v_nom, rmove.x_total, rmove.dir, 
+//                rmove.start_pos, rmove.t3, rmove.seg_count);
+
+  pathmode = PATH_RAMPS_MOVING;
+  ramps_moveid++;
+  release_history();
+  cap_path_move(move, start_time);
+}
+
+// Plans a trapezoidal move into m, starting from start_pos. This is the part of path_ramps_move that
+// doesn't touch the path state, so the lookahead can plan the next queued block while this one runs.
+static void plan_ramps_move(ramps_move_t *m, volatile const msg_queue_move_t *move, real start_pos)
+{
+  real ratio, t1, t2, t3, x1, x2, vp;
+  real dur[RAMPS_MAX_SEGS], acc[RAMPS_MAX_SEGS], jrk[RAMPS_MAX_SEGS];
+  uint32_t count;
+
+  // set up the move structure. We will convert everything here into tics and seconds, and compute
   // the move at full scale (without adjusting for the distance just this axis is supposed to move)
   // then scale according to the actual move length when we're done.
   ratio = (real)fabsf(move->length) / (real)move->total_length;
-  rmove.accel = (real)move->acceleration * enc_tics_per_step * MIN_PER_TENUS_F * MIN_PER_TENUS_F;   // (steps/min^2) * (tics/step) * (min/tenus)^2
-  rmove.v_init = (real)move->initial_rate * enc_tics_per_step * MIN_PER_TENUS_F;              // (steps/min) * (tics/step) * (min/tenus)
-  rmove.v_final = (real)move->final_rate * enc_tics_per_step * MIN_PER_TENUS_F;
-  rmove.v_nom = (real)move->nominal_rate * enc_tics_per_step * MIN_PER_TENUS_F;
-  rmove.x_total = (real)move->total_length * enc_tics_per_step;
-  rmove.dir = move->length >= 0 ? 1.f : -1.f;
-
-  rmove.start_pos = (real)ramps_endpos;      // position defined as "x = 0"
-
-  // compute t1 and t2
-  rmove.t1 = (rmove.v_nom - rmove.v_init) / rmove.accel;       // Eqn (2). Units: tenus.
-  rmove.x1 = rmove.t1 * (rmove.v_init + 0.5f * rmove.accel * rmove.t1);    // Eqn (1)
-  rmove.x2 = rmove.x_total - (rmove.v_nom * rmove.v_nom - rmove.v_final * rmove.v_final) / (2.f * rmove.accel);   // Eqn (9). Units: tics
-  rmove.t2 = rmove.t1 + (rmove.x2 - rmove.x1) / rmove.v_nom;    // Eqn (5). Units: tenus
-  rmove.t3 = rmove.t2 + (rmove.v_nom - rmove.v_final) / rmove.accel;
-
-  // is this a short move?
-  rmove.short_move = rmove.t1 > rmove.t2;
-  if(rmove.short_move)
+  m->accel = (real)move->acceleration * enc_tics_per_step * MIN_PER_TENUS_F * MIN_PER_TENUS_F;   // (steps/min^2) * (tics/step) * (min/tenus)^2
+  m->v_init = (real)move->initial_rate * enc_tics_per_step * MIN_PER_TENUS_F;              // (steps/min) * (tics/step) * (min/tenus)
+  m->v_final = (real)move->final_rate * enc_tics_per_step * MIN_PER_TENUS_F;
+  m->v_nom = (real)move->nominal_rate * enc_tics_per_step * MIN_PER_TENUS_F;
+  m->x_total = (real)move->total_length * enc_tics_per_step;
+  m->dir = move->length >= 0 ? 1.f : -1.f;
+
+  m->start_pos = start_pos;      // position defined as "x = 0"
+
+  // use a jerk-limited profile if we have a jerk limit. The trapezoid is the fallback for blocks too
+  // short to fit one.
+  count = 0;
+  if(ramps_jerk > 0)
+    count = plan_scurve(m, (real)ramps_jerk * enc_tics_per_step * MIN_PER_TENUS_F * MIN_PER_TENUS_F * MIN_PER_TENUS_F, dur, acc, jrk);
+  if(0 == count)
   {
-    rmove.vp = sqrtf(0.5f * (rmove.v_init * rmove.v_init + rmove.v_final * rmove.v_final + 2 * rmove.accel * rmove.x_total));
-    rmove.x1 = (rmove.vp * rmove.vp - rmove.v_init * rmove.v_init) / (2.f * rmove.accel);
-    rmove.t1 = (rmove.vp - rmove.v_init) / rmove.accel;
-    rmove.t3 = (2 * rmove.vp - rmove.v_init - rmove.v_final) / rmove.accel;
+    // compute t1 and t2
+    t1 = (m->v_nom - m->v_init) / m->accel;       // Eqn (2). Units: tenus. Time we reach the nominal rate.
+    x1 = t1 * (m->v_init + 0.5f * m->accel * t1);    // Eqn (1)
+    x2 = m->x_total - (m->v_nom * m->v_nom - m->v_final * m->v_final) / (2.f * m->accel);   // Eqn (9). Units: tics
+    t2 = t1 + (x2 - x1) / m->v_nom;    // Eqn (5). Units: tenus. Time we start decelerating.
+    t3 = t2 + (m->v_nom - m->v_final) / m->accel;
+
+    // is this a short move? (we never reach v_nom during the move)
+    if(t1 > t2)
+    {
+      vp = sqrtf(0.5f * (m->v_init * m->v_init + m->v_final * m->v_final + 2 * m->accel * m->x_total));   // peak velocity
+      t1 = (vp - m->v_init) / m->accel;
+      t3 = (2 * vp - m->v_init - m->v_final) / m->accel;
+      t2 = t1;    // there is no t2.
+    }
+
+    // accelerate, cruise, decelerate
+    dur[0] = t1;        acc[0] = m->accel;    jrk[0] = 0;
+    dur[1] = t2 - t1;   acc[1] = 0;           jrk[1] = 0;
+    dur[2] = t3 - t2;   acc[2] = -m->accel;   jrk[2] = 0;
+    count = 3;
   }
+  ramps_build_segs(m, count, dur, acc, jrk, ratio);
   
   // scale everything according to the actual move length in this axis:
-  rmove.accel *= ratio;
-  rmove.vp *= ratio;
-  rmove.v_final *= ratio;
-  rmove.v_init *= ratio;
-  rmove.v_nom *= ratio;
-  rmove.x1 *= ratio;
-  rmove.x2 *= ratio;
-  rmove.x_total *= ratio;
+  m->accel *= ratio;
+  m->v_final *= ratio;
+  m->v_init *= ratio;
+  m->v_nom *= ratio;
+  m->x_total *= ratio;
+}
 
-//  hid_printf("accel = %g, v_init = %g, v_final = %g\n\
-//v_nom = %g, x_total = %g, dir = %g\n\
-//start_pos = %g t1 = %g, t2 = %g, t3 = %g\n\
-//x1 = %g, x2 = %g, short_move = %i, vp = %g\n",
-//                rmove.accel, rmove.v_init, rmove.v_final,
-//                rmove.v_nom, rmove.x_total, rmove.dir, 
-//                rmove.start_pos, rmove.t1, rmove.t2, rmove.t3,
-//                rmove.x1, rmove.x2, rmove.short_move, rmove.vp);
+// Time (tenus) to change speed by dv from a standstill in acceleration, with the given jerk and
+// acceleration limits. Fills in the jerk (tj) and constant acceleration (ta) phase durations; the
+// whole change takes 2 * tj + ta and, since the profile is symmetric, covers the average of the
+// two speeds times that.
+static real scurve_ramp(real dv, real accel, real jerk, real *tj, real *ta)
+{
+  if(dv * jerk >= accel * accel)    // we reach full acceleration
+  {
+    *tj = accel / jerk;
+    *ta = dv / accel - *tj;
+  }
+  else
+  {
+    *tj = sqrtf(dv / jerk);
+    *ta = 0;
+  }
+  return 2.f * *tj + *ta;
+}
 
-  pathmode = PATH_RAMPS_MOVING;
-  ramps_moveid++;
+// Distance covered by the speed-up from m->v_init to vp and the slow-down from vp to m->v_final.
+// Fills in the phase times of both (see scurve_ramp).
+static real scurve_ramps_dist(const ramps_move_t *m, real vp, real jerk, real *tj1, real *ta1, real *tj2, real *ta2)
+{
+  return 0.5f * (m->v_init + vp) * scurve_ramp(vp - m->v_init, m->accel, jerk, tj1, ta1) +
+         0.5f * (m->v_final + vp) * scurve_ramp(vp - m->v_final, m->accel, jerk, tj2, ta2);
+}
+
+// Plans a 7-segment jerk-limited version of the (full-scale, unscaled) trapezoidal move in m, using the
+// same v_init, v_nom, v_final, accel and x_total. jerk is in tics/tenus^3. Fills in the duration,
+// starting acceleration and jerk of each segment for ramps_build_segs and returns the segment count,
+// or 0 if the move can't be done within those limits (the block is too short to change between
+// v_init and v_final under the jerk limit).
+static uint32_t plan_scurve(const ramps_move_t *m, real jerk, real *dur, real *acc, real *jrk)
+{
+  real vp, lo, hi, tj1, ta1, tj2, ta2, x_ramps;
+
+  if(m->v_nom < m->v_init || m->v_nom < m->v_final || m->accel <= 0)
+    return 0;
+
+  vp = m->v_nom;
+  if(scurve_ramps_dist(m, vp, jerk, &tj1, &ta1, &tj2, &ta2) > m->x_total)
+  {
+    // we never reach v_nom. Find the peak velocity that uses up exactly x_total.
+    lo = max(m->v_init, m->v_final);
+    if(scurve_ramps_dist(m, lo, jerk, &tj1, &ta1, &tj2, &ta2) > m->x_total)
+      return 0;
+    hi = vp;
+    for(uint32_t k = 0; k < SCURVE_BISECT_STEPS; k++)
+    {
+      vp = 0.5f * (lo + hi);
+      if(scurve_ramps_dist(m, vp, jerk, &tj1, &ta1, &tj2, &ta2) > m->x_total)
+        hi = vp;
+      else
+        lo = vp;
+    }
+    vp = lo;
+  }
+  x_ramps = scurve_ramps_dist(m, vp, jerk, &tj1, &ta1, &tj2, &ta2);   // also leaves the phase times for vp in tj1...ta2
+
+  // jerk up, constant acceleration, jerk down, cruise, jerk down, constant deceleration, jerk up
+  dur[0] = tj1;   acc[0] = 0;           jrk[0] = jerk;
+  dur[1] = ta1;   acc[1] = jerk * tj1;  jrk[1] = 0;
+  dur[2] = tj1;   acc[2] = jerk * tj1;  jrk[2] = -jerk;
+  dur[3] = (m->x_total - x_ramps) / vp;
+                  acc[3] = 0;           jrk[3] = 0;
+  dur[4] = tj2;   acc[4] = 0;           jrk[4] = -jerk;
+  dur[5] = ta2;   acc[5] = -jerk * tj2; jrk[5] = 0;
+  dur[6] = tj2;   acc[6] = -jerk * tj2; jrk[6] = jerk;
+  return 7;
+}
+
+// Fills in m's segment table from each segment's duration (tenus), starting acceleration and jerk, all
+// full-scale and scaled by ratio here. Segments start on whole tenus. Acceleration is set from acc at the
+// start of each segment, while position and velocity carry on from the end of the segment before, so the
+// target never jumps.
+// Rounding the durations to whole tenus (and ramps_advance's own rounding) leaves the end of the last segment
+// a little off the move length, so the last segment takes up the remainder: its velocity is trimmed by
+// whatever makes it end exactly on x_total, and the target doesn't jump to ramps_endpos when the move is done.
+static void ramps_build_segs(ramps_move_t *m, uint32_t count, const real *dur, const real *acc, const real *jrk, real ratio)
+{
+  ramps_state_t s;
+  ramps_seg_t *g;
+  uint32_t steps[RAMPS_MAX_SEGS], last = 0;
+  int64_t x_end, dv;
+
+  s.t = 0;
+  s.x = 0;
+  s.v = (int64_t)(m->v_init * ratio * RAMPS_Q_V);
+  for(uint32_t k = 0; k < count; k++)
+  {
+    g = &m->seg[k];
+    s.a = (int64_t)(acc[k] * ratio * RAMPS_Q_A);
+    g->start = s;
+    g->j = (int64_t)(jrk[k] * ratio * RAMPS_Q_J);
+    g->j6 = g->j / 6;
+    steps[k] = dur[k] > 0 ? (uint32_t)(dur[k] + 0.5f) : 0;
+    if(steps[k])
+      last = k;
+    ramps_advance(&s, g, steps[k]);
+  }
+
+  // (x_total * ratio is the same float the move length is scaled to, and converts to and from RAMPS_Q_X exactly)
+  x_end = (int64_t)(m->x_total * ratio * RAMPS_Q_X);
+  if(count && steps[last])
+  {
+    // (position goes with v * t >> 8 in these units; what's off is a fraction of a tic)
+    dv = (x_end - s.x) * 256 / (int64_t)steps[last];
+    s = m->seg[last].start;
+    s.v += dv;
+    for(uint32_t k = last; k < count; k++)
+    {
+      g = &m->seg[k];
+      s.a = g->start.a;
+      g->start = s;
+      ramps_advance(&s, g, steps[k]);
+    }
+  }
+  m->t3 = s.t;
+  m->seg_count = count;
+  m->cur_seg = 0;
+  m->mark = m->now = m->seg[0].start;
+}
+
+// Advances s by dt tenus along segment g, a few 64-bit multiplies per RAMPS_MAX_STEP of dt. Exact in time,
+// since dt is a whole number of tenus.
+static void ramps_advance(ramps_state_t *s, const ramps_seg_t *g, uint32_t dt)
+{
+  uint32_t step;
+  int64_t x_acc, v_acc;
+
+  while(dt > 0)
+  {
+    step = min(dt, RAMPS_MAX_STEP);
+    x_acc = (s->a >> 1) + ((g->j6 * step) >> 8);      // a/2 + j*dt/6
+    v_acc = s->a + (((g->j >> 1) * step) >> 8);       // a + j*dt/2
+    s->x += ((s->v + ((x_acc * step) >> 8)) * step) >> 8;
+    s->v += (v_acc * step) >> 8;
+    s->a += (g->j * step) >> 8;
+    s->t += step;
+    dt -= step;
+  }
+}
+
+// Brings m->now up to time t (tenus into the move). The state is worked out in the same steps ramps_build_segs
+// took from the start of the segment, so the rounding in ramps_advance never adds up over the updates and the
+// last segment ends exactly where it was planned to. Those steps are whole RAMPS_MAX_STEPs, so m->mark keeps
+// the state at the last one reached, and each update only advances from there: a single step at most.
+static void ramps_seek(ramps_move_t *m, uint32_t t)
+{
+  const ramps_seg_t *g;
+
+  while(m->cur_seg + 1 < m->seg_count && t >= m->seg[m->cur_seg + 1].start.t)
+    m->cur_seg++;
+  g = &m->seg[m->cur_seg];
+  // (a mark from an earlier segment, even a zero-length one ending where this starts, or ahead of t, starts
+  // over from the segment)
+  if(m->mark.t <= g->start.t || m->mark.t > t)
+    m->mark = g->start;
+  while(t - m->mark.t >= RAMPS_MAX_STEP)
+    ramps_advance(&m->mark, g, RAMPS_MAX_STEP);
+  m->now = m->mark;
+  if(t > m->now.t)
+    ramps_advance(&m->now, g, t - m->now.t);
 }
 
 uint32_t path_get_ramps_moveid(void)
@@ -207,6 +498,7 @@ void path_custom_clear(void)
   custom_path_curloc = 0;
   if(PATH_CUSTOM == pathmode)
     pathmode = PATH_STEP;
+  cap_path(CAP_PATH_CUSTOM_CLEAR, start_time, NULL, 0);
 }
 
 void path_custom_add_elem(const custom_path_dp_t *elem)
@@ -218,6 +510,16 @@ void path_custom_add_elem(const custom_path_dp_t *elem)
     custom_path[custom_path_length].time = elem->time;
     custom_path_length++;
   }
+  cap_path(CAP_PATH_CUSTOM_ADD, start_time, elem, sizeof(custom_path_dp_t));
+}
+
+// copies element i of the custom path to elem. Returns false past the end of the path.
+bool path_custom_get_elem(uint32_t i, custom_path_dp_t *elem)
+{
+  if(i >= custom_path_length)
+    return false;
+  *elem = custom_path[i];
+  return true;
 }
 
 void path_custom_start(void)
@@ -225,47 +527,189 @@ void path_custom_start(void)
   if(custom_path_length > 0)
   {
     pathmode = PATH_CUSTOM;
-    start_time = get_systick_tenus();
+    start_time = time_tenus();
     custom_path_curloc = 0;
   }
+  release_history();
+  cap_path(CAP_PATH_CUSTOM_START, start_time, NULL, 0);
 }
 
 void path_sines_start(void)
 {
   path_sines_setfreq(sine_freq_base);
   pathmode = PATH_SINES;
-  start_time = get_systick_tenus();
+  start_time = time_tenus();
+  release_history();
+  cap_path(CAP_PATH_SINES, start_time, NULL, 0);
 }
 
 void path_rand_start(void)
 {
   pathmode = PATH_RAND;
-  start_time = get_systick_tenus();
+  start_time = time_tenus();
+  release_history();
+  cap_path(CAP_PATH_RAND, start_time, NULL, 0);
 }
 
-// sets the frequency of the sine series. new_base_freq is the base frequency in Hz
+// Starts the PRBS path around the current target. Bit k of the sequence is the low bit of a Galois LFSR of pnb bits
+// after k steps from all ones, where a step shifts the register right and xors in prbs_taps[pnb] if the bit shifted
+// out was 1. The target is center + pna while the bit is 1, center - pna while it's 0. Each bit lasts exactly pnt
+// control updates, counted from the first update the path is computed for (an update the slow path missed still
+// counts, going by the time between updates), so jitter in the update times never moves a bit edge. The sequence only
+// depends on pnb, and the target on pna and pnt too, so data recorded during the path can be correlated with the
+// sequence on the host without sending it.
+void path_prbs_start(void)
+{
+  uint32_t bits = max(2U, min(prbs_bits, (uint32_t)PRBS_MAX_BITS));
+
+  prbs_mask = prbs_taps[bits];
+  prbs_state = (1U << bits) - 1;
+  prbs_index = 0;
+  prbs_update_us = max(1U, ctrl_get_period());
+  prbs_bit_updates = max(1U, prbs_period);
+  prbs_center = last_target_pos;
+  prbs_level = prbs_amp;
+  prbs_started = false;
+  pathmode = PATH_PRBS;
+  start_time = time_tenus();
+  release_history();
+  cap_path(CAP_PATH_PRBS, start_time, NULL, 0);
+}
+
+// starts a frequency response sweep around the current target. Returns false if the sweep parameters are bad.
+bool path_fra_start(void)
+{
+  if(!fra_start(last_target_pos, ctrl_get_period()))
+    return false;
+  pathmode = PATH_FRA;
+  start_time = time_tenus();
+  release_history();
+  cap_path(CAP_PATH_FRA, start_time, NULL, 0);
+  return true;
+}
+
+// Fills snap with the path state a capture starts from (see capture.c). The state of a RAMPS move under way,
+// of the lookahead, and of a frequency response sweep isn't included, so a replay of a capture started in the
+// middle of one only matches from the next path command on.
+void path_get_snap(path_snap_t *snap)
+{
+  uint32_t rand_state[4];
+
+  snap->mode = pathmode;
+  snap->step_target = step_target;
+  snap->start_time = start_time;
+  snap->last_time = last_time;
+  snap->last_target_pos = last_target_pos;
+  snap->ramps_endpos = ramps_endpos;
+  snap->ramps_moveid = ramps_moveid;
+  snap->custom_curloc = custom_path_curloc;
+  rand_get_state(rand_state);
+  memcpy(snap->rand_state, rand_state, sizeof(rand_state));
+  snap->sine_time = sine_time;
+  snap->sine_period = sine_period;
+  snap->sine_resync = sine_resync;
+  memcpy(snap->sine_sin, sine_sin, sizeof(sine_sin));
+  memcpy(snap->sine_cos, sine_cos, sizeof(sine_cos));
+  snap->prbs_state = prbs_state;
+  snap->prbs_mask = prbs_mask;
+  snap->prbs_index = prbs_index;
+  snap->prbs_count = prbs_count;
+  snap->prbs_bit_updates = prbs_bit_updates;
+  snap->prbs_update_us = prbs_update_us;
+  snap->prbs_center = prbs_center;
+  snap->prbs_level = prbs_level;
+  snap->prbs_started = prbs_started;
+}
+
+// Restores the path state saved by path_get_snap (with no RAMPS move planned or blended). The custom path
+// itself is loaded separately, with path_custom_add_elem, and the sine parameters with the others.
+void path_set_snap(const path_snap_t *snap)
+{
+  uint32_t rand_state[4];
+
+  pathmode = snap->mode;
+  step_target = snap->step_target;
+  start_time = snap->start_time;
+  last_time = snap->last_time;
+  last_target_pos = snap->last_target_pos;
+  ramps_endpos = snap->ramps_endpos;
+  ramps_moveid = snap->ramps_moveid;
+  custom_path_curloc = min(snap->custom_curloc, custom_path_length);
+  memcpy(rand_state, snap->rand_state, sizeof(rand_state));
+  rand_set_state(rand_state);
+  ramps_lookahead_reset();
+  sine_time = snap->sine_time;
+  sines_set_step(snap->sine_period);
+  sine_resync = snap->sine_resync;
+  memcpy(sine_sin, snap->sine_sin, sizeof(sine_sin));
+  memcpy(sine_cos, snap->sine_cos, sizeof(sine_cos));
+  prbs_state = snap->prbs_state;
+  prbs_mask = snap->prbs_mask;
+  prbs_index = snap->prbs_index;
+  prbs_count = snap->prbs_count;
+  prbs_bit_updates = max(1U, snap->prbs_bit_updates);
+  prbs_update_us = max(1U, snap->prbs_update_us);
+  prbs_center = snap->prbs_center;
+  prbs_level = snap->prbs_level;
+  prbs_started = snap->prbs_started;
+}
+
+// sets the frequency of the sine series. new_base_freq is the base frequency in Hz. Also picks up changes
+// to the other sine parameters; the oscillators start over from the exact phases at the next update.
 void path_sines_setfreq(float new_base_freq)
 {
+  float turns;
+
   sine_freq_base = new_base_freq;
   for(uint32_t i = 0; i < SINE_COUNT; i++)
   {
-    sine_freqs[i] = def_sine_freqs[i] * sine_freq_base * 2 * PI * 0.00001f;   // convert from hz to rad/tenus
+    sine_freqs[i] = sine_freq_ratios[i] * sine_freq_base * 2 * PI * 0.00001f;   // convert from hz to rad/tenus
+    sine_vel_amps[i] = sine_amps[i] * sine_freqs[i];
+    // (anything past half a turn per tenus is aliased anyway)
+    turns = fminf(fabsf(sine_freq_ratios[i] * sine_freq_base * 0.00001f), 0.5f) * 18446744073709551616.f;
+    sine_incs[i] = (uint64_t)turns;
+    if(sine_freqs[i] < 0)
+      sine_incs[i] = -sine_incs[i];
   }
+  sines_set_step(0);
+  sine_resync = 0;
 }
 
-// curtime is the defined time of this update step, created with a query to get_systic_tenus()
+// sets the oscillators up to rotate through one control period (us) of each sine per update
+static void sines_set_step(uint32_t period_us)
+{
+  sine_period = period_us;
+  sine_skip_tenus = (period_us + period_us / 2) / 10;
+  for(uint32_t i = 0; i < SINE_COUNT; i++)
+  {
+    sine_rot_sin[i] = sinf(sine_freqs[i] * (0.1f * period_us));
+    sine_rot_cos[i] = cosf(sine_freqs[i] * (0.1f * period_us));
+  }
+}
+
+// recomputes the oscillators from the exact phases at t (tenus since the start of the path). The phase is
+// worked out in fixed point, so it stays exact however long the path runs.
+static void sines_sync(uint32_t t)
+{
+  float phase;
+
+  for(uint32_t i = 0; i < sine_count; i++)
+  {
+    phase = (float)(uint32_t)((sine_incs[i] * t) >> 32) * (2 * PI / 4294967296.f) + sine_phases[i];
+    sine_sin[i] = sinf(phase);
+    sine_cos[i] = cosf(phase);
+  }
+  sine_resync = SINE_RESYNC_STEPS;
+}
+
+// curtime is the defined time of this update step, created with a query to time_tenus()
 // at the beginning of the control update.
 void path_get_target(volatile real *target_pos, volatile real *target_vel, uint32_t curtime)
 {
-  static uint32_t last_time = 0;
   uint32_t i, elapsed_time;
   int32_t foo;
 
-  // check for counter rollover
-  if(curtime < start_time)
-    elapsed_time = curtime + UINT32_MAX - start_time;
-  else
-    elapsed_time = curtime - start_time;
+  elapsed_time = curtime - start_time;    // (right across time_tenus() rollovers too)
 
 
   switch(pathmode)
@@ -276,6 +720,12 @@ void path_get_target(volatile real *target_pos, volatile real *target_vel, uint3
     break;
   case PATH_RAMPS_WAITING:
     // waiting for a new move packet (buffer was empty last time we tried)
+    if(ramps_sync_owed && st.state == STATE_EXECUTE)
+    {
+      // the handshake for a block we had already finished just came in; signal that we're done with it.
+      ramps_sync_owed = false;
+      enter_sync_state();
+    }
     *target_pos = (real)ramps_endpos;
     *target_vel = (real)0.;
     break;
@@ -300,7 +750,7 @@ void path_get_target(volatile real *target_pos, volatile real *target_vel, uint3
         }
         if(i == custom_path_length)   // we've exhausted the move sequence
         {
-          path_set_step_target((int32_t)custom_path[custom_path_length - 1].target_pos);
+          set_step_target((int32_t)custom_path[custom_path_length - 1].target_pos);
           *target_pos = (real)custom_path[custom_path_length - 1].target_pos;
           *target_vel = (real)0;
           break;
@@ -323,25 +773,90 @@ void path_get_target(volatile real *target_pos, volatile real *target_vel, uint3
     }
     break;
   case PATH_SINES :
-    *target_pos = 0;
-    *target_vel = 0;
-    for(uint32_t i = 0; i < sine_count; i++)
     {
-      float t = fmodf(elapsed_time, 2*PI / sine_freqs[i]);
-      *target_pos += sine_amp * sinf(sine_freqs[i] * t + sine_shifts[i]);
-      *target_vel += sine_amp * sine_freqs[i] * cosf(sine_freqs[i] * t + sine_shifts[i]);
+      // step each oscillator on by one control period: rotate it through one update's worth of its sine,
+      // unless the period changed, an update was skipped, or it's time to recompute them.
+      real pos = 0, vel = 0, s;
+      uint32_t period = ctrl_get_period();
+
+      if(period != sine_period)
+      {
+        sines_set_step(period);
+        sine_resync = 0;
+      }
+      if(elapsed_time - sine_time > sine_skip_tenus)
+        sine_resync = 0;
+      if(!sine_resync)
+        sines_sync(elapsed_time);
+      else
+      {
+        for(uint32_t i = 0; i < sine_count; i++)
+        {
+          s = sine_sin[i] * sine_rot_cos[i] + sine_cos[i] * sine_rot_sin[i];
+          sine_cos[i] = sine_cos[i] * sine_rot_cos[i] - sine_sin[i] * sine_rot_sin[i];
+          sine_sin[i] = s;
+        }
+      }
+      sine_resync--;
+      sine_time = elapsed_time;
+
+      for(uint32_t i = 0; i < sine_count; i++)
+      {
+        pos += sine_amps[i] * sine_sin[i];
+        vel += sine_vel_amps[i] * sine_cos[i];
+      }
+      *target_pos = sine_amp * pos;
+      // convert from target_vel being in steps/tenus to steps/min
+      *target_vel = sine_amp * TENUS_PER_MIN_F * vel;
     }
-    // convert from target_vel being in steps/tenus to steps/min
-    *target_vel *= TENUS_PER_MIN_F;
     break;
   case PATH_RAND :
     {
-      // move by at most max_ctrl_vel tics/minute.
-      *target_vel = 0;      // I don't want to think about how to set this right now...
+      // move at a random velocity of at most max_ctrl_vel tics/minute. The target got here from the last update
+      // at that velocity, so that's the velocity target too.
       if(elapsed_time - last_time < 50000U)   // if it's been < 50ms
-        *target_pos = last_target_pos + rand_scale * 2.f * ((real)rand_uint32() - (real)UINT_FAST32_MAX * 0.5f) / (real)UINT_FAST32_MAX * (real)max_ctrl_vel / TENUS_PER_MIN_F * (real)(elapsed_time - last_time);
+      {
+        *target_vel = rand_scale * 2.f * ((real)rand_uint32() - (real)UINT32_MAX * 0.5f) / (real)UINT32_MAX * (real)max_ctrl_vel;
+        *target_pos = last_target_pos + *target_vel / TENUS_PER_MIN_F * (real)(elapsed_time - last_time);
+      }
       else
+      {
         *target_pos = last_target_pos;
+        *target_vel = 0;
+      }
+    }
+    break;
+  case PATH_PRBS :
+    {
+      uint32_t dt = elapsed_time - last_time, bit;
+      real dt_tenus = (real)dt;
+
+      // count this update, and any the slow path missed. (If time went backwards, stay on the update we have.)
+      if(!prbs_started)
+      {
+        prbs_count = 0;
+        dt_tenus = 0.1f * prbs_update_us;
+        prbs_started = true;
+      }
+      else if((int32_t)dt > 0)
+        prbs_count += max(1U, (dt * 10 + prbs_update_us / 2) / prbs_update_us);
+      // step the register on to the bit we're in
+      bit = prbs_count / prbs_bit_updates;
+      for(; prbs_index < bit; prbs_index++)
+        prbs_state = (prbs_state >> 1) ^ ((prbs_state & 1) ? prbs_mask : 0);
+      *target_pos = prbs_center + ((prbs_state & 1) ? prbs_level : -prbs_level);
+      // the target is flat but for its steps; a step's velocity is what covers it in the update it happens in,
+      // so a controller that feeds the velocity forward makes the whole step right away.
+      *target_vel = dt_tenus > 0 ? (*target_pos - last_target_pos) * TENUS_PER_MIN_F / dt_tenus : 0;
+    }
+    break;
+  case PATH_FRA :
+    if(!fra_target(elapsed_time, target_pos, target_vel))
+    {
+      // the sweep is over; hold at its center
+      set_step_target((int32_t)lroundf(last_target_pos));
+      *target_pos = (real)step_target;
+      *target_vel = 0;
     }
     break;
   default :
@@ -359,8 +874,9 @@ void path_get_target(volatile real *target_pos, volatile real *target_vel, uint3
 // gets the targets when in a RAMPS move, using the contents of the rmove structure.
 void get_targets_ramps(volatile real *target_pos, volatile real *target_vel, uint32_t t)
 {
-  // check for stepper module errors (IMC end stop hit, etc.)
-  if(st.state != STATE_EXECUTE)
+  // check for stepper module errors (IMC end stop hit, etc.). After blending into a block, the stepper
+  // module stays in STATE_SYNC until the handshake for that block arrives.
+  if(st.state != STATE_EXECUTE && !(blended_block && st.state == STATE_SYNC))
   {
     // Something went horribly wrong!
     hid_printf("'Unexpected stepper state change in get_targets_ramps!\n");
@@ -372,67 +888,78 @@ void get_targets_ramps(volatile real *target_pos, volatile real *target_vel, uin
     return;
   }
 
-
-  // short move?
-  if(rmove.short_move)   // we never reach the flat part of the trapezoid. This move has a trianglular velocity profile
+  // plan the next queued block while this one runs, so it's ready to start the moment this one ends.
+  // While a blended block's handshake is pending, peek_block(0) is still that block; wait for it to be dequeued.
+  if(ramps_lookahead && !rnext_block && !blended_block)
   {
-    if(t < rmove.t1)
-    {
-      *target_pos = t * (rmove.v_init + 0.5f * rmove.accel * t);    // Eqn (11)
-      *target_vel = rmove.v_init + rmove.accel * t;                                               // Eqn (12)
-    }
-    else if(t < rmove.t3)   // there is no t2.
+    const msg_queue_move_t *next = peek_block(0);
+    if(next)
     {
-      *target_pos = rmove.x1 + (t - rmove.t1) * (rmove.vp - 0.5f * rmove.accel * (t - rmove.t1));
-      *target_vel = rmove.vp - rmove.accel * (t - rmove.t1);
-    }
-    else    // move finished
-    {
-      pathmode = PATH_RAMPS_WAITING;
-      ramps_endpos = rmove.start_pos + rmove.dir * rmove.x_total;
-      *target_pos = ramps_endpos;
-      *target_vel = rmove.v_final * TENUS_PER_MIN_F * rmove.dir;
-      enter_sync_state();   // tell the stepper module to float the sync line, signaling we're finished with the move.
-      //hid_printf("'Done with short move. Cur Time: %u Move Time: %u\n", get_systick_tenus(), get_systick_tenus() - start_time);
-      return;   // don't need to do the final conversions, and besides, once entering sync_state, the contents of rmove could change on a higher-priority interrupt.
+      cap_queue_peek(next);
+      plan_ramps_move(&rnext, next, rmove.start_pos + rmove.dir * rmove.x_total);
+      rnext_block = next;
     }
   }
-  else    // normal move
+
+  if(t >= rmove.t3 && !ramps_blend(&t))   // move finished, and there's no next block to go straight on to
   {
-    // figure out which chunk we are in
-    if(t < rmove.t1)    // first region, accelerating
-    {
-      *target_pos = t * (rmove.v_init + 0.5f * t * rmove.accel);    // Eqn (0.5)
-      *target_vel = rmove.v_init + rmove.accel * t;                                               // Eqn (0)
-    }
-    else if(t < rmove.t2) // flat region
-    {
-      *target_pos = (rmove.x1 + rmove.v_nom * (t - rmove.t1));      // Eqn (4)
-      *target_vel = rmove.v_nom;    // Eqn (3)
-    }
-    else if(t < rmove.t3) // descelerating region
-    {
-      *target_pos = (rmove.x2 + (t - rmove.t2) * (rmove.v_nom  - 0.5f * (t - rmove.t2) * rmove.accel)); // Eqn (7)
-      *target_vel = rmove.v_final + rmove.accel * (rmove.t3 - t);
-    }
-    else    // move finished
-    {
-      //hid_printf("'Done with long move.\n");
-      pathmode = PATH_RAMPS_WAITING;
-      ramps_endpos = rmove.start_pos + rmove.dir * rmove.x_total;
-      *target_pos = ramps_endpos;
-      *target_vel = rmove.v_final * TENUS_PER_MIN_F * rmove.dir;
+    //hid_printf("'Done with move.\n");
+    __disable_irq();    // don't let the handshake for a blended block get in between these
+    pathmode = PATH_RAMPS_WAITING;
+    ramps_endpos = rmove.start_pos + rmove.dir * rmove.x_total;
+    if(!blended_block)    // (if we blended into this block, we're still in sync state from the last one; path_ramps_move handles it)
       enter_sync_state();   // tell the stepper module to float the sync line, signaling we're finished with the move.
-      //hid_printf("'Done with long move. Cur Time: %u Move Time: %u\n", get_systick_tenus(), get_systick_tenus() - start_time);
-      return;   // don't need to do the final conversions, and besides, once entering sync_state, the contents of rmove could change on a higher-priority interrupt.
-    }
+    __enable_irq();
+    *target_pos = ramps_endpos;
+    *target_vel = rmove.v_final * TENUS_PER_MIN_F * rmove.dir;
+    //hid_printf("'Done with move. Cur Time: %u Move Time: %u\n", time_tenus(), time_tenus() - start_time);
+    return;   // don't need to do the final conversions, and besides, once entering sync_state, the contents of rmove could change on a higher-priority interrupt.
   }
+
+  ramps_seek(&rmove, t);
+  *target_pos = (real)rmove.now.x * (1.f / RAMPS_Q_X);
+  *target_vel = (real)rmove.now.v * (1.f / RAMPS_Q_V);
   *target_pos = *target_pos * rmove.dir + rmove.start_pos;
   *target_vel *= TENUS_PER_MIN_F * rmove.dir;   // get velocity back into tics/min.
   
   // check for big change (DEBUG!) //||\\!!
   if(fabsf(*target_pos - last_target_pos) > 1000)
   {
-    hid_printf("'Big change! Last: %f, Next: %f, Time: %lu, t1=%f, t2=%f\n", pathmode, last_target_pos, *target_pos, t, rmove.t1, rmove.t2);
+    hid_printf("'Big change! Last: %f, Next: %f, Time: %lu, segment=%u, t3=%lu\n", last_target_pos, *target_pos, (unsigned long)t, rmove.cur_seg, (unsigned long)rmove.t3);
   }
-}
\ No newline at end of file
+}
+
+// Called when the current RAMPS move ends at time t (tenus into the move). If the next block is already
+// planned, starts it right away with the leftover time, so the target position and velocity run straight
+// through the junction instead of dwelling at the end of the block until the sync handshake comes back.
+// The block boundary is still signaled on the sync line; the handshake dequeues the block we're already
+// running, and path_ramps_move recognizes it. Returns false (and leaves everything alone) if we have to
+// stop at the end of this block instead.
+static bool ramps_blend(uint32_t *t)
+{
+  // only one block can be ahead of the handshake; the queue entry after it isn't dequeued yet. Also don't
+  // skip over a whole block inside one control update.
+  if(!rnext_block || blended_block || *t - rmove.t3 >= rnext.t3)
+    return false;
+
+  // move start_time up to the junction
+  start_time += rmove.t3;
+  *t -= rmove.t3;
+
+  rmove = rnext;
+  ramps_endpos = rmove.start_pos;
+  blended_block = rnext_block;    // needs to be set before the handshake can come in
+  rnext_block = NULL;
+  ramps_moveid++;
+  release_history();
+  enter_sync_state();   // float the sync line, signaling we're finished with the last block.
+  return true;
+}
+
+// forgets any planned or blended block. Whatever we do next starts from scratch.
+static void ramps_lookahead_reset(void)
+{
+  rnext_block = NULL;
+  blended_block = NULL;
+  ramps_sync_owed = false;
+}
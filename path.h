@@ -28,6 +28,8 @@
 
 #include "imc/protocol/message_structs.h"
 
+#define SINE_COUNT        5       // number of sines for sinusoidal path
+
 // custom path definition structure
 typedef struct {
   uint32_t time;
@@ -42,9 +44,38 @@ typedef enum {
   PATH_RAMPS_WAITING,   // mode for when we are waiting for a move to queue so we can start moving
   PATH_CUSTOM,
   PATH_SINES,
-  PATH_RAND
+  PATH_RAND,
+  PATH_FRA,             // frequency response sweep (fra.h)
+  PATH_PRBS             // pseudo-random binary sequence (path_prbs_start)
 } __attribute__ ((packed)) pathmode_t;
 
+// path state a capture starts from (see path_get_snap and capture.c)
+typedef struct {
+  pathmode_t mode;
+  int32_t step_target;
+  uint32_t start_time;
+  uint32_t last_time;
+  real last_target_pos;
+  real ramps_endpos;
+  uint32_t ramps_moveid;
+  uint32_t custom_curloc;
+  uint32_t rand_state[4];     // rand_uint32's state (PATH_RAND)
+  uint32_t sine_time;         // sine oscillators (PATH_SINES): time of their state, control period (us) they
+  uint32_t sine_period;       // rotate by, and updates left until they're recomputed exactly
+  uint32_t sine_resync;
+  real sine_sin[SINE_COUNT];
+  real sine_cos[SINE_COUNT];
+  uint32_t prbs_state;        // PRBS path (PATH_PRBS): register, feedback mask, bit index, updates counted, and
+  uint32_t prbs_mask;         // the parameters latched when it started
+  uint32_t prbs_index;
+  uint32_t prbs_count;
+  uint32_t prbs_bit_updates;
+  uint32_t prbs_update_us;
+  real prbs_center;
+  real prbs_level;
+  uint8_t prbs_started;
+} __attribute__ ((packed)) path_snap_t;
+
 void path_set_step_target(int32_t target);
 
 void path_imc(real wait_pos);
@@ -54,12 +85,20 @@ uint32_t path_get_ramps_moveid(void);
 void path_custom_clear(void);
 void path_custom_add_elem(const custom_path_dp_t *elem);
 void path_custom_start(void);
+bool path_custom_get_elem(uint32_t i, custom_path_dp_t *elem);
 
 void path_sines_start(void);
 void path_sines_setfreq(float new_base_freq);
 
 void path_rand_start(void);
 
+bool path_fra_start(void);
+
+void path_prbs_start(void);
+
 void path_get_target(volatile real *target_pos, volatile real *target_vel, uint32_t curtime);
 
+void path_get_snap(path_snap_t *snap);
+void path_set_snap(const path_snap_t *snap);
+
 #endif
\ No newline at end of file
@@ -195,6 +195,31 @@ int hid_flush(uint32_t timeout)
     return 0;   // keep the packet on the buffer.
 }
 
+// returns the number of packets that can be sent right now without waiting.
+int hid_tx_ready(void)
+{
+#ifdef USB_RAWHID
+  return usb_rawhid_tx_available();
+#else
+  return 1;
+#endif
+}
+
+// sends data (count < HID_PACKLEN) as one packet of its own on the pack_type stream, without
+// touching the packet hid_write is collapsing data into. Returns 1 if successful, 0 on timeout.
+// Check hid_tx_ready() first if this must not wait.
+int hid_write_frame(hid_pack_type pack_type, const uint8_t *data, uint32_t count, uint32_t timeout)
+{
+  uint8_t frame[HID_PACKLEN];
+
+  if(count > HID_PACKLEN - 1)
+    return 0;
+  frame[0] = pack_type | (count << 2);
+  memcpy(frame + 1, data, count);
+  vmemset(frame + 1 + count, 0, HID_PACKLEN - 1 - count);
+  return hid_write_packet(frame, timeout);
+}
+
 // buf should be a buffer to write to, 64 bytes long. Timeout is the time to wait
 // (in ms) before failing the read. If the read times out (no data available), 0 is returned,
 // if it succeeds, the number of bytes read (always 64) is returned. Even if the
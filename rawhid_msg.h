@@ -39,6 +39,7 @@
 
 // Message header constants, shared with rawhid_listener
 #define RX_HEAD_DEVID      0x08      // this is backspace, and shouldn't appear in a normal text transmission...
+#define RX_HEAD_BINARY     0xB5      // first byte of a binary command packet (bincmd.c). Not ASCII, so it can't start a text command.
 #define TX_HEAD_DEVID           0xFC      // for querying the deviceid, this is the entire header (which is the same as an impossible 64-length text packet)
 
 typedef enum {
@@ -55,7 +56,7 @@ void hid_init(uint32_t device_id);
 
 // This code is not terribly robust; it may block while waiting for a packet to
 // buffer for up to 100 ms, and it doesn't know how to recover from lost packets
-void hid_printf(const char *str, ...);
+void hid_printf(const char *str, ...) __attribute__ ((format (printf, 1, 2)));
 
 // pack_type specifies the packet type and is . If this function
 // is called successively with the same header, data is collapsed into as few
@@ -67,6 +68,14 @@ int hid_write(hid_pack_type pack_type, const uint8_t *data, uint32_t count, uint
 // flushes the local not-full packet if one is waiting to be sent.
 int hid_flush(uint32_t timeout);
 
+// returns the number of packets that can be sent right now without waiting.
+int hid_tx_ready(void);
+
+// sends data (count < HID_PACKLEN) as one packet of its own on the pack_type stream, without
+// touching the packet hid_write is collapsing data into. Returns 1 if successful, 0 on timeout.
+// Check hid_tx_ready() first if this must not wait.
+int hid_write_frame(hid_pack_type pack_type, const uint8_t *data, uint32_t count, uint32_t timeout);
+
 
 
 
@@ -0,0 +1,216 @@
+/********************************************************************************
+ * Host simulation: tracking benchmark
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Scores how well the controller followed its path over a simulated run (imcsim -j), so controllers
+ *   and control changes can be compared run against run. Every control update is sampled right after
+ *   software_isr files it (ctrl_get_telemetry), from the moment a control mode is on to the end of the run.
+ *   The metrics, written as one line of JSON by bench_report:
+ *
+ *     name               the scripts run, by file name
+ *     seed               the random number seed (imcsim -S)
+ *     seconds            simulated run time
+ *     updates            control updates sampled
+ *     rms_err_tics       RMS following error (path target - encoder), encoder tics
+ *     max_err_tics       largest following error
+ *     holds              times the target came to rest after moving (a step, or the end of a RAMPS move)
+ *     unsettled          holds that ended (or the run did) with the error still outside one step (q)
+ *     settle_ms_mean     time from the target coming to rest to the error staying within one step, over the
+ *     settle_ms_max      holds that settled. null if none did.
+ *     overshoot_max_tics furthest the encoder went past a resting target, in the direction of the move. null
+ *                        without holds.
+ *     wallclock          host timings, which are NOT deterministic:
+ *       ctrl_ns_mean     host cpu time per control update: pit3_isr, spi0_isr and software_isr together,
+ *       ctrl_ns_p99      without the simulation's own work inside them (sim.c:host_switch). Mean and 99th
+ *                        percentile.
+ *
+ *   Everything outside "wallclock" is deterministic, so two runs of the same scripts with the same seed on the
+ *   same build give the same numbers, and those are what a regression check should compare. The wallclock
+ *   figures change from run to run with the host's load and caches; they are only good for rough comparisons
+ *   of controllers against each other on one machine, and should be left out of any regression check. On the
+ *   board, the control update's cycle counts come from "gw".
+ *
+ *   The sim/bench/ctrl_*.txt scripts set their parameters first and start their controller at 100 ms ("@100"),
+ *   ahead of every reference path, so the control updates fall at the same times against the path whatever
+ *   the setup takes; two scripts that set up the same controller score the same.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sim.h"
+#include "../common.h"
+#include "../ctrl.h"
+
+// Global Variables ====================================================================
+extern float enc_tics_per_step;
+bool bench_enabled = false;
+
+// Local Variables ===================================================================
+static bool have_sample = false;
+static uint32_t last_time;                // time of the last update sampled (tenus)
+static float last_target;
+static uint64_t last_ns;                  // control path host time as of the last sample
+static uint32_t updates = 0;
+static double err_sq = 0, err_max = 0;
+
+// the hold being timed: a target that stopped changing at hold_start, approached from move_from
+static bool moving = false;               // the target changed at the last update
+static bool in_hold = false;              // ... and has since held still, so this is a hold to score
+static uint32_t hold_start;
+static float move_from;
+static uint32_t settled_at;               // first update of the current run of in-band errors
+static bool in_band;
+static double hold_overshoot;
+
+static uint32_t holds = 0, unsettled = 0, settled = 0;
+static double settle_sum = 0, settle_max = 0, overshoot_max = 0;
+
+static uint32_t *ns_samples = NULL;       // host time of each control update after the first
+static uint32_t ns_count = 0, ns_size = 0;
+
+
+// scores the hold that just ended
+static void close_hold(void)
+{
+  double ms;
+
+  holds++;
+  overshoot_max = fmax(overshoot_max, hold_overshoot);
+  if(!in_band)
+  {
+    unsettled++;
+    return;
+  }
+  ms = (settled_at - hold_start) / 100.;
+  settled++;
+  settle_sum += ms;
+  settle_max = fmax(settle_max, ms);
+}
+
+// sim.c calls this after every software_isr
+void bench_sample(void)
+{
+  ctrl_telemetry_t t;
+  uint64_t ns = sim_host_ns[IRQ_PIT_CH3] + sim_host_ns[IRQ_SPI0] + sim_host_ns[IRQ_SOFTWARE];
+  double err;
+  bool band;
+
+  ctrl_get_telemetry(&t);
+  if(CTRL_DISABLED == t.mode || (have_sample && t.time == last_time))
+  {
+    last_ns = ns;     // no control update since the last call
+    return;
+  }
+
+  if(have_sample)
+  {
+    if(ns_count >= ns_size)
+    {
+      ns_size = ns_size ? 2 * ns_size : 4096;
+      ns_samples = realloc(ns_samples, ns_size * sizeof(ns_samples[0]));
+    }
+    ns_samples[ns_count++] = (uint32_t)(ns - last_ns);
+  }
+  last_ns = ns;
+  updates++;
+
+  err = t.target_pos - t.position;
+  err_sq += err * err;
+  err_max = fmax(err_max, fabs(err));
+  band = fabs(err) <= enc_tics_per_step;
+
+  if(have_sample && t.target_pos != last_target)
+  {
+    // the target moved. A new hold starts here if it stays put from now on.
+    if(in_hold)
+      close_hold();
+    if(!moving)
+      move_from = last_target;
+    moving = true;
+    in_hold = false;
+    hold_start = settled_at = t.time;
+    in_band = band;
+    hold_overshoot = 0;
+  }
+  else if(moving)
+  {
+    moving = false;
+    in_hold = true;
+  }
+
+  if(moving || in_hold)
+  {
+    if(band && !in_band)
+      settled_at = t.time;
+    in_band = band;
+    hold_overshoot = fmax(hold_overshoot, (t.position - t.target_pos) * (t.target_pos > move_from ? 1. : -1.));
+  }
+
+  have_sample = true;
+  last_time = t.time;
+  last_target = t.target_pos;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// writes the metrics as one line of JSON
+void bench_report(FILE *f, const char *name, double seconds, uint32_t seed)
+{
+  double ns_sum = 0;
+  uint32_t p99 = 0;
+
+  if(in_hold)
+    close_hold();
+  for(uint32_t i = 0; i < ns_count; i++)
+    ns_sum += ns_samples[i];
+  if(ns_count)
+  {
+    qsort(ns_samples, ns_count, sizeof(ns_samples[0]), cmp_u32);
+    p99 = ns_samples[(uint32_t)(0.99 * (ns_count - 1))];
+  }
+
+  fprintf(f, "{\"name\": \"%s\", \"seed\": %u, \"seconds\": %g, \"updates\": %u, ", name, (unsigned int)seed, seconds,
+          (unsigned int)updates);
+  fprintf(f, "\"rms_err_tics\": %.3f, \"max_err_tics\": %.3f, ", updates ? sqrt(err_sq / updates) : 0., err_max);
+  fprintf(f, "\"holds\": %u, \"unsettled\": %u, ", (unsigned int)holds, (unsigned int)unsettled);
+  if(settled)
+    fprintf(f, "\"settle_ms_mean\": %.2f, \"settle_ms_max\": %.2f, ", settle_sum / settled, settle_max);
+  else
+    fprintf(f, "\"settle_ms_mean\": null, \"settle_ms_max\": null, ");
+  if(holds)
+    fprintf(f, "\"overshoot_max_tics\": %.3f, ", overshoot_max);
+  else
+    fprintf(f, "\"overshoot_max_tics\": null, ");
+  fprintf(f, "\"wallclock\": {\"ctrl_ns_mean\": %.0f, \"ctrl_ns_p99\": %u}}\n", ns_count ? ns_sum / ns_count : 0.,
+          (unsigned int)p99);
+}
@@ -0,0 +1,510 @@
+/********************************************************************************
+ * Host simulation: USB and main()
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Runs the firmware in the host simulation (sim.h): reads the command line, feeds the command script
+ *   to the firmware in place of the USB host and the IMC master, prints what it sends back, and writes the
+ *   motor trace.
+ *
+ *   The Teensy core's raw HID calls are replaced here. usb_rawhid_available() is polled once per main loop
+ *   pass, so it is also where the main loop's time goes by (SIM_LOOP_CYCLES). Sends never block.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <usb_desc.h>
+#include <usb_rawhid.h>
+
+#include "sim.h"
+#include "../rawhid_msg.h"
+#include "../imc/config.h"
+#include "../imc/protocol/message_structs.h"
+
+// Constants ==========================================================================
+#define RX_QUEUE_PACKETS        32          // longest command: RX_QUEUE_PACKETS * 64 - 1 characters
+#define SCRIPT_LINE_MAX         (RX_QUEUE_PACKETS * RAWHID_RX_SIZE)
+#define SCRIPT_MAX              8           // -s options
+#define BENCH_NAME_MAX          256
+#define IMC_ADDRESS             I2C_BASE_ADDRESS    // the board's address switches are all open here
+#define IMC_MSG_MAX             128
+#define IMC_REPLY_CYCLES        (F_CPU / 2000)      // the master reads the reply 500 us after sending
+
+// Global Variables ====================================================================
+uint32_t host_tick_cycles = 0;
+
+// Local Variables ===================================================================
+static FILE *scripts[SCRIPT_MAX];
+static uint32_t script_count = 0, script_cur = 0;
+static FILE *trace = NULL, *data = NULL, *bench = NULL;
+static char bench_name[BENCH_NAME_MAX];     // the script file names, joined by '+'
+static double run_seconds;
+static bool quiet = false;
+static uint32_t rand_seed = 1;              // -S
+static char line[SCRIPT_LINE_MAX];
+static bool line_ready = false;             // line holds the next command
+static uint64_t line_time = 0;              // and it goes out at this sim_now
+static uint8_t rx_queue[RX_QUEUE_PACKETS][RAWHID_RX_SIZE];
+static uint32_t rx_head = 0, rx_count = 0;
+static struct timespec host_start;
+
+// the IMC message being sent (a "!" script line)
+static struct {
+  bool on;
+  uint8_t msg[IMC_MSG_MAX];   // type, body and checksum
+  uint32_t len, sent;         // bytes in it, and bytes sent so far
+  uint64_t reply_time;        // when to read the reply; 0 = not yet
+  bool reading;
+  uint8_t reply[SIM_I2C_MAX];
+} imc;
+
+// Function Predeclares ======================================================
+int firmware_main();                        // main.c, built with -Dmain=firmware_main
+void rand_set_state(const uint32_t *state); // main.c
+static void seed_rand(uint32_t seed);
+static void script_poll(void);
+static void bench_add_name(const char *path);
+static bool imc_parse(const char *s);
+static bool imc_poll(void);
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: imcsim [-t seconds] [-s script]... [-o trace.csv] [-r trace_us] [-d data.bin] [-j bench.json]\n"
+                  "              [-p name=value]... [-S seed] [-q]\n"
+                  "       imcsim -R capture.bin\n"
+                  "  (see sim/sim.h)\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = 2, trace_us = 100;
+  int opt;
+
+  while((opt = getopt(argc, argv, "t:s:o:r:d:j:p:S:qR:")) != -1)
+  {
+    switch(opt)
+    {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 's':
+      if(script_count >= SCRIPT_MAX)
+        usage();
+      if(!(scripts[script_count++] = fopen(optarg, "r")))
+      {
+        perror(optarg);
+        return 1;
+      }
+      bench_add_name(optarg);
+      break;
+    case 'o':
+      if(!(trace = fopen(optarg, "w")))
+      {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      trace_us = atof(optarg);
+      break;
+    case 'd':
+      if(!(data = fopen(optarg, "wb")))
+      {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'j':
+      if(!(bench = fopen(optarg, "a")))
+      {
+        perror(optarg);
+        return 1;
+      }
+      bench_enabled = sim_host_timing = true;
+      break;
+    case 'p':
+    {
+      char *eq = strchr(optarg, '=');
+      if(!eq)
+        usage();
+      *eq = 0;
+      if(!plant_set_param(optarg, atof(eq + 1)))
+      {
+        fprintf(stderr, "imcsim: no motor parameter %s\n", optarg);
+        return 1;
+      }
+      break;
+    }
+    case 'S':
+      rand_seed = strtoul(optarg, NULL, 0);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'R':
+      replay_run(optarg);   // doesn't return
+      break;
+    default:
+      usage();
+    }
+  }
+  if(optind < argc || seconds <= 0 || trace_us <= 0)
+    usage();
+
+  run_seconds = seconds;
+  sim_end = (uint64_t)(seconds * F_CPU);
+  if(trace)
+  {
+    host_tick_cycles = (uint32_t)(trace_us * (F_CPU / 1000000));
+    if(!host_tick_cycles)
+      host_tick_cycles = 1;
+    fprintf(trace, "t,steps,position,tics,velocity\n");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &host_start);
+  plant_init();
+  sim_reset();
+  seed_rand(rand_seed);
+  firmware_main();
+  return 0;
+}
+
+// writes a row of the motor trace
+void host_tick(void)
+{
+  int32_t steps, tics;
+  double position, velocity;
+  plant_state(&steps, &position, &velocity, &tics);
+  fprintf(trace, "%.6f,%i,%.3f,%i,%.1f\n", (double)sim_now / F_CPU, steps, position, tics, velocity);
+}
+
+// the run is over (sim_end): prints the summary and exits
+void sim_finish(void)
+{
+  struct timespec now;
+  int32_t steps, tics;
+  double position, velocity, host;
+
+  fflush(stdout);
+  if(trace)
+    fclose(trace);
+  if(data)
+    fclose(data);
+  if(bench)
+  {
+    bench_report(bench, bench_name, run_seconds, rand_seed);
+    fclose(bench);
+  }
+  if(!quiet)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    host = (now.tv_sec - host_start.tv_sec) + 1e-9 * (now.tv_nsec - host_start.tv_nsec);
+    plant_state(&steps, &position, &velocity, &tics);
+    fprintf(stderr, "imcsim: %.3f s simulated in %.3f s\n", (double)sim_now / F_CPU, host);
+    fprintf(stderr, "imcsim: steps %i, rotor %.2f steps, encoder %i tics\n", steps, position, tics);
+    fprintf(stderr, "imcsim: interrupts:");
+    for(uint32_t irq = 0; irq <= SIM_IRQ_SYSTICK; irq++)
+      if(sim_irq_counts[irq])
+        fprintf(stderr, " %s %u", sim_irq_name(irq), (unsigned int)sim_irq_counts[irq]);
+    fprintf(stderr, "\n");
+  }
+  exit(0);
+}
+
+// adds a script's file name, less its directory and extension, to the benchmark name
+static void bench_add_name(const char *path)
+{
+  const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  size_t len = strlen(bench_name), n = strcspn(base, ".");
+
+  if(len && len + 1 < sizeof(bench_name))
+    bench_name[len++] = '+';
+  snprintf(bench_name + len, sizeof(bench_name) - len, "%.*s", (int)n, base);
+}
+
+// reads the next command from the scripts into line. Returns false at the end of the last script.
+static bool script_next(void)
+{
+  char *s, *end;
+
+  while(script_cur < script_count)
+  {
+    if(!fgets(line, sizeof(line), scripts[script_cur]))
+    {
+      fclose(scripts[script_cur++]);
+      continue;
+    }
+    s = line;
+    line_time = 0;
+    while(isspace((unsigned char)*s))
+      s++;
+    if('@' == *s)
+    {
+      line_time = (uint64_t)(strtod(s + 1, &s) * (F_CPU / 1000));
+      while(isspace((unsigned char)*s))
+        s++;
+    }
+    end = s + strlen(s);
+    while(end > s && isspace((unsigned char)end[-1]))
+      *--end = 0;
+    if(!*s || '#' == *s)
+      continue;
+    memmove(line, s, end - s + 1);
+    return true;
+  }
+  return false;
+}
+
+// queues the next script command once the firmware has read the last one (or the IMC master has its reply)
+// and its time has come
+static void script_poll(void)
+{
+  uint32_t len;
+  if(rx_count || (imc.on && imc_poll()))
+    return;
+  if(!line_ready)
+    line_ready = script_next();
+  if(!line_ready || sim_now < line_time)
+    return;
+
+  printf("> %s\n", line);
+  if('!' == line[0])
+  {
+    if(imc_parse(line + 1))
+      imc_poll();
+    else
+      printf("< imc: bad message\n");
+    line_ready = false;
+    return;
+  }
+  // commands end at a zero byte, which may take another packet
+  len = strlen(line) + 1;
+  for(uint32_t i = 0; i < len; i += RAWHID_RX_SIZE)
+  {
+    uint8_t *pack = rx_queue[(rx_head + rx_count++) % RX_QUEUE_PACKETS];
+    memset(pack, 0, RAWHID_RX_SIZE);
+    memcpy(pack, line + i, len - i < RAWHID_RX_SIZE ? len - i : RAWHID_RX_SIZE);
+  }
+  line_ready = false;
+}
+
+// IMC master ========================================================================
+// one zigzag varint of a Queue Moves field difference (imc/protocol/message_structs.c:imc_decode_move)
+static uint32_t put_varint(uint8_t *p, uint32_t diff)
+{
+  uint32_t zz = (diff << 1) ^ (uint32_t)((int32_t)diff >> 31), n = 0;
+  while(zz >= 0x80)
+  {
+    p[n++] = zz | 0x80;
+    zz >>= 7;
+  }
+  p[n++] = zz;
+  return n;
+}
+
+// builds the message a "!" script line (less the !) asks for into imc, and gets it ready to go. Returns false
+// if the line doesn't make sense.
+static bool imc_parse(const char *s)
+{
+  char word[8], *end;
+  int skip;
+  uint32_t len = 0, fields[8], prev[8] = {0}, count = 0, nf = 0;
+  uint8_t sum = 0;
+
+  if(sscanf(s, "%7s%n", word, &skip) != 1)
+    return false;
+  s += skip;
+  if(!strcmp(word, "imc"))
+  {
+    for(unsigned long v = strtoul(s, &end, 16); end != s; v = strtoul(s, &end, 16))
+    {
+      if(len >= IMC_MSG_MAX - 1 || v > 0xFF)
+        return false;
+      imc.msg[len++] = v;
+      s = end;
+    }
+  }
+  else if(!strcmp(word, "move") || !strcmp(word, "moves"))
+  {
+    bool many = !strcmp(word, "moves");
+    len = many ? 1 + sizeof(msg_queue_moves_t) : 1;
+    imc.msg[0] = many ? IMC_MSG_QUEUEMOVES : IMC_MSG_QUEUEMOVE;
+    for(long long v = strtoll(s, &end, 0); end != s; v = strtoll(s, &end, 0))
+    {
+      fields[nf++] = (uint32_t)v;
+      s = end;
+      if(nf < 8)
+        continue;
+      nf = 0;
+      if(!many)
+      {
+        if(count++)
+          return false;
+        memcpy(imc.msg + len, fields, sizeof(msg_queue_move_t));
+        len += sizeof(msg_queue_move_t);
+        continue;
+      }
+      for(uint32_t i = 0; i < 8; i++)
+      {
+        if(len + 5 > 1 + sizeof(msg_queue_moves_t) + IMC_QUEUEMOVES_MAX_DATA)
+          return false;
+        len += put_varint(imc.msg + len, fields[i] - prev[i]);
+        prev[i] = fields[i];
+      }
+      count++;
+    }
+    if(nf || !count)
+      return false;
+    if(many)
+    {
+      imc.msg[1] = len - 1 - sizeof(msg_queue_moves_t);
+      imc.msg[2] = count;
+    }
+  }
+  while(isspace((unsigned char)*s))
+    s++;
+  if(!len || *s)
+    return false;
+
+  for(uint32_t i = 0; i < len; i++)
+    sum ^= imc.msg[i];
+  imc.msg[len++] = sum;
+  imc.len = len;
+  imc.sent = 0;
+  imc.reply_time = 0;
+  imc.reading = false;
+  imc.on = true;
+  return true;
+}
+
+// prints the reply to the IMC message, n bytes of it (0 if the board didn't answer)
+static void imc_print_reply(uint32_t n)
+{
+  uint8_t sum = 0;
+  if(!n)
+  {
+    printf("< imc: no answer\n");
+    return;
+  }
+  printf("< imc");
+  for(uint32_t i = 0; i < n; i++)
+  {
+    printf(" %02x", imc.reply[i]);
+    sum ^= imc.reply[i];
+  }
+  printf(sum ? " (bad checksum)\n" : "\n");
+}
+
+// moves the IMC message along: it goes out in one or more transfers, and after IMC_REPLY_CYCLES the master
+// reads back the reply (status, body and checksum; imc_resp_length). After a reply to moves, the master lets
+// go of the sync line so the board can start them. Returns true until the reply is in.
+static bool imc_poll(void)
+{
+  uint32_t n, type = imc.msg[0];
+
+  if(sim_i2c_busy())
+    return true;
+  if(imc.reading || (imc.sent && !sim_i2c_result(NULL)))
+  {
+    n = imc.reading ? sim_i2c_result(imc.reply) : 0;
+    imc_print_reply(n);
+    if(n && (IMC_MSG_QUEUEMOVE == type || IMC_MSG_QUEUEMOVES == type))
+      sim_sync_release();
+    imc.on = false;
+    return false;
+  }
+  if(imc.sent < imc.len)
+  {
+    // a message whose body and checksum fit in PROTOCOL_MAX_TRANSMIT_SIZE goes in one transfer; the parser
+    // takes longer ones in pieces (parser.c:big_packet)
+    n = imc.len - imc.sent;
+    if(imc.len - 1 > PROTOCOL_MAX_TRANSMIT_SIZE && n > PROTOCOL_MAX_TRANSMIT_SIZE)
+      n = PROTOCOL_MAX_TRANSMIT_SIZE;
+    sim_i2c_start(IMC_ADDRESS, false, imc.msg + imc.sent, n);
+    imc.sent += n;
+    return true;
+  }
+  if(!imc.reply_time)
+    imc.reply_time = sim_now + IMC_REPLY_CYCLES;
+  if(sim_now < imc.reply_time)
+    return true;
+  n = 2 + (type <= IMC_MESSAGE_TYPE_COUNT ? imc_resp_length[type] : 0);
+  sim_i2c_start(IMC_ADDRESS, true, NULL, n);
+  imc.reading = true;
+  return true;
+}
+
+// Raw HID ===========================================================================
+int usb_rawhid_available(void)
+{
+  sim_advance(SIM_LOOP_CYCLES);
+  script_poll();
+  return rx_count ? RAWHID_RX_SIZE : 0;
+}
+
+int usb_rawhid_recv(void *buffer, uint32_t timeout)
+{
+  if(!rx_count)
+    return 0;
+  memcpy(buffer, rx_queue[rx_head], RAWHID_RX_SIZE);
+  rx_head = (rx_head + 1) % RX_QUEUE_PACKETS;
+  rx_count--;
+  return RAWHID_RX_SIZE;
+}
+
+// text goes to stdout; data packets (header and payload) to the -d file
+int usb_rawhid_send(const void *buffer, uint32_t timeout)
+{
+  const uint8_t *pack = buffer;
+  uint32_t len = pack[0] >> 2;
+  if(TX_PACK_TYPE_TEXT == (pack[0] & TX_PACK_TYPE_MASK))
+    fwrite(pack + 1, 1, len, stdout);
+  else if(data)
+    fwrite(pack, 1, len + 1, data);
+  return RAWHID_TX_SIZE;
+}
+
+int usb_rawhid_tx_available(void)
+{
+  return 4;
+}
+
+// seeds the firmware's random number generator (main.c:rand_uint32, which draws the random path), so a run
+// depends only on its scripts and -S. Each word is kept above the minimum the generator needs (z4 >= 128).
+static void seed_rand(uint32_t seed)
+{
+  uint32_t state[4];
+  for(uint32_t i = 0; i < 4; i++)
+  {
+    seed = seed * 1664525U + 1013904223U;
+    state[i] = seed | 0x80;
+  }
+  rand_set_state(state);
+}
@@ -0,0 +1,57 @@
+/* Simulated Cortex-M4 SIMD intrinsics
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __CORE_CM4_SIMD_H
+#define __CORE_CM4_SIMD_H
+
+#include <stdint.h>
+
+/********************************************************************************
+ * Simulated Cortex-M4 SIMD intrinsics
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Stands in for teensy-include/core_cm4_simd.h in the host build (make sim), with plain C versions of
+ *   the intrinsics the firmware uses. Each gives the same result as the instruction.
+ ********************************************************************************/
+
+// dual signed 16-bit multiply, both products added to a 64-bit accumulator
+static inline uint64_t __SMLALD(uint32_t op1, uint32_t op2, uint64_t acc)
+{
+  return acc + (int64_t)((int32_t)(int16_t)op1 * (int16_t)op2)
+             + (int64_t)((int32_t)(int16_t)(op1 >> 16) * (int16_t)(op2 >> 16));
+}
+
+// as __SMLALD, with the halves of op2 exchanged
+static inline uint64_t __SMLALDX(uint32_t op1, uint32_t op2, uint64_t acc)
+{
+  return __SMLALD(op1, (op2 << 16) | (op2 >> 16), acc);
+}
+
+// dual signed 16-bit multiply, both products added to a 32-bit accumulator
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t acc)
+{
+  return (uint32_t)((int64_t)__SMLALD(op1, op2, 0) + acc);
+}
+
+#endif
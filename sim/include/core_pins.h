@@ -0,0 +1,68 @@
+/* Simulated Teensy pin definitions
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef _core_pins_h_
+#define _core_pins_h_
+
+#include "mk20dx128.h"
+
+/********************************************************************************
+ * Simulated Teensy pin definitions
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Stands in for teensy-include/core_pins.h in the host build (make sim): the Teensy 3.1 pin to port
+ *   control register map for the digital pins the firmware configures.
+ ********************************************************************************/
+
+#define HIGH                1
+#define LOW                 0
+#define INPUT               0
+#define OUTPUT              1
+
+#define CORE_PIN0_CONFIG    PORTB_PCR16
+#define CORE_PIN1_CONFIG    PORTB_PCR17
+#define CORE_PIN2_CONFIG    PORTD_PCR0
+#define CORE_PIN3_CONFIG    PORTA_PCR12
+#define CORE_PIN4_CONFIG    PORTA_PCR13
+#define CORE_PIN5_CONFIG    PORTD_PCR7
+#define CORE_PIN6_CONFIG    PORTD_PCR4
+#define CORE_PIN7_CONFIG    PORTD_PCR2
+#define CORE_PIN8_CONFIG    PORTD_PCR3
+#define CORE_PIN9_CONFIG    PORTC_PCR3
+#define CORE_PIN10_CONFIG   PORTC_PCR4
+#define CORE_PIN11_CONFIG   PORTC_PCR6
+#define CORE_PIN12_CONFIG   PORTC_PCR7
+#define CORE_PIN13_CONFIG   PORTC_PCR5
+#define CORE_PIN14_CONFIG   PORTD_PCR1
+#define CORE_PIN15_CONFIG   PORTC_PCR0
+#define CORE_PIN16_CONFIG   PORTB_PCR0
+#define CORE_PIN17_CONFIG   PORTB_PCR1
+#define CORE_PIN18_CONFIG   PORTB_PCR3
+#define CORE_PIN19_CONFIG   PORTB_PCR2
+#define CORE_PIN20_CONFIG   PORTD_PCR5
+#define CORE_PIN21_CONFIG   PORTD_PCR6
+#define CORE_PIN22_CONFIG   PORTC_PCR1
+#define CORE_PIN23_CONFIG   PORTC_PCR2
+
+#endif
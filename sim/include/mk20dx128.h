@@ -0,0 +1,362 @@
+/* Simulated MK20DX256 register map
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef _mk20dx128_h_
+#define _mk20dx128_h_
+
+#include <stdint.h>
+
+/********************************************************************************
+ * Simulated MK20DX256 register map
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Stands in for teensy-include/mk20dx128.h (and the Freescale MK20DZ10.h it pulls in) in the host
+ *   build (make sim). Only what the firmware uses is here, at the real addresses, but every register goes
+ *   through sim_reg() (sim/sim.c), which brings the simulated peripherals up to date - handling anything
+ *   written since the last register access, advancing the clock where the firmware is waiting on it, and
+ *   taking any interrupt that's due - before handing back the location to read or write. See sim/sim.h.
+ ********************************************************************************/
+
+#define F_BUS 48000000
+#define F_MEM 24000000
+
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+// Register access ===================================================================
+void *sim_reg(uint32_t addr);
+void sim_set_primask(uint32_t mask);
+uint32_t sim_get_primask(void);
+void sim_set_basepri(uint32_t pri);
+void sim_delay_cycles(uint32_t cycles);
+
+#define SIM_REG8(addr)          (*(volatile uint8_t *)sim_reg(addr))
+#define SIM_REG16(addr)         (*(volatile uint16_t *)sim_reg(addr))
+#define SIM_REG32(addr)         (*(volatile uint32_t *)sim_reg(addr))
+
+// Chapter 12: System Integration Module (SIM)
+#define SIM_SCGC4               SIM_REG32(0x40048034)
+#define SIM_SCGC5               SIM_REG32(0x40048038)
+#define SIM_SCGC6               SIM_REG32(0x4004803C)
+#define SIM_SCGC7               SIM_REG32(0x40048040)
+#define SIM_SCGC4_I2C0          (uint32_t)0x00000040
+#define SIM_SCGC4_USBOTG        (uint32_t)0x00040000
+#define SIM_SCGC5_PORTA         (uint32_t)0x00000200
+#define SIM_SCGC5_PORTB         (uint32_t)0x00000400
+#define SIM_SCGC5_PORTC         (uint32_t)0x00000800
+#define SIM_SCGC5_PORTD         (uint32_t)0x00001000
+#define SIM_SCGC5_PORTE         (uint32_t)0x00002000
+#define SIM_SCGC6_FTM0          (uint32_t)0x01000000
+#define SIM_SCGC6_PIT           (uint32_t)0x00800000
+#define SIM_SCGC6_SPI0          (uint32_t)0x00001000
+#define SIM_SCGC6_DMAMUX        (uint32_t)0x00000002
+#define SIM_SCGC7_DMA           (uint32_t)0x00000002
+
+// Chapter 11: Port control and interrupts (PORT)
+#define PORT_PCR(port, pin)     SIM_REG32(0x40049000 + 0x1000 * (port) + 4 * (pin))
+#define PORTA_PCR12             PORT_PCR(0, 12)
+#define PORTA_PCR13             PORT_PCR(0, 13)
+#define PORTB_PCR0              PORT_PCR(1, 0)
+#define PORTB_PCR1              PORT_PCR(1, 1)
+#define PORTB_PCR2              PORT_PCR(1, 2)
+#define PORTB_PCR3              PORT_PCR(1, 3)
+#define PORTB_PCR16             PORT_PCR(1, 16)
+#define PORTB_PCR17             PORT_PCR(1, 17)
+#define PORTB_PCR18             PORT_PCR(1, 18)
+#define PORTB_PCR19             PORT_PCR(1, 19)
+#define PORTC_PCR0              PORT_PCR(2, 0)
+#define PORTC_PCR1              PORT_PCR(2, 1)
+#define PORTC_PCR2              PORT_PCR(2, 2)
+#define PORTC_PCR3              PORT_PCR(2, 3)
+#define PORTC_PCR4              PORT_PCR(2, 4)
+#define PORTC_PCR5              PORT_PCR(2, 5)
+#define PORTC_PCR6              PORT_PCR(2, 6)
+#define PORTC_PCR7              PORT_PCR(2, 7)
+#define PORTD_PCR0              PORT_PCR(3, 0)
+#define PORTD_PCR1              PORT_PCR(3, 1)
+#define PORTD_PCR2              PORT_PCR(3, 2)
+#define PORTD_PCR3              PORT_PCR(3, 3)
+#define PORTD_PCR4              PORT_PCR(3, 4)
+#define PORTD_PCR5              PORT_PCR(3, 5)
+#define PORTD_PCR6              PORT_PCR(3, 6)
+#define PORTD_PCR7              PORT_PCR(3, 7)
+#define PORTB_ISFR              SIM_REG32(0x4004A0A0)
+#define PORT_PCR_ISF            (uint32_t)0x01000000
+#define PORT_PCR_IRQC(n)        (uint32_t)(((n) & 15) << 16)
+#define PORT_PCR_IRQC_MASK      (uint32_t)0x000F0000
+#define PORT_PCR_MUX(n)         (uint32_t)(((n) & 7) << 8)
+#define PORT_PCR_MUX_MASK       (uint32_t)0x00000700
+#define PORT_PCR_DSE            (uint32_t)0x00000040
+#define PORT_PCR_ODE            (uint32_t)0x00000020
+#define PORT_PCR_PFE            (uint32_t)0x00000010
+#define PORT_PCR_SRE            (uint32_t)0x00000004
+#define PORT_PCR_PE             (uint32_t)0x00000002
+#define PORT_PCR_PS             (uint32_t)0x00000001
+
+// Chapter 47: General-Purpose Input/Output (GPIO)
+#define GPIO_REG(port, off)     SIM_REG32(0x400FF000 + 0x40 * (port) + (off))
+#define GPIOA_PDOR              GPIO_REG(0, 0x00)
+#define GPIOA_PSOR              GPIO_REG(0, 0x04)
+#define GPIOA_PCOR              GPIO_REG(0, 0x08)
+#define GPIOA_PTOR              GPIO_REG(0, 0x0C)
+#define GPIOA_PDIR              GPIO_REG(0, 0x10)
+#define GPIOA_PDDR              GPIO_REG(0, 0x14)
+#define GPIOB_PDOR              GPIO_REG(1, 0x00)
+#define GPIOB_PSOR              GPIO_REG(1, 0x04)
+#define GPIOB_PCOR              GPIO_REG(1, 0x08)
+#define GPIOB_PTOR              GPIO_REG(1, 0x0C)
+#define GPIOB_PDIR              GPIO_REG(1, 0x10)
+#define GPIOB_PDDR              GPIO_REG(1, 0x14)
+#define GPIOC_PDOR              GPIO_REG(2, 0x00)
+#define GPIOC_PSOR              GPIO_REG(2, 0x04)
+#define GPIOC_PCOR              GPIO_REG(2, 0x08)
+#define GPIOC_PTOR              GPIO_REG(2, 0x0C)
+#define GPIOC_PDIR              GPIO_REG(2, 0x10)
+#define GPIOC_PDDR              GPIO_REG(2, 0x14)
+#define GPIOD_PDOR              GPIO_REG(3, 0x00)
+#define GPIOD_PSOR              GPIO_REG(3, 0x04)
+#define GPIOD_PCOR              GPIO_REG(3, 0x08)
+#define GPIOD_PTOR              GPIO_REG(3, 0x0C)
+#define GPIOD_PDIR              GPIO_REG(3, 0x10)
+#define GPIOD_PDDR              GPIO_REG(3, 0x14)
+#define GPIOE_PDOR              GPIO_REG(4, 0x00)
+#define GPIOE_PSOR              GPIO_REG(4, 0x04)
+#define GPIOE_PCOR              GPIO_REG(4, 0x08)
+#define GPIOE_PTOR              GPIO_REG(4, 0x0C)
+#define GPIOE_PDIR              GPIO_REG(4, 0x10)
+#define GPIOE_PDDR              GPIO_REG(4, 0x14)
+
+// Chapter 37: Periodic Interrupt Timer (PIT)
+#define PIT_MCR                 SIM_REG32(0x40037000)
+#define PIT_LDVAL(n)            SIM_REG32(0x40037100 + 0x10 * (n))
+#define PIT_CVAL(n)             SIM_REG32(0x40037104 + 0x10 * (n))
+#define PIT_TCTRL(n)            SIM_REG32(0x40037108 + 0x10 * (n))
+#define PIT_TFLG(n)             SIM_REG32(0x4003710C + 0x10 * (n))
+#define PIT_LDVAL0              PIT_LDVAL(0)
+#define PIT_CVAL0               PIT_CVAL(0)
+#define PIT_TCTRL0              PIT_TCTRL(0)
+#define PIT_TFLG0               PIT_TFLG(0)
+#define PIT_LDVAL1              PIT_LDVAL(1)
+#define PIT_CVAL1               PIT_CVAL(1)
+#define PIT_TCTRL1              PIT_TCTRL(1)
+#define PIT_TFLG1               PIT_TFLG(1)
+#define PIT_LDVAL2              PIT_LDVAL(2)
+#define PIT_CVAL2               PIT_CVAL(2)
+#define PIT_TCTRL2              PIT_TCTRL(2)
+#define PIT_TFLG2               PIT_TFLG(2)
+#define PIT_LDVAL3              PIT_LDVAL(3)
+#define PIT_CVAL3               PIT_CVAL(3)
+#define PIT_TCTRL3              PIT_TCTRL(3)
+#define PIT_TFLG3               PIT_TFLG(3)
+#define PIT_MCR_MDIS_MASK       0x2u
+#define PIT_TCTRL_TEN_MASK      0x1u
+#define PIT_TCTRL_TIE_MASK      0x2u
+#define PIT_TFLG_TIF_MASK       0x1u
+
+// Chapter 21: Direct Memory Access Controller (eDMA)
+#define DMA_CR                  SIM_REG32(0x40008000)
+#define DMA_ERQ                 SIM_REG32(0x4000800C)
+#define DMA_CERQ                SIM_REG8(0x4000801A)
+#define DMA_SERQ                SIM_REG8(0x4000801B)
+#define DMA_CINT                SIM_REG8(0x4000801F)
+#define DMA_INT                 SIM_REG32(0x40008024)
+#define DMA_TCD_SADDR(n)        SIM_REG32(0x40009000 + 0x20 * (n))
+#define DMA_TCD_SOFF(n)         SIM_REG16(0x40009004 + 0x20 * (n))
+#define DMA_TCD_ATTR(n)         SIM_REG16(0x40009006 + 0x20 * (n))
+#define DMA_TCD_NBYTES_MLNO(n)  SIM_REG32(0x40009008 + 0x20 * (n))
+#define DMA_TCD_SLAST(n)        SIM_REG32(0x4000900C + 0x20 * (n))
+#define DMA_TCD_DADDR(n)        SIM_REG32(0x40009010 + 0x20 * (n))
+#define DMA_TCD_DOFF(n)         SIM_REG16(0x40009014 + 0x20 * (n))
+#define DMA_TCD_CITER_ELINKNO(n) SIM_REG16(0x40009016 + 0x20 * (n))
+#define DMA_TCD_DLASTSGA(n)     SIM_REG32(0x40009018 + 0x20 * (n))
+#define DMA_TCD_CSR(n)          SIM_REG16(0x4000901C + 0x20 * (n))
+#define DMA_TCD_BITER_ELINKNO(n) SIM_REG16(0x4000901E + 0x20 * (n))
+#define DMA_TCD3_SADDR          DMA_TCD_SADDR(3)
+#define DMA_TCD3_SOFF           DMA_TCD_SOFF(3)
+#define DMA_TCD3_ATTR           DMA_TCD_ATTR(3)
+#define DMA_TCD3_NBYTES_MLNO    DMA_TCD_NBYTES_MLNO(3)
+#define DMA_TCD3_SLAST          DMA_TCD_SLAST(3)
+#define DMA_TCD3_DADDR          DMA_TCD_DADDR(3)
+#define DMA_TCD3_DOFF           DMA_TCD_DOFF(3)
+#define DMA_TCD3_CITER_ELINKNO  DMA_TCD_CITER_ELINKNO(3)
+#define DMA_TCD3_DLASTSGA       DMA_TCD_DLASTSGA(3)
+#define DMA_TCD3_CSR            DMA_TCD_CSR(3)
+#define DMA_TCD3_BITER_ELINKNO  DMA_TCD_BITER_ELINKNO(3)
+#define DMA_TCD_ATTR_SSIZE(n)   (((n) & 0x7) << 8)
+#define DMA_TCD_ATTR_DSIZE(n)   (((n) & 0x7) << 0)
+#define DMA_TCD_ATTR_SIZE_8BIT  0
+#define DMA_TCD_ATTR_SIZE_16BIT 1
+#define DMA_TCD_ATTR_SIZE_32BIT 2
+#define DMA_TCD_CSR_DONE        0x0080
+#define DMA_TCD_CSR_DREQ        0x0008
+#define DMA_TCD_CSR_INTMAJOR    0x0002
+#define DMA_TCD_CSR_START       0x0001
+
+// Chapter 20: Direct Memory Access Multiplexer (DMAMUX)
+#define DMAMUX0_CHCFG(n)        SIM_REG8(0x40021000 + (n))
+#define DMAMUX0_CHCFG3          DMAMUX0_CHCFG(3)
+#define DMAMUX0_CHCFG4          DMAMUX0_CHCFG(4)
+#define DMAMUX_DISABLE          0
+#define DMAMUX_TRIG             64
+#define DMAMUX_ENABLE           128
+#define DMAMUX_SOURCE_SPI0_RX   16
+#define DMAMUX_SOURCE_SPI0_TX   17
+#define DMAMUX_SOURCE_FTM0_CH7  31
+#define DMAMUX_SOURCE_ALWAYS0   54
+
+// Chapter 43: SPI (DSPI)
+// SPI0.POPR pops the receive FIFO, which no plain memory location can do, so POPR is renamed to an array member
+// whose index expression (sim_spi_pop()) does the pop and returns the slot holding the popped frame.
+typedef struct {
+  volatile uint32_t MCR;      // 0
+  volatile uint32_t unused1;  // 4
+  volatile uint32_t TCR;      // 8
+  volatile uint32_t CTAR0;    // c
+  volatile uint32_t CTAR1;    // 10
+  volatile uint32_t CTAR2;    // 14
+  volatile uint32_t CTAR3;    // 18
+  volatile uint32_t CTAR4;    // 1c
+  volatile uint32_t CTAR5;    // 20
+  volatile uint32_t CTAR6;    // 24
+  volatile uint32_t CTAR7;    // 28
+  volatile uint32_t SR;       // 2c
+  volatile uint32_t RSER;     // 30
+  volatile uint32_t PUSHR;    // 34
+  volatile uint32_t POPR_[1]; // 38
+  volatile uint32_t TXFR[16]; // 3c
+  volatile uint32_t RXFR[16]; // 7c
+} SPI_t;
+uint32_t sim_spi_pop(void);
+#define SPI0                    (*(SPI_t *)sim_reg(0x4002C000))
+#define POPR                    POPR_[sim_spi_pop()]
+#define SPI_MCR_MSTR            (uint32_t)0x80000000
+#define SPI_MCR_MDIS            (uint32_t)0x00004000
+#define SPI_MCR_CLR_TXF         (uint32_t)0x00000800
+#define SPI_MCR_CLR_RXF         (uint32_t)0x00000400
+#define SPI_MCR_HALT            (uint32_t)0x00000001
+#define SPI_MCR_PCSIS(n)        (((n) & 0x1F) << 16)
+#define SPI_CTAR_DBR            (uint32_t)0x80000000
+#define SPI_CTAR_FMSZ(n)        (((n) & 15) << 27)
+#define SPI_CTAR_CPOL           (uint32_t)0x04000000
+#define SPI_CTAR_CPHA           (uint32_t)0x02000000
+#define SPI_CTAR_PBR(n)         (((n) & 3) << 16)
+#define SPI_CTAR_BR(n)          (((n) & 15) << 0)
+#define SPI_SR_TCF              (uint32_t)0x80000000
+#define SPI_SR_TXRXS            (uint32_t)0x40000000
+#define SPI_SR_EOQF             (uint32_t)0x10000000
+#define SPI_SR_TFFF             (uint32_t)0x02000000
+#define SPI_SR_RFDF             (uint32_t)0x00020000
+#define SPI_RSER_EOQF_RE        (uint32_t)0x10000000
+#define SPI_PUSHR_CONT          (uint32_t)0x80000000
+#define SPI_PUSHR_CTAS(n)       (((n) & 7) << 28)
+#define SPI_PUSHR_EOQ           (uint32_t)0x08000000
+#define SPI_PUSHR_PCS(n)        (((n) & 31) << 16)
+
+// Chapter 44: Inter-Integrated Circuit (I2C)
+#define I2C0_A1                 SIM_REG8(0x40066000)
+#define I2C0_F                  SIM_REG8(0x40066001)
+#define I2C0_C1                 SIM_REG8(0x40066002)
+#define I2C0_S                  SIM_REG8(0x40066003)
+#define I2C0_D                  SIM_REG8(0x40066004)
+#define I2C0_C2                 SIM_REG8(0x40066005)
+#define I2C0_FLT                SIM_REG8(0x40066006)
+#define I2C_C1_IICEN            (uint8_t)0x80
+#define I2C_C1_IICIE            (uint8_t)0x40
+#define I2C_C1_MST              (uint8_t)0x20
+#define I2C_C1_TX               (uint8_t)0x10
+#define I2C_C1_TXAK             (uint8_t)0x08
+#define I2C_C2_HDRS             (uint8_t)0x20
+#define I2C_S_TCF               (uint8_t)0x80
+#define I2C_S_IAAS              (uint8_t)0x40
+#define I2C_S_BUSY              (uint8_t)0x20
+#define I2C_S_ARBL              (uint8_t)0x10
+#define I2C_S_SRW               (uint8_t)0x04
+#define I2C_S_IICIF             (uint8_t)0x02
+#define I2C_S_RXAK              (uint8_t)0x01
+
+// Interrupt numbers (MK20DX256)
+#define IRQ_DMA_CH0             0
+#define IRQ_DMA_CH1             1
+#define IRQ_DMA_CH2             2
+#define IRQ_DMA_CH3             3
+#define IRQ_DMA_CH4             4
+#define IRQ_I2C0                24
+#define IRQ_SPI0                26
+#define IRQ_CMP1                60
+#define IRQ_FTM0                62
+#define IRQ_FTM2                64
+#define IRQ_PIT_CH0             68
+#define IRQ_PIT_CH1             69
+#define IRQ_PIT_CH2             70
+#define IRQ_PIT_CH3             71
+#define IRQ_USBOTG              73
+#define IRQ_PORTA               87
+#define IRQ_PORTB               88
+#define IRQ_PORTC               89
+#define IRQ_PORTD               90
+#define IRQ_PORTE               91
+#define IRQ_SOFTWARE            94
+#define NVIC_NUM_INTERRUPTS     95
+
+// System Control Space (SCS), ARMv7 ref manual, B3.2
+#define SYST_CSR                SIM_REG32(0xE000E010)
+#define SYST_RVR                SIM_REG32(0xE000E014)
+#define SYST_CVR                SIM_REG32(0xE000E018)
+#define SYST_CSR_COUNTFLAG      (uint32_t)0x00010000
+#define SYST_CSR_CLKSOURCE      (uint32_t)0x00000004
+#define SYST_CSR_TICKINT        (uint32_t)0x00000002
+#define SYST_CSR_ENABLE         (uint32_t)0x00000001
+#define SCB_VTOR                SIM_REG32(0xE000ED08)
+#define SCB_SHPR3               SIM_REG32(0xE000ED20)
+#define ARM_DEMCR               SIM_REG32(0xE000EDFC)
+#define ARM_DEMCR_TRCENA        (1 << 24)
+#define ARM_DWT_CTRL            SIM_REG32(0xE0001000)
+#define ARM_DWT_CTRL_CYCCNTENA  (1 << 0)
+#define ARM_DWT_CYCCNT          SIM_REG32(0xE0001004)
+
+#define NVIC_ENABLE_IRQ(n)      (*((volatile uint32_t *)sim_reg(0xE000E100) + ((n) >> 5)) = (1 << ((n) & 31)))
+#define NVIC_DISABLE_IRQ(n)     (*((volatile uint32_t *)sim_reg(0xE000E180) + ((n) >> 5)) = (1 << ((n) & 31)))
+#define NVIC_SET_PENDING(n)     (*((volatile uint32_t *)sim_reg(0xE000E200) + ((n) >> 5)) = (1 << ((n) & 31)))
+#define NVIC_CLEAR_PENDING(n)   (*((volatile uint32_t *)sim_reg(0xE000E280) + ((n) >> 5)) = (1 << ((n) & 31)))
+#define NVIC_SET_PRIORITY(irqnum, priority)  (*((volatile uint8_t *)sim_reg(0xE000E400) + (irqnum)) = (uint8_t)(priority))
+#define NVIC_GET_PRIORITY(irqnum) (*((volatile uint8_t *)sim_reg(0xE000E400) + (irqnum)))
+
+#define __disable_irq()         sim_set_primask(1);
+#define __enable_irq()          sim_set_primask(0);
+
+extern void systick_isr(void);
+extern void dma_ch3_isr(void);
+extern void dma_ch4_isr(void);
+extern void i2c0_isr(void);
+extern void spi0_isr(void);
+extern void pit0_isr(void);
+extern void pit1_isr(void);
+extern void pit2_isr(void);
+extern void pit3_isr(void);
+extern void usb_isr(void);
+extern void portb_isr(void);
+extern void software_isr(void);
+
+#endif
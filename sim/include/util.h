@@ -0,0 +1,51 @@
+/* Simulated Teensy delay helpers
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef util_h
+#define util_h
+
+#include <stdint.h>
+
+/********************************************************************************
+ * Simulated Teensy delay helpers
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Stands in for teensy-include/util.h in the host build (make sim). The busy-wait loops become waits
+ *   on the simulated clock, so interrupts that come due during the delay still run.
+ ********************************************************************************/
+
+void sim_delay_cycles(uint32_t cycles);
+
+static inline void delay(uint32_t ms)
+{
+  while(ms--)
+    sim_delay_cycles(F_CPU / 1000);
+}
+
+static inline void delay_microseconds(uint32_t usec)
+{
+  sim_delay_cycles(usec * (F_CPU / 1000000));
+}
+
+#endif
@@ -0,0 +1,189 @@
+/********************************************************************************
+ * Host simulation: motor and encoder
+ * Ben Weiss, University of Washington 2014
+ * Purpose: The stepper, its load and the magnetic encoder on its shaft, for the host simulation (sim.h).
+ *
+ *   The driver holds the rotor at the commanded microstep with a torque that varies sinusoidally over one
+ *   electrical cycle (4 full steps, so 50 per rev for a 200 step motor):
+ *     J w' = -T_hold sin(50 (theta - theta_cmd)) - b w - T_friction sign(w) + T_load
+ *   integrated forward to the simulated time whenever the firmware steps or reads the encoder. Disabling the
+ *   driver drops the holding torque. Steps that come too fast for the rotor to follow are lost, the same as
+ *   on the bench, and the encoder tells the controller so.
+ *
+ *   The encoder (AS5045) reports a 12-bit angle, scaled so one microstep is plant_params.tics_per_step
+ *   tics, in the 32-bit frame spienc.c:decode_spi() expects.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sim.h"
+#include "../imc/config.h"
+
+// Constants ==========================================================================
+#define FULL_STEPS_PER_REV      200
+#define POLE_PAIRS              (FULL_STEPS_PER_REV / 4)
+#define ENC_ROLLOVER            4096
+#define DT_CYCLES               (F_CPU / 500000)        // integration step (2 us)
+
+// Global Variables ====================================================================
+// Motor and encoder. Set any of these with "imcsim -p name=value".
+static struct {
+  double microsteps;          // microsteps per full step; the firmware sets DEFAULT_MICROSTEPPING
+  double tics_per_step;       // encoder tics per microstep (main.c:enc_tics_per_step, parameter q)
+  double hold_torque;         // N m
+  double inertia;             // rotor and load, kg m^2
+  double damping;             // viscous, N m s/rad
+  double friction;            // Coulomb, N m
+  double load;                // constant external torque, N m
+  double noise;               // encoder noise, tics peak (uniform)
+} plant_params = {
+  .microsteps = DEFAULT_MICROSTEPPING,
+  .tics_per_step = 21.7343,
+  .hold_torque = 0.4,
+  .inertia = 1e-5,
+  .damping = 2e-3,
+  .friction = 0.005,
+  .load = 0,
+  .noise = 0,
+};
+
+static const struct {
+  const char *name;
+  double *value;
+} param_names[] = {
+  {"microsteps", &plant_params.microsteps},
+  {"tics_per_step", &plant_params.tics_per_step},
+  {"hold_torque", &plant_params.hold_torque},
+  {"inertia", &plant_params.inertia},
+  {"damping", &plant_params.damping},
+  {"friction", &plant_params.friction},
+  {"load", &plant_params.load},
+  {"noise", &plant_params.noise},
+};
+
+// Local Variables ===================================================================
+static double theta = 0, omega = 0;   // rotor angle (rad) and speed (rad/s)
+static double rad_per_step;           // per microstep
+static int32_t steps = 0;             // commanded microstep
+static bool enabled = true;
+static uint64_t updated = 0;          // sim_now the state is good for
+static uint32_t noise_seed = 1;
+
+// Function Predeclares ======================================================
+static void plant_update(void);
+
+
+void plant_init(void)
+{
+  rad_per_step = 2 * M_PI / (FULL_STEPS_PER_REV * plant_params.microsteps);
+  theta = omega = 0;
+  steps = 0;
+  updated = sim_now;
+}
+
+// sets a parameter by name. Returns false if there's no such parameter.
+bool plant_set_param(const char *name, double value)
+{
+  for(uint32_t i = 0; i < sizeof(param_names) / sizeof(param_names[0]); i++)
+    if(!strcmp(name, param_names[i].name))
+    {
+      *param_names[i].value = value;
+      return true;
+    }
+  return false;
+}
+
+// brings the rotor up to sim_now
+static void plant_update(void)
+{
+  while(updated < sim_now)
+  {
+    uint64_t cycles = sim_now - updated < DT_CYCLES ? sim_now - updated : DT_CYCLES;
+    double dt = (double)cycles / F_CPU;
+    double torque = plant_params.load - plant_params.damping * omega;
+    if(enabled)
+      torque -= plant_params.hold_torque * sin(POLE_PAIRS * (theta - steps * rad_per_step));
+
+    if(0 == omega && fabs(torque) <= plant_params.friction)
+      torque = 0;         // stuck
+    else
+    {
+      double w = omega + (torque - copysign(plant_params.friction, 0 != omega ? omega : torque)) / plant_params.inertia * dt;
+      omega = (omega > 0 && w < 0) || (omega < 0 && w > 0) ? 0 : w;     // friction stops the rotor, never reverses it
+    }
+    theta += omega * dt;
+    updated += cycles;
+  }
+}
+
+// a rising edge on the step pin
+void plant_step(bool backwards)
+{
+  plant_update();
+  steps += backwards ? -1 : 1;
+}
+
+void plant_enable(bool on)
+{
+  plant_update();
+  enabled = on;
+}
+
+// encoder reading, unwrapped
+static int32_t plant_tics(void)
+{
+  double tics = theta / rad_per_step * plant_params.tics_per_step;
+  if(plant_params.noise > 0)
+    tics += plant_params.noise * (2.0 * rand_r(&noise_seed) / RAND_MAX - 1);
+  return (int32_t)floor(tics);
+}
+
+// the 32-bit frame the encoder shifts out when chip select falls: a garbage bit (0), the 12-bit angle, OCF = 1,
+// COF = LIN = MagINC = MagDEC = 0, and even parity over the 17 bits before it.
+uint32_t plant_encoder_word(void)
+{
+  uint32_t angle, word;
+  plant_update();
+  angle = (uint32_t)(((plant_tics() % ENC_ROLLOVER) + ENC_ROLLOVER) % ENC_ROLLOVER);
+  word = (angle << 19) | (1u << 18);
+  if(__builtin_parity(word >> 14))
+    word |= 1u << 13;
+  return word;
+}
+
+// commanded step, rotor position (steps), speed (steps/s) and encoder tics (unwrapped), for the trace
+void plant_state(int32_t *step, double *position, double *velocity, int32_t *tics)
+{
+  plant_update();
+  *step = steps;
+  *position = theta / rad_per_step;
+  *velocity = omega / rad_per_step;
+  *tics = plant_tics();
+}
@@ -0,0 +1,343 @@
+/********************************************************************************
+ * Host simulation: capture replay
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Plays a control input capture (capture.h, parameter x) back through the firmware's own ctrl.c and
+ *   path.c, and checks every control update against what the board computed (imcsim -R capture.bin). The
+ *   capture is a data file from the board, or an imcsim -d file (the capture packets are picked out of the
+ *   DATA0 stream by their flag).
+ *
+ *   Nothing runs on its own here: there are no interrupts, the controller timer never ticks, and the clock
+ *   (timebase.h) is set to each record's time before it is applied. A TICK record goes through ctrl_run with
+ *   the inputs the board sampled, and its outputs - target position and controller output - have to match
+ *   the board's to the bit; a SLOW record runs software_isr with the stepper state the board's saw. QUEUE
+ *   records load the IMC queue, and MODE, PARAM, PERIOD and PATH records make the same calls the board made.
+ *
+ *   Prints the number of updates replayed, the first few mismatches, how many records preempted the slow
+ *   path (CAP_REC_NESTED; those may not land where they did on the board), and the host time per update.
+ *   Exits 1 if any update didn't match or the capture is broken.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "sim.h"
+#include "../common.h"
+#include "../capture.h"
+#include "../rawhid_msg.h"
+#include "../imc/queue.h"
+#include "../imc/stepper.h"
+
+// Constants ==========================================================================
+#define REPLAY_SHOW_MISMATCHES  5       // mismatches printed in full
+
+// Local Variables ===================================================================
+static uint8_t *stream = NULL;          // the records, out of their packets
+static uint32_t stream_len = 0, stream_size = 0;
+static uint32_t updates = 0, mismatches = 0, nested = 0;
+static uint64_t host_ns = 0;
+
+
+static uint64_t host_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// sets the firmware's clock to t (tenus)
+static void set_time(uint32_t t)
+{
+  time_seq++;
+  time_snap.cyccnt = ARM_DWT_CYCCNT;
+  time_snap.tenus = t;
+  time_seq++;
+}
+
+// reads the capture packets out of a data file (host.c's -d format: each packet behind its header byte) into
+// stream. Returns false if the file can't be read or a packet is missing.
+static bool read_capture(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  uint8_t head, pack[RAWHID_TX_SIZE];
+  uint32_t len, packets = 0;
+  uint8_t seq = 0;
+
+  if(!f)
+  {
+    perror(path);
+    return false;
+  }
+  while(fread(&head, 1, 1, f) == 1)
+  {
+    len = head >> 2;
+    if(fread(pack, 1, len, f) != len)
+    {
+      fprintf(stderr, "imcsim: %s: truncated packet\n", path);
+      break;
+    }
+    if(CAP_PACK_TYPE != (head & TX_PACK_TYPE_MASK) || len < CAP_PACK_HEAD || !(pack[1] & CAP_PACK_FLAG))
+      continue;   // history streaming, or another stream
+    if(packets++ && pack[0] != seq)
+    {
+      fprintf(stderr, "imcsim: %s: capture packets %u to %u are missing\n", path, (unsigned int)seq,
+              (unsigned int)(uint8_t)(pack[0] - 1));
+      fclose(f);
+      return false;
+    }
+    seq = pack[0] + 1;
+    if(stream_len + len > stream_size)
+    {
+      stream_size = stream_size ? 2 * stream_size : 65536;
+      stream = realloc(stream, stream_size);
+    }
+    memcpy(stream + stream_len, pack + CAP_PACK_HEAD, len - CAP_PACK_HEAD);
+    stream_len += len - CAP_PACK_HEAD;
+  }
+  fclose(f);
+  if(!packets)
+    fprintf(stderr, "imcsim: %s: no capture packets\n", path);
+  return packets > 0;
+}
+
+// replays a TICK record, and checks its outputs
+static void replay_tick(const cap_tick_t *rec)
+{
+  real target_pos, ctrl_out;
+  uint64_t start;
+
+  set_time(rec->in.time);
+  start = host_now_ns();
+  if(!ctrl_run(&rec->in, &target_pos, &ctrl_out))
+  {
+    target_pos = NAN;
+    ctrl_out = NAN;
+  }
+  host_ns += host_now_ns() - start;
+  updates++;
+  if(!memcmp(&target_pos, &rec->target_pos, sizeof(real)) && !memcmp(&ctrl_out, &rec->ctrl_out, sizeof(real)))
+    return;
+  if(mismatches++ < REPLAY_SHOW_MISMATCHES)
+    printf("mismatch at update %u, time %u: target %.9g (board %.9g), output %.9g (board %.9g)\n",
+           (unsigned int)updates, (unsigned int)rec->in.time, target_pos, rec->target_pos, ctrl_out, rec->ctrl_out);
+}
+
+// replays a PATH record
+static bool replay_path(const uint8_t *payload, uint32_t len)
+{
+  cap_path_t hdr;
+  cap_move_t move;
+  const uint8_t *arg = payload + sizeof(hdr);
+  uint32_t arglen = len - sizeof(hdr);
+  int32_t target;
+  real wait_pos;
+  custom_path_dp_t elem;
+  path_snap_t snap;
+  msg_queue_move_t *block;
+
+  if(len < sizeof(hdr))
+    return false;
+  memcpy(&hdr, payload, sizeof(hdr));
+  set_time(hdr.time);
+  switch(hdr.op)
+  {
+  case CAP_PATH_STEP:
+    if(arglen != sizeof(target))
+      return false;
+    memcpy(&target, arg, sizeof(target));
+    path_set_step_target(target);
+    break;
+  case CAP_PATH_IMC:
+    if(arglen != sizeof(wait_pos))
+      return false;
+    memcpy(&wait_pos, arg, sizeof(wait_pos));
+    path_imc(wait_pos);
+    break;
+  case CAP_PATH_MOVE:
+    if(arglen != sizeof(move))
+      return false;
+    memcpy(&move, arg, sizeof(move));
+    if(move.from_queue)
+    {
+      // the head of the queue, which the QUEUE records have loaded just as the board had it
+      if(!(block = dequeue_block()))
+        return false;
+      path_ramps_move(block);
+    }
+    else
+      path_ramps_move(&move.move);
+    break;
+  case CAP_PATH_CUSTOM_CLEAR:
+    path_custom_clear();
+    break;
+  case CAP_PATH_CUSTOM_ADD:
+    if(arglen != sizeof(elem))
+      return false;
+    memcpy(&elem, arg, sizeof(elem));
+    path_custom_add_elem(&elem);
+    break;
+  case CAP_PATH_CUSTOM_START:
+    path_custom_start();
+    break;
+  case CAP_PATH_SINES:
+    path_sines_start();
+    break;
+  case CAP_PATH_RAND:
+    path_rand_start();
+    break;
+  case CAP_PATH_FRA:
+    path_fra_start();
+    break;
+  case CAP_PATH_PRBS:
+    path_prbs_start();
+    break;
+  case CAP_PATH_SNAP:
+    if(arglen != sizeof(snap))
+      return false;
+    memcpy(&snap, arg, sizeof(snap));
+    path_set_snap(&snap);
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// replays one record. Returns false if it's malformed.
+static bool replay_record(uint8_t type, const uint8_t *payload, uint32_t len)
+{
+  const param_desc_t *p;
+  cap_tick_t tick;
+  cap_mode_t mode;
+  msg_queue_move_t *block;
+  uint32_t us;
+  uint64_t start;
+
+  switch(type)
+  {
+  case CAP_REC_START:
+    if(len < 5 || CAP_VERSION != payload[0])
+    {
+      fprintf(stderr, "imcsim: capture version %u; this build replays version %u\n", (unsigned int)payload[0], CAP_VERSION);
+      return false;
+    }
+    memcpy(&us, payload + 1, sizeof(us));
+    set_time(us);
+    while(dequeue_block())
+      ;
+    break;
+  case CAP_REC_PARAM:
+    if(!len || !(p = param_by_id(payload[0])) || !param_write(p, payload + 1, len - 1))
+      return false;
+    break;
+  case CAP_REC_PERIOD:
+    if(len != sizeof(us))
+      return false;
+    memcpy(&us, payload, sizeof(us));
+    ctrl_set_period(us);
+    break;
+  case CAP_REC_PATH:
+    return replay_path(payload, len);
+  case CAP_REC_MODE:
+    if(len != sizeof(mode))
+      return false;
+    memcpy(&mode, payload, sizeof(mode));
+    set_time(mode.time);
+    ctrl_enable_at((ctrl_mode)mode.mode, mode.encpos);
+    break;
+  case CAP_REC_QUEUE:
+    if(len != sizeof(msg_queue_move_t) || !(block = reserve_block()))
+      return false;
+    memcpy(block, payload, sizeof(msg_queue_move_t));
+    commit_block();
+    break;
+  case CAP_REC_TICK:
+    if(len != sizeof(tick))
+      return false;
+    memcpy(&tick, payload, sizeof(tick));
+    replay_tick(&tick);
+    break;
+  case CAP_REC_SLOW:
+    if(len != 1)
+      return false;
+    st.state = payload[0];
+    start = host_now_ns();
+    software_isr();
+    host_ns += host_now_ns() - start;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// imcsim -R: replays the capture in path and exits
+void replay_run(const char *path)
+{
+  uint32_t pos = 0, len;
+  uint8_t type;
+  bool ended = false, ok = true;
+
+  if(!read_capture(path))
+    exit(1);
+  plant_init();
+  sim_reset();
+  initialize_motion_queue();
+  params_init();
+
+  while(pos + CAP_REC_HEAD <= stream_len && !ended)
+  {
+    type = stream[pos];
+    len = stream[pos + 1];
+    if(pos + CAP_REC_HEAD + len > stream_len)
+      break;
+    if(type & CAP_REC_NESTED)
+      nested++;
+    type &= ~CAP_REC_NESTED;
+    if(CAP_REC_END == type)
+    {
+      printf("capture ended: %s\n", len && CAP_END_OVERFLOW == stream[pos + 2] ? "overflowed" : "stopped");
+      ended = true;
+    }
+    else if(!replay_record(type, stream + pos + CAP_REC_HEAD, len))
+    {
+      fprintf(stderr, "imcsim: bad capture record (type %u, %u bytes) at byte %u\n", (unsigned int)type,
+              (unsigned int)len, (unsigned int)pos);
+      ok = false;
+      break;
+    }
+    pos += CAP_REC_HEAD + len;
+  }
+  if(ok && !ended)
+    printf("capture ends without an END record\n");
+
+  printf("replayed %u updates: %u mismatches, %u records preempted the slow path, %.0f ns per update\n",
+         (unsigned int)updates, (unsigned int)mismatches, (unsigned int)nested, updates ? (double)host_ns / updates : 0.);
+  exit(ok && !mismatches ? 0 : 1);
+}
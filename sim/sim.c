@@ -0,0 +1,1121 @@
+/********************************************************************************
+ * Host simulation: peripherals
+ * Ben Weiss, University of Washington 2014
+ * Purpose: The simulated clock, NVIC, PIT, SysTick, DWT cycle counter, GPIO, the sync line's pin interrupt,
+ *   DMA channels 0-3, SPI0 and the I2C0 slave behind the registers in sim/include/mk20dx128.h. See sim.h.
+ *
+ *   Registers are plain memory at their real addresses (offset into mem_aips and mem_ppb). The firmware reads
+ *   and writes them directly through the pointer sim_reg() returns, so a write is only seen at the next
+ *   register access, when sync() compares each register with side effects against the value it last held.
+ *   Write-only registers (GPIO set/clear/toggle, NVIC set/clear, PIT flags, DMA set/clear request) go back
+ *   to their idle value once handled; SPI SR and PUSHR carry a reserved bit the firmware never writes, so a
+ *   store of any value is noticed. Registers the hardware computes (PDIR, CVALs, CVR, CYCCNT, SPI SR) are
+ *   filled in on the way out of sim_reg().
+ *
+ *   Pointers the firmware hands the DMA controller are used as host pointers, so the simulator is linked
+ *   -no-pie: the firmware's statics and the register memory then sit below 4 GB, where they fit in 32 bits.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <mk20dx128.h>
+
+#include "sim.h"
+#include "../imc/hardware.h"
+
+#ifdef STEP_USE_FTM
+#error "FTM0 isn't simulated; make sim needs imc/hardware.h:STEP_USE_FTM off"
+#endif
+
+// Constants ==========================================================================
+#define AIPS_BASE               0x40000000u
+#define PPB_BASE                0xE0000000u
+#define WATCH_MAX               96
+#define SPI_FIFO_DEPTH          4
+#define SPI_BASE                0x4002C000u
+#define SPI_SR_SIM              (uint32_t)0x20000000    // reserved bits the firmware never writes
+#define SPI_PUSHR_SIM           (uint32_t)0x02000000
+#define DMA_REQ_IDLE            0x80                    // DMA_SERQ/CERQ/CINT: NOP
+#define SHPR3_SYSTICK           0xE000ED23u             // SysTick priority byte
+#define SYST_CVR_MASK           0x00FFFFFFu
+#define I2C_BASE                0x40066000u
+#define I2C_BYTE_CYCLES         (9 * (F_CPU / 400000))  // a byte and its acknowledge at the master's 400 kHz
+
+// Global Variables ====================================================================
+volatile uint64_t sim_now = 0;
+uint64_t sim_end = 0;
+uint32_t sim_irq_counts[NVIC_NUM_INTERRUPTS + 1];
+volatile uint32_t systick_millis_count = 0;     // mk20dx128.c on the Teensy
+bool sim_host_timing = false;
+uint64_t sim_host_ns[SIM_CTX_COUNT];
+
+// The handlers the firmware defines. Any it doesn't (or, like usb_isr, that live in the Teensy core) stay null.
+#pragma weak systick_isr
+#pragma weak dma_ch3_isr
+#pragma weak dma_ch4_isr
+#pragma weak i2c0_isr
+#pragma weak spi0_isr
+#pragma weak pit0_isr
+#pragma weak pit1_isr
+#pragma weak pit2_isr
+#pragma weak pit3_isr
+#pragma weak usb_isr
+#pragma weak portb_isr
+#pragma weak software_isr
+void (* const gVectors[NVIC_NUM_INTERRUPTS + 16])(void) = {
+  [15]                  = systick_isr,
+  [IRQ_DMA_CH3 + 16]    = dma_ch3_isr,
+  [IRQ_DMA_CH4 + 16]    = dma_ch4_isr,
+  [IRQ_I2C0 + 16]       = i2c0_isr,
+  [IRQ_SPI0 + 16]       = spi0_isr,
+  [IRQ_PIT_CH0 + 16]    = pit0_isr,
+  [IRQ_PIT_CH1 + 16]    = pit1_isr,
+  [IRQ_PIT_CH2 + 16]    = pit2_isr,
+  [IRQ_PIT_CH3 + 16]    = pit3_isr,
+  [IRQ_USBOTG + 16]     = usb_isr,
+  [IRQ_PORTB + 16]      = portb_isr,
+  [IRQ_SOFTWARE + 16]   = software_isr,
+};
+
+// Local Variables ===================================================================
+static uint8_t mem_aips[0x100000] __attribute__ ((aligned(4096)));   // 0x40000000 - 0x400FFFFF: peripherals, GPIO
+static uint8_t mem_ppb[0x10000] __attribute__ ((aligned(4096)));     // 0xE0000000 - 0xE000FFFF: DWT, SysTick, NVIC, SCB
+
+// registers with side effects: written(addr, old, value) handles a store and returns what the register holds after
+typedef uint32_t (*written_fn)(uint32_t addr, uint32_t old, uint32_t value);
+typedef struct {
+  uint32_t addr;
+  uint8_t size;
+  uint32_t shadow;            // what the register held after the last sync or refresh
+  written_fn written;
+} watch_t;
+static watch_t watches[WATCH_MAX];
+static uint32_t watch_count = 0;
+
+// NVIC. Exception SIM_IRQ_SYSTICK is SysTick, which sorts ahead of every IRQ at the same priority.
+static uint32_t nvic_enabled[3], nvic_pending[3];
+static uint8_t active[NVIC_NUM_INTERRUPTS + 1];     // stack of running handlers, innermost last
+static uint8_t active_prio[NVIC_NUM_INTERRUPTS + 1];
+static uint32_t active_depth = 0;
+static uint32_t primask = 0, basepri = 0;
+
+static struct {
+  bool running;
+  bool tif;
+  uint64_t next;              // cycle the timer next reaches 0
+} pit[4];
+
+static bool syst_running = false;
+static uint64_t syst_next;
+static uint64_t cyccnt_base = 0;
+static uint64_t host_next = 0;
+
+// host time accounting (sim_host_timing): the context running since host_mark, and the cost of reading the clock
+static uint32_t host_ctx = SIM_CTX_MAIN;
+static uint64_t host_mark = 0, host_cal = 0;
+
+static uint32_t gpio_out[5];                        // levels on the output pins, (PDOR & PDDR) per port
+static uint32_t step_port, dir_port;                // ports holding imc/hardware.h's STEP_BIT and DIR_BIT/DISABLE_BIT
+static uint32_t grounded[5];                        // inputs held low from outside
+static uint32_t pulled[5];                          // and high, unless they're also held low
+static uint32_t sync_pcr = 0, sync_port;           // the sync line (imc/hardware.h:SYNC_CTRL, SYNC_BIT)
+static watch_t *sync_watch;
+static bool sync_level = false;                     // at the last look
+static bool sync_touched = false;                   // SYNC_CTRL was accessed with its flag up
+
+static struct {
+  uint32_t tx[SPI_FIFO_DEPTH], rx[SPI_FIFO_DEPTH];
+  uint32_t tx_n, rx_n;
+  bool eoqf, tcf;
+  bool busy;                  // a frame is on the wire, done at frame_end
+  uint64_t frame_end;
+  uint32_t frame_cmd, frame_bits;
+  bool cs;                    // chip select held from the last frame (PUSHR CONT)
+  uint32_t word, bit;         // encoder frame being shifted in, and how many bits of it have gone
+} spi;
+
+static struct {
+  bool on;                    // the master has a transfer going (between START and STOP)
+  uint8_t addr;               // slave it's addressing
+  bool read;
+  uint8_t data[SIM_I2C_MAX];  // bytes to write, or those read
+  uint32_t len, n;            // bytes in the transfer, and done so far (after the address)
+  bool addressed, acked;      // the address byte has gone, and the board answered it
+  bool busy;                  // a byte is on the wire, done at byte_end
+  uint64_t byte_end;
+  bool held;                  // the board is holding SCL low after a byte, until its isr has dealt with it
+  bool d_seen;                // the isr has read or written D since the byte
+} i2c;
+
+// Function Predeclares ======================================================
+static void sync(void);
+static void dispatch(void);
+static void refresh(uint32_t addr);
+static void update_levels(void);
+static void spi_kick(void);
+static void pit_start(uint32_t n);
+static void sync_irq_update(void);
+static void i2c_kick(void);
+
+
+// Host timing =======================================================================
+static uint64_t host_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// charges the host time since the last switch to whatever was running, less the clock read that falls inside
+// it, and switches to ctx. Returns the context that was running, to switch back to.
+static uint32_t host_switch(uint32_t ctx)
+{
+  uint32_t prev = host_ctx;
+  if(sim_host_timing)
+  {
+    uint64_t now = host_ns(), dt = now - host_mark;
+    sim_host_ns[prev] += dt > host_cal ? dt - host_cal : 0;
+    host_mark = now;
+  }
+  host_ctx = ctx;
+  return prev;
+}
+
+
+// register memory for addr
+static inline void *cell(uint32_t addr)
+{
+  if(addr - AIPS_BASE < sizeof(mem_aips))
+    return mem_aips + (addr - AIPS_BASE);
+  if(addr - PPB_BASE < sizeof(mem_ppb))
+    return mem_ppb + (addr - PPB_BASE);
+  fprintf(stderr, "imcsim: access to unmapped register 0x%08x\n", (unsigned int)addr);
+  abort();
+}
+
+static inline uint32_t rd(uint32_t addr, uint32_t size)
+{
+  void *p = cell(addr);
+  return 1 == size ? *(volatile uint8_t *)p : 2 == size ? *(volatile uint16_t *)p : *(volatile uint32_t *)p;
+}
+
+static inline void wr(uint32_t addr, uint32_t size, uint32_t value)
+{
+  void *p = cell(addr);
+  if(1 == size)
+    *(volatile uint8_t *)p = value;
+  else if(2 == size)
+    *(volatile uint16_t *)p = value;
+  else
+    *(volatile uint32_t *)p = value;
+}
+
+#define RD32(addr)      rd((addr), 4)
+#define WR32(addr, v)   wr((addr), 4, (v))
+
+static void watch(uint32_t addr, uint32_t size, uint32_t reset, written_fn fn)
+{
+  if(watch_count >= WATCH_MAX)
+  {
+    fprintf(stderr, "imcsim: too many watched registers\n");
+    abort();
+  }
+  wr(addr, size, reset);
+  watches[watch_count++] = (watch_t){addr, size, reset, fn};
+}
+
+// sets a watched register without it counting as a write
+static void set_watched(uint32_t addr, uint32_t value)
+{
+  for(uint32_t i = 0; i < watch_count; i++)
+    if(watches[i].addr == addr)
+    {
+      wr(addr, watches[i].size, value);
+      watches[i].shadow = rd(addr, watches[i].size);
+      return;
+    }
+  WR32(addr, value);
+}
+
+// register memory address of a pointer sim_reg() handed out
+static uint32_t addr_of(volatile void *p)
+{
+  return (uint32_t)((uint8_t *)p - mem_aips) + AIPS_BASE;
+}
+
+
+// NVIC ==============================================================================
+static inline bool bit_get(const uint32_t *set, uint32_t n)
+{
+  return (set[n >> 5] >> (n & 31)) & 1;
+}
+
+static inline void bit_put(uint32_t *set, uint32_t n, bool value)
+{
+  if(value)
+    set[n >> 5] |= 1u << (n & 31);
+  else
+    set[n >> 5] &= ~(1u << (n & 31));
+}
+
+static void pend(uint32_t irq)
+{
+  bit_put(nvic_pending, irq, true);
+}
+
+// 4 priority bits are implemented, in the top of each byte
+static inline uint32_t priority(uint32_t irq)
+{
+  return rd(SIM_IRQ_SYSTICK == irq ? SHPR3_SYSTICK : 0xE000E400 + irq, 1) & 0xF0;
+}
+
+static bool is_active(uint32_t irq)
+{
+  for(uint32_t i = 0; i < active_depth; i++)
+    if(active[i] == irq)
+      return true;
+  return false;
+}
+
+// priority an exception has to beat to preempt what's running
+static uint32_t exec_priority(void)
+{
+  uint32_t p = 256;
+  if(active_depth)
+    p = active_prio[active_depth - 1];
+  if(basepri && basepri < p)
+    p = basepri;
+  if(primask)
+    p = 0;
+  return p;
+}
+
+static void take(uint32_t irq)
+{
+  void (**vectors)(void) = (void (**)(void))(uintptr_t)RD32(0xE000ED08);
+  void (*handler)(void);
+
+  if(!vectors)
+    vectors = (void (**)(void))gVectors;
+  handler = vectors[SIM_IRQ_SYSTICK == irq ? 15 : irq + 16];
+  bit_put(nvic_pending, irq, false);
+  active[active_depth] = irq;
+  active_prio[active_depth++] = priority(irq);
+  sim_irq_counts[irq]++;
+
+  sim_advance(SIM_EXC_CYCLES);
+  if(handler)
+  {
+    uint32_t prev = host_switch(irq);
+    handler();
+    host_switch(prev);
+  }
+  else
+    fprintf(stderr, "imcsim: no handler for irq %u\n", (unsigned int)irq);
+  if(IRQ_SOFTWARE == irq && bench_enabled)
+    bench_sample();     // software_isr has just filed the control update
+  sync();
+  sim_advance(SIM_EXC_CYCLES);
+
+  active_depth--;
+  update_levels();
+}
+
+// takes every pending exception that can preempt what's running, most urgent first
+static void dispatch(void)
+{
+  for(;;)
+  {
+    uint32_t best = 0, best_prio = exec_priority();
+    bool found = false;
+    if(bit_get(nvic_pending, SIM_IRQ_SYSTICK) && priority(SIM_IRQ_SYSTICK) < best_prio)
+    {
+      best = SIM_IRQ_SYSTICK;
+      best_prio = priority(SIM_IRQ_SYSTICK);
+      found = true;
+    }
+    for(uint32_t i = 0; i < 3; i++)
+    {
+      uint32_t ready = nvic_pending[i] & nvic_enabled[i];
+      while(ready)
+      {
+        uint32_t irq = i * 32 + __builtin_ctz(ready);
+        ready &= ready - 1;
+        if(irq < NVIC_NUM_INTERRUPTS && priority(irq) < best_prio)
+        {
+          best = irq;
+          best_prio = priority(irq);
+          found = true;
+        }
+      }
+    }
+    if(!found)
+      return;
+    take(best);
+  }
+}
+
+static uint32_t nvic_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  uint32_t word = (addr & 0x7F) >> 2;
+  switch(addr & ~0x7Fu)
+  {
+  case 0xE000E100:
+    nvic_enabled[word] |= value;
+    break;
+  case 0xE000E180:
+    nvic_enabled[word] &= ~value;
+    break;
+  case 0xE000E200:
+    nvic_pending[word] |= value;
+    break;
+  case 0xE000E280:
+    nvic_pending[word] &= ~value;
+    break;
+  }
+  return 0;
+}
+
+// interrupt lines that stay asserted while their flag is set
+static void update_levels(void)
+{
+  for(uint32_t n = 0; n < 4; n++)
+    if(pit[n].tif && (RD32(0x40037108 + 0x10 * n) & PIT_TCTRL_TIE_MASK) && !is_active(IRQ_PIT_CH0 + n))
+      pend(IRQ_PIT_CH0 + n);
+  if(spi.eoqf && (RD32(SPI_BASE + 0x30) & SPI_RSER_EOQF_RE) && !is_active(IRQ_SPI0))
+    pend(IRQ_SPI0);
+  if((rd(I2C_BASE + 3, 1) & I2C_S_IICIF) && (rd(I2C_BASE + 2, 1) & I2C_C1_IICIE) && !is_active(IRQ_I2C0))
+    pend(IRQ_I2C0);
+  if(sync_pcr && (RD32(sync_pcr) & PORT_PCR_ISF) && !is_active(IRQ_PORTB))
+    pend(IRQ_PORTB);
+}
+
+// imc/utils.h:irq_save
+uint32_t sim_get_primask(void)
+{
+  return primask;
+}
+
+// called by __disable_irq()/__enable_irq()
+void sim_set_primask(uint32_t mask)
+{
+  uint32_t prev = host_switch(SIM_CTX_SIM);
+  sync();
+  dispatch();
+  primask = mask;
+  dispatch();
+  host_switch(prev);
+}
+
+// called by common.h:SET_BASEPRI()/CLEAR_BASEPRI()
+void sim_set_basepri(uint32_t pri)
+{
+  uint32_t prev = host_switch(SIM_CTX_SIM);
+  sync();
+  dispatch();
+  basepri = pri & 0xF0;
+  dispatch();
+  host_switch(prev);
+}
+
+
+// DMA ===============================================================================
+static uint32_t dma_req_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  uint32_t mask = (value & 0x40) ? 0xFFFF : 1u << (value & 15);
+  if(value & DMA_REQ_IDLE)
+    return DMA_REQ_IDLE;
+  if(0x4000801B == addr)
+    WR32(0x4000800C, RD32(0x4000800C) | mask);
+  else if(0x4000801A == addr)
+    WR32(0x4000800C, RD32(0x4000800C) & ~mask);
+  else
+    WR32(0x40008024, RD32(0x40008024) & ~mask);
+  return DMA_REQ_IDLE;
+}
+
+// a hardware request on channel ch (only the PIT triggers, for channels 0-3): runs one minor loop
+static void dma_request(uint32_t ch)
+{
+  uint32_t tcd = 0x40009000 + 0x20 * ch;
+  uint32_t cfg = rd(0x40021000 + ch, 1);
+  uint32_t saddr, daddr, nbytes, ssize, dsize, citer, csr;
+  int16_t soff, doff;
+
+  if(!(cfg & DMAMUX_ENABLE) || !(cfg & DMAMUX_TRIG) || !(RD32(0x4000800C) & (1u << ch)))
+    return;
+  saddr = RD32(tcd);
+  soff = rd(tcd + 0x4, 2);
+  ssize = 1u << ((rd(tcd + 0x6, 2) >> 8) & 7);
+  dsize = 1u << (rd(tcd + 0x6, 2) & 7);
+  nbytes = RD32(tcd + 0x8);
+  daddr = RD32(tcd + 0x10);
+  doff = rd(tcd + 0x14, 2);
+
+  for(uint32_t done = 0; done < nbytes; done += ssize)
+  {
+    volatile void *src = (volatile void *)(uintptr_t)saddr, *dst = (volatile void *)(uintptr_t)daddr;
+    uint32_t v = 1 == ssize ? *(volatile uint8_t *)src : 2 == ssize ? *(volatile uint16_t *)src : *(volatile uint32_t *)src;
+    if(1 == dsize)
+      *(volatile uint8_t *)dst = v;
+    else if(2 == dsize)
+      *(volatile uint16_t *)dst = v;
+    else
+      *(volatile uint32_t *)dst = v;
+    sync();     // the destination is usually a register
+    saddr += soff;
+    daddr += doff;
+  }
+
+  citer = rd(tcd + 0x16, 2) - 1;
+  csr = rd(tcd + 0x1C, 2) & ~DMA_TCD_CSR_DONE;
+  if(!citer)
+  {
+    saddr += RD32(tcd + 0xC);
+    daddr += RD32(tcd + 0x18);
+    citer = rd(tcd + 0x1E, 2);
+    csr |= DMA_TCD_CSR_DONE;
+    if(csr & DMA_TCD_CSR_INTMAJOR)
+    {
+      WR32(0x40008024, RD32(0x40008024) | (1u << ch));
+      pend(IRQ_DMA_CH0 + ch);
+    }
+    if(csr & DMA_TCD_CSR_DREQ)
+      WR32(0x4000800C, RD32(0x4000800C) & ~(1u << ch));
+  }
+  WR32(tcd, saddr);
+  WR32(tcd + 0x10, daddr);
+  wr(tcd + 0x16, 2, citer);
+  wr(tcd + 0x1C, 2, csr);
+}
+
+
+// PIT ===============================================================================
+static void pit_start(uint32_t n)
+{
+  pit[n].running = !(RD32(0x40037000) & PIT_MCR_MDIS_MASK) && (RD32(0x40037108 + 0x10 * n) & PIT_TCTRL_TEN_MASK);
+  pit[n].next = sim_now + RD32(0x40037100 + 0x10 * n) + 1;
+}
+
+static uint32_t pit_mcr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if((old ^ value) & PIT_MCR_MDIS_MASK)
+    for(uint32_t n = 0; n < 4; n++)
+      pit_start(n);
+  return value;
+}
+
+static uint32_t pit_tctrl_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  uint32_t n = (addr - 0x40037108) / 0x10;
+  if((old ^ value) & PIT_TCTRL_TEN_MASK)
+  {
+    WR32(addr, value);
+    pit_start(n);
+  }
+  return value;
+}
+
+static uint32_t pit_tflg_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if(value & PIT_TFLG_TIF_MASK)
+    pit[(addr - 0x4003710C) / 0x10].tif = false;
+  return 0;
+}
+
+
+// SysTick and DWT ===================================================================
+static uint32_t syst_csr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if((old ^ value) & SYST_CSR_ENABLE)
+  {
+    syst_running = value & SYST_CSR_ENABLE;
+    syst_next = sim_now + (RD32(0xE000E014) & SYST_CVR_MASK) + 1;
+  }
+  return value & ~SYST_CSR_COUNTFLAG;
+}
+
+// any write zeros the count, which reloads on the next clock
+static uint32_t syst_cvr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  syst_next = sim_now + (RD32(0xE000E014) & SYST_CVR_MASK) + 1;
+  return 0;
+}
+
+static uint32_t cyccnt_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  cyccnt_base = sim_now - value;
+  return value;
+}
+
+
+// GPIO ==============================================================================
+// sends changes on the stepper pins to the motor
+static void gpio_update(void)
+{
+  uint32_t changed[5];
+  for(uint32_t port = 0; port < 5; port++)
+  {
+    uint32_t out = RD32(0x400FF000 + 0x40 * port) & RD32(0x400FF014 + 0x40 * port);
+    changed[port] = out ^ gpio_out[port];
+    gpio_out[port] = out;
+  }
+  if(changed[dir_port] & DISABLE_BIT)
+    plant_enable(!(gpio_out[dir_port] & DISABLE_BIT));
+  if((changed[step_port] & STEP_BIT) && (gpio_out[step_port] & STEP_BIT))
+    plant_step(gpio_out[dir_port] & DIR_BIT);     // DIR high = backwards (imc/stepper.c)
+}
+
+static uint32_t gpio_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  uint32_t pdor = addr & ~0x3Fu;
+  uint32_t result = value;
+  switch(addr & 0x3F)
+  {
+  case 0x04:
+    WR32(pdor, RD32(pdor) | value);
+    result = 0;
+    break;
+  case 0x08:
+    WR32(pdor, RD32(pdor) & ~value);
+    result = 0;
+    break;
+  case 0x0C:
+    WR32(pdor, RD32(pdor) ^ value);
+    result = 0;
+    break;
+  }
+  set_watched(pdor, RD32(pdor));
+  WR32(addr, result);
+  gpio_update();
+  sync_irq_update();
+  return result;
+}
+
+// inputs read high with the pullup on, low otherwise, unless they're grounded
+static uint32_t gpio_pdir(uint32_t port)
+{
+  uint32_t ddr = RD32(0x400FF014 + 0x40 * port), in = 0;
+  for(uint32_t pin = 0; pin < 32; pin++)
+  {
+    uint32_t pcr = RD32(0x40049000 + 0x1000 * port + 4 * pin);
+    if((pcr & (PORT_PCR_PE | PORT_PCR_PS)) == (PORT_PCR_PE | PORT_PCR_PS))
+      in |= 1u << pin;
+  }
+  in = (in | pulled[port]) & ~grounded[port];
+  return (RD32(0x400FF000 + 0x40 * port) & ddr) | (in & ~ddr);
+}
+
+// Pin interrupts are only simulated on the sync line; the limit switches never change here. The flag sets
+// while the line is at the level IRQC asks for, or when it has changed the way it asks for. The level only
+// changes at GPIO and pin control writes, and when the master lets go of the line, which all call this.
+//
+// portb_isr clears the flag with read-modify-writes, which store back what they read, so a store of ISF can't
+// be told from a load: any access that leaves SYNC_CTRL as it was while the flag is up clears it (sync()). A
+// level interrupt, the only kind the firmware uses on the line, flags again straight away if it still holds.
+static void sync_irq_update(void)
+{
+  uint32_t pcr = RD32(sync_pcr);
+  bool level = gpio_pdir(sync_port) & SYNC_BIT, rose = level && !sync_level, fell = !level && sync_level;
+  bool flag;
+
+  sync_level = level;
+  switch((pcr & PORT_PCR_IRQC_MASK) >> 16)
+  {
+  case 8:  flag = !level;         break;
+  case 9:  flag = rose;           break;
+  case 10: flag = fell;           break;
+  case 11: flag = rose || fell;   break;
+  case 12: flag = level;          break;
+  default: flag = false;          break;
+  }
+  if(flag && !(pcr & PORT_PCR_ISF))
+    set_watched(sync_pcr, pcr | PORT_PCR_ISF);
+}
+
+// ISF is write 1 to clear. A level interrupt flags again straight away if the line is still there.
+static uint32_t sync_pcr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  WR32(addr, (value & ~PORT_PCR_ISF) | (old & ~value & PORT_PCR_ISF));
+  sync_irq_update();
+  return RD32(addr);
+}
+
+// the master lets go of the sync line; the bus pulls it high whenever the board doesn't hold it low
+void sim_sync_release(void)
+{
+  grounded[sync_port] &= ~SYNC_BIT;
+  sync_irq_update();
+}
+
+
+// SPI0 ==============================================================================
+static uint32_t spi_sr(void)
+{
+  return (spi.tcf ? SPI_SR_TCF : 0) | (spi.eoqf ? SPI_SR_EOQF : 0) | (spi.tx_n < SPI_FIFO_DEPTH ? SPI_SR_TFFF : 0)
+       | (spi.rx_n ? SPI_SR_RFDF : 0) | (RD32(SPI_BASE) & (SPI_MCR_HALT | SPI_MCR_MDIS) ? 0 : SPI_SR_TXRXS)
+       | (spi.tx_n << 12) | (spi.rx_n << 4) | SPI_SR_SIM;
+}
+
+// cpu cycles per SCK period for the CTAR a frame uses
+static uint32_t spi_bit_cycles(uint32_t ctar)
+{
+  static const uint32_t pbr[4] = {2, 3, 5, 7};
+  static const uint32_t br[16] = {2, 4, 6, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
+  return (F_CPU / F_BUS) * pbr[(ctar >> 16) & 3] * br[ctar & 15] / ((ctar & SPI_CTAR_DBR) ? 2 : 1);
+}
+
+// starts the next frame from the TX FIFO, if the port is idle and running
+static void spi_kick(void)
+{
+  uint32_t ctar;
+  if(spi.busy || !spi.tx_n || (RD32(SPI_BASE) & (SPI_MCR_HALT | SPI_MCR_MDIS)))
+    return;
+  spi.frame_cmd = spi.tx[0];
+  memmove(spi.tx, spi.tx + 1, --spi.tx_n * sizeof(spi.tx[0]));
+  ctar = RD32(SPI_BASE + 0xC + 4 * ((spi.frame_cmd >> 28) & 7));
+  spi.frame_bits = ((ctar >> 27) & 15) + 1;
+  if(!spi.cs)
+  {
+    // chip select falls: the encoder latches its position
+    spi.word = plant_encoder_word();
+    spi.bit = 0;
+    spi.cs = true;
+  }
+  spi.frame_end = sim_now + spi.frame_bits * spi_bit_cycles(ctar);
+  spi.busy = true;
+}
+
+static void spi_frame_done(void)
+{
+  uint32_t data = 0;
+  for(uint32_t i = 0; i < spi.frame_bits; i++, spi.bit++)
+    data = (data << 1) | (spi.bit < 32 ? (spi.word >> (31 - spi.bit)) & 1 : 0);
+  if(spi.rx_n < SPI_FIFO_DEPTH)
+    spi.rx[spi.rx_n++] = data;
+  if(!(spi.frame_cmd & SPI_PUSHR_CONT))
+    spi.cs = false;
+  if(spi.frame_cmd & SPI_PUSHR_EOQ)
+    spi.eoqf = true;
+  spi.tcf = true;
+  spi.busy = false;
+  spi_kick();
+  update_levels();
+}
+
+static uint32_t spi_mcr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if(value & SPI_MCR_CLR_TXF)
+    spi.tx_n = 0;
+  if(value & SPI_MCR_CLR_RXF)
+    spi.rx_n = 0;
+  WR32(addr, value & ~(SPI_MCR_CLR_TXF | SPI_MCR_CLR_RXF));
+  spi_kick();
+  return RD32(addr);
+}
+
+static uint32_t spi_sr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if(value & SPI_SR_EOQF)
+    spi.eoqf = false;
+  if(value & SPI_SR_TCF)
+    spi.tcf = false;
+  return spi_sr();
+}
+
+static uint32_t spi_pushr_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  if(spi.tx_n < SPI_FIFO_DEPTH)
+    spi.tx[spi.tx_n++] = value;
+  spi_kick();
+  return SPI_PUSHR_SIM;
+}
+
+// SPI0.POPR (see mk20dx128.h): pops the RX FIFO into POPR_[0]
+uint32_t sim_spi_pop(void)
+{
+  uint32_t prev = host_switch(SIM_CTX_SIM);
+  sim_advance(SIM_REG_CYCLES);
+  if(spi.rx_n)
+  {
+    WR32(SPI_BASE + 0x38, spi.rx[0]);
+    memmove(spi.rx, spi.rx + 1, --spi.rx_n * sizeof(spi.rx[0]));
+  }
+  host_switch(prev);
+  return 0;
+}
+
+
+// I2C0 ==============================================================================
+// The board is a slave on the IMC master's bus. The master (host.c) runs one transfer at a time through
+// sim_i2c_start(), a byte every I2C_BYTE_CYCLES. After each byte the board holds SCL low, stalling the
+// master, until its isr has cleared IICIF and read or written D. Only the bytes are modeled, not the
+// lines, so the STOP detection parser.c arms on SDA never fires.
+static void i2c_byte_start(void)
+{
+  i2c.busy = true;
+  i2c.byte_end = sim_now + I2C_BYTE_CYCLES;
+  set_watched(I2C_BASE + 3, rd(I2C_BASE + 3, 1) & ~I2C_S_TCF);
+}
+
+static void i2c_stop(void)
+{
+  i2c.on = false;
+  set_watched(I2C_BASE + 3, rd(I2C_BASE + 3, 1) & ~(I2C_S_BUSY | I2C_S_IAAS | I2C_S_SRW));
+}
+
+// a byte has gone over the wire: the address, one the master wrote, or one it read (which it acknowledges,
+// but for the last)
+static void i2c_byte_done(void)
+{
+  uint32_t s = rd(I2C_BASE + 3, 1) | I2C_S_TCF;
+
+  i2c.busy = false;
+  if(!i2c.addressed)
+  {
+    i2c.addressed = true;
+    i2c.acked = (rd(I2C_BASE + 2, 1) & I2C_C1_IICEN) && (rd(I2C_BASE, 1) >> 1) == i2c.addr;
+    if(!i2c.acked)
+    {
+      set_watched(I2C_BASE + 3, s);
+      i2c_stop();     // nobody answered
+      return;
+    }
+    wr(I2C_BASE + 4, 1, (i2c.addr << 1) | i2c.read);
+    s = (s & ~(I2C_S_SRW | I2C_S_RXAK)) | I2C_S_IAAS | I2C_S_IICIF | (i2c.read ? I2C_S_SRW : 0);
+  }
+  else if(i2c.read)
+  {
+    i2c.data[i2c.n++] = rd(I2C_BASE + 4, 1);
+    s = (s & ~(I2C_S_IAAS | I2C_S_RXAK)) | I2C_S_IICIF | (i2c.n == i2c.len ? I2C_S_RXAK : 0);
+  }
+  else
+  {
+    wr(I2C_BASE + 4, 1, i2c.data[i2c.n++]);
+    s = (s & ~I2C_S_IAAS) | I2C_S_IICIF;
+  }
+  set_watched(I2C_BASE + 3, s);
+  i2c.held = true;
+  i2c.d_seen = false;
+  update_levels();
+}
+
+// lets the master go on once the isr has dealt with the last byte: with the next byte, or a STOP
+static void i2c_kick(void)
+{
+  if(!i2c.held || !i2c.d_seen || (rd(I2C_BASE + 3, 1) & I2C_S_IICIF))
+    return;
+  i2c.held = false;
+  if(i2c.n < i2c.len)
+    i2c_byte_start();
+  else
+    i2c_stop();
+}
+
+// IICIF and ARBL are write 1 to clear
+static uint32_t i2c_s_written(uint32_t addr, uint32_t old, uint32_t value)
+{
+  wr(addr, 1, old & ~(value & (I2C_S_IICIF | I2C_S_ARBL)));
+  i2c_kick();
+  return rd(addr, 1);
+}
+
+// starts a transfer of len bytes from the master to slave addr (data), or from it (read)
+void sim_i2c_start(uint8_t addr, bool read, const uint8_t *data, uint32_t len)
+{
+  if(i2c.on || len > SIM_I2C_MAX)
+  {
+    fprintf(stderr, "imcsim: bad I2C transfer\n");
+    abort();
+  }
+  i2c.on = true;
+  i2c.addr = addr;
+  i2c.read = read;
+  if(!read)
+    memcpy(i2c.data, data, len);
+  i2c.len = len;
+  i2c.n = 0;
+  i2c.addressed = i2c.acked = i2c.held = false;
+  set_watched(I2C_BASE + 3, rd(I2C_BASE + 3, 1) | I2C_S_BUSY);
+  i2c_byte_start();
+}
+
+// true until the transfer sim_i2c_start started has finished
+bool sim_i2c_busy(void)
+{
+  return i2c.on;
+}
+
+// the bytes the last transfer moved (for a read, copied to data), or 0 if the board didn't answer
+uint32_t sim_i2c_result(uint8_t *data)
+{
+  if(!i2c.acked)
+    return 0;
+  if(i2c.read)
+    memcpy(data, i2c.data, i2c.n);
+  return i2c.n;
+}
+
+
+// Clock =============================================================================
+// handles the registers written since the last call
+static void sync(void)
+{
+  if(sync_touched)
+  {
+    sync_touched = false;
+    if(RD32(sync_pcr) == sync_watch->shadow)
+    {
+      set_watched(sync_pcr, sync_watch->shadow & ~PORT_PCR_ISF);
+      sync_irq_update();
+    }
+  }
+  for(uint32_t i = 0; i < watch_count; i++)
+  {
+    watch_t *w = &watches[i];
+    uint32_t v = rd(w->addr, w->size);
+    if(v != w->shadow)
+    {
+      uint32_t old = w->shadow;
+      w->shadow = v;
+      v = w->written(w->addr, old, v);
+      wr(w->addr, w->size, v);
+      w->shadow = rd(w->addr, w->size);
+    }
+  }
+  update_levels();
+}
+
+// fills in the registers the hardware computes, for a read of addr
+static void refresh(uint32_t addr)
+{
+  if(addr - 0x400FF000u < 0x140 && 0x10 == (addr & 0x3F))
+    WR32(addr, gpio_pdir((addr - 0x400FF000) / 0x40));
+  else if(addr - 0x40037104u < 0x40 && 0x4 == (addr & 0xF))
+  {
+    uint32_t n = (addr - 0x40037104) / 0x10;
+    WR32(addr, pit[n].running && pit[n].next > sim_now ? (uint32_t)(pit[n].next - sim_now - 1) : 0);
+  }
+  else if(0xE000E018 == addr && syst_running)
+    set_watched(addr, (uint32_t)(syst_next - sim_now - 1) & SYST_CVR_MASK);
+  else if(0xE0001004 == addr)
+    set_watched(addr, (uint32_t)(sim_now - cyccnt_base));
+  else if(SPI_BASE == addr)
+    set_watched(SPI_BASE + 0x2C, spi_sr());
+  else if(sync_pcr == addr)
+    sync_touched = RD32(addr) & PORT_PCR_ISF;
+  else if(I2C_BASE + 4 == addr)
+  {
+    i2c.d_seen = true;
+    i2c_kick();
+  }
+}
+
+static uint64_t next_event(void)
+{
+  uint64_t t = sim_end ? sim_end : UINT64_MAX;
+  for(uint32_t n = 0; n < 4; n++)
+    if(pit[n].running && pit[n].next < t)
+      t = pit[n].next;
+  if(syst_running && syst_next < t)
+    t = syst_next;
+  if(spi.busy && spi.frame_end < t)
+    t = spi.frame_end;
+  if(i2c.busy && i2c.byte_end < t)
+    t = i2c.byte_end;
+  if(host_tick_cycles && host_next < t)
+    t = host_next;
+  return t;
+}
+
+// everything due by sim_now
+static void run_events(void)
+{
+  for(uint32_t n = 0; n < 4; n++)
+    while(pit[n].running && pit[n].next <= sim_now)
+    {
+      pit[n].tif = true;
+      pit[n].next += RD32(0x40037100 + 0x10 * n) + 1;
+      dma_request(n);
+    }
+  while(syst_running && syst_next <= sim_now)
+  {
+    if(RD32(0xE000E010) & SYST_CSR_TICKINT)
+      pend(SIM_IRQ_SYSTICK);
+    syst_next += (RD32(0xE000E014) & SYST_CVR_MASK) + 1;
+  }
+  if(spi.busy && spi.frame_end <= sim_now)
+    spi_frame_done();
+  if(i2c.busy && i2c.byte_end <= sim_now)
+    i2c_byte_done();
+  while(host_tick_cycles && host_next <= sim_now)
+  {
+    host_tick();
+    host_next += host_tick_cycles;
+  }
+  update_levels();
+  if(sim_end && sim_now >= sim_end)
+    sim_finish();
+}
+
+// runs the clock forward at least cycles, taking the interrupts that come due
+void sim_advance(uint64_t cycles)
+{
+  uint64_t target = sim_now + cycles;
+  sync();
+  dispatch();
+  for(;;)
+  {
+    uint64_t t = next_event();
+    if(t > target)
+      break;
+    if(t > sim_now)
+      sim_now = t;
+    run_events();
+    dispatch();
+  }
+  if(sim_now < target)
+    sim_now = target;
+}
+
+// util.h and common.h delays
+void sim_delay_cycles(uint32_t cycles)
+{
+  uint32_t prev = host_switch(SIM_CTX_SIM);
+  sim_advance(cycles);
+  host_switch(prev);
+}
+
+// every register access (see mk20dx128.h)
+void *sim_reg(uint32_t addr)
+{
+  uint32_t prev = host_switch(SIM_CTX_SIM);
+  sim_advance(SIM_REG_CYCLES);
+  refresh(addr);
+  host_switch(prev);
+  return cell(addr);
+}
+
+// name of an interrupt, for the run summary
+const char *sim_irq_name(uint32_t irq)
+{
+  switch(irq)
+  {
+  case SIM_IRQ_SYSTICK: return "systick";
+  case IRQ_DMA_CH3:     return "dma_ch3";
+  case IRQ_DMA_CH4:     return "dma_ch4";
+  case IRQ_I2C0:        return "i2c0";
+  case IRQ_SPI0:        return "spi0";
+  case IRQ_PIT_CH0:     return "pit0";
+  case IRQ_PIT_CH1:     return "pit1";
+  case IRQ_PIT_CH2:     return "pit2";
+  case IRQ_PIT_CH3:     return "pit3";
+  case IRQ_USBOTG:      return "usb";
+  case IRQ_PORTB:       return "portb";
+  case IRQ_SOFTWARE:    return "software";
+  default:              return "irq";
+  }
+}
+
+// powers up the board: peripherals at their reset values, then what the Teensy startup code
+// (mk20dx128.c:ResetHandler) does before main().
+void sim_reset(void)
+{
+  if((uintptr_t)mem_aips + sizeof(mem_aips) > UINT32_MAX || (uintptr_t)mem_ppb + sizeof(mem_ppb) > UINT32_MAX)
+  {
+    fprintf(stderr, "imcsim: register memory is above 4 GB; link with -no-pie\n");
+    exit(1);
+  }
+
+  for(uint32_t port = 0; port < 5; port++)
+  {
+    uint32_t base = 0x400FF000 + 0x40 * port;
+    watch(base + 0x00, 4, 0, gpio_written);
+    watch(base + 0x04, 4, 0, gpio_written);
+    watch(base + 0x08, 4, 0, gpio_written);
+    watch(base + 0x0C, 4, 0, gpio_written);
+    watch(base + 0x14, 4, 0, gpio_written);
+  }
+  for(uint32_t i = 0; i < 3; i++)
+  {
+    watch(0xE000E100 + 4 * i, 4, 0, nvic_written);
+    watch(0xE000E180 + 4 * i, 4, 0, nvic_written);
+    watch(0xE000E200 + 4 * i, 4, 0, nvic_written);
+    watch(0xE000E280 + 4 * i, 4, 0, nvic_written);
+  }
+  watch(0x40037000, 4, PIT_MCR_MDIS_MASK, pit_mcr_written);
+  for(uint32_t n = 0; n < 4; n++)
+  {
+    watch(0x40037108 + 0x10 * n, 4, 0, pit_tctrl_written);
+    watch(0x4003710C + 0x10 * n, 4, 0, pit_tflg_written);
+  }
+  watch(0xE000E010, 4, 0, syst_csr_written);
+  watch(0xE000E018, 4, 0, syst_cvr_written);
+  watch(0xE0001004, 4, 0, cyccnt_written);
+  watch(0x4000801A, 1, DMA_REQ_IDLE, dma_req_written);
+  watch(0x4000801B, 1, DMA_REQ_IDLE, dma_req_written);
+  watch(0x4000801F, 1, DMA_REQ_IDLE, dma_req_written);
+  watch(SPI_BASE + 0x00, 4, SPI_MCR_MDIS | SPI_MCR_HALT, spi_mcr_written);
+  watch(SPI_BASE + 0x2C, 4, SPI_SR_TFFF | SPI_SR_SIM, spi_sr_written);
+  watch(SPI_BASE + 0x34, 4, SPI_PUSHR_SIM, spi_pushr_written);
+  // S always has TCF or BUSY set, so the isr's stores of IICIF and ARBL are noticed
+  watch(I2C_BASE + 3, 1, I2C_S_TCF, i2c_s_written);
+  host_next = host_tick_cycles;
+
+  step_port = (addr_of(&STEP_PORT(DOR)) - 0x400FF000) / 0x40;
+  dir_port = (addr_of(&STEPPER_PORT(DOR)) - 0x400FF000) / 0x40;
+  // the bench wiring: a normally closed min limit switch to ground, which the firmware reads as not asserted
+  // (high = asserted), and nothing on the max limit, which the firmware inverts. The sync line has the bus's
+  // pullup, and the master holds it low until it has sent moves (host.c).
+  sync_port = (addr_of(&CONTROL_PORT(DOR)) - 0x400FF000) / 0x40;
+  grounded[sync_port] = MIN_LIMIT_BIT | SYNC_BIT;
+  pulled[sync_port] = SYNC_BIT;
+  sync_pcr = 0x40049000 + 0x1000 * sync_port + 4 * __builtin_ctz(SYNC_BIT);   // SYNC_CTRL
+  sync_watch = &watches[watch_count];
+  watch(sync_pcr, 4, 0, sync_pcr_written);
+
+  // what a clock read costs; host_switch takes one back out of every charge
+  if(sim_host_timing)
+  {
+    uint64_t start = host_ns();
+    for(uint32_t i = 0; i < 1000; i++)
+      host_ns();
+    host_cal = (host_ns() - start) / 1001;
+    host_mark = host_ns();
+  }
+
+  for(uint32_t i = 0; i < NVIC_NUM_INTERRUPTS; i++)
+    NVIC_SET_PRIORITY(i, 128);
+  SCB_SHPR3 = 0x20200000;
+  SYST_RVR = (F_CPU / 1000) - 1;
+  SYST_CSR = SYST_CSR_CLKSOURCE | SYST_CSR_TICKINT | SYST_CSR_ENABLE;
+  __enable_irq();
+}
@@ -0,0 +1,140 @@
+/* Host simulation of the controller board
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __sim_h
+#define __sim_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <mk20dx128.h>
+
+/********************************************************************************
+ * Host simulation of the controller board
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Runs the firmware on a Linux box, against simulated peripherals and a simulated motor, so control
+ *   changes can be tried and timed without the bench rig. Build with "make sim" (host gcc; no Teensy tools
+ *   needed) and run sim/imcsim:
+ *
+ *     sim/imcsim [-t seconds] [-s script]... [-o trace.csv] [-r trace_us] [-d data.bin] [-j bench.json]
+ *                [-p name=value]... [-S seed] [-q]
+ *     sim/imcsim -R capture.bin
+ *
+ *   -t  simulated run time (default 2 s)
+ *   -s  command script. One USB command per line ("cp 0", "sqk 1", ...); blank lines and lines starting with #
+ *       are skipped. "@ms command" holds the command until that simulated time; commands without a time go out
+ *       as soon as the firmware has read the one before. More than one -s runs the scripts one after another,
+ *       with their times all counted from the start of the run. Lines starting with ! are IMC messages, which
+ *       the master sends over I2C (host.c), reading back the reply:
+ *         !imc byte...         any message: its type and body, in hex; the master adds the checksum
+ *         !move f...           Queue Move, the eight msg_queue_move_t fields (length, total_length,
+ *                              initial_rate, nominal_rate, final_rate, acceleration, stop_accelerating,
+ *                              start_decelerating), in decimal
+ *         !moves f...          Queue Moves, eight fields for each move
+ *       The master holds the sync line low until it has sent moves, then leaves it to the board.
+ *   -o  writes a CSV trace of the motor: time (s), step count, rotor position (steps), encoder tics, rotor
+ *       velocity (steps/s). -r sets the interval (us; default 100).
+ *   -d  appends the payload of every DATA0-2 packet (history dumps, streaming, bincmd replies) to a file, each
+ *       packet behind its header byte. Text packets always go to stdout.
+ *   -j  benchmark: appends a line of JSON with the tracking metrics and control update cost of the run (see
+ *       bench.c) to a file. "make bench" runs every controller in sim/bench/ against every reference there.
+ *   -p  sets a motor parameter (see plant.c:plant_params).
+ *   -S  seed for the firmware's random number generator (the random path, "pr"; default 1).
+ *   -q  no run summary on stderr.
+ *   -R  replays a control input capture (capture.h) instead of running, and checks the control updates
+ *       against the board's (see replay.c). The capture comes from the board, or from a run with -d.
+ *
+ *   The firmware is built unchanged. The headers in sim/include/ stand in for the Teensy's mk20dx128.h,
+ *   util.h, core_pins.h and core_cm4_simd.h, and every register they define is a call to sim_reg() (sim.c)
+ *   followed by a plain load or store. sim_reg() is where the simulation runs: it notices what was written since
+ *   the last call, charges the access SIM_REG_CYCLES, brings the PIT, SysTick, DWT, DMA channel 3, SPI0 and
+ *   I2C0 up to the new time, and takes whatever interrupts came due on the way, by priority and with
+ *   preemption like the NVIC. GPIO feeds the step/direction/disable pins to the motor (plant.c), whose rotor
+ *   position comes back through the encoder frames SPI0 shifts in. USB and the IMC master are host.c; the
+ *   master's messages reach parser.c byte by byte through I2C0 and i2c0_isr, and moves start on the sync line
+ *   through portb_isr, as on the bench.
+ *
+ *   Simulated time only moves at register accesses, at the main loop's USB poll (SIM_LOOP_CYCLES), in
+ *   delays, and at exception entry and return, so it is not cycle accurate: code that doesn't touch a
+ *   register runs in no time. It is close enough to see step and control timing, jitter between the
+ *   interrupts, and how the loop closes. Not simulated: FTM0 (imc/hardware.h:STEP_USE_FTM), the I2C bus
+ *   lines (only the bytes on them), pin interrupts other than the sync line's, the quadrature decoder, and USB
+ *   timing.
+ *
+ *   The host is 64-bit, where long is 64 bits, so "%li" of an int32_t prints garbage for negative numbers; the
+ *   target has 32-bit longs. Build with "make sim SIM_ARCH=-m32" where a 32-bit libc is installed.
+ ********************************************************************************/
+
+// Constants ==========================================================================
+#define SIM_REG_CYCLES          2       // cost of each register access (peripheral bridge wait states)
+#define SIM_EXC_CYCLES          12      // exception entry and exit (stacking and unstacking)
+#define SIM_LOOP_CYCLES         480     // main loop pass around the USB poll (10 us)
+#define SIM_I2C_MAX             64      // longest I2C transfer
+
+// Global Variables ====================================================================
+extern volatile uint64_t sim_now;       // cpu cycles since reset
+extern uint64_t sim_end;                // sim_finish() is called when sim_now gets here
+extern uint32_t sim_irq_counts[];       // times each interrupt was taken (index IRQ number; SysTick at SIM_IRQ_SYSTICK)
+
+#define SIM_IRQ_SYSTICK         NVIC_NUM_INTERRUPTS
+// contexts sim_host_ns charges host time to: the interrupts (by number, as sim_irq_counts), and these
+#define SIM_CTX_MAIN            (NVIC_NUM_INTERRUPTS + 1)   // the firmware's main loop
+#define SIM_CTX_SIM             (NVIC_NUM_INTERRUPTS + 2)   // the simulation itself
+#define SIM_CTX_COUNT           (NVIC_NUM_INTERRUPTS + 3)
+
+extern bool sim_host_timing;            // charge host cpu time to sim_host_ns (set before sim_reset())
+extern uint64_t sim_host_ns[];          // host cpu time (ns) spent in each context, index SIM_CTX_*
+
+// sim.c
+void sim_reset(void);
+void sim_advance(uint64_t cycles);
+const char *sim_irq_name(uint32_t irq);
+void sim_i2c_start(uint8_t addr, bool read, const uint8_t *data, uint32_t len);
+bool sim_i2c_busy(void);
+uint32_t sim_i2c_result(uint8_t *data);
+void sim_sync_release(void);
+
+// plant.c
+void plant_init(void);
+bool plant_set_param(const char *name, double value);
+void plant_step(bool backwards);
+void plant_enable(bool enabled);
+uint32_t plant_encoder_word(void);
+void plant_state(int32_t *steps, double *position, double *velocity, int32_t *tics);
+
+// bench.c
+extern bool bench_enabled;
+void bench_sample(void);
+void bench_report(FILE *f, const char *name, double seconds, uint32_t seed);
+
+// replay.c
+void replay_run(const char *path);
+
+// host.c
+void host_tick(void);
+void sim_finish(void);
+extern uint32_t host_tick_cycles;       // how often sim.c calls host_tick(); 0 = never
+
+#endif // __sim_h
@@ -39,6 +39,8 @@
 #include <util.h>
 
 #include "spienc.h"
+#include "imc/utils.h"
+#include "isrprof.h"
 
 
 #ifndef USE_QD_ENC
@@ -60,10 +62,16 @@ static uint32_t last_update_tenus = 0, readval, last_readval = 0;
 static int32_t rollovers = 0;
 static bool lost_track = true;
 static int32_t offset = 0;
+#ifdef ENC_USE_DMA
+static uint32_t dma_tx[2];                  // SPI PUSHR words for one encoder read, written out by DMA channel 3
+static volatile bool dma_running = false;
+#endif
 
 // Local Function Defines ====================================
 void read_enc(void);
+void track_reading(uint8_t err, uint32_t val, uint32_t time);
 uint8_t read_spi(uint32_t *value);
+uint8_t decode_spi(uint32_t inp, uint32_t *value);
 uint32_t spibitbang_read(void);
  
 
@@ -87,7 +95,32 @@ void enc_Init(void)
   CS_ON();
 #endif    // !ENC_USE_SPFIFO
 
-  last_update_tenus = get_systick_tenus();
+#ifdef ENC_USE_DMA
+  // DMA channels 0-3 can be triggered straight from PITs 0-3. Each time the control timer (PIT3) expires, channel 3
+  // pushes the two frames of an encoder read into the SPI TX FIFO. The second frame is marked end-of-queue, so
+  // spi0_isr fires once the whole reading is sitting in the RX FIFO.
+  SIM_SCGC6 |= SIM_SCGC6_DMAMUX;
+  SIM_SCGC7 |= SIM_SCGC7_DMA;
+  dma_tx[0] = 0x1234 | ((uint32_t)pcs << 16) | SPI_PUSHR_CONT | SPI_PUSHR_CTAS(1);
+  dma_tx[1] = 0x1234 | ((uint32_t)pcs << 16) | SPI_PUSHR_EOQ | SPI_PUSHR_CTAS(1);
+  DMA_TCD3_SADDR = (uint32_t)dma_tx;
+  DMA_TCD3_SOFF = 4;
+  DMA_TCD3_ATTR = DMA_TCD_ATTR_SSIZE(DMA_TCD_ATTR_SIZE_32BIT) | DMA_TCD_ATTR_DSIZE(DMA_TCD_ATTR_SIZE_32BIT);
+  DMA_TCD3_NBYTES_MLNO = sizeof(dma_tx);    // both frames on every trigger
+  DMA_TCD3_SLAST = -(int32_t)sizeof(dma_tx);
+  DMA_TCD3_DADDR = (uint32_t)&SPI0.PUSHR;
+  DMA_TCD3_DOFF = 0;
+  DMA_TCD3_CITER_ELINKNO = 1;
+  DMA_TCD3_BITER_ELINKNO = 1;
+  DMA_TCD3_DLASTSGA = 0;
+  DMA_TCD3_CSR = 0;                         // no DREQ, so the channel stays armed after each major loop
+  DMAMUX0_CHCFG3 = 0;
+  DMAMUX0_CHCFG3 = DMAMUX_ENABLE | DMAMUX_TRIG | DMAMUX_SOURCE_ALWAYS0;
+  SPI0.RSER = SPI_RSER_EOQF_RE;
+  NVIC_ENABLE_IRQ(IRQ_SPI0);
+#endif
+
+  last_update_tenus = time_tenus();
 
   if(read_spi(&readval))
   {
@@ -106,10 +139,19 @@ void enc_idle(void)
 // this function reads the encoder and traps rollovers.
 void read_enc(void)
 {
-  uint32_t time = get_systick_tenus();
+  uint32_t time = time_tenus();
+  uint32_t val = 0;
+  uint8_t err = read_spi(&val);
+  track_reading(err, val, time);
+}
+
+// handles a new reading (err = 0 if it was valid) taken at time (tenus): traps rollovers and big jumps.
+FASTRUN void track_reading(uint8_t err, uint32_t val, uint32_t time)
+{
   bool rolled = false;
-  uint32_t val, last_val = last_readval;
-  if(!read_spi(&val))
+  uint32_t last_val = last_readval;
+  int32_t change;
+  if(!err)
 		{
       readval = val;
       last_readval = val;
@@ -126,13 +168,15 @@ void read_enc(void)
 				rollovers++;
         rolled = true;
 			}
-      // check for high absolute change --> possibility of skipping a step.
-      if(labs((rolled ? ROLLOVER : 0) - labs(last_val - val)) > DISP_BEFORE_LOST_TRACK)
+      // check for high absolute change --> possibility of skipping a step. (int32_t, not long, so this also
+      // works where long is 64 bits - the host simulation in sim/)
+      change = abs((rolled ? (int32_t)ROLLOVER : 0) - abs((int32_t)(last_val - val)));
+      if(change > DISP_BEFORE_LOST_TRACK)
       {
         if(!lost_track)
         {
           hid_printf("'High Enc Change: %u. readval = %u, last_readval = %u, Time change = %u\n", 
-            (unsigned int)labs((rolled ? -ROLLOVER : 0) + labs(last_val - val)), 
+            (unsigned int)change, 
             (unsigned int)val, 
             (unsigned int)last_val, 
             (unsigned int)(time - last_update_tenus));
@@ -152,9 +196,15 @@ void read_enc(void)
 
 // get_enc_value()
 // returns the current encoder tic index
-uint8_t get_enc_value(volatile int32_t *value)
+// With DMA sampling running, this is the latest sample (see enc_sample_time) and the SPI port isn't touched.
+FASTRUN uint8_t get_enc_value(volatile int32_t *value)
 {
+#ifdef ENC_USE_DMA
+  if(!dma_running)
+    read_enc();
+#else
   read_enc();
+#endif
 	*value = rollovers * ROLLOVER + (int32_t)readval + offset;
   return lost_track ? 1 : 0;
 }
@@ -172,11 +222,56 @@ bool enc_lost_track(void)
   return lost_track;
 }
 
+// returns the time (tenus) the current encoder value was sampled.
+uint32_t enc_sample_time(void)
+{
+  return last_update_tenus;
+}
+
+#ifdef ENC_USE_DMA
+// Starts/stops the encoder reads triggered by PIT3. While running, get_enc_value only returns the latest sample.
+void enc_dma_enable(bool enable)
+{
+  if(enable && !dma_running)
+  {
+    spififo_clear();
+    dma_running = true;
+    DMA_SERQ = 3;
+  }
+  else if(!enable && dma_running)
+  {
+    DMA_CERQ = 3;
+    dma_running = false;
+    // let a transfer that's already under way finish before anyone else uses the port
+    delay_microseconds(50);
+    spififo_clear();
+  }
+}
+
+// SPI interrupt - an encoder read started by PIT3 has completed.
+FASTRUN void spi0_isr(void)
+{
+  uint32_t inp, val = 0, elapsed;
+  uint8_t err;
+  PROF_ISR(PROF_SPI0);
+
+  // the encoder latched its position when PIT3 expired (the transfer starts right then); back the timestamp up to that.
+  elapsed = PIT_LDVAL3 - PIT_CVAL3;
+  SPI0.SR = SPI_SR_EOQF;
+  inp = (SPI0.POPR & 0xFFFF) << 16;
+  inp |= SPI0.POPR & 0xFFFF;
+
+  err = decode_spi(inp, &val);     // before track_reading reads val: argument order isn't defined
+  track_reading(err, val, time_tenus() - elapsed / (F_BUS / 100000L));
+  if(dma_running)
+    enc_sample_hook();
+}
+#endif
+
 
 // reads the encoder value over SPI. Returns 0 if read was successful, 1 otherwise.
-uint8_t read_spi(uint32_t *value)
+FASTRUN uint8_t read_spi(uint32_t *value)
 {
-	uint8_t i;
 	// write out some uint8_ts...The content is bogus, we just need the clock to fire.
   // we need to block the control interrupt from firing while we read the serial port (if it fires half way through
   // reading, we'll be in big trouble!)
@@ -193,6 +288,13 @@ uint8_t read_spi(uint32_t *value)
 #endif
   CLEAR_BASEPRI();
 
+  return decode_spi(inp, value);
+}
+
+// checks and decodes one 32-bit encoder transfer. Returns 0 if the reading was valid, 1 otherwise.
+FASTRUN uint8_t decode_spi(uint32_t inp, uint32_t *value)
+{
+	uint8_t i;
 	// first bit (msb) is garbage
 	inp &= 0x7fffffff;
 	// next 12 bits are the reading
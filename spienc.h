@@ -32,6 +32,15 @@
 // (useful for when SPI is being used for another task)
 #define ENC_USE_SPIFIFO
 
+// comment the following define to read the encoder from inside the control interrupt instead of having the control
+// timer (PIT3) start the transfer through DMA. With DMA, the control law runs from the SPI interrupt as soon as the
+// reading is in (see spienc.c:spi0_isr and ctrl.c:enc_sample_hook). Needs ENC_USE_SPIFIFO.
+#define ENC_USE_DMA
+
+#ifndef ENC_USE_SPIFIFO
+#undef ENC_USE_DMA
+#endif
+
 #ifndef ENC_USE_SPIFIFO
 // pins to use for serial communications
 // Pin 23 is sck
@@ -75,6 +84,13 @@ uint8_t get_enc_value(volatile int32_t *);
 void set_enc_value(int32_t);
 
 bool enc_lost_track(void);
+uint32_t enc_sample_time(void);
+
+#ifdef ENC_USE_DMA
+void enc_dma_enable(bool enable);
+// called from spi0_isr each time a new sample is ready while DMA sampling is enabled. Defined in ctrl.c.
+void enc_sample_hook(void);
+#endif
 
 #endif
 #endif
\ No newline at end of file
@@ -0,0 +1,231 @@
+/********************************************************************************
+ * Hardware step generation
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Puts out step pulses with FTM0 channel 7, so a steady step rate costs no
+ *   interrupts, and counts them with DMA so st.position stays exact.
+ *
+ *   The channel runs edge-aligned PWM with low-true pulses: the output goes low when the
+ *   counter reloads and high on the channel match, so each period ends in one step pulse and
+ *   restarting the counter waits a whole new period before stepping, like restarting PIT0.
+ *   New periods are double-buffered by the FTM and start at the end of the current one.
+ *   Each channel match also requests DMA channel 4, which moves one dummy word; its CITER
+ *   counts down once per pulse, and once every STEPFTM_DMA_LOOP pulses the major loop
+ *   interrupt carries the count. Pulses counted are added to st.position, in the current
+ *   direction, whenever the position is read or the direction changes.
+ *
+ *   The FTM takes over from the PIT whenever the controller sets a step rate it can do (see
+ *   stepper_hooks.c:set_step_events_per_minute_ctrl). Step rates too slow for the 16-bit
+ *   counter, counted moves (steps_to_go) and the legacy IMC stepper code use the PIT.
+ *
+ * License:
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+
+#include "common.h"
+#include <pin_config.h>
+
+#include "stepftm.h"
+#include "isrprof.h"
+#include "imc/hardware.h"
+#include "imc/stepper.h"
+
+#ifdef STEP_USE_FTM
+
+// Constants ==========================================================================
+#define STEPFTM_PULSE_CYCLES      (F_BUS / 500000)    // step pulse width (2 us)
+#define STEPFTM_MAX_PS            7                   // largest FTM prescaler (divide by 128)
+#define STEPFTM_DMA_LOOP          0x7FFF              // pulses per DMA major loop (CITER is 15 bits)
+#define STEPFTM_CHSC              (FTM_CnSC_MSB_MASK | FTM_CnSC_ELSA_MASK | FTM_CnSC_CHIE_MASK | FTM_CnSC_DMA_MASK)
+#define STEPFTM_PIN_FTM           ((STANDARD_OUTPUT & ~MUX_GPIO) | PORT_PCR_MUX(4))   // PTD7 as FTM0_CH7
+
+// Global Variables ====================================================================
+volatile bool stepftm_running = false;
+
+// Local Variables ===================================================================
+static volatile uint32_t loops_done = 0;  // pulses counted by completed DMA major loops
+static uint32_t folded = 0;               // pulse count already added to st.position
+static uint32_t cur_ps = 0;               // prescaler the FTM is running with
+static uint32_t dma_dummy;                // source and destination of the counting transfers
+
+// Function Predeclares ======================================================
+static uint32_t pulse_count(void);
+static void halt(void);
+
+
+// Sets up FTM0 and the counting DMA channel. The FTM stays stopped until stepftm_run.
+void stepftm_init(void)
+{
+  SIM_SCGC6 |= SIM_SCGC6_FTM0 | SIM_SCGC6_DMAMUX;
+  SIM_SCGC7 |= SIM_SCGC7_DMA;
+
+  FTM0_SC = 0;
+  FTM0_MOD = 0xFFFF;
+  FTM0_C7V = 0xFFFF;
+  FTM0_C7SC = STEPFTM_CHSC;
+  FTM0_CNT = 0;
+
+  DMA_TCD4_SADDR = (uint32_t)&dma_dummy;
+  DMA_TCD4_SOFF = 0;
+  DMA_TCD4_ATTR = DMA_TCD_ATTR_SSIZE(DMA_TCD_ATTR_SIZE_32BIT) | DMA_TCD_ATTR_DSIZE(DMA_TCD_ATTR_SIZE_32BIT);
+  DMA_TCD4_NBYTES_MLNO = 4;
+  DMA_TCD4_SLAST = 0;
+  DMA_TCD4_DADDR = (uint32_t)&dma_dummy;
+  DMA_TCD4_DOFF = 0;
+  DMA_TCD4_CITER_ELINKNO = STEPFTM_DMA_LOOP;
+  DMA_TCD4_BITER_ELINKNO = STEPFTM_DMA_LOOP;
+  DMA_TCD4_DLASTSGA = 0;
+  DMA_TCD4_CSR = DMA_TCD_CSR_INTMAJOR;      // no DREQ, so the channel stays armed after each major loop
+  DMAMUX0_CHCFG4 = 0;
+  DMAMUX0_CHCFG4 = DMAMUX_ENABLE | DMAMUX_SOURCE_FTM0_CH7;
+  DMA_SERQ = 4;
+  NVIC_ENABLE_IRQ(IRQ_DMA_CH4);
+
+  loops_done = 0;
+  folded = 0;
+  stepftm_running = false;
+}
+
+// Steps once every cycles bus cycles. If restart is set, or the new period is shorter than what's left of
+// the current one, it starts now; otherwise at the end of the current period. Returns false, with the FTM
+// stopped, if cycles is too long for the counter.
+bool stepftm_run(uint32_t cycles, bool restart)
+{
+  uint32_t ps = 0, mod, pulse;
+
+  while((cycles >> ps) > 0x10000 && ps < STEPFTM_MAX_PS)
+    ps++;
+  if((cycles >> ps) > 0x10000)
+  {
+    stepftm_stop();
+    return false;
+  }
+  pulse = max(STEPFTM_PULSE_CYCLES >> ps, 1);
+  mod = max(cycles >> ps, pulse * 2) - 1;   // leave the driver as much low time as high time
+
+  if(stepftm_running && ps == cur_ps && !restart && ((FTM0_MOD - FTM0_CNT) << ps) <= cycles)
+  {
+    // double-buffered; takes over at the end of this period
+    FTM0_MOD = mod;
+    FTM0_C7V = mod + 1 - pulse;
+    return true;
+  }
+
+  if(stepftm_running)
+  {
+    // don't cut a step pulse short; it ends when the counter reloads, within STEPFTM_PULSE_CYCLES.
+    while(STEP_PORT(DIR) & STEP_BIT) ;
+    halt();
+  }
+  FTM0_MOD = mod;
+  FTM0_C7V = mod + 1 - pulse;
+  FTM0_CNT = 0;
+  if(!stepftm_running)
+  {
+    STEP_CTRL = STEPFTM_PIN_FTM;
+    stepftm_running = true;
+  }
+  cur_ps = ps;
+  FTM0_SC = FTM_SC_CLKS(1) | FTM_SC_PS(ps);
+  return true;
+}
+
+// Stops stepping (after any pulse under way) and gives the step pin back to the PIT code.
+void stepftm_stop(void)
+{
+  if(!stepftm_running)
+    return;
+  while(STEP_PORT(DIR) & STEP_BIT) ;
+  halt();
+  STEP_PORT(COR) = STEP_BIT;
+  STEP_CTRL = STANDARD_OUTPUT;
+  stepftm_running = false;
+  stepftm_sync();
+}
+
+// Adds the pulses put out since the last call to st.position, in the current direction.
+void stepftm_sync(void)
+{
+  uint32_t n;
+  __disable_irq();
+  n = pulse_count() - folded;
+  folded += n;
+  if(get_direction())
+    st.position -= n;
+  else
+    st.position += n;
+  __enable_irq();
+}
+
+// Pauses the FTM (if it's running) with every pulse so far in st.position, so the direction can change
+// without a pulse landing on the wrong side of it. Pass the return value to stepftm_resume.
+uint32_t stepftm_hold(void)
+{
+  uint32_t sc = 0;
+  if(stepftm_running)
+  {
+    sc = FTM0_SC;
+    halt();
+  }
+  stepftm_sync();
+  return sc;
+}
+
+void stepftm_resume(uint32_t sc)
+{
+  if(sc)
+    FTM0_SC = sc;
+}
+
+// DMA channel 4 finished a major loop (STEPFTM_DMA_LOOP more pulses).
+void dma_ch4_isr(void)
+{
+  PROF_ISR(PROF_STEPDMA);
+  __disable_irq();
+  pulse_count();
+  __enable_irq();
+}
+
+// Pulses put out since stepftm_init (wraps). Call with interrupts off.
+static uint32_t pulse_count(void)
+{
+  uint32_t citer = DMA_TCD4_CITER_ELINKNO;
+  if(DMA_INT & (1 << 4))
+  {
+    // the major loop just completed (CITER reloaded); count it here in case dma_ch4_isr hasn't yet.
+    DMA_CINT = 4;
+    loops_done += STEPFTM_DMA_LOOP;
+    citer = DMA_TCD4_CITER_ELINKNO;
+  }
+  return loops_done + STEPFTM_DMA_LOOP - citer;
+}
+
+// Stops the counter once the last match's DMA transfer has counted it. The output stays where it is.
+static void halt(void)
+{
+  FTM0_SC = 0;
+  while(FTM0_C7SC & FTM_CnSC_CHF_MASK) ;    // the DMA transfer clears CHF
+}
+
+#endif
@@ -0,0 +1,47 @@
+/* Hardware step generation
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 Ben Weiss
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __stepftm_h
+#define __stepftm_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "imc/hardware.h"
+
+#ifdef STEP_USE_FTM
+
+// Global Variables ====================================================================
+extern volatile bool stepftm_running;   // FTM0 is putting out the steps (and the PIT isn't)
+
+void stepftm_init(void);
+bool stepftm_run(uint32_t cycles, bool restart);
+void stepftm_stop(void);
+void stepftm_sync(void);
+uint32_t stepftm_hold(void);
+void stepftm_resume(uint32_t sc);
+
+#endif
+#endif
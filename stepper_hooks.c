@@ -31,15 +31,22 @@
 #include "imc/stepper.h"
 #include "imc/parameters.h"
 #include "imc/homing.h"
+#include "imc/utils.h"
 
 #include "ctrl.h"
 #include "path.h"
 #include "qdenc.h"
 #include "spienc.h"
+#include "stepftm.h"
 
+// Constants =========================================================================
+#define STEP_DDA_HZ         40000UL                                 // DDA tick rate, and the fastest DDA step rate (steps/s)
+#define STEP_DDA_CYCLES     (F_CPU / STEP_DDA_HZ)
+#define STEP_DDA_PER_SPM    (4294967296.f / (60.f * STEP_DDA_HZ))  // phase increment per tick for 1 step/min
 
 // Global Variables ==================================================================
 bool old_stepper_mode = false;      // use stock IMC stepper isr code.
+bool step_dda_mode = false;         // step from the fixed-rate phase accumulator instead of timing each step (param md)
 extern float enc_tics_per_step;
 extern float steps_per_enc_tic;
 
@@ -49,12 +56,16 @@ static uint32_t old_steps_per_minute = MINIMUM_STEPS_PER_MINUTE;
 static uint32_t new_cycles_per_step_event = MINIMUM_STEPS_PER_MINUTE;
 bool force_steps_per_minute = true;   // force the stepper module to reset its counter ever update?
 static ctrl_mode old_ctrl_mode;       // used in homing to store the old control mode while control is disabled.
+static volatile uint32_t dda_phase = 0;   // DDA phase accumulator: a step goes out each time it wraps
+static volatile uint32_t dda_inc = 0;     // added to dda_phase every DDA tick (steps per tick, 0.32 fixed point)
 //static char message[100];
 
 // Function Predeclares ==============================================================
 void init_hook();
 bool step_hook();
 bool exec_hook(volatile msg_queue_move_t *);
+static bool endstop_blocks(void);
+static void dda_set_rate(real steps_per_minute);
 
 bool homing_start_hook();
 void homing_end_hook();
@@ -76,7 +87,7 @@ void init_hook(void)
   path_imc((real)0);  // tell path not to go off the deep end.
 }
 
-void set_step_events_per_minute_ctrl(uint32_t steps_per_minute) 
+FASTRUN void set_step_events_per_minute_ctrl(uint32_t steps_per_minute) 
 {
   if (steps_per_minute < 1){//MINIMUM_STEPS_PER_MINUTE){
     steps_per_minute = 1;//MINIMUM_STEPS_PER_MINUTE;
@@ -86,10 +97,36 @@ void set_step_events_per_minute_ctrl(uint32_t steps_per_minute)
   // 2) waiting too long because the new steps_per_minute is high but the current one is very low and we didn't reset.
   // so, if the new timer value is less than the current remaining time, we'll restart the timer.
   
+  // the DDA keeps its own rate (and get_step_events_per_minute reads it from there), so skip the divide
+  if(step_dda_mode)
+  {
+    dda_set_rate((real)steps_per_minute);
+    return;
+  }
+
   // set this as the new value to be implemented on the next interrupt
   new_cycles_per_step_event = (F_CPU*((uint32_t)60))/steps_per_minute;
-  
+
+#ifdef STEP_USE_FTM
+  // the FTM puts out the steps when it can (see stepftm.c): the motor has been started (start_moving armed the
+  // PIT0 interrupt), this isn't a counted move or legacy IMC stepping, and the rate isn't too slow for it.
+  bool handback = stepftm_running;
+  if((PIT_TCTRL0 & TIE) && !old_stepper_mode && steps_to_go < 0 && st.state != STATE_ERROR && !endstop_blocks())
+  {
+    if(stepftm_run(new_cycles_per_step_event, force_steps_per_minute))
+    {
+      PIT_TCTRL0 &= ~TEN;
+      PIT_TFLG0 = 1;
+      return;
+    }
+  }
+  else
+    stepftm_stop();
+  // PIT0 has been stopped while the FTM ran, so its count is stale.
+  if (handback || force_steps_per_minute || new_cycles_per_step_event < PIT_CVAL0)
+#else
   if (force_steps_per_minute || new_cycles_per_step_event < PIT_CVAL0)
+#endif
   {
     // reset the timer to count down from the new value.
     st.cycles_per_step_event = config_step_timer(new_cycles_per_step_event);
@@ -98,15 +135,76 @@ void set_step_events_per_minute_ctrl(uint32_t steps_per_minute)
 
 uint32_t get_step_events_per_minute(void)
 {
+  if(step_dda_mode)
+    return (uint32_t)((real)dda_inc / STEP_DDA_PER_SPM);
   return (F_CPU*((uint32_t)60))/new_cycles_per_step_event;
 }
 
+// Sets the step rate from the controller: signed steps/min. In DDA mode the fraction is kept and this is just a
+// multiply; otherwise the rate is rounded down to whole steps/min and turned into a step period.
+FASTRUN void set_step_rate_ctrl(real steps_per_minute)
+{
+  bool backwards = steps_per_minute < 0.f;
+
+  if(!step_dda_mode)
+  {
+    set_direction(steps_per_minute > 0.f ? false : true);
+    set_step_events_per_minute_ctrl((uint32_t)abs((int32_t)floorf(steps_per_minute)));
+    return;
+  }
+
+  if(backwards != get_direction())
+  {
+    // the fraction of a step accumulated so far, measured the other way, is what's left to the step behind us.
+    __disable_irq();
+    dda_phase = -dda_phase;
+    set_direction(backwards);
+    __enable_irq();
+  }
+  dda_set_rate(fabsf(steps_per_minute));
+}
+
+// on_change for md: moves PIT0 between the fixed DDA tick and one tick per step, keeping the step rate.
+void step_dda_changed(void)
+{
+  if(step_dda_mode)
+  {
+#ifdef STEP_USE_FTM
+    stepftm_stop();
+#endif
+    dda_phase = 0;
+    dda_set_rate((real)(F_CPU*((uint32_t)60)) / (real)new_cycles_per_step_event);
+  }
+  else
+  {
+    new_cycles_per_step_event = (F_CPU*((uint32_t)60)) / max((uint32_t)((real)dda_inc / STEP_DDA_PER_SPM), 1);
+    st.cycles_per_step_event = config_step_timer(new_cycles_per_step_event);
+#ifdef STEP_USE_FTM
+    set_step_events_per_minute_ctrl(get_step_events_per_minute());
+#endif
+  }
+}
+
+// sets the DDA phase increment for a step rate (steps/min, >= 0), and puts PIT0 on the DDA tick if something
+// (legacy IMC stepping, leaving DDA mode) has moved it.
+static FASTRUN void dda_set_rate(real steps_per_minute)
+{
+  real inc = steps_per_minute * STEP_DDA_PER_SPM;
+  dda_inc = inc < 4294967296.f ? (uint32_t)inc : 0xFFFFFFFFU;
+  if(PIT_LDVAL0 != STEP_DDA_CYCLES)
+    st.cycles_per_step_event = config_step_timer(STEP_DDA_CYCLES);
+}
+
 
 // Limit the move to a set number of steps.
 void set_steps_to_go(int32_t steps)
 {
   if(steps < 0)
     steps = -1;
+#ifdef STEP_USE_FTM
+  else
+    stepftm_stop();   // counted moves step from the PIT
+#endif
   steps_to_go = steps;
 }
 
@@ -120,39 +218,39 @@ int32_t get_steps_to_go(void)
 // Returns true if the stepping is complete (i.e. the controller
 // is active and we don't want legacy behavior) and false if
 // the imc controller should continue with its normal behavior.
-bool step_hook(void) {
+FASTRUN bool step_hook(void) {
   // should we keep legacy open-loop behavior?
   if(old_stepper_mode)
     return false;     // have the isr continue with stock IMC code
   
 
-  // check for end stop states (this needed as a safety net for testing) //||\\!
-  if(get_direction())   // going backwards?
+#ifdef STEP_USE_FTM
+  if(stepftm_running)
   {
-    // logic: Trigger a pulse if we are going forward, and
-    // if the endstop is not enabled, step anyway.
-    // if the endstop pin matches the invert flag, we can step.
-    if(parameters.homing & ENABLE_MIN && (((CONTROL_PORT(DIR) & MIN_LIMIT_BIT) ? 1 : 0) != (parameters.homing & INVERT_MIN ? 1 : 0)))
-    {
-      // the endstop is asserted.
-      hid_printf("'Min Endstop Assert!\n");
-      
-    }
-    else
-      trigger_pulse();
+    // the FTM has taken over; this is a leftover tick.
+    PIT_TCTRL0 &= ~TEN;
+    PIT_TFLG0 = 1;
+    return true;
   }
-  else    // going forwards
+#endif
+
+  if(step_dda_mode)
   {
-    if(parameters.homing & ENABLE_MAX && (((CONTROL_PORT(DIR) & MAX_LIMIT_BIT) ? 1 : 0) != (parameters.homing & INVERT_MAX ? 1 : 0)))
+    // fixed-rate tick: step only when the phase accumulator wraps.
+    uint32_t phase = dda_phase + dda_inc;
+    bool wrapped = phase < dda_phase;
+    dda_phase = phase;
+    if(!wrapped)
     {
-      // the endstop is asserted.
-      hid_printf("'Max Endstop Assert!\n");
-      
+      PIT_TFLG0 = 1;
+      return true;
     }
-    else
-      trigger_pulse();
   }
 
+  // check for end stop states (this needed as a safety net for testing) //||\\!
+  if(!endstop_blocks())
+    trigger_pulse();
+
 
   // are we out of steps on a steps-limited move?
   if(steps_to_go >= 0)
@@ -180,12 +278,38 @@ bool step_hook(void) {
   // clear the interrupt flag
   PIT_TFLG0 = 1;
   
-  // load new cycle count
-  st.cycles_per_step_event = config_step_timer(new_cycles_per_step_event);
+  // load new cycle count (the DDA tick never changes)
+  if(!step_dda_mode)
+    st.cycles_per_step_event = config_step_timer(new_cycles_per_step_event);
   return true;
 } 
 
 
+// Checks the endstop in the direction we're going. Returns true (and complains) if it's asserted.
+// logic: if the endstop is not enabled, step anyway. if the endstop pin matches the invert flag, we can step.
+static FASTRUN bool endstop_blocks(void)
+{
+  if(get_direction())   // going backwards?
+  {
+    if(parameters.homing & ENABLE_MIN && (((CONTROL_PORT(DIR) & MIN_LIMIT_BIT) ? 1 : 0) != (parameters.homing & INVERT_MIN ? 1 : 0)))
+    {
+      // the endstop is asserted.
+      hid_printf("'Min Endstop Assert!\n");
+      return true;
+    }
+  }
+  else    // going forwards
+  {
+    if(parameters.homing & ENABLE_MAX && (((CONTROL_PORT(DIR) & MAX_LIMIT_BIT) ? 1 : 0) != (parameters.homing & INVERT_MAX ? 1 : 0)))
+    {
+      // the endstop is asserted.
+      hid_printf("'Max Endstop Assert!\n");
+      return true;
+    }
+  }
+  return false;
+}
+
 void start_moving(void){
 
   st.state = STATE_EXECUTE;
@@ -194,6 +318,9 @@ void start_moving(void){
   //PIT_TCTRL0 &= ~TEN;
   //PIT_LDVAL0 = 48;
   PIT_TCTRL0 |= TEN | TIE;
+#ifdef STEP_USE_FTM
+  set_step_events_per_minute_ctrl(old_steps_per_minute);    // hand the steps to the FTM if it can take them
+#endif
 }
 
 
@@ -209,7 +336,12 @@ bool exec_hook(volatile msg_queue_move_t *current_block)
   
   // tell the path module to run a block.
   if(current_block)
+  {
     path_ramps_move(current_block);
+    // if the queue ran dry before this block came in, step_hook stopped the step timer on the idle state.
+    if(!(PIT_TCTRL0 & TEN))
+      start_moving();
+  }
   return true;
 }
 
@@ -37,6 +37,10 @@ int32_t get_steps_to_go(void);
 // set step rate
 void set_step_events_per_minute_ctrl(uint32_t); 
 uint32_t get_step_events_per_minute(void);
+// set the signed step rate (steps/min) from the controller; keeps the fraction in DDA mode
+void set_step_rate_ctrl(real steps_per_minute);
+// on_change for the md parameter (step_dda_mode)
+void step_dda_changed(void);
 // start motion (like execute_move(), but does not dequeue a move since we're not in IMC mode.
 void start_moving(void);
 #endif
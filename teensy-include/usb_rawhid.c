@@ -72,6 +72,16 @@ int usb_rawhid_available(void)
 // Maximum number of transmit packets to queue so we don't starve other endpoints for memory
 #define TX_PACKET_LIMIT 4
 
+// Returns the number of packets usb_rawhid_send can queue right now without waiting.
+int usb_rawhid_tx_available(void)
+{
+	uint32_t count;
+
+	if (!usb_configuration) return 0;
+	count = usb_tx_packet_count(RAWHID_TX_ENDPOINT);
+	return count < TX_PACKET_LIMIT ? TX_PACKET_LIMIT - count : 0;
+}
+
 int usb_rawhid_send(const void *buffer, uint32_t timeout)
 {
 	usb_packet_t *tx_packet;
@@ -43,6 +43,7 @@ extern "C" {
 int usb_rawhid_recv(void *buffer, uint32_t timeout);
 int usb_rawhid_available(void);
 int usb_rawhid_send(const void *buffer, uint32_t timeout);
+int usb_rawhid_tx_available(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,65 @@
+/********************************************************************************
+ * Time Base
+ * Ben Weiss, University of Washington 2014
+ * Purpose: 64-bit monotonic time off the DWT cycle counter. See timebase.h.
+ *
+ * License: 
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2014 Ben Weiss
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ********************************************************************************/
+
+#include "common.h"
+#include "timebase.h"
+#include "imc/utils.h"
+
+// Global Variables ====================================================================
+volatile time_snap_t time_snap;
+volatile uint32_t time_seq = 0;
+
+
+// starts the cycle counter and zeros the time base. Call before anything reads the time.
+void time_init(void)
+{
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CYCCNT = 0;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  memset((void *)&time_snap, 0, sizeof(time_snap));
+  time_seq = 0;
+}
+
+// Refreshes the time base. Called from systick_isr, every ms. This has to happen at least once per
+// CYCCNT rollover (2^32 cycles, 89 s at 48 MHz), which is what extends it to 64 bits.
+void time_tick(void)
+{
+  uint32_t whole, primask;
+
+  primask = irq_save();
+  time_seq++;
+  whole = (ARM_DWT_CYCCNT - time_snap.cyccnt) / TIME_CYCLES_PER_TENUS;
+  // only whole tenus move into the snapshot; the rest stays behind in cyccnt, so nothing drifts.
+  time_snap.cyccnt += whole * TIME_CYCLES_PER_TENUS;
+  time_snap.cycles += whole * TIME_CYCLES_PER_TENUS;
+  time_snap.tenus += whole;
+  time_seq++;
+  irq_restore(primask);
+}
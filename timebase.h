@@ -0,0 +1,124 @@
+/* Time base
+
+ * This software is (c) 2014 by Ben Weiss and is released under the following license:
+ * The MIT License (MIT)
+ * 
+ * Copyright (c) 2014 Ben Weiss
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __timebase_h
+#define __timebase_h
+
+#include <mk20dx128.h>
+#include <stdint.h>
+
+/********************************************************************************
+ * Time Base
+ * Ben Weiss, University of Washington 2014
+ * Purpose: Monotonic time for the control, path and encoder code, counted off the
+ *   Cortex-M4 DWT cycle counter (CYCCNT). CYCCNT is extended to 64 bits, and converted to
+ *   10us units (tenus), by a snapshot of (CYCCNT, cycles, tenus) that systick_isr refreshes
+ *   every ms through time_tick(). A read is one snapshot copy plus one hardware divide of
+ *   the cycles since the snapshot, so it never goes backwards and never needs rollover
+ *   handling: 64-bit time doesn't wrap, and the 32-bit tenus time wraps every ~12 hours
+ *   but differences of it are right across the wrap as long as they're taken unsigned.
+ *
+ *   The snapshot is guarded by a sequence counter, odd while time_tick() is writing it: a
+ *   reader copies it and retries unless the counter was even and unchanged across the copy,
+ *   so it sees a consistent snapshot without turning interrupts off, from any interrupt
+ *   priority, however long it was preempted. time_tick() writes with interrupts off, so a
+ *   reader never preempts it and has to wait for it to finish.
+ ********************************************************************************/
+
+// DWT cycle counter registers (not in this version of mk20dx128.h)
+#ifndef ARM_DWT_CYCCNT
+#define ARM_DEMCR                 (*(volatile uint32_t *)0xE000EDFC)  // Debug Exception and Monitor Control
+#define ARM_DEMCR_TRCENA          (1 << 24)                           // Enable debugging & monitoring blocks
+#define ARM_DWT_CTRL              (*(volatile uint32_t *)0xE0001000)  // DWT control register
+#define ARM_DWT_CTRL_CYCCNTENA    (1 << 0)                            // Enable cycle count
+#define ARM_DWT_CYCCNT            (*(volatile uint32_t *)0xE0001004)  // Cycle count register
+#endif
+
+// Constants ==========================================================================
+#define TIME_CYCLES_PER_TENUS     (F_CPU / 100000L)
+
+// one snapshot of the time base.
+typedef struct {
+  uint32_t cyccnt;    // CYCCNT the snapshot was taken at (less any part of a tenus not counted in tenus yet)
+  uint64_t cycles;    // 64-bit cycle count at cyccnt
+  uint64_t tenus;     // tenus at cyccnt
+} time_snap_t;
+
+// Global Variables ====================================================================
+extern volatile time_snap_t time_snap;
+extern volatile uint32_t time_seq;      // odd while time_snap is being written
+
+void time_init(void);
+void time_tick(void);
+
+// current time in F_CPU cycles since time_init()
+__attribute__ ((always_inline)) inline uint64_t time_cycles(void)
+{
+  uint32_t seq, base;
+  uint64_t cycles;
+  do
+  {
+    seq = time_seq;
+    base = time_snap.cyccnt;
+    cycles = time_snap.cycles;
+  } while((seq & 1) || seq != time_seq);
+  return cycles + (uint32_t)(ARM_DWT_CYCCNT - base);
+}
+
+// current time in tenus since time_init()
+__attribute__ ((always_inline)) inline uint64_t time_tenus64(void)
+{
+  uint32_t seq, base;
+  uint64_t tenus;
+  do
+  {
+    seq = time_seq;
+    base = time_snap.cyccnt;
+    tenus = time_snap.tenus;
+  } while((seq & 1) || seq != time_seq);
+  return tenus + (ARM_DWT_CYCCNT - base) / TIME_CYCLES_PER_TENUS;
+}
+
+// current time in tenus, wrapping every ~12 hours. Take differences of these unsigned.
+__attribute__ ((always_inline)) inline uint32_t time_tenus(void)
+{
+  return (uint32_t)time_tenus64();
+}
+
+// converts a (short) span of cycles, e.g. a difference of ARM_DWT_CYCCNT readings, to tenus
+__attribute__ ((always_inline)) inline uint32_t time_cycles_to_tenus(uint32_t cycles)
+{
+  return cycles / TIME_CYCLES_PER_TENUS;
+}
+
+// busy-waits ms milliseconds
+__attribute__ ((always_inline)) inline void delay_real(uint32_t ms)
+{
+  uint64_t end = time_tenus64() + ms * 100ULL;
+  while(time_tenus64() < end)
+    ;
+}
+
+#endif